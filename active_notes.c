@@ -0,0 +1,74 @@
+//Active note table. See active_notes.h.
+
+#include "midi_types.h"
+#include "active_notes.h"
+
+
+//Turn every note off. The start times don't need clearing, since a key's start
+//time is only looked at while its bit is set.
+void Active_Clear(struct active_notes *a, uint32_t time)
+{
+	int c;
+
+	for (c = 0; c < 16; c++)
+		a->keys[c][0] = a->keys[c][1] = 0;
+	a->since = time;
+	a->sounding = 0;
+}
+
+
+//Check whether a channel message ends a note. A note on with a velocity of 0
+//is the usual way of writing a note off, since it lets a whole run of notes
+//share one running status.
+bool Active_Is_Note_Off(uint8_t status, const uint8_t *data)
+{
+	return (status & 0xF0) == MIDI_EVENT_NOTE_OFF ||
+	       ((status & 0xF0) == MIDI_EVENT_NOTE_ON && data[1] == 0);
+}
+
+
+bool Active_Is_On(const struct active_notes *a, uint8_t channel, uint8_t key)
+{
+	return (a->keys[channel & 0x0F][(key >> 6) & 1] >> (key & 63)) & 1;
+}
+
+
+//Start a note. Returns false if the key was already on, in which case the old
+//note is over and the new one starts now.
+bool Active_Start(struct active_notes *a, uint8_t channel, uint8_t key, uint32_t time)
+{
+	bool wasOn;
+
+	channel &= 0x0F;
+	key &= 0x7F;
+	wasOn = Active_Is_On(a, channel, key);
+	a->keys[channel][key >> 6] |= (uint64_t)1 << (key & 63);
+	a->starts[channel][key] = time;
+	a->sounding |= (uint16_t)1 << channel;
+	return !wasOn;
+}
+
+
+//Stop a note and return the time it started. A key that wasn't on is timed
+//from when the table was cleared.
+uint32_t Active_Stop(struct active_notes *a, uint8_t channel, uint8_t key)
+{
+	channel &= 0x0F;
+	key &= 0x7F;
+	if (!Active_Is_On(a, channel, key))
+		return a->since;
+
+	a->keys[channel][key >> 6] &= ~((uint64_t)1 << (key & 63));
+	if ((a->keys[channel][0] | a->keys[channel][1]) == 0)
+		a->sounding &= ~((uint16_t)1 << channel);
+	return a->starts[channel][key];
+}
+
+
+//Turn off every key on one channel
+void Active_Stop_Channel(struct active_notes *a, uint8_t channel)
+{
+	channel &= 0x0F;
+	a->keys[channel][0] = a->keys[channel][1] = 0;
+	a->sounding &= ~((uint16_t)1 << channel);
+}
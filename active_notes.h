@@ -0,0 +1,29 @@
+//Active note table. This keeps track of which keys are sounding on every
+//channel and when each of them started, so a note off gets matched up with its
+//own note on no matter how many other notes are on at the same time. Each
+//channel's keys are a 128-bit set, so finding out whether a channel has
+//anything on at all is two compares.
+
+#ifndef ACTIVE_NOTES_H
+#define ACTIVE_NOTES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct active_notes
+{
+	uint64_t keys[16][2];       //Keys sounding on each channel, one bit per key
+	uint32_t starts[16][128];   //Time each sounding key started
+	uint32_t since;             //Time the table was cleared. Notes that end
+	                            //without having started are timed from here.
+	uint16_t sounding;          //Channels with any key on
+};
+
+void Active_Clear(struct active_notes *a, uint32_t time);
+bool Active_Is_Note_Off(uint8_t status, const uint8_t *data);
+bool Active_Is_On(const struct active_notes *a, uint8_t channel, uint8_t key);
+bool Active_Start(struct active_notes *a, uint8_t channel, uint8_t key, uint32_t time);
+uint32_t Active_Stop(struct active_notes *a, uint8_t channel, uint8_t key);
+void Active_Stop_Channel(struct active_notes *a, uint8_t channel);
+
+#endif
@@ -0,0 +1,301 @@
+//Throughput benchmark. This generates a synthetic MIDI file, times the decoding
+//and quantizing stages in-process, then times the midi_dump and midi_notes
+//tools end to end on the same file with their output thrown away. Each stage
+//reports events per second, bytes per second, and peak memory use, so that a
+//slowdown shows up before a new build gets rolled out.
+//
+//Build from the top directory with something like:
+//	gcc -O2 -Wall -pthread -I. -o midi_bench bench/midi_bench.c bench/smf_gen.c
+//	    midi_events.c midi_decode.c seek_index.c tempo_map.c note_lengths.c
+//	    out_buffer.c work_pool.c active_notes.c
+//and run it from the directory with the midi_dump and midi_notes binaries, or
+//point it at them with -b. Run with -h to see the generator options.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "smf_gen.h"
+#include "midi_events.h"
+#include "note_lengths.h"
+#include "active_notes.h"
+#include "work_pool.h"
+
+struct bench
+{
+	struct smf_params params;
+	const uint8_t *data;
+	size_t size;
+	size_t events;
+	unsigned iterations;
+	const char *binDir;
+	const char *filename;
+};
+
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void Report(const struct bench *b, const char *stage, double seconds, long maxRSS,
+                   const char *note)
+{
+	printf("%-12s %9.2f ms %10.2f Mevents/s %9.2f MB/s %9ld KB peak%s%s\n",
+	       stage, 1e3 * seconds, b->events / seconds / 1e6, b->size / seconds / 1e6,
+	       maxRSS, note ? "  " : "", note ? note : "");
+}
+
+
+static long Self_Max_RSS(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+
+//Decode the file into an event store. This is what both tools do first.
+static bool Bench_Decode(const struct bench *b)
+{
+	struct event_store store;
+	double start, best = 0;
+	unsigned i;
+	bool ok = true;
+
+	for (i = 0; i < b->iterations && ok; i++)
+	{
+		start = Now();
+		ok = Events_Load(&store, b->data, b->size, Pool_Default_Threads()) && !store.failed;
+		if (i == 0 || Now() - start < best)
+			best = Now() - start;
+		Events_Free(&store);
+	}
+
+	Report(b, "decode", best, Self_Max_RSS(), ok ? NULL : "(decode failed)");
+	return ok;
+}
+
+
+//Split every note's duration into written note lengths, the same way
+//midi_notes does, but without printing anything. Notes are paired up key by
+//key within each track, and a note on with a velocity of 0 ends a note too.
+static bool Bench_Quantize(const struct bench *b)
+{
+	const struct length_table *lengths;
+	const struct note_split *split;
+	struct event_store store;
+	struct active_notes active;
+	uint32_t wholeNotes;
+	uint64_t parts = 0;
+	double start, best = 0;
+	size_t e, t;
+	unsigned i;
+	uint8_t status, data[2];
+
+	lengths = Lengths_Get(b->params.division);
+	if (lengths == NULL || !Events_Load(&store, b->data, b->size, Pool_Default_Threads()))
+		return false;
+
+	for (i = 0; i < b->iterations; i++)
+	{
+		start = Now();
+		for (t = 0; t < store.numTracks; t++)
+		{
+			Active_Clear(&active, 0);
+			for (e = store.trackStart[t]; e < store.trackStart[t + 1]; e++)
+			{
+				status = store.status[e];
+				if ((status & 0xF0) != MIDI_EVENT_NOTE_OFF && (status & 0xF0) != MIDI_EVENT_NOTE_ON)
+					continue;
+				data[0] = store.data1[e];
+				data[1] = store.data2[e];
+
+				//A key that's struck again while it's still on ends the note
+				//it was already playing
+				if (Active_Is_On(&active, status & 0x0F, data[0]))
+				{
+					split = Lengths_Split(lengths, store.tick[e] -
+					                      Active_Stop(&active, status & 0x0F, data[0]),
+					                      &wholeNotes);
+					parts += split->count + wholeNotes;
+				}
+				if (!Active_Is_Note_Off(status, data))
+					Active_Start(&active, status & 0x0F, data[0], store.tick[e]);
+			}
+		}
+		if (i == 0 || Now() - start < best)
+			best = Now() - start;
+	}
+
+	Events_Free(&store);
+	Report(b, "quantize", best, Self_Max_RSS(), parts ? NULL : "(no notes)");
+	return true;
+}
+
+
+//Run one of the tools on the generated file with its output going nowhere.
+//The best wall-clock time and the peak memory use of the child are reported.
+static bool Bench_Tool(const struct bench *b, const char *stage, char *const argv[])
+{
+	struct rusage usage;
+	long maxRSS = 0;
+	double start, elapsed, best = 0;
+	pid_t pid;
+	int status = 0, null;
+	unsigned i;
+	bool ok = true;
+
+	for (i = 0; i < b->iterations && ok; i++)
+	{
+		start = Now();
+		pid = fork();
+		if (pid < 0)
+		{
+			fprintf(stderr, "Error starting %s: %s\n\n", argv[0], strerror(errno));
+			return false;
+		} else if (pid == 0)
+		{
+			null = open("/dev/null", O_WRONLY);
+			dup2(null, STDOUT_FILENO);
+			dup2(null, STDERR_FILENO);
+			execv(argv[0], argv);
+			_exit(127);
+		}
+		if (wait4(pid, &status, 0, &usage) < 0)
+		{
+			fprintf(stderr, "Error waiting for %s: %s\n\n", argv[0], strerror(errno));
+			return false;
+		}
+		elapsed = Now() - start;
+		ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		if (i == 0 || elapsed < best)
+			best = elapsed;
+		if (usage.ru_maxrss > maxRSS)
+			maxRSS = usage.ru_maxrss;
+	}
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+		Report(b, stage, best, maxRSS, "(couldn't run the tool)");
+	else
+		Report(b, stage, best, maxRSS, ok ? NULL : "(tool reported an error)");
+	return ok;
+}
+
+
+static void Usage(void)
+{
+	fprintf(stderr, "Usage:\n\tmidi_bench [options]\n\n"
+	        "\t-t <n>     Tracks\n"
+	        "\t-n <n>     Notes per track\n"
+	        "\t-l <n>     Average note length in ticks\n"
+	        "\t-p <n>     Rest before every nth note (0 for none)\n"
+	        "\t-r         Use running status\n"
+	        "\t-x <n>     SysEx payload size (0 for none)\n"
+	        "\t-X <n>     SysEx event before every nth note\n"
+	        "\t-T <n>     Tempo change before every nth note (0 for none)\n"
+	        "\t-d <n>     Division (ticks per quarter note)\n"
+	        "\t-s <n>     Random seed\n"
+	        "\t-i <n>     Iterations per stage (the best time is reported)\n"
+	        "\t-b <dir>   Directory with the midi_dump and midi_notes binaries\n"
+	        "\t-o <file>  Keep the generated file under this name\n\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct bench b;
+	struct smf_params *p = &b.params;
+	char tempName[] = "/tmp/midi_bench_XXXXXX";
+	char dumpPath[1024], notesPath[1024], division[16];
+	uint8_t *data;
+	FILE *file;
+	int opt, fd;
+	bool ok = true;
+
+	memset(&b, 0, sizeof(b));
+	SMF_Default_Params(p);
+	b.iterations = 3;
+	b.binDir = ".";
+
+	while ((opt = getopt(argc, argv, "t:n:l:p:rx:X:T:d:s:i:b:o:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 't': p->tracks = strtoul(optarg, NULL, 10); break;
+			case 'n': p->notesPerTrack = strtoul(optarg, NULL, 10); break;
+			case 'l': p->noteTicks = strtoul(optarg, NULL, 10); break;
+			case 'p': p->restEvery = strtoul(optarg, NULL, 10); break;
+			case 'r': p->runningStatus = true; break;
+			case 'x': p->sysexSize = strtoul(optarg, NULL, 10); break;
+			case 'X': p->sysexEvery = strtoul(optarg, NULL, 10); break;
+			case 'T': p->tempoEvery = strtoul(optarg, NULL, 10); break;
+			case 'd': p->division = strtoul(optarg, NULL, 10); break;
+			case 's': p->seed = strtoul(optarg, NULL, 10); break;
+			case 'i': b.iterations = strtoul(optarg, NULL, 10); break;
+			case 'b': b.binDir = optarg; break;
+			case 'o': b.filename = optarg; break;
+			default:
+				Usage();
+				return EXIT_FAILURE;
+		}
+	}
+	if (p->tracks == 0 || p->tracks > 0xFFFF || p->division == 0 || p->division > 0x7FFF ||
+	    b.iterations == 0)
+	{
+		Usage();
+		return EXIT_FAILURE;
+	}
+
+	//Make the file and save it for the tools
+	if (!SMF_Generate(p, &data, &b.size, &b.events))
+		return EXIT_FAILURE;
+	b.data = data;
+	if (b.filename != NULL)
+	{
+		file = fopen(b.filename, "wb");
+	} else
+	{
+		fd = mkstemp(tempName);
+		file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+		b.filename = tempName;
+	}
+	if (file == NULL || fwrite(data, 1, b.size, file) != b.size || fclose(file) != 0)
+	{
+		fprintf(stderr, "Error writing file %s: %s\n\n", b.filename, strerror(errno));
+		free(data);
+		return EXIT_FAILURE;
+	}
+
+	printf("%u tracks, %zu events, %zu bytes%s%s%s\n\n", p->tracks, b.events, b.size,
+	       p->runningStatus ? ", running status" : "",
+	       p->sysexSize ? ", SysEx" : "", p->tempoEvery ? ", tempo changes" : "");
+
+	ok = Bench_Decode(&b) && ok;
+	ok = Bench_Quantize(&b) && ok;
+
+	snprintf(dumpPath, sizeof(dumpPath), "%s/midi_dump", b.binDir);
+	snprintf(notesPath, sizeof(notesPath), "%s/midi_notes", b.binDir);
+	snprintf(division, sizeof(division), "%u", (unsigned)p->division);
+	ok = Bench_Tool(&b, "midi_dump", (char *const[]){dumpPath, (char *)b.filename, NULL}) && ok;
+	ok = Bench_Tool(&b, "midi_notes", (char *const[]){notesPath, (char *)b.filename,
+	                division, "all", NULL}) && ok;
+
+	if (b.filename == tempName)
+		unlink(tempName);
+	free(data);
+	Lengths_Free_All();
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
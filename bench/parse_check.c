@@ -0,0 +1,355 @@
+//Agreement check for the decoders. Parse_Buffer(), the streaming decoder, and
+//the event store the tools use for mapped files are supposed to see exactly the
+//same events in the same file, so this records every callback from each of
+//them (the event store's are made up from its table) and compares the lists.
+//The stream is fed in blocks of a few different sizes, so events that get split
+//across blocks are checked too. It runs on the files on the command line, on a
+//couple of files with tracks that have no End of Track event, and on generated
+//files with and without running status.
+//
+//Build from the top directory with something like:
+//	gcc -O2 -Wall -pthread -I. -o parse_check bench/parse_check.c bench/smf_gen.c
+//	    midi_parse.c midi_stream.c midi_decode.c midi_events.c seek_index.c
+//	    tempo_map.c midi_input.c out_buffer.c work_pool.c
+//Then run it with any number of .mid files:
+//	./parse_check *.mid
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "smf_gen.h"
+#include "midi_parse.h"
+#include "midi_stream.h"
+#include "midi_input.h"
+#include "midi_decode.h"
+#include "midi_events.h"
+
+enum callback_kind
+{
+	CALLBACK_HEADER,
+	CALLBACK_TRACK,
+	CALLBACK_EVENT,
+	CALLBACK_SYSEX,
+	CALLBACK_META
+};
+
+//One callback and everything it was given. Meta data is only compared as far
+//as the streaming decoder keeps it.
+struct callback
+{
+	uint8_t kind;
+	uint8_t status;        //Status byte, or the meta type
+	uint8_t data[2];       //Channel message data
+	uint32_t delta;
+	uint32_t length;       //Chunk, SysEx, or meta length
+	struct midi_header header;
+	uint8_t meta[MIDI_STREAM_META_MAX];
+};
+
+struct callback_list
+{
+	struct callback *calls;
+	size_t count;
+	size_t capacity;
+	bool failed;
+};
+
+
+static struct callback *List_Add(struct callback_list *l, uint8_t kind, uint32_t delta,
+                                 uint32_t length)
+{
+	struct callback *newCalls;
+
+	if (l->count == l->capacity)
+	{
+		l->capacity = l->capacity ? 2 * l->capacity : 4096;
+		newCalls = realloc(l->calls, l->capacity * sizeof(struct callback));
+		if (newCalls == NULL)
+		{
+			fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+			l->failed = true;
+			return NULL;
+		}
+		l->calls = newCalls;
+	}
+
+	memset(&l->calls[l->count], 0, sizeof(struct callback));
+	l->calls[l->count].kind = kind;
+	l->calls[l->count].delta = delta;
+	l->calls[l->count].length = length;
+	return &l->calls[l->count++];
+}
+
+static bool On_Header(void *user, uint32_t length, const struct midi_header *header)
+{
+	struct callback *c = List_Add(user, CALLBACK_HEADER, 0, length);
+
+	if (c != NULL)
+		c->header = *header;
+	return c != NULL;
+}
+
+static bool On_Track(void *user, uint32_t length)
+{
+	return List_Add(user, CALLBACK_TRACK, 0, length) != NULL;
+}
+
+static bool On_Event(void *user, uint32_t delta, uint8_t status, const uint8_t *data)
+{
+	struct callback *c = List_Add(user, CALLBACK_EVENT, delta, 0);
+
+	if (c == NULL)
+		return false;
+	c->status = status;
+	c->data[0] = data[0];
+
+	//Only three-byte messages have a second data byte
+	if ((status & 0xF0) != MIDI_EVENT_PROGRAM_CHANGE &&
+	    (status & 0xF0) != MIDI_EVENT_CHAN_KEY_PRESSURE)
+		c->data[1] = data[1];
+	return true;
+}
+
+static bool On_SysEx(void *user, uint32_t delta, uint8_t status, uint32_t length)
+{
+	struct callback *c = List_Add(user, CALLBACK_SYSEX, delta, length);
+
+	if (c != NULL)
+		c->status = status;
+	return c != NULL;
+}
+
+static bool On_Meta(void *user, uint32_t delta, uint8_t type, const uint8_t *data,
+                    uint32_t length)
+{
+	struct callback *c = List_Add(user, CALLBACK_META, delta, length);
+
+	if (c == NULL)
+		return false;
+	c->status = type;
+	memcpy(c->meta, data, (length < MIDI_STREAM_META_MAX) ? length : MIDI_STREAM_META_MAX);
+	return true;
+}
+
+static const struct midi_stream_handler recordHandler =
+{
+	On_Header,
+	On_Track,
+	On_Event,
+	On_SysEx,
+	On_Meta,
+};
+
+
+//Run the streaming decoder over the data in blocks of blockSize bytes
+static bool Stream_Record(const uint8_t *data, size_t size, size_t blockSize,
+                          struct callback_list *l)
+{
+	struct midi_stream s;
+	size_t pos, n;
+	bool ok = true;
+
+	Stream_Init(&s, &recordHandler, l);
+	for (pos = 0; pos < size && ok; pos += n)
+	{
+		n = (size - pos < blockSize) ? size - pos : blockSize;
+		ok = Stream_Feed(&s, data + pos, n);
+	}
+	return ok && Stream_Finish(&s);
+}
+
+
+//Turn the mapped path's event store back into callbacks. This is what midi_dump
+//and midi_notes decode a file into when it's given as a path, so it has to
+//agree with the other two as well.
+static bool Store_Record(const uint8_t *data, size_t size, struct callback_list *l)
+{
+	struct event_store store;
+	struct callback *c;
+	const uint8_t *status, *payload;
+	uint32_t lastTime;
+	size_t t, i;
+	bool ok;
+
+	ok = Events_Load(&store, data, size, 1) && !store.failed;
+	if (store.index.haveHeader)
+		On_Header(l, store.index.headerLength, &store.index.header);
+	for (t = 0; t < store.numTracks && !l->failed; t++)
+	{
+		On_Track(l, store.index.tracks[t].length);
+		lastTime = 0;
+		for (i = store.trackStart[t]; i < store.trackStart[t + 1] && !l->failed; i++)
+		{
+			status = &store.status[i];
+			payload = store.base + store.payload[i];
+			if ((*status & 0xF0) < 0xF0)
+			{
+				c = List_Add(l, CALLBACK_EVENT, store.tick[i] - lastTime, 0);
+				if (c != NULL)
+				{
+					c->status = *status;
+					c->data[0] = store.data1[i];
+					if ((*status & 0xF0) != MIDI_EVENT_PROGRAM_CHANGE &&
+					    (*status & 0xF0) != MIDI_EVENT_CHAN_KEY_PRESSURE)
+						c->data[1] = store.data2[i];
+				}
+			} else if (*status == MIDI_EVENT_META)
+				On_Meta(l, store.tick[i] - lastTime, store.data1[i], payload, store.length[i]);
+			else
+				On_SysEx(l, store.tick[i] - lastTime, *status, store.length[i]);
+			lastTime = store.tick[i];
+		}
+	}
+
+	Events_Free(&store);
+	return ok;
+}
+
+
+//Compare one decoder's callbacks with the stream's. They have to agree on
+//whether the file is good, and for a good file they have to make the same
+//callbacks. For a bad one, the others can stop sooner, since they see that a
+//chunk runs past the end of the file before decoding any of it, but everything
+//they do pass on has to match.
+static bool Compare(const char *name, const char *what, const struct callback_list *got,
+                    bool gotOK, const struct callback_list *want, bool wantOK, size_t blockSize)
+{
+	size_t i;
+
+	if (got->failed || want->failed)
+		return false;
+	if (gotOK != wantOK)
+	{
+		fprintf(stderr, "Error: %s: the %s says the file is %s, the stream says %s "
+		        "(%zu-byte blocks)\n", name, what, gotOK ? "good" : "bad",
+		        wantOK ? "good" : "bad", blockSize);
+		return false;
+	}
+	for (i = 0; i < got->count && i < want->count; i++)
+	{
+		if (memcmp(&got->calls[i], &want->calls[i], sizeof(struct callback)) != 0)
+		{
+			fprintf(stderr, "Error: %s: callback %zu from the %s differs (%zu-byte blocks)\n",
+			        name, i, what, blockSize);
+			return false;
+		}
+	}
+	if (gotOK ? got->count != want->count : got->count > want->count)
+	{
+		fprintf(stderr, "Error: %s: %zu callbacks from the %s, %zu from the stream "
+		        "(%zu-byte blocks)\n", name, got->count, what, want->count, blockSize);
+		return false;
+	}
+	return true;
+}
+
+
+//Check one file with the parser and the event store against the stream fed in
+//blocks of a few sizes
+static bool Check(const char *name, const uint8_t *data, size_t size)
+{
+	static const size_t blockSizes[] = {1, 3, 4096, SIZE_MAX};
+	struct callback_list parsed, stored, streamed;
+	struct midi_parser p;
+	enum midi_error error;
+	size_t b;
+	bool storeOK, streamOK, ok = true;
+
+	memset(&parsed, 0, sizeof(parsed));
+	Parser_Init(&p, &recordHandler, &parsed);
+	error = Parse_Buffer(&p, data, size);
+	memset(&stored, 0, sizeof(stored));
+	storeOK = Store_Record(data, size, &stored);
+
+	for (b = 0; b < sizeof(blockSizes) / sizeof(blockSizes[0]) && ok; b++)
+	{
+		memset(&streamed, 0, sizeof(streamed));
+		streamOK = Stream_Record(data, size, blockSizes[b], &streamed);
+		ok = Compare(name, "parser", &parsed, error == MIDI_OK, &streamed, streamOK,
+		             blockSizes[b]) &&
+		     Compare(name, "event store", &stored, storeOK, &streamed, streamOK, blockSizes[b]);
+		free(streamed.calls);
+	}
+
+	if (ok)
+		printf("%-40s %10zu callbacks  %s\n", name, parsed.count,
+		       (error == MIDI_OK) ? "OK" : MIDI_Error_String(error));
+	free(parsed.calls);
+	free(stored.calls);
+	return ok;
+}
+
+
+//Add a chunk to a file being put together in memory
+static size_t Put_Chunk(uint8_t *file, size_t pos, const char *type, const uint8_t *data,
+                        uint32_t length)
+{
+	memcpy(file + pos, type, 4);
+	file[pos + 4] = length >> 24;
+	file[pos + 5] = length >> 16;
+	file[pos + 6] = length >> 8;
+	file[pos + 7] = length;
+	memcpy(file + pos + 8, data, length);
+	return pos + 8 + length;
+}
+
+
+int main(int argc, char *argv[])
+{
+	static const uint8_t header[] = {0x00, 0x01, 0x00, 0x03, 0x00, 0x60};
+	static const uint8_t noEnd[] = {0x00, 0x90, 0x3C, 0x40, 0x60, 0x80, 0x3C, 0x00};
+	static const uint8_t withEnd[] = {0x00, 0x90, 0x40, 0x40, 0x60, 0x40, 0x00,
+	                                  0x00, 0xFF, 0x2F, 0x00};
+	struct midi_input input;
+	struct smf_params params;
+	uint8_t file[64], *data;
+	size_t size, events;
+	int a;
+	bool ok = true;
+
+	for (a = 1; a < argc; a++)
+	{
+		Input_Init(&input);
+		if (!Input_Open(&input, argv[a]))
+		{
+			ok = false;
+			continue;
+		}
+		ok = Check(argv[a], input.data, input.size) && ok;
+		Input_Free(&input);
+	}
+
+	//Tracks without an End of Track event. These just end when their data
+	//runs out, as long as it runs out right after a whole event. One file has
+	//one in the middle with an empty track after it, and the other ends with
+	//one.
+	size = Put_Chunk(file, 0, "MThd", header, sizeof(header));
+	size = Put_Chunk(file, size, "MTrk", noEnd, sizeof(noEnd));
+	ok = Check("no End of Track at the end", file, size) && ok;
+	size = Put_Chunk(file, size, "MTrk", NULL, 0);
+	size = Put_Chunk(file, size, "MTrk", withEnd, sizeof(withEnd));
+	ok = Check("no End of Track in the middle", file, size) && ok;
+
+	//Generated files, with everything turned on so SysEx and tempo changes get
+	//checked too
+	SMF_Default_Params(&params);
+	params.sysexSize = 40;
+	params.sysexEvery = 50;
+	params.tempoEvery = 30;
+	for (a = 0; a < 2; a++)
+	{
+		params.runningStatus = (a == 1);
+		if (!SMF_Generate(&params, &data, &size, &events))
+		{
+			ok = false;
+			continue;
+		}
+		ok = Check(params.runningStatus ? "generated, running status" : "generated", data,
+		           size) && ok;
+		free(data);
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,186 @@
+//Synthetic MIDI file generator. Each track plays a stream of single notes on
+//its own channel (track number mod 16), with the odd rest, SysEx event, or
+//tempo change mixed in as requested. Note lengths are multiples of a 32nd note
+//so that midi_notes can write all of them down when run at the file's PPQN.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smf_gen.h"
+#include "out_buffer.h"
+#include "midi_types.h"
+
+
+void SMF_Default_Params(struct smf_params *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->tracks = 16;
+	p->notesPerTrack = 50000;
+	p->noteTicks = 240;
+	p->restEvery = 8;
+	p->sysexEvery = 1000;
+	p->division = 480;
+	p->seed = 12345;
+}
+
+
+//Simple xorshift generator so the same seed always gives the same file
+static uint32_t Random(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+
+static void Put_BE32(struct out_buffer *b, uint32_t value)
+{
+	uint8_t bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+
+	Out_Append(b, (const char *)bytes, sizeof(bytes));
+}
+
+static void Put_VarLen(struct out_buffer *b, uint32_t value)
+{
+	uint8_t bytes[4];
+	int n = 0;
+
+	//Fill in the groups from the end, with the flag on all but the last one
+	do
+	{
+		bytes[3 - n] = (value & 0x7F) | (n > 0 ? 0x80 : 0x00);
+		value >>= 7;
+		n++;
+	} while (value != 0 && n < 4);
+	Out_Append(b, (const char *)bytes + 4 - n, n);
+}
+
+//Write a channel message, leaving out the status byte if running status allows
+static void Put_Message(struct out_buffer *b, uint8_t *lastStatus, bool runningStatus,
+                        uint8_t status, uint8_t data1, uint8_t data2)
+{
+	uint8_t bytes[3] = {status, data1, data2};
+
+	if (runningStatus && status == *lastStatus)
+		Out_Append(b, (const char *)bytes + 1, 2);
+	else
+		Out_Append(b, (const char *)bytes, 3);
+	*lastStatus = status;
+}
+
+
+//Generate one track. Returns the number of events written.
+static size_t Put_Track(struct out_buffer *b, const struct smf_params *p, unsigned track,
+                        uint32_t *seed)
+{
+	uint8_t channel = track % 16, lastStatus = 0, key, header[4];
+	uint32_t unit = p->division / 8 ? p->division / 8 : 1;
+	uint32_t length, delta, tempo, n, i;
+	size_t start, events = 0;
+
+	Put_BE32(b, MIDI_TRACK_CHUNK);
+	start = b->used;
+	Put_BE32(b, 0);
+
+	for (n = 0; n < p->notesPerTrack; n++)
+	{
+		delta = (p->restEvery && n % p->restEvery == 0) ? p->noteTicks : 0;
+
+		if (p->tempoEvery && n % p->tempoEvery == 0)
+		{
+			tempo = 300000 + Random(seed) % 400000;
+			header[0] = tempo >> 16;
+			header[1] = tempo >> 8;
+			header[2] = tempo;
+			Put_VarLen(b, delta);
+			Out_Append(b, "\xFF\x51\x03", 3);
+			Out_Append(b, (const char *)header, 3);
+			lastStatus = 0;
+			delta = 0;
+			events++;
+		}
+
+		if (p->sysexSize && p->sysexEvery && n % p->sysexEvery == 0)
+		{
+			Put_VarLen(b, delta);
+			Out_Append(b, "\xF0", 1);
+			Put_VarLen(b, p->sysexSize);
+			if (!Out_Grow(b, p->sysexSize))
+				return 0;
+			for (i = 0; i + 1 < p->sysexSize; i++)
+				b->data[b->used++] = (char)(Random(seed) & 0x7F);
+			b->data[b->used++] = (char)0xF7;
+			lastStatus = 0;
+			delta = 0;
+			events++;
+		}
+
+		//Note lengths are 1/2x, 1x, 3/2x, or 2x the average, rounded to a 32nd
+		length = p->noteTicks * (1 + Random(seed) % 4) / 2;
+		length = (length + unit / 2) / unit * unit;
+		if (length == 0)
+			length = unit;
+		key = 36 + Random(seed) % 48;
+
+		Put_VarLen(b, delta);
+		Put_Message(b, &lastStatus, p->runningStatus, MIDI_EVENT_NOTE_ON | channel, key, 100);
+		Put_VarLen(b, length);
+		if (p->runningStatus)
+			Put_Message(b, &lastStatus, true, MIDI_EVENT_NOTE_ON | channel, key, 0);
+		else
+			Put_Message(b, &lastStatus, false, MIDI_EVENT_NOTE_OFF | channel, key, 0);
+		events += 2;
+	}
+
+	Put_VarLen(b, 0);
+	Out_Append(b, "\xFF\x2F\x00", 3);
+	events++;
+
+	//Go back and fill in the chunk length
+	length = (uint32_t)(b->used - start - 4);
+	header[0] = length >> 24;
+	header[1] = length >> 16;
+	header[2] = length >> 8;
+	header[3] = length;
+	memcpy(b->data + start, header, 4);
+
+	return events;
+}
+
+
+//Generate a whole file in memory. The caller frees *data when done with it.
+//The number of events in the file goes in *events.
+bool SMF_Generate(const struct smf_params *p, uint8_t **data, size_t *size, size_t *events)
+{
+	struct out_buffer b;
+	uint32_t seed = p->seed ? p->seed : 1;
+	uint8_t header[6];
+	unsigned t;
+
+	Out_Init(&b, -1);
+	*events = 0;
+
+	Put_BE32(&b, MIDI_HEADER_CHUNK);
+	Put_BE32(&b, sizeof(header));
+	header[0] = 0;
+	header[1] = 1;
+	header[2] = p->tracks >> 8;
+	header[3] = p->tracks;
+	header[4] = (p->division >> 8) & 0x7F;
+	header[5] = p->division;
+	Out_Append(&b, (const char *)header, sizeof(header));
+
+	for (t = 0; t < p->tracks; t++)
+		*events += Put_Track(&b, p, t, &seed);
+
+	if (b.failed)
+	{
+		Out_Free(&b);
+		return false;
+	}
+
+	*data = (uint8_t *)b.data;
+	*size = b.used;
+	return true;
+}
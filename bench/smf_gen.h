@@ -0,0 +1,31 @@
+//Synthetic MIDI file generator for benchmarking. Everything about the file is
+//controlled by the parameters, and the same parameters always give the same
+//bytes, so runs can be compared against each other.
+
+#ifndef SMF_GEN_H
+#define SMF_GEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+struct smf_params
+{
+	unsigned tracks;          //Number of track chunks (format 1)
+	unsigned notesPerTrack;   //Note on/off pairs in each track
+	uint32_t noteTicks;       //Average note length. Lengths are 1/2x to 2x this.
+	uint32_t restEvery;       //Put a rest before every Nth note (0 for none)
+	bool runningStatus;       //Leave out repeated status bytes. Note offs become
+	                          //note ons with velocity 0 so that there's
+	                          //something to repeat.
+	uint32_t sysexSize;       //Payload size of each SysEx event (0 for none)
+	uint32_t sysexEvery;      //Put a SysEx event before every Nth note
+	uint32_t tempoEvery;      //Put a tempo change before every Nth note (0 for none)
+	uint16_t division;        //Ticks per quarter note
+	uint32_t seed;            //Random seed for pitches and lengths
+};
+
+void SMF_Default_Params(struct smf_params *p);
+bool SMF_Generate(const struct smf_params *p, uint8_t **data, size_t *size, size_t *events);
+
+#endif
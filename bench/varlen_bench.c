@@ -0,0 +1,254 @@
+//Microbenchmark for the variable-length value decoders. This compares the
+//original byte-at-a-time VarLen_Read() loop with the bounds-checked
+//VarLen_Decode() on real delta times and lengths pulled from MIDI files, and on
+//some synthetic worst cases. Both decoders are checked against each other on
+//every value before anything is timed.
+//
+//Build from the top directory with something like:
+//	gcc -O2 -Wall -pthread -I. -o varlen_bench bench/varlen_bench.c midi_decode.c midi_input.c work_pool.c
+//Then run it with any number of .mid files:
+//	./varlen_bench *.mid
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include "midi_decode.h"
+#include "midi_input.h"
+
+//Make sure each test decodes at least this many values in total so the timings
+//mean something
+#define MIN_VALUES 50000000
+
+//A buffer full of back-to-back variable-length values
+struct varlen_data
+{
+	const char *name;
+	uint8_t *bytes;
+	size_t size;
+	size_t count;
+	size_t capacity;
+};
+
+static bool Data_Add(struct varlen_data *d, uint32_t value)
+{
+	uint8_t temp[4];
+	uint8_t *newBytes;
+	int n = 0;
+
+	if (d->size + 4 > d->capacity)
+	{
+		d->capacity = d->capacity ? 2 * d->capacity : 65536;
+		newBytes = realloc(d->bytes, d->capacity);
+		if (newBytes == NULL)
+		{
+			fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+			return false;
+		}
+		d->bytes = newBytes;
+	}
+
+	//Write the groups out backwards, then flip them around
+	do
+	{
+		temp[n++] = value & 0x7F;
+		value >>= 7;
+	} while (value != 0 && n < 4);
+	while (n > 0)
+	{
+		n--;
+		d->bytes[d->size++] = temp[n] | (n > 0 ? 0x80 : 0x00);
+	}
+	d->count++;
+	return true;
+}
+
+
+//Gather the delta times and payload lengths from every track of a file
+static bool Data_Add_File(struct varlen_data *d, const char *filename)
+{
+	struct midi_input input;
+	struct midi_index index;
+	struct track_events *tracks;
+	const struct track_event *e;
+	uint32_t lastTime;
+	size_t t, i;
+	bool ok;
+
+	Input_Init(&input);
+	if (!Input_Open(&input, filename))
+		return false;
+	ok = Index_Chunks(&index, input.data, input.size);
+	if (!ok)
+		fprintf(stderr, "Error: %s: %s\n", filename, MIDI_Error_String(index.error));
+	tracks = ok ? Decode_All_Tracks(&index, 1) : NULL;
+	ok = tracks != NULL;
+
+	for (t = 0; ok && t < index.numTracks; t++)
+	{
+		lastTime = 0;
+		for (i = 0; ok && i < tracks[t].count; i++)
+		{
+			e = &tracks[t].events[i];
+			ok = Data_Add(d, e->time - lastTime);
+			if (ok && e->event.status >= 0xF0)
+				ok = Data_Add(d, e->length);
+			lastTime = e->time;
+		}
+	}
+
+	Free_Tracks(tracks, index.numTracks);
+	Index_Free(&index);
+	Input_Close(&input);
+	Input_Free(&input);
+	return ok;
+}
+
+
+//Simple xorshift generator so the synthetic data is the same every run
+static uint32_t Random(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+//Check that both decoders agree on every value
+static bool Check(const struct varlen_data *d)
+{
+	struct var_len a, b;
+	size_t pos = 0;
+
+	while (pos < d->size)
+	{
+		a = VarLen_Read(d->bytes + pos);
+		if (!VarLen_Decode(d->bytes + pos, d->size - pos, &b) ||
+		    a.value != b.value || a.size != b.size)
+		{
+			fprintf(stderr, "Error: %s: decoders disagree at offset %zu\n", d->name, pos);
+			return false;
+		}
+		pos += b.size;
+	}
+
+	return true;
+}
+
+
+//Time both decoders over the data. The old loop isn't bounds-checked, so the
+//buffer has a few bytes of padding past the end to keep it safe.
+static void Run(const struct varlen_data *d)
+{
+	struct var_len v;
+	uint64_t sumOld = 0, sumNew = 0;
+	size_t pos, rounds, r;
+	double start, timeOld, timeNew;
+
+	if (d->count == 0)
+		return;
+	rounds = MIN_VALUES / d->count + 1;
+
+	start = Now();
+	for (r = 0; r < rounds; r++)
+	{
+		for (pos = 0; pos < d->size; pos += v.size)
+		{
+			v = VarLen_Read(d->bytes + pos);
+			sumOld += v.value;
+		}
+	}
+	timeOld = Now() - start;
+
+	start = Now();
+	for (r = 0; r < rounds; r++)
+	{
+		for (pos = 0; pos < d->size; pos += v.size)
+		{
+			VarLen_Decode(d->bytes + pos, d->size - pos, &v);
+			sumNew += v.value;
+		}
+	}
+	timeNew = Now() - start;
+
+	printf("%-32s %10zu values  loop %6.2f ns  decode %6.2f ns  %5.2fx%s\n",
+	       d->name, d->count,
+	       1e9 * timeOld / (rounds * d->count), 1e9 * timeNew / (rounds * d->count),
+	       timeOld / timeNew, sumOld == sumNew ? "" : "  (sums differ!)");
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct varlen_data tests[5];
+	uint32_t seed = 12345, value;
+	size_t numTests = 0, t, i;
+	int a;
+	bool ok = true;
+
+	memset(tests, 0, sizeof(tests));
+
+	//Real data from the files on the command line, all lumped together
+	tests[numTests].name = "MIDI files";
+	for (a = 1; a < argc && ok; a++)
+		ok = Data_Add_File(&tests[numTests], argv[a]);
+	numTests++;
+
+	//Small values only. This is what most delta times look like.
+	tests[numTests].name = "synthetic 1 byte";
+	for (i = 0; i < 1000000 && ok; i++)
+		ok = Data_Add(&tests[numTests], Random(&seed) & 0x7F);
+	numTests++;
+
+	//Every value at the maximum size
+	tests[numTests].name = "synthetic 4 bytes";
+	for (i = 0; i < 1000000 && ok; i++)
+		ok = Data_Add(&tests[numTests], (Random(&seed) & 0x0FFFFFFF) | 0x00200000);
+	numTests++;
+
+	//Random sizes, which is the worst case for the loop's branches
+	tests[numTests].name = "synthetic mixed sizes";
+	for (i = 0; i < 1000000 && ok; i++)
+	{
+		value = Random(&seed);
+		ok = Data_Add(&tests[numTests], value >> (4 + 7 * (value % 4)));
+	}
+	numTests++;
+
+	//Lots of tiny buffers, so the tail path gets a workout
+	tests[numTests].name = "synthetic short tails";
+	for (i = 0; i < 3 && ok; i++)
+		ok = Data_Add(&tests[numTests], 0x7F);
+	numTests++;
+
+	for (t = 0; t < numTests && ok; t++)
+	{
+		//Pad the buffer so the old loop can't read past it
+		ok = Data_Add(&tests[t], 0) && Data_Add(&tests[t], 0);
+		if (!ok)
+			break;
+		tests[t].size -= 2;
+		tests[t].count -= 2;
+		ok = Check(&tests[t]);
+	}
+
+	for (t = 0; t < numTests && ok; t++)
+		Run(&tests[t]);
+
+	for (t = 0; t < numTests; t++)
+		free(tests[t].bytes);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,601 @@
+//Conversion cache. Every entry is a plain file holding exactly the text the
+//conversion wrote. New entries are written to a temporary file in the cache
+//directory and renamed into place, which is atomic, so a crash or another
+//process never sees a partial entry. Every hit updates the entry's modified
+//time, which makes eviction least-recently-used: the oldest entries go first.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "conv_cache.h"
+#include "out_buffer.h"
+
+//Once the cache goes over its limit, thin it out to this fraction of the limit
+//so that we don't end up scanning the directory for every new entry
+#define CACHE_EVICT_PERCENT 90
+
+//Temporary files older than this were left by a program that died, so they get
+//cleaned up along with the evicted entries
+#define CACHE_STALE_SECONDS 3600
+
+#define CACHE_TEMP_PREFIX "tmp."
+
+
+//The hash is XXH64. It's not cryptographic, but it's fast and mixes well, and
+//two 64-bit hashes with different seeds make accidental collisions a
+//non-issue. Reads are little-endian, which only matters for sharing a cache
+//between machines with different byte orders.
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t Rotate_Left(uint64_t x, unsigned bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+static inline uint64_t Read64(const uint8_t *p)
+{
+	uint64_t value;
+
+	memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	value = __builtin_bswap64(value);
+#endif
+	return value;
+}
+
+static inline uint32_t Read32(const uint8_t *p)
+{
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	value = __builtin_bswap32(value);
+#endif
+	return value;
+}
+
+static inline uint64_t XXH_Round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_P2;
+	return Rotate_Left(acc, 31) * XXH_P1;
+}
+
+static inline uint64_t XXH_Merge(uint64_t acc, uint64_t value)
+{
+	acc ^= XXH_Round(0, value);
+	return acc * XXH_P1 + XXH_P4;
+}
+
+static uint64_t XXH64(const uint8_t *p, size_t size, uint64_t seed)
+{
+	const uint8_t *end = p + size;
+	uint64_t h, v1, v2, v3, v4;
+
+	if (size >= 32)
+	{
+		//Four lanes at a time for the bulk of the data
+		v1 = seed + XXH_P1 + XXH_P2;
+		v2 = seed + XXH_P2;
+		v3 = seed;
+		v4 = seed - XXH_P1;
+		for (; end - p >= 32; p += 32)
+		{
+			v1 = XXH_Round(v1, Read64(p));
+			v2 = XXH_Round(v2, Read64(p + 8));
+			v3 = XXH_Round(v3, Read64(p + 16));
+			v4 = XXH_Round(v4, Read64(p + 24));
+		}
+		h = Rotate_Left(v1, 1) + Rotate_Left(v2, 7) + Rotate_Left(v3, 12) + Rotate_Left(v4, 18);
+		h = XXH_Merge(h, v1);
+		h = XXH_Merge(h, v2);
+		h = XXH_Merge(h, v3);
+		h = XXH_Merge(h, v4);
+	} else
+	{
+		h = seed + XXH_P5;
+	}
+	h += size;
+
+	//Whatever's left over
+	for (; end - p >= 8; p += 8)
+		h = Rotate_Left(h ^ XXH_Round(0, Read64(p)), 27) * XXH_P1 + XXH_P4;
+	if (end - p >= 4)
+	{
+		h = Rotate_Left(h ^ (uint64_t)Read32(p) * XXH_P1, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+	for (; p < end; p++)
+		h = Rotate_Left(h ^ *p * XXH_P5, 11) * XXH_P1;
+
+	//Final mix
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+//Hash of an input file
+void Cache_Hash(const uint8_t *data, size_t size, struct cache_hash *hash)
+{
+	hash->h[0] = XXH64(data, size, 0);
+	hash->h[1] = XXH64(data, size, XXH_P5);
+}
+
+
+//Make the key for an input file converted with some settings. The settings can
+//be any text, as long as different settings never give the same text.
+void Cache_Key(const struct conv_cache *c, const struct cache_hash *hash, const char *params,
+               char key[CACHE_KEY_SIZE])
+{
+	uint64_t seed[2];
+
+	seed[0] = XXH64((const uint8_t *)params, strlen(params), c->toolHash);
+	seed[1] = XXH64((const uint8_t *)params, strlen(params), ~c->toolHash);
+	snprintf(key, CACHE_KEY_SIZE, "%016" PRIx64 "%016" PRIx64,
+	         XXH64((const uint8_t *)hash->h, sizeof(hash->h), seed[0]),
+	         XXH64((const uint8_t *)hash->h, sizeof(hash->h), seed[1]));
+}
+
+
+//Hash the running program. If it can't be read, fall back on the build time.
+static uint64_t Cache_Tool_Hash(void)
+{
+	static const char buildTime[] = __DATE__ " " __TIME__;
+	uint8_t buffer[65536];
+	uint64_t h = 0;
+	ssize_t got;
+	int fd;
+
+	fd = open("/proc/self/exe", O_RDONLY);
+	if (fd < 0)
+		return XXH64((const uint8_t *)buildTime, sizeof(buildTime), 0);
+	while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+		h = XXH64(buffer, (size_t)got, h);
+	close(fd);
+	return (got < 0) ? XXH64((const uint8_t *)buildTime, sizeof(buildTime), 0) : h;
+}
+
+
+//Take the --cache and --cache-size options out of a command line. They can go
+//anywhere, and whatever's left is moved down to fill the gap. *dir is left
+//NULL if there's no --cache.
+bool Cache_Parse_Options(int *argc, char *argv[], const char **dir, uint64_t *maxBytes)
+{
+	unsigned long long megabytes;
+	char *end;
+	int i, n = 1;
+
+	*dir = NULL;
+	*maxBytes = (uint64_t)CACHE_DEFAULT_MB << 20;
+
+	for (i = 1; i < *argc; i++)
+	{
+		if (strcmp(argv[i], "--cache") != 0 && strcmp(argv[i], "--cache-size") != 0)
+		{
+			argv[n++] = argv[i];
+			continue;
+		}
+		if (i + 1 >= *argc)
+		{
+			fprintf(stderr, "Error: %s needs a value\n\n", argv[i]);
+			return false;
+		}
+
+		if (strcmp(argv[i], "--cache") == 0)
+		{
+			*dir = argv[i + 1];
+		} else
+		{
+			errno = 0;
+			megabytes = strtoull(argv[i + 1], &end, 10);
+			if (errno != 0 || *end != '\0' || end == argv[i + 1] || megabytes == 0 ||
+			    megabytes > UINT64_MAX >> 20)
+			{
+				fprintf(stderr, "Error: Bad cache size: %s\n\n", argv[i + 1]);
+				return false;
+			}
+			*maxBytes = (uint64_t)megabytes << 20;
+		}
+		i++;
+	}
+
+	*argc = n;
+	argv[n] = NULL;
+	return true;
+}
+
+
+//Make a file name in the cache directory. The caller frees it.
+static char *Cache_Path(const struct conv_cache *c, const char *name)
+{
+	char *path = malloc(strlen(c->dir) + strlen(name) + 2);
+
+	if (path == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		return NULL;
+	}
+	sprintf(path, "%s/%s", c->dir, name);
+	return path;
+}
+
+
+//Whether a file in the cache directory is an entry
+static bool Is_Entry_Name(const char *name)
+{
+	size_t i;
+
+	for (i = 0; name[i] != '\0'; i++)
+	{
+		if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+			return false;
+	}
+	return i == CACHE_KEY_SIZE - 1;
+}
+
+
+struct cache_entry
+{
+	char name[CACHE_KEY_SIZE];
+	struct timespec used;
+	uint64_t size;
+};
+
+static int Compare_Entries(const void *a, const void *b)
+{
+	const struct cache_entry *x = a, *y = b;
+
+	if (x->used.tv_sec != y->used.tv_sec)
+		return (x->used.tv_sec < y->used.tv_sec) ? -1 : 1;
+	if (x->used.tv_nsec != y->used.tv_nsec)
+		return (x->used.tv_nsec < y->used.tv_nsec) ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+
+//Look at everything in the cache directory. This counts up the size of the
+//entries and gets rid of old temporary files. If target isn't UINT64_MAX, the
+//least recently used entries are deleted until the rest fit in it. Returns the
+//size of what's left. The cache must be locked.
+static uint64_t Cache_Scan(struct conv_cache *c, uint64_t target)
+{
+	struct cache_entry *entries = NULL, *newEntries;
+	size_t numEntries = 0, maxEntries = 0, i;
+	uint64_t total = 0;
+	struct dirent *d;
+	struct stat info;
+	time_t now = time(NULL);
+	char *path;
+	DIR *dir;
+
+	dir = opendir(c->dir);
+	if (dir == NULL)
+		return 0;
+
+	while ((d = readdir(dir)) != NULL)
+	{
+		if (!Is_Entry_Name(d->d_name) &&
+		    strncmp(d->d_name, CACHE_TEMP_PREFIX, strlen(CACHE_TEMP_PREFIX)) != 0)
+			continue;
+		if ((path = Cache_Path(c, d->d_name)) == NULL)
+			break;
+		if (stat(path, &info) != 0 || !S_ISREG(info.st_mode))
+		{
+			free(path);
+			continue;
+		}
+
+		if (!Is_Entry_Name(d->d_name))
+		{
+			if (now - info.st_mtim.tv_sec > CACHE_STALE_SECONDS)
+				unlink(path);
+			free(path);
+			continue;
+		}
+		free(path);
+
+		total += (uint64_t)info.st_size;
+		if (target == UINT64_MAX)
+			continue;
+		if (numEntries == maxEntries)
+		{
+			maxEntries = maxEntries ? 2 * maxEntries : 256;
+			newEntries = realloc(entries, maxEntries * sizeof(struct cache_entry));
+			if (newEntries == NULL)
+			{
+				fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+				break;
+			}
+			entries = newEntries;
+		}
+		strcpy(entries[numEntries].name, d->d_name);
+		entries[numEntries].used = info.st_mtim;
+		entries[numEntries++].size = (uint64_t)info.st_size;
+	}
+	closedir(dir);
+
+	//Oldest first
+	if (numEntries > 0)
+		qsort(entries, numEntries, sizeof(struct cache_entry), Compare_Entries);
+	for (i = 0; i < numEntries && total > target; i++)
+	{
+		if ((path = Cache_Path(c, entries[i].name)) == NULL)
+			break;
+		if (unlink(path) == 0 || errno == ENOENT)
+			total -= entries[i].size;
+		free(path);
+	}
+
+	free(entries);
+	return total;
+}
+
+
+//Open a cache directory, making it if it isn't there. If it's already over the
+//limit (say, because the limit went down), it gets thinned out now.
+bool Cache_Init(struct conv_cache *c, const char *dir, uint64_t maxBytes)
+{
+	memset(c, 0, sizeof(*c));
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "Error making cache directory %s: %s\n\n", dir, strerror(errno));
+		return false;
+	}
+	c->dir = strdup(dir);
+	if (c->dir == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		return false;
+	}
+	c->maxBytes = maxBytes;
+	c->toolHash = Cache_Tool_Hash();
+	pthread_mutex_init(&c->lock, NULL);
+
+	c->usedBytes = Cache_Scan(c, UINT64_MAX);
+	if (c->usedBytes > c->maxBytes)
+		c->usedBytes = Cache_Scan(c, c->maxBytes / 100 * CACHE_EVICT_PERCENT);
+	return true;
+}
+
+void Cache_Free(struct conv_cache *c)
+{
+	if (c->dir == NULL)
+		return;
+	free(c->dir);
+	pthread_mutex_destroy(&c->lock);
+	memset(c, 0, sizeof(*c));
+}
+
+
+//Write all of a block of data, even if it takes more than one try
+static bool Write_All(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t wrote;
+
+	while (size > 0)
+	{
+		wrote = write(fd, p, size);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote < 0)
+			return false;
+		p += wrote;
+		size -= (size_t)wrote;
+	}
+	return true;
+}
+
+
+//Copy everything from one file to another
+static bool Copy_File(int from, int to)
+{
+	char buffer[65536];
+	ssize_t got;
+
+	while ((got = read(from, buffer, sizeof(buffer))) != 0)
+	{
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 || !Write_All(to, buffer, (size_t)got))
+			return false;
+	}
+	return true;
+}
+
+
+//Write out a cached entry, if there is one. Using an entry makes it the most
+//recently used, so it gets its time updated.
+enum cache_result Cache_Fetch(struct conv_cache *c, const char *key, int fd)
+{
+	char *path;
+	int entry;
+	bool ok;
+
+	if ((path = Cache_Path(c, key)) == NULL)
+		return CACHE_MISS;
+	entry = open(path, O_RDONLY);
+	free(path);
+	if (entry < 0)
+		return CACHE_MISS;
+
+	futimens(entry, NULL);
+	ok = Copy_File(entry, fd);
+	close(entry);
+	if (!ok)
+	{
+		fprintf(stderr, "Error writing cached output: %s\n\n", strerror(errno));
+		return CACHE_FAILED;
+	}
+	return CACHE_HIT;
+}
+
+
+//Read a short entry into a string. Returns false if there's no entry or it
+//doesn't fit.
+bool Cache_Read(struct conv_cache *c, const char *key, char *text, size_t size)
+{
+	char *path;
+	ssize_t got;
+	int entry;
+
+	if ((path = Cache_Path(c, key)) == NULL)
+		return false;
+	entry = open(path, O_RDONLY);
+	free(path);
+	if (entry < 0)
+		return false;
+
+	futimens(entry, NULL);
+	got = read(entry, text, size);
+	close(entry);
+	if (got < 0 || (size_t)got >= size)
+		return false;
+	text[got] = '\0';
+	return true;
+}
+
+
+//Start writing a new entry
+bool Cache_Begin(struct conv_cache *c, struct cache_write *w)
+{
+	w->tempName = Cache_Path(c, CACHE_TEMP_PREFIX "XXXXXX");
+	if (w->tempName == NULL)
+	{
+		w->fd = -1;
+		return false;
+	}
+	w->fd = Out_Temp_File(w->tempName);
+	if (w->fd < 0)
+	{
+		fprintf(stderr, "Error making cache file: %s\n\n", strerror(errno));
+		free(w->tempName);
+		w->tempName = NULL;
+		return false;
+	}
+	return true;
+}
+
+
+//Copy what's been written to an entry so far to another file
+bool Cache_Replay(struct cache_write *w, int fd)
+{
+	off_t end = lseek(w->fd, 0, SEEK_CUR);
+	bool ok;
+
+	ok = end >= 0 && lseek(w->fd, 0, SEEK_SET) == 0 && Copy_File(w->fd, fd);
+	if (end >= 0)
+		lseek(w->fd, end, SEEK_SET);
+	return ok;
+}
+
+
+//Finish an entry and put it in the cache. The data goes to disk before the
+//rename so that a crash can't leave an empty entry under a good name. If that
+//takes the cache over its limit, the oldest entries get thrown out.
+bool Cache_Commit(struct conv_cache *c, struct cache_write *w, const char *key)
+{
+	struct stat info;
+	char *path;
+	bool ok;
+
+	path = Cache_Path(c, key);
+	ok = path != NULL && fstat(w->fd, &info) == 0 && fdatasync(w->fd) == 0;
+	ok = (close(w->fd) == 0) && ok;
+	ok = ok && rename(w->tempName, path) == 0;
+	if (!ok)
+	{
+		fprintf(stderr, "Error saving cache file: %s\n\n", strerror(errno));
+		unlink(w->tempName);
+	}
+	free(path);
+	free(w->tempName);
+	w->tempName = NULL;
+	w->fd = -1;
+	if (!ok)
+		return false;
+
+	pthread_mutex_lock(&c->lock);
+	c->usedBytes += (uint64_t)info.st_size;
+	if (c->usedBytes > c->maxBytes)
+		c->usedBytes = Cache_Scan(c, c->maxBytes / 100 * CACHE_EVICT_PERCENT);
+	pthread_mutex_unlock(&c->lock);
+	return true;
+}
+
+
+//Throw away an entry that didn't work out
+void Cache_Abort(struct cache_write *w)
+{
+	if (w->tempName == NULL)
+		return;
+	close(w->fd);
+	unlink(w->tempName);
+	free(w->tempName);
+	w->tempName = NULL;
+	w->fd = -1;
+}
+
+
+//Save some text in memory as an entry
+bool Cache_Store(struct conv_cache *c, const char *key, const struct iovec *iov, int count)
+{
+	struct cache_write w;
+	int i;
+
+	if (!Cache_Begin(c, &w))
+		return false;
+
+	//Out_Write_Vector() would do, but it changes the vector as it goes
+	for (i = 0; i < count; i++)
+	{
+		if (!Write_All(w.fd, iov[i].iov_base, iov[i].iov_len))
+		{
+			fprintf(stderr, "Error writing cache file: %s\n\n", strerror(errno));
+			Cache_Abort(&w);
+			return false;
+		}
+	}
+	return Cache_Commit(c, &w, key);
+}
+
+
+//Save a copy of a file as an entry
+bool Cache_Store_File(struct conv_cache *c, const char *key, const char *filename)
+{
+	struct cache_write w;
+	int fd;
+	bool ok;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (!Cache_Begin(c, &w))
+	{
+		close(fd);
+		return false;
+	}
+	ok = Copy_File(fd, w.fd);
+	close(fd);
+	if (!ok)
+	{
+		fprintf(stderr, "Error writing cache file: %s\n\n", strerror(errno));
+		Cache_Abort(&w);
+		return false;
+	}
+	return Cache_Commit(c, &w, key);
+}
@@ -0,0 +1,69 @@
+//Conversion cache. Converting the same file with the same settings always
+//gives the same text, so the text can be saved in a cache directory and handed
+//back the next time without parsing anything. Entries are named after a hash
+//of the input data, the settings, and the program itself (so a new build never
+//uses an old build's output). The cache has a size limit, and when it goes
+//over, the entries that were used longest ago get thrown out.
+
+#ifndef CONV_CACHE_H
+#define CONV_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+//Entry names are 32 hex digits
+#define CACHE_KEY_SIZE 33
+
+//Size limit if nobody says otherwise, in megabytes
+#define CACHE_DEFAULT_MB 512
+
+struct conv_cache
+{
+	char *dir;
+	uint64_t maxBytes;
+	uint64_t usedBytes;    //Our best guess; other processes can use the cache too
+	uint64_t toolHash;     //Hash of the running program
+	pthread_mutex_t lock;  //Batch mode uses the cache from several threads
+};
+
+//Hash of an input file. This is the slow part of making a key, so it's done
+//once per file no matter how many keys get made from it.
+struct cache_hash
+{
+	uint64_t h[2];
+};
+
+//An entry that's being written. It doesn't show up in the cache until it's
+//committed, so nobody ever sees half of one.
+struct cache_write
+{
+	int fd;
+	char *tempName;
+};
+
+enum cache_result
+{
+	CACHE_MISS,
+	CACHE_HIT,
+	CACHE_FAILED    //There was an entry, but it couldn't be written out
+};
+
+bool Cache_Parse_Options(int *argc, char *argv[], const char **dir, uint64_t *maxBytes);
+bool Cache_Init(struct conv_cache *c, const char *dir, uint64_t maxBytes);
+void Cache_Free(struct conv_cache *c);
+void Cache_Hash(const uint8_t *data, size_t size, struct cache_hash *hash);
+void Cache_Key(const struct conv_cache *c, const struct cache_hash *hash, const char *params,
+               char key[CACHE_KEY_SIZE]);
+enum cache_result Cache_Fetch(struct conv_cache *c, const char *key, int fd);
+bool Cache_Read(struct conv_cache *c, const char *key, char *text, size_t size);
+bool Cache_Begin(struct conv_cache *c, struct cache_write *w);
+bool Cache_Replay(struct cache_write *w, int fd);
+bool Cache_Commit(struct conv_cache *c, struct cache_write *w, const char *key);
+void Cache_Abort(struct cache_write *w);
+bool Cache_Store(struct conv_cache *c, const char *key, const struct iovec *iov, int count);
+bool Cache_Store_File(struct conv_cache *c, const char *key, const char *filename);
+
+#endif
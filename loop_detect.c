@@ -0,0 +1,245 @@
+//Loop detection. See loop_detect.h for the two approaches.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "loop_detect.h"
+
+//Multiplier for the rolling window hash. Any large odd number works.
+#define LOOP_HASH_BASE 0x100000001B3ull
+
+
+//Mix a value into a signature
+uint64_t Loop_Hash(uint64_t hash, uint64_t value)
+{
+	hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+	return hash ^ (hash >> 31);
+}
+
+
+//Set up a detector. The history is rounded up to a power of two.
+bool Loop_Init(struct loop_detector *d, uint32_t window, uint32_t minRepeat, uint32_t history)
+{
+	uint32_t size = 1, i;
+
+	memset(d, 0, sizeof(*d));
+	while (size < history)
+		size *= 2;
+
+	d->window = window ? window : 1;
+	d->minRepeat = minRepeat;
+	d->mask = size - 1;
+	d->history = malloc(size * sizeof(uint64_t));
+	d->active = malloc(size);
+	d->chain = malloc(size * sizeof(uint32_t));
+	d->heads = calloc(size, sizeof(uint32_t));
+	if (d->history == NULL || d->active == NULL || d->chain == NULL || d->heads == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		Loop_Free(d);
+		return false;
+	}
+
+	d->power = 1;
+	for (i = 0; i < d->window; i++)
+		d->power *= LOOP_HASH_BASE;
+
+	return true;
+}
+
+void Loop_Free(struct loop_detector *d)
+{
+	free(d->history);
+	free(d->active);
+	free(d->chain);
+	free(d->heads);
+	d->history = NULL;
+	d->active = NULL;
+	d->chain = NULL;
+	d->heads = NULL;
+}
+
+
+//Check whether frame f matches the frame one period before it. Frames that
+//have fallen out of the history don't match anything.
+static bool Loop_Match(const struct loop_detector *d, uint32_t f, uint32_t period)
+{
+	if (f < period || d->count - (f - period) > d->mask + 1)
+		return false;
+	return d->history[f & d->mask] == d->history[(f - period) & d->mask];
+}
+
+
+//See if a candidate has repeated for long enough. If so, the loop starts one
+//period before its run does.
+static bool Loop_Confirm(struct loop_detector *d, const struct loop_candidate *c)
+{
+	if (c->run < c->period || c->run < d->minRepeat)
+		return false;
+
+	d->found = true;
+	d->length = c->period;
+	d->start = d->count - c->run - c->period;
+	return true;
+}
+
+
+//A window matched an earlier one. Check that it really did, then find out how
+//far back the match goes and start watching the period.
+static bool Loop_Add_Candidate(struct loop_detector *d, uint32_t f, uint32_t period)
+{
+	struct loop_candidate *c;
+	uint32_t i, run;
+
+	if (period > (d->mask + 1) / 2 || d->numCandidates == LOOP_MAX_CANDIDATES)
+		return false;
+	for (i = 0; i < d->numCandidates; i++)
+	{
+		if (d->candidates[i].period == period)
+			return false;
+	}
+
+	for (run = 0; run < f + 1 && Loop_Match(d, f - run, period); run++)
+		;
+	if (run < d->window)
+		return false;
+
+	c = &d->candidates[d->numCandidates++];
+	c->period = period;
+	c->run = run;
+	return Loop_Confirm(d, c);
+}
+
+
+//Add the next frame's signature. Returns true once a loop has been found, after
+//which the start and length fields say where it is.
+bool Loop_Add(struct loop_detector *d, uint64_t signature, bool active)
+{
+	uint32_t f = d->count, i, bucket, g, steps;
+	struct loop_candidate *c;
+
+	if (d->found)
+		return true;
+
+	d->history[f & d->mask] = signature;
+	d->active[f & d->mask] = active;
+	d->count++;
+
+	//Keep the rolling hash and the note count up to date
+	d->windowHash = d->windowHash * LOOP_HASH_BASE + signature;
+	d->activeCount += active;
+	if (f >= d->window)
+	{
+		d->windowHash -= d->history[(f - d->window) & d->mask] * d->power;
+		d->activeCount -= d->active[(f - d->window) & d->mask];
+	}
+
+	//Carry on watching the periods we already know about, and drop any that
+	//stopped repeating
+	for (i = 0; i < d->numCandidates; )
+	{
+		c = &d->candidates[i];
+		if (Loop_Match(d, f, c->period))
+		{
+			c->run++;
+			if (Loop_Confirm(d, c))
+				return true;
+			i++;
+		} else
+		{
+			*c = d->candidates[--d->numCandidates];
+		}
+	}
+
+	//Look for earlier copies of the window
+	if (f + 1 < d->window || d->activeCount == 0)
+		return false;
+	bucket = (uint32_t)(d->windowHash >> 32) & d->mask;
+	g = d->heads[bucket];
+	for (steps = 0; g != 0 && steps < LOOP_MAX_CHAIN; steps++)
+	{
+		g--;
+		if (d->count - g > d->mask + 1)
+			break;
+		if (Loop_Add_Candidate(d, f, f - g))
+			return true;
+		g = d->chain[g & d->mask];
+	}
+	d->chain[f & d->mask] = d->heads[bucket];
+	d->heads[bucket] = f + 1;
+
+	return false;
+}
+
+
+//Offline detector for data we have all of. Finds the longest stretch at the end
+//of the sequence that repeats with the same period at least twice, with a note
+//start in it and at least minSpan ticks per period. times[] is the tick of each
+//signature, plus one more entry for the end. Returns false if nothing at the
+//end repeats.
+//
+//This runs the Z algorithm on the sequence backwards. z[p] is how far the end of
+//the sequence matches the part p steps before it, so the stretch that repeats
+//with period p is z[p] + p long.
+bool Loop_Find_Suffix(const uint64_t *signatures, const uint8_t *active, const uint32_t *times,
+                      size_t count, uint32_t minSpan, size_t *start, size_t *length)
+{
+	size_t *z, *notes, i, left = 0, right = 0, p, s, best = 0, bestCover = 0;
+
+	if (count < 2)
+		return false;
+
+	z = malloc(count * sizeof(size_t));
+	notes = malloc((count + 1) * sizeof(size_t));
+	if (z == NULL || notes == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		free(z);
+		free(notes);
+		return false;
+	}
+
+	//notes[i] is how many note starts come before signature i
+	notes[0] = 0;
+	for (i = 0; i < count; i++)
+		notes[i + 1] = notes[i] + (active[i] != 0);
+
+	//Z algorithm, indexing from the end
+	#define R(k) signatures[count - 1 - (k)]
+	z[0] = count;
+	for (i = 1; i < count; i++)
+	{
+		z[i] = 0;
+		if (i < right)
+			z[i] = (right - i < z[i - left]) ? right - i : z[i - left];
+		while (i + z[i] < count && R(z[i]) == R(i + z[i]))
+			z[i]++;
+		if (i + z[i] > right)
+		{
+			left = i;
+			right = i + z[i];
+		}
+	}
+	#undef R
+
+	for (p = 1; p <= count / 2; p++)
+	{
+		if (z[p] < p || z[p] + p <= bestCover)
+			continue;
+		s = count - (z[p] + p);
+		if (notes[s + p] == notes[s] || times[s + p] - times[s] < minSpan)
+			continue;
+		best = p;
+		bestCover = z[p] + p;
+	}
+
+	free(z);
+	free(notes);
+	if (best == 0)
+		return false;
+
+	*start = count - bestCover;
+	*length = best;
+	return true;
+}
@@ -0,0 +1,62 @@
+//Loop detection. Game music loops forever, so the players would otherwise run
+//for however long they're told to, and MIDI rips often have the loop written
+//out more than once. Both detectors here work on a sequence of signatures, one
+//per frame or tick, that hash whatever matters about that step: the sound
+//chip state for the players, or the events for MIDI files. A loop is a stretch
+//of signatures that repeats itself.
+
+#ifndef LOOP_DETECT_H
+#define LOOP_DETECT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//Repeat lengths we're watching at once, and how far back we look for each
+//window we've seen before
+#define LOOP_MAX_CANDIDATES 16
+#define LOOP_MAX_CHAIN 8
+
+//A repeat that might be the loop. Frames from the start of the run onward match
+//the frames one period earlier.
+struct loop_candidate
+{
+	uint32_t period;
+	uint32_t run;
+};
+
+//Online detector for players. Frames go in one at a time, and the detector
+//says when the song has looped. A window of recent frames is hashed on every
+//frame and looked up in a table of earlier windows. A match suggests a loop
+//period, which is then watched until it has repeated for a full period and at
+//least minRepeat frames. Only windows with a note start in them are looked up,
+//so silence and held notes don't count as loops. Memory use is fixed by the
+//history length, which is also the longest loop that can be found, times two.
+struct loop_detector
+{
+	uint32_t window;          //Frames in the hashed window
+	uint32_t minRepeat;       //Frames a repeat has to last before we believe it
+	uint32_t mask;            //History length minus one
+	uint64_t *history;        //Signature of each frame, in a ring
+	uint8_t *active;          //Whether a note started on each frame
+	uint32_t *chain;          //Previous frame with the same window hash, plus one
+	uint32_t *heads;          //Latest frame in each hash bucket, plus one
+	uint64_t windowHash;      //Rolling hash of the current window
+	uint64_t power;           //The hash base to the window'th power
+	uint32_t activeCount;     //Frames in the window where a note started
+	uint32_t count;           //Frames so far
+	struct loop_candidate candidates[LOOP_MAX_CANDIDATES];
+	uint32_t numCandidates;
+	bool found;
+	uint32_t start;           //First frame of the loop, once it's found
+	uint32_t length;          //Frames in the loop
+};
+
+bool Loop_Init(struct loop_detector *d, uint32_t window, uint32_t minRepeat, uint32_t history);
+void Loop_Free(struct loop_detector *d);
+bool Loop_Add(struct loop_detector *d, uint64_t signature, bool active);
+bool Loop_Find_Suffix(const uint64_t *signatures, const uint8_t *active, const uint32_t *times,
+                      size_t count, uint32_t minSpan, size_t *start, size_t *length);
+uint64_t Loop_Hash(uint64_t hash, uint64_t value);
+
+#endif
@@ -0,0 +1,515 @@
+//Shared MIDI file decoding. This used to be done one chunk at a time, with each
+//track decoded inline as soon as its header was read. But every chunk header
+//gives the chunk's length up front, so we can find all of the tracks without
+//decoding any of them, and then decode the tracks independently.
+
+#include <stdlib.h>
+#include <string.h>
+#include "midi_decode.h"
+#include "work_pool.h"
+
+
+//Messages for the error codes, for whoever wants to print them
+const char *MIDI_Error_String(enum midi_error error)
+{
+	switch (error)
+	{
+		case MIDI_OK:                    return "No error";
+		case MIDI_ERROR_TRUNCATED:       return "Unexpected end of file";
+		case MIDI_ERROR_CHUNK_LENGTH:    return "Chunk runs past the end of the file";
+		case MIDI_ERROR_SHORT_HEADER:    return "Header chunk is too short";
+		case MIDI_ERROR_UNKNOWN_CHUNK:   return "Unknown chunk type";
+		case MIDI_ERROR_UNKNOWN_EVENT:   return "Unknown event type";
+		case MIDI_ERROR_EVENT_LENGTH:    return "Event runs past the end of its chunk";
+		case MIDI_ERROR_NO_END_OF_TRACK: return "Track data ends in the middle of an event";
+		case MIDI_ERROR_BAD_SEEK:        return "Seek position is past the end of the track";
+		case MIDI_ERROR_NO_MEMORY:       return "Out of memory";
+		case MIDI_ERROR_STOPPED:         return "Stopped";
+	}
+	return "Unknown error";
+}
+
+
+//Event kind for every status byte. See enum status_class.
+const uint8_t statusClass[256] =
+{
+	[0x00 ... 0x7F] = STATUS_RUNNING,
+	[0x80 ... 0xBF] = STATUS_CHANNEL2,
+	[0xC0 ... 0xDF] = STATUS_CHANNEL1,
+	[0xE0 ... 0xEF] = STATUS_CHANNEL2,
+	[0xF0]          = STATUS_SYSEX,
+	[0xF1 ... 0xF6] = STATUS_BAD,
+	[0xF7]          = STATUS_SYSEX,
+	[0xF8 ... 0xFE] = STATUS_BAD,
+	[0xFF]          = STATUS_META,
+};
+
+
+//Helper functions for reading big-endian values from the byte stream
+uint16_t BE_Read16(const uint8_t *value)
+{
+	return (uint16_t)value[0] << 8 |
+	       (uint16_t)value[1] << 0;
+}
+
+uint32_t BE_Read32(const uint8_t *value)
+{
+	return (uint32_t)value[0] << 24 |
+	       (uint32_t)value[1] << 16 |
+		   (uint32_t)value[2] << 8 |
+		   (uint32_t)value[3] << 0;
+}
+
+//The MIDI standard allows for variable-length numbers. These are given as a
+//sequence of up to four bytes. The lower 7 bits are numerical data, and the
+//most-significant bit is a flag which indicates that more bytes are needed.
+//The maximum possible number of data bits is 28.
+struct var_len VarLen_Read(const uint8_t *value)
+{
+	struct var_len v = {0, 0};
+	int c;
+
+	for (c = 0; c < 4; c++)
+	{
+		v.value <<= 7;
+		v.value |= (value[c] & 0x7F);
+		v.size++;
+
+		if ((value[c] & 0x80) == 0x00)
+			break;
+	}
+
+	return v;
+}
+
+//Slow path for VarLen_Decode(), for when there are fewer than four bytes left.
+//This goes a byte at a time and stops if we run out.
+bool VarLen_Decode_Tail(const uint8_t *data, size_t available, struct var_len *v)
+{
+	size_t c;
+
+	v->value = 0;
+	for (c = 0; c < available; c++)
+	{
+		v->value = (v->value << 7) | (data[c] & 0x7F);
+		if ((data[c] & 0x80) == 0x00)
+		{
+			v->size = c + 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+//Read the chunk that starts at *pos and move *pos past it. The chunk's data is
+//checked to be inside the file, but nothing in it is looked at.
+enum midi_error Chunk_Read(const uint8_t *data, size_t totalSize, size_t *pos,
+                           struct midi_chunk *chunk)
+{
+	//Read the chunk type and length. MIDI bytes are in big-endian order, so
+	//we can't just do 32-bit reads even if we wanted to be lazy.
+	if (totalSize - *pos < 2*sizeof(uint32_t))
+		return MIDI_ERROR_TRUNCATED;
+	chunk->type = BE_Read32(data + *pos);
+	chunk->length = BE_Read32(data + *pos + sizeof(uint32_t));
+	chunk->data = data + *pos + 2*sizeof(uint32_t);
+	*pos += 2*sizeof(uint32_t);
+	if (chunk->length > totalSize - *pos)
+		return MIDI_ERROR_CHUNK_LENGTH;
+	*pos += chunk->length;
+
+	if (chunk->type != MIDI_HEADER_CHUNK && chunk->type != MIDI_TRACK_CHUNK)
+		return MIDI_ERROR_UNKNOWN_CHUNK;
+	return MIDI_OK;
+}
+
+
+//Parse the header chunk's fields
+enum midi_error Header_Read(const struct midi_chunk *chunk, struct midi_header *header)
+{
+	uint16_t temp;
+
+	if (chunk->length < 3*sizeof(uint16_t))
+		return MIDI_ERROR_SHORT_HEADER;
+	header->format = BE_Read16(chunk->data);
+	header->tracks = BE_Read16(chunk->data + sizeof(uint16_t));
+	temp = BE_Read16(chunk->data + 2*sizeof(uint16_t));
+	header->division = temp & 0x7FFF;
+	header->divType = temp >> 15;
+	//Ignore any extra data as per the MIDI spec
+	return MIDI_OK;
+}
+
+
+//First pass. Walk the chunk headers, save the header chunk's fields, and record
+//where each track chunk is. Nothing inside a track is read. If the file is bad,
+//index->error says why.
+bool Index_Chunks(struct midi_index *index, const uint8_t *data, size_t totalSize)
+{
+	struct midi_chunk chunk, *newTracks;
+	size_t usedSize = 0, maxTracks = 0;
+
+	memset(index, 0, sizeof(*index));
+
+	while (usedSize < totalSize)
+	{
+		index->error = Chunk_Read(data, totalSize, &usedSize, &chunk);
+		if (index->error != MIDI_OK)
+			return false;
+
+		if (chunk.type == MIDI_HEADER_CHUNK)
+		{
+			index->error = Header_Read(&chunk, &index->header);
+			if (index->error != MIDI_OK)
+				return false;
+			index->haveHeader = true;
+			index->headerLength = chunk.length;
+		} else
+		{
+			if (index->numTracks == maxTracks)
+			{
+				maxTracks = maxTracks ? 2 * maxTracks : 16;
+				newTracks = realloc(index->tracks, maxTracks * sizeof(struct midi_chunk));
+				if (newTracks == NULL)
+				{
+					index->error = MIDI_ERROR_NO_MEMORY;
+					return false;
+				}
+				index->tracks = newTracks;
+			}
+			index->tracks[index->numTracks++] = chunk;
+		}
+	}
+
+	return true;
+}
+
+void Index_Free(struct midi_index *index)
+{
+	free(index->tracks);
+	index->tracks = NULL;
+	index->numTracks = 0;
+}
+
+
+//Add an event to a track's event array
+static bool Add_Event(struct track_events *track, const struct track_event *e)
+{
+	struct track_event *newEvents;
+	size_t newCapacity;
+
+	if (track->count == track->capacity)
+	{
+		newCapacity = track->capacity ? 2 * track->capacity : 256;
+		newEvents = realloc(track->events, newCapacity * sizeof(struct track_event));
+		if (newEvents == NULL)
+			return false;
+		track->events = newEvents;
+		track->capacity = newCapacity;
+	}
+
+	track->events[track->count++] = *e;
+	return true;
+}
+
+
+//Start decoding a track from the beginning
+void Cursor_Init(struct track_cursor *c, const struct midi_chunk *chunk)
+{
+	c->data = chunk->data;
+	c->pos = 0;
+	c->end = chunk->length;
+	c->time = 0;
+	c->running = 0;
+	c->done = false;
+	c->failed = false;
+	c->error = MIDI_OK;
+}
+
+
+//Save the spot the cursor is at, to come back to later with Cursor_Seek()
+void Cursor_Mark(const struct track_cursor *c, struct cursor_mark *mark)
+{
+	memset(mark, 0, sizeof(*mark));
+	mark->pos = (uint32_t)c->pos;
+	mark->time = c->time;
+	mark->running = c->running;
+}
+
+
+//Start decoding a track from a saved spot. The mark might come from a file
+//that's out of date, so make sure it's at least inside the track.
+bool Cursor_Seek(struct track_cursor *c, const struct midi_chunk *chunk,
+                 const struct cursor_mark *mark)
+{
+	Cursor_Init(c, chunk);
+	if (mark->pos > chunk->length)
+		return false;
+	c->pos = mark->pos;
+	c->time = mark->time;
+	c->running = mark->running;
+	return true;
+}
+
+
+//Read the length and payload of a SysEx or meta event. Returns false if it runs
+//past the end of the track.
+static inline bool Cursor_Payload(const uint8_t *data, size_t *pos, size_t end,
+                                  struct track_event *e)
+{
+	struct var_len v;
+
+	if (!VarLen_Decode(data + *pos, end - *pos, &v))
+		return false;
+	*pos += v.size;
+	if (v.value > end - *pos)
+		return false;
+	e->length = v.value;
+	e->payload = data + *pos;
+	*pos += v.value;
+	return true;
+}
+
+
+//Decode the next event in a track. This may be a MIDI event, a SysEx event, or
+//a meta event. The events are all different lengths, so we have to keep track of
+//the data position here. A channel message can leave out its status byte if
+//it's the same as the last one's (running status), which is how most sequencers
+//save space. The track should conclude with an End of Track meta event, but we
+//check the chunk length too so that a bad file can't send us off the end of the
+//data. A track that runs out of data right after a whole event just ends, the
+//same as in the streaming decoder. Returns false once there are no more events:
+//after the End of Track event, at the end of the data, or at bad data, which
+//sets c->failed and c->error.
+bool Cursor_Next(struct track_cursor *c, struct track_event *e)
+{
+	const uint8_t *data = c->data;
+	struct var_len v;
+	uint8_t status;
+	size_t pos = c->pos, end = c->end;
+	bool ok;
+
+	if (c->done)
+		return false;
+	if (pos >= end)
+	{
+		c->done = true;
+		return false;
+	}
+
+	//If anything runs past the end of the chunk, we stop and drop the partial
+	//event
+	while (pos < end)
+	{
+		//Get the delta time
+		if (!VarLen_Decode(data + pos, end - pos, &v))
+			break;
+		c->time += v.value;
+		pos += v.size;
+		if (pos >= end)
+			break;
+
+		e->time = c->time;
+		e->length = 0;
+		e->payload = NULL;
+		e->event.data1 = 0;
+		e->event.data2 = 0;
+
+		//Figure out what kind of event this is. A data byte where the status
+		//should be means running status, so it's left for the data. SysEx and
+		//meta events are supposed to cancel running status, but some files
+		//rely on it carrying on past them, and a data byte can't mean anything
+		//else, so it's kept.
+		status = data[pos];
+		if (statusClass[status] == STATUS_RUNNING && c->running != 0)
+			status = c->running;
+		else
+			pos++;
+		e->event.status = status;
+
+		switch (statusClass[status])
+		{
+			case STATUS_CHANNEL1:
+				c->running = status;
+				ok = (end - pos >= 1);
+				if (ok)
+					e->event.data1 = data[pos++];
+				break;
+			case STATUS_CHANNEL2:
+				c->running = status;
+				ok = (end - pos >= 2);
+				if (ok)
+				{
+					e->event.data1 = data[pos];
+					e->event.data2 = data[pos + 1];
+					pos += 2;
+				}
+				break;
+			case STATUS_SYSEX:
+				ok = Cursor_Payload(data, &pos, end, e);
+				break;
+			case STATUS_META:
+				ok = (pos < end);
+				if (ok)
+				{
+					e->event.data1 = data[pos++];
+					ok = Cursor_Payload(data, &pos, end, e);
+				}
+				break;
+			default:
+				//Running status with no status before it, or a message that
+				//only makes sense on a MIDI cable
+				c->done = c->failed = true;
+				c->error = MIDI_ERROR_UNKNOWN_EVENT;
+				return false;
+		}
+		if (!ok)
+			break;
+
+		//The track is over at the End of Track event. Anything after that in
+		//the chunk is ignored.
+		c->pos = pos;
+		if (status == MIDI_EVENT_META && e->event.data1 == MIDI_META_END_OF_TRACK)
+			c->done = true;
+		return true;
+	}
+
+	//We only get here if the track ran out of data in the middle of an event
+	c->pos = pos;
+	c->done = c->failed = true;
+	c->error = MIDI_ERROR_NO_END_OF_TRACK;
+	return false;
+}
+
+
+//Decode a whole track into an array of events. This only touches the chunk and
+//the track it's given, so it's safe to decode different tracks on different
+//threads.
+bool Decode_Track(const struct midi_chunk *chunk, struct track_events *track)
+{
+	return Decode_Track_Range(chunk, track, NULL, 0, UINT32_MAX);
+}
+
+
+//Decode only the events of a track from tick from up to (but not including)
+//tick to, plus the note offs at tick to. If start isn't NULL, decoding starts
+//there instead of at the start of the track, so the events before the range
+//don't cost anything. The start has to be at or before the first event in the
+//range.
+bool Decode_Track_Range(const struct midi_chunk *chunk, struct track_events *track,
+                        const struct cursor_mark *start, uint32_t from, uint32_t to)
+{
+	struct track_cursor c;
+	struct track_event e;
+
+	memset(track, 0, sizeof(*track));
+
+	//Most events take at least three bytes, so this is usually enough room for
+	//a whole track. Running status can get them down to two, and then
+	//Add_Event() makes more room. A range can be any small part of the track,
+	//so its array just grows as it goes.
+	if (from == 0 && to == UINT32_MAX)
+	{
+		track->capacity = chunk->length / 3 + 1;
+		track->events = malloc(track->capacity * sizeof(struct track_event));
+		if (track->events == NULL)
+		{
+			track->capacity = 0;
+			track->failed = true;
+			track->error = MIDI_ERROR_NO_MEMORY;
+			return false;
+		}
+	}
+
+	if (start == NULL)
+		Cursor_Init(&c, chunk);
+	else if (!Cursor_Seek(&c, chunk, start))
+	{
+		track->failed = true;
+		track->error = MIDI_ERROR_BAD_SEEK;
+		return false;
+	}
+
+	while (Cursor_Next(&c, &e))
+	{
+		if (e.time > to)
+			break;
+		if (e.time < from)
+			continue;
+
+		//A note that ends right on the closing barline is still in the range,
+		//so note offs (and note ons with a velocity of 0) at tick to are kept.
+		//Nothing else there is.
+		if (e.time == to && (e.event.status & 0xF0) != MIDI_EVENT_NOTE_OFF &&
+		    ((e.event.status & 0xF0) != MIDI_EVENT_NOTE_ON || e.event.data2 != 0))
+			continue;
+		if (!Add_Event(track, &e))
+		{
+			track->failed = true;
+			track->error = MIDI_ERROR_NO_MEMORY;
+			return false;
+		}
+	}
+
+	track->endTime = c.time;
+	track->failed = c.failed;
+	track->error = c.error;
+	return !c.failed;
+}
+
+
+//Second pass: decode every track. Each track goes into its own slot in the
+//result, so the output is the same no matter which thread decodes what.
+struct decode_job
+{
+	const struct midi_index *index;
+	const struct cursor_mark *const *starts;
+	uint32_t from, to;
+	struct track_events *tracks;
+};
+
+static void Decode_Job(void *context, size_t index, unsigned worker)
+{
+	struct decode_job *job = context;
+
+	Decode_Track_Range(&job->index->tracks[index], &job->tracks[index],
+	                   (job->starts != NULL) ? job->starts[index] : NULL, job->from, job->to);
+}
+
+struct track_events *Decode_All_Tracks(const struct midi_index *index, unsigned numThreads)
+{
+	return Decode_All_Tracks_Range(index, NULL, 0, UINT32_MAX, numThreads);
+}
+
+//Decode a tick range of every track. starts has a place to start from for each
+//track (or NULL to start at the beginning), or is NULL itself.
+struct track_events *Decode_All_Tracks_Range(const struct midi_index *index,
+                                             const struct cursor_mark *const *starts,
+                                             uint32_t from, uint32_t to, unsigned numThreads)
+{
+	struct decode_job job;
+
+	job.index = index;
+	job.starts = starts;
+	job.from = from;
+	job.to = to;
+	job.tracks = calloc(index->numTracks ? index->numTracks : 1, sizeof(struct track_events));
+	if (job.tracks == NULL)
+		return NULL;
+
+	Pool_Run(index->numTracks, numThreads, Decode_Job, &job);
+	return job.tracks;
+}
+
+void Free_Tracks(struct track_events *tracks, size_t numTracks)
+{
+	size_t t;
+
+	if (tracks == NULL)
+		return;
+	for (t = 0; t < numTracks; t++)
+		free(tracks[t].events);
+	free(tracks);
+}
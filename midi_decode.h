@@ -0,0 +1,159 @@
+//Shared MIDI file decoding. Decoding happens in two passes: first we walk the
+//chunk headers to find every track, then each track is decoded into an array
+//of events on its own. Tracks don't depend on each other, so the second pass
+//can run on several threads at once.
+
+#ifndef MIDI_DECODE_H
+#define MIDI_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include "midi_types.h"
+
+//Chunk index for a file. This is built from the chunk headers alone; none of
+//the track data is looked at.
+struct midi_index
+{
+	bool haveHeader;            //False if the file has no header chunk
+	uint32_t headerLength;      //Length of the header chunk
+	struct midi_header header;  //Parsed header fields
+	struct midi_chunk *tracks;  //Track chunks, in file order
+	size_t numTracks;
+	enum midi_error error;      //Why indexing stopped, if it did
+};
+
+//One decoded event. Channel messages use the status and data bytes as-is. For
+//meta events, the status is MIDI_EVENT_META and data1 is the meta type. SysEx
+//and meta events point to their payload in the file data.
+struct track_event
+{
+	uint32_t time;            //Ticks since the start of the track
+	struct midi_event event;  //Status and data bytes
+	uint32_t length;          //Payload length for SysEx and meta events
+	const uint8_t *payload;   //Payload for SysEx and meta events
+};
+
+//All of the events in one track
+struct track_events
+{
+	struct track_event *events;
+	size_t count;
+	size_t capacity;
+	uint32_t endTime;  //Time of the last event
+	bool failed;       //The track has bad data; events stop at the problem
+	enum midi_error error;  //What was wrong with it
+};
+
+//What a status byte says about the event it starts. This comes from a table
+//(statusClass[]) instead of working it out from the bits, so the decoders can
+//go straight to the right code for each event with one lookup.
+enum status_class
+{
+	STATUS_RUNNING,    //0x00-0x7F: not a status byte at all, but the first data
+	                   //byte of a channel message with the same status as the
+	                   //last one (running status)
+	STATUS_CHANNEL1,   //Channel message with one data byte: 0xC0-0xDF
+	STATUS_CHANNEL2,   //Channel message with two data bytes
+	STATUS_SYSEX,      //0xF0 and 0xF7, followed by a length and a payload
+	STATUS_META,       //0xFF, followed by a type, a length and a payload
+	STATUS_BAD,        //System common and real-time messages, which can't be in
+	                   //a file
+};
+
+//Where we are in a track that's being decoded one event at a time
+struct track_cursor
+{
+	const uint8_t *data;     //Track chunk data
+	size_t pos;
+	size_t end;
+	uint32_t time;           //Time of the last event, in ticks
+	uint8_t running;         //Status byte of the last channel message
+	bool done;               //No more events
+	bool failed;             //The track has bad data
+	enum midi_error error;   //What was wrong with it
+};
+
+//A saved spot in a track, between two events. Decoding can pick up from here
+//without going over the events before it.
+struct cursor_mark
+{
+	uint32_t pos;            //Offset into the track chunk data
+	uint32_t time;           //Time of the event before this spot, in ticks
+	uint8_t running;         //Running status at this spot
+};
+
+const char *MIDI_Error_String(enum midi_error error);
+extern const uint8_t statusClass[256];
+
+uint16_t BE_Read16(const uint8_t *value);
+uint32_t BE_Read32(const uint8_t *value);
+struct var_len VarLen_Read(const uint8_t *value);
+bool VarLen_Decode_Tail(const uint8_t *data, size_t available, struct var_len *v);
+enum midi_error Chunk_Read(const uint8_t *data, size_t totalSize, size_t *pos,
+                           struct midi_chunk *chunk);
+enum midi_error Header_Read(const struct midi_chunk *chunk, struct midi_header *header);
+bool Index_Chunks(struct midi_index *index, const uint8_t *data, size_t totalSize);
+void Index_Free(struct midi_index *index);
+void Cursor_Init(struct track_cursor *c, const struct midi_chunk *chunk);
+bool Cursor_Next(struct track_cursor *c, struct track_event *e);
+void Cursor_Mark(const struct track_cursor *c, struct cursor_mark *mark);
+bool Cursor_Seek(struct track_cursor *c, const struct midi_chunk *chunk,
+                 const struct cursor_mark *mark);
+bool Decode_Track(const struct midi_chunk *chunk, struct track_events *track);
+bool Decode_Track_Range(const struct midi_chunk *chunk, struct track_events *track,
+                        const struct cursor_mark *start, uint32_t from, uint32_t to);
+struct track_events *Decode_All_Tracks(const struct midi_index *index, unsigned numThreads);
+struct track_events *Decode_All_Tracks_Range(const struct midi_index *index,
+                                             const struct cursor_mark *const *starts,
+                                             uint32_t from, uint32_t to, unsigned numThreads);
+void Free_Tracks(struct track_events *tracks, size_t numTracks);
+
+//Bounds-checked version of VarLen_Read(), which is what the decoder actually
+//uses. It reads the same values, but never looks past the available data and
+//returns false if the value doesn't end before the data does.
+//
+//Nearly every call has at least four bytes to work with, so that case loads
+//all four at once and works out the size and value with bit tricks instead of
+//a loop. A byte without the high bit set ends the value, so inverting the
+//word and masking off the high bits leaves a bit set for each byte that could
+//be the last one, and the first of those gives the size. If none of them are
+//set, the value is four bytes long, like VarLen_Read() does. Or-ing in the low
+//bit makes that case come out of the same count with no special case. This is
+//called for every event, so it's inline.
+static inline bool VarLen_Decode(const uint8_t *data, size_t available, struct var_len *v)
+{
+	uint32_t word, ends;
+	unsigned size;
+
+	//Most delta times fit in one byte. Checking for that first lets the CPU
+	//run ahead on the usual case instead of waiting for the bit tricks.
+	if (available >= 1 && data[0] < 0x80)
+	{
+		v->value = data[0];
+		v->size = 1;
+		return true;
+	}
+	if (available < 4)
+		return VarLen_Decode_Tail(data, available, v);
+
+	//Unaligned big-endian load
+	memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap32(word);
+#endif
+	ends = (~word & 0x80808080) | 1;
+	size = (unsigned)__builtin_clz(ends) / 8 + 1;
+
+	//Drop the bytes after the end of the value, then pack the 7-bit groups
+	word >>= 32 - 8 * size;
+	v->value = ((word & 0x0000007F) >> 0) |
+	           ((word & 0x00007F00) >> 1) |
+	           ((word & 0x007F0000) >> 2) |
+	           ((word & 0x7F000000) >> 3);
+	v->size = size;
+	return true;
+}
+
+#endif
@@ -4,256 +4,450 @@
 #include <errno.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
 #include "midi_types.h"
 #include "midi_strings.h"
+#include "midi_input.h"
+#include "midi_stream.h"
+#include "midi_events.h"
+#include "tempo_map.h"
+#include "midi_merge.h"
+#include "seek_index.h"
+#include "work_pool.h"
+#include "conv_cache.h"
+#include "active_notes.h"
 
-uint16_t BE_Read16(uint8_t *value);
-uint32_t BE_Read32(uint8_t *value);
-struct var_len VarLen_Read(uint8_t *value);
-void MIDI_State_Machine(uint8_t *data, size_t totalSize);
-size_t Process_Chunk(uint8_t *data);
-void Process_Track(uint8_t *data);
-void Process_MIDI_Event(uint8_t status, uint8_t *data);
+//Dump state. Everything that changes while a file is being dumped lives here
+//instead of in globals, so every function says what it works on and none of
+//them has to bail out with exit(). So far, this is the timing and the notes
+//that are on.
+struct dump_state
+{
+	uint32_t division;
+	uint16_t format;
+	struct tempo_map tempoMap;
+	struct active_notes notes;  //Keys that are on, for timing the note offs
+	uint32_t time;            //Time of the current event in ticks
+};
+
+//Cache state. While a dump is being saved, standard output points at the new
+//cache entry and the real standard output is kept in savedStdout.
+struct dump_cache
+{
+	struct conv_cache cache;
+	bool open;
+	struct cache_write pending;
+	char key[CACHE_KEY_SIZE];
+	int savedStdout;
+};
+
+void Dump_Init(struct dump_state *d);
+bool MIDI_State_Machine(struct dump_state *d, const uint8_t *data, size_t totalSize);
+bool Range_Dump(struct dump_state *d, const uint8_t *data, size_t totalSize,
+                const char *filename, uint32_t fromBar, uint32_t toBar);
+bool Merged_Dump(struct dump_state *d, const uint8_t *data, size_t totalSize);
+bool Process_Header(struct dump_state *d, uint32_t length, const struct midi_header *header);
+void Process_Meta_Event(uint8_t metaType, const uint8_t *data, uint32_t length);
+bool Process_Events(struct dump_state *d, const struct event_store *store);
+bool Process_MIDI_Event(struct dump_state *d, uint8_t status, const uint8_t *data);
+bool Stream_File(struct dump_state *d, const char *filename);
+enum cache_result Start_Cache(struct dump_cache *dc, const char *dir, uint64_t maxBytes,
+                              const struct midi_input *input, bool merged, uint32_t fromBar,
+                              uint32_t toBar);
+void Finish_Cache(struct dump_cache *dc, bool ok);
 
 
 int main(int argc, char *argv[])
 {
-	FILE *inFile;
-	uint8_t *midiData;
-	size_t dataSize;
-	int nextByte, c;
+	struct dump_state dump;
+	struct dump_cache cache;
+	struct midi_input input;
+	uint32_t fromBar, toBar;
+	bool merged, ranged, seekFile, ok;
+	const char *cacheDir;
+	uint64_t cacheBytes;
+	enum cache_result result = CACHE_MISS;
 	
 	//Check for valid command line arguments
-	if (argc != 2)
+	if (!Seek_Parse_Range(&argc, argv, &fromBar, &toBar, &ranged, &seekFile))
+		return EXIT_FAILURE;
+	if (!Cache_Parse_Options(&argc, argv, &cacheDir, &cacheBytes))
+		return EXIT_FAILURE;
+	merged = (argc == 3 && strcmp(argv[1], "-m") == 0);
+	if ((argc != 2 && !merged) || (merged && ranged))
 	{
-		fprintf(stderr, "Usage:\n\tmidi_dump <input filename>\n\n");
+		fprintf(stderr, "Usage:\n\tmidi_dump [--cache <dir>] [-m] <input filename>\n"
+		        "\tmidi_dump [--cache <dir>] [--from <bar>] [--to <bar>] [--no-seek-file] "
+		        "<input filename>\n\n"
+		        "-m prints the events of every track together in time order.\n"
+		        "--from and --to print only the bars from one to the other, counting\n"
+		        "from 1. A seek index gets saved next to the file to find them quickly;\n"
+		        "--no-seek-file builds it in memory instead, without reading or saving one.\n"
+		        "--cache <dir> saves the dump in a cache directory and prints it from there\n"
+		        "the next time. --cache-size sets the cache's size limit in megabytes\n"
+		        "(default %d). Pipes don't get cached.\n\n", CACHE_DEFAULT_MB);
 		return EXIT_FAILURE;
 	}
 
-	//Open the input file
-	inFile = fopen(argv[1], "rb");
-	if (inFile == NULL)
-	{
-		fprintf(stderr, "Error opening file: %s\n\n", strerror(errno));
+	//Pipes get decoded a block at a time as the data arrives. Merging and ranges
+	//need all of the tracks at once, so a merged pipe gets read in first.
+	Dump_Init(&dump);
+	if (!merged && !ranged && Input_Is_Stream(argv[1]))
+		return Stream_File(&dump, argv[1]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	//Map the input file into memory. This makes it easier to tokenize later.
+	Input_Init(&input);
+	if (!Input_Open(&input, argv[argc - 1]))
 		return EXIT_FAILURE;
-	}
 	
-	//Read the input file into memory. We could parse it one byte at a time,
-	//but I prefer to read all of the data into memory. This makes it easier
-	//to tokenize later. But first, we need to allocate memory, and that means
-	//we need to know how big the file is. Unfortunately, there's no standard
-	//way to do this. We'll have to settle for POSIX compliance instead.
-	fseek(inFile, 0, SEEK_END);
-	dataSize = (size_t)ftell(inFile);
-	rewind(inFile);
-	
-	midiData = malloc(dataSize);
-	if (midiData == NULL)
-	{
-		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
-		return EXIT_FAILURE;
-	}
-	fread(midiData, sizeof(uint8_t), dataSize, inFile);
-	if (errno != 0)
+	//If the cache has this dump already, print that instead. Input that came
+	//from a pipe doesn't have a name to check the seek index against, and it
+	//can't be read twice anyway, so it isn't worth caching.
+	cache.open = false;
+	cache.savedStdout = -1;
+	if (cacheDir != NULL && !Input_Is_Stream(argv[argc - 1]))
+		result = Start_Cache(&cache, cacheDir, cacheBytes, &input, merged, fromBar, toBar);
+	if (result != CACHE_MISS)
 	{
-		fprintf(stderr, "Error reading from file: %s\n\n", strerror(errno));
-		return EXIT_FAILURE;
+		Input_Free(&input);
+		return (result == CACHE_HIT) ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
-	fclose(inFile);
 	
 	//Invoke the MIDI state machine to do the real work
-	MIDI_State_Machine(midiData, dataSize);
+	if (merged)
+		ok = Merged_Dump(&dump, input.data, input.size);
+	else if (ranged)
+		ok = Range_Dump(&dump, input.data, input.size,
+		                (seekFile && !Input_Is_Stream(argv[1])) ? argv[1] : NULL, fromBar, toBar);
+	else
+		ok = MIDI_State_Machine(&dump, input.data, input.size);
 	
 	//It's a good habit to manually free the memory
-	free(midiData);
+	Finish_Cache(&cache, ok);
+	Input_Free(&input);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-//MIDI state variables. So far, this is just the timing parameters.
-static uint32_t division = 120, tempo = 480;
-uint32_t g_time = 0;
 
-
-//MIDI state machine. This is the interface function for interpreting the MIDI
-//file and producing converted data.
-void MIDI_State_Machine(uint8_t *data, size_t totalSize)
+//Look the dump up in the cache, and print it from there if it's a hit. On a
+//miss, standard output gets pointed at a new entry so that everything the dump
+//prints ends up in the cache. Everything that's wrong with the cache is reported
+//and then ignored; the dump still gets printed the normal way.
+enum cache_result Start_Cache(struct dump_cache *dc, const char *dir, uint64_t maxBytes,
+                              const struct midi_input *input, bool merged, uint32_t fromBar,
+                              uint32_t toBar)
 {
-	size_t usedSize = 0;
+	struct cache_hash hash;
+	char params[96];
+	enum cache_result result;
 	
-	while (usedSize < totalSize)
+	if (!Cache_Init(&dc->cache, dir, maxBytes))
+		return CACHE_MISS;
+	dc->open = true;
+	
+	Cache_Hash(input->data, input->size, &hash);
+	snprintf(params, sizeof(params), "midi_dump merged=%d from=%" PRIu32 " to=%" PRIu32,
+	         merged, fromBar, toBar);
+	Cache_Key(&dc->cache, &hash, params, dc->key);
+	result = Cache_Fetch(&dc->cache, dc->key, STDOUT_FILENO);
+	if (result != CACHE_MISS)
+	{
+		Cache_Free(&dc->cache);
+		dc->open = false;
+		return result;
+	}
+	
+	fflush(stdout);
+	if (!Cache_Begin(&dc->cache, &dc->pending))
+		return CACHE_MISS;
+	dc->savedStdout = dup(STDOUT_FILENO);
+	if (dc->savedStdout < 0 || dup2(dc->pending.fd, STDOUT_FILENO) < 0)
+	{
+		fprintf(stderr, "Error redirecting output to the cache: %s\n\n", strerror(errno));
+		if (dc->savedStdout >= 0)
+			close(dc->savedStdout);
+		dc->savedStdout = -1;
+		Cache_Abort(&dc->pending);
+	}
+	return CACHE_MISS;
+}
+
+
+//Put standard output back and copy the dump to it. The entry only gets saved if
+//the dump worked; whatever got printed before a problem still needs to reach
+//the user, but it shouldn't be cached.
+void Finish_Cache(struct dump_cache *dc, bool ok)
+{
+	if (dc->savedStdout >= 0)
 	{
-		usedSize += Process_Chunk(data + usedSize);
+		fflush(stdout);
+		dup2(dc->savedStdout, STDOUT_FILENO);
+		close(dc->savedStdout);
+		dc->savedStdout = -1;
+		if (!Cache_Replay(&dc->pending, STDOUT_FILENO))
+		{
+			fprintf(stderr, "Error printing the dump: %s\n\n", strerror(errno));
+			ok = false;
+		}
+		if (ok)
+			Cache_Commit(&dc->cache, &dc->pending, dc->key);
+		else
+			Cache_Abort(&dc->pending);
 	}
+	if (dc->open)
+		Cache_Free(&dc->cache);
+	dc->open = false;
 }
 
 
-//Helper functions for reading big-endian values from the byte stream
-uint16_t BE_Read16(uint8_t *value)
+//Set up the state for a new file. The division is 120 until the header says
+//otherwise.
+void Dump_Init(struct dump_state *d)
 {
-	return (uint16_t)value[0] << 8 |
-	       (uint16_t)value[1] << 0;
+	memset(d, 0, sizeof(*d));
+	d->division = 120;
+	d->format = MIDI_FORMAT_SIMULTANEOUS;
 }
 
-uint32_t BE_Read32(uint8_t *value)
+
+//Print the time of an event in ticks and in seconds
+static void Print_Time(uint32_t tick, uint64_t micros)
 {
-	return (uint32_t)value[0] << 24 |
-	       (uint32_t)value[1] << 16 |
-		   (uint32_t)value[2] << 8 |
-		   (uint32_t)value[3] << 0;
+	printf("%6" PRIu32 " %9.3f  ", tick, (double)micros / 1000000.0);
 }
 
-//The MIDI standard allows for variable-length numbers. These are given as a
-//sequence of up to four bytes. The lower 7 bits are numerical data, and the
-//most-significant bit is a flag which indicates that more bytes are needed.
-//The maximum possible number of data bits is 28.
-struct var_len VarLen_Read(uint8_t *value)
+
+//MIDI state machine. This is the interface function for interpreting the MIDI
+//file and producing converted data. The file is decoded into an event store on
+//all of the CPU cores, then printed in file order. Returns false if the file
+//couldn't all be printed.
+bool MIDI_State_Machine(struct dump_state *d, const uint8_t *data, size_t totalSize)
 {
-	struct var_len v = {0, 0};
-	int c;
+	struct event_store store;
+	bool ok;
 	
-	for (c = 0; c < 4; c++)
-	{
-		v.value <<= 7;
-		v.value |= (value[c] & 0x7F);
-		v.size++;
-		
-		if ((value[c] & 0x80) == 0x00)
-			break;
-	}
+	ok = Events_Load(&store, data, totalSize, Pool_Default_Threads());
+	if (store.error != MIDI_OK)
+		fprintf(stderr, "Error: %s\n", MIDI_Error_String(store.error));
+	if (!ok)
+		return false;
 	
-	return v;
+	ok = Process_Events(d, &store);
+	Events_Free(&store);
+	return ok;
 }
-	
 
-//Process a chunk. First, get the type and length, then either process the
-//header (if it's a header chunk) or call a helper function to process events
-//(if it's a track chunk). Finally, return the number of bytes processed.
-size_t Process_Chunk(uint8_t *dataStart)
+
+//Print a range of bars. Only the events in the range get decoded.
+bool Range_Dump(struct dump_state *d, const uint8_t *data, size_t totalSize,
+                const char *filename, uint32_t fromBar, uint32_t toBar)
 {
-	struct midi_chunk chunk;
-	struct midi_header header;
-	uint16_t temp;
+	struct event_store store;
+	bool ok;
+	
+	ok = Events_Load_Range(&store, data, totalSize, filename, fromBar, toBar,
+	                       Pool_Default_Threads());
+	if (store.error != MIDI_OK)
+		fprintf(stderr, "Error: %s\n", MIDI_Error_String(store.error));
+	if (!ok)
+		return false;
 	
-	//Read the chunk type and length. MIDI bytes are in big-endian order, so we
-	//can't just do 32-bit reads even if we wanted to be lazy.
-	chunk.type = BE_Read32(dataStart);
-	chunk.length = BE_Read32(dataStart + sizeof(uint32_t));
-	chunk.data = dataStart + 2*sizeof(uint32_t);
-
-	//Output the chunk type and length. If this is a header chunk, process it
-	//now. If it's a track chunk, call a helper function.
-	if (chunk.type == MIDI_HEADER_CHUNK)
+	ok = Process_Events(d, &store);
+	Events_Free(&store);
+	return ok;
+}
+
+
+//Print one event of any kind
+static bool Print_Event(struct dump_state *d, uint8_t status, uint8_t data1, uint8_t data2,
+                        const uint8_t *payload, uint32_t length)
+{
+	uint8_t data[2] = {data1, data2};
+
+	//Figure out what kind of event this is
+	if ((status & 0xF0) < 0xF0)
 	{
-		header.format = BE_Read16(chunk.data);
-		header.tracks = BE_Read16(chunk.data + sizeof(uint16_t));
-		temp = BE_Read16(chunk.data + 2*sizeof(uint16_t));
-		header.division = temp & 0x7FFF;
-		header.divType = temp >> 15;
-		//Ignore any extra data as per the MIDI spec
-		
-		//Save the division
-		if (header.divType == 0)
-		{
-			division = header.division;
-		} else
-		{
-			fprintf(stderr, "Error: SMTPE timing is not supported\n\n");
-			exit(EXIT_FAILURE);
-		}
-		
-		printf("\nHeader chunk: length = %" PRIu32 ", format = %" PRIu16
-		       ", tracks = %" PRIu16 ", division = %" PRIu16 ", div type = %"
-			   PRIu16 "\n", chunk.length, header.format, header.tracks,
-			   header.division, header.divType);
-	} else if (chunk.type == MIDI_TRACK_CHUNK)
+		//MIDI event
+		return Process_MIDI_Event(d, status, data);
+	} else if (status == MIDI_EVENT_META)
 	{
-		printf("\nTrack chunk: length = %" PRIu32 "\n", chunk.length);
-		Process_Track(chunk.data);
+		//Meta event
+		Process_Meta_Event(data1, payload, length);
 	} else
 	{
-		fprintf(stderr, "\nUnknown chunk type: %08" PRIx32 "\n", chunk.type);
-		exit(EXIT_FAILURE);
+		//SysEx event
+		printf("SysEx event\n");
 	}
+	return true;
+}
+
 
-	return chunk.length + 2*sizeof(uint32_t);
+//Add the tempo changes for a track to the tempo map. If only a range was
+//loaded, the ones from before it are in the seek index, along with the rest.
+static bool Dump_Tempo_Map(struct dump_state *d, const struct event_store *store, size_t track)
+{
+	if (store->ranged)
+		return Seek_Tempo_Map(&store->seek, &d->tempoMap, track);
+	return Tempo_Build(&d->tempoMap, store, track);
 }
 
 
-//Process a track. This involves reading a series of events, which may be MIDI
-//events, SysEx events, or meta events. The events are all different lengths, so
-//we have to keep track of the data position here. The track will conclude with
-//an End of Track meta event, so we don't need to know the overall length.
-void Process_Track(uint8_t *data)
+//Print every event in the store, one track at a time. The real time of every
+//event is worked out a track at a time from the tempo map. Format 2 tracks are
+//separate songs with their own tempos, so each one gets its own map.
+bool Process_Events(struct dump_state *d, const struct event_store *store)
 {
-	struct var_len v;
-	uint32_t eventLen;
-	uint8_t status, metaType;
-	float realTime;
-	size_t pos = 0;
+	uint64_t *times;
+	size_t i, t;
+	bool ok = true;
+	
+	if (store->index.haveHeader && !Process_Header(d, store->index.headerLength,
+	                                                &store->index.header))
+		return false;
+	if (store->ranged && store->to == SEEK_NO_END)
+		printf("\nRange: ticks %" PRIu32 " to the end\n", store->from);
+	else if (store->ranged)
+		printf("\nRange: ticks %" PRIu32 " to %" PRIu32 "\n", store->from, store->to);
 	
-	//Main event loop
-	while (1)
+	times = malloc((store->count ? store->count : 1) * sizeof(uint64_t));
+	if (times == NULL || !Tempo_Init(&d->tempoMap, d->division))
 	{
-		//Get the delta time and print the current time
-		v = VarLen_Read(data + pos);
-		g_time += v.value;
-		pos += v.size;
-		realTime = (float)(60 * g_time) / (float)(tempo / division);
-		printf("%6" PRIu32 "  ", g_time);
-
-		//Figure out what kind of event this is
-		status = data[pos++];
-		if ((status & 0xF0) < 0xF0)
-		{
-			//MIDI event
-			Process_MIDI_Event(status, data + pos);
-			if ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0)
-				pos++;
-			else
-				pos += 2;
-		} else if (status == 0xF0 || status == 0xF7)
-		{
-			//SysEx event
-			v = VarLen_Read(data + pos);
-			eventLen = v.value;
-			pos += v.size;
-			pos += eventLen;
-			printf("SysEx event\n");
-		} else if (status == 0xFF)
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		free(times);
+		return false;
+	}
+	if (d->format != MIDI_FORMAT_SEQUENTIAL)
+		ok = Dump_Tempo_Map(d, store, TEMPO_ALL_TRACKS);
+	
+	for (t = 0; t < store->numTracks && ok; t++)
+	{
+		printf("\nTrack chunk: length = %" PRIu32 "\n", store->index.tracks[t].length);
+		
+		if (d->format == MIDI_FORMAT_SEQUENTIAL)
 		{
-			//Meta event
-			metaType = data[pos++];
-			printf("Meta event, type %02" PRIx8 "\n", metaType);
-			v = VarLen_Read(data + pos);
-			eventLen = v.value;
-			pos += v.size;
-			
-			//If this is a Set Tempo event, update the tempo
-			if (metaType == MIDI_META_SET_TEMPO)
-			{
-				tempo = (uint32_t)data[pos+0] << 16 |
-				        (uint32_t)data[pos+1] << 8  |
-						(uint32_t)data[pos+2];
-				printf("New tempo: %" PRIu32 "\n", tempo);
-			}
-			
-			pos += eventLen;
-			
-			if (metaType == MIDI_META_END_OF_TRACK)
+			Tempo_Free(&d->tempoMap);
+			ok = Tempo_Init(&d->tempoMap, d->division) && Dump_Tempo_Map(d, store, t);
+			if (!ok)
 				break;
-		} else
+		}
+		Tempo_Times(&d->tempoMap, store->tick + store->trackStart[t],
+		            store->trackStart[t+1] - store->trackStart[t],
+		            times + store->trackStart[t]);
+		
+		//A note that started before the range is timed from the start of it
+		Active_Clear(&d->notes, store->from);
+		for (i = store->trackStart[t]; i < store->trackStart[t+1] && ok; i++)
 		{
-			fprintf(stderr, "Unknown event type %02" PRIx8 "\n", status);
-			exit(EXIT_FAILURE);
+			//Print the current time
+			d->time = store->tick[i];
+			Print_Time(d->time, times[i]);
+			ok = Print_Event(d, store->status[i], store->data1[i], store->data2[i],
+			                 store->base + store->payload[i], store->length[i]);
 		}
 	}
+	
+	Tempo_Free(&d->tempoMap);
+	free(times);
+	return ok && !store->failed;
+}
+
+
+//Print every event in the file in time order, with the track each one came
+//from. The tracks are decoded side by side, so the tempo map is built as the
+//tempo changes go by, no matter which track they're in.
+bool Merged_Dump(struct dump_state *d, const uint8_t *data, size_t totalSize)
+{
+	struct midi_index index;
+	struct track_merge merge;
+	struct track_event e;
+	size_t track;
+	bool ok = true;
+
+	if (!Index_Chunks(&index, data, totalSize))
+	{
+		fprintf(stderr, "Error: %s\n", MIDI_Error_String(index.error));
+		Index_Free(&index);
+		return false;
+	}
+	if (index.haveHeader && !Process_Header(d, index.headerLength, &index.header))
+	{
+		Index_Free(&index);
+		return false;
+	}
+	if (!Tempo_Init(&d->tempoMap, d->division) || !Merge_Init(&merge, &index))
+	{
+		Tempo_Free(&d->tempoMap);
+		Index_Free(&index);
+		return false;
+	}
+
+	printf("\nMerged tracks: %zu\n", index.numTracks);
+	while (ok && Merge_Next(&merge, &e, &track))
+	{
+		d->time = e.time;
+		Print_Time(d->time, Tempo_Time(&d->tempoMap, d->time));
+		printf("tr %2zu  ", track);
+		ok = Print_Event(d, e.event.status, e.event.data1, e.event.data2, e.payload, e.length);
+		if (ok && e.event.status == MIDI_EVENT_META && e.event.data1 == MIDI_META_SET_TEMPO &&
+		    e.length >= 3)
+			ok = Tempo_Add(&d->tempoMap, d->time, (uint32_t)e.payload[0] << 16 |
+			                                      (uint32_t)e.payload[1] << 8  |
+			                                      (uint32_t)e.payload[2]);
+	}
+
+	if (merge.failed)
+	{
+		fprintf(stderr, "Error: %s\n", MIDI_Error_String(merge.error));
+		ok = false;
+	}
+	Merge_Free(&merge);
+	Tempo_Free(&d->tempoMap);
+	Index_Free(&index);
+	return ok;
+}
+
+
+//Process the header chunk. SMPTE timing isn't supported, so bail out if we see
+//it.
+bool Process_Header(struct dump_state *d, uint32_t length, const struct midi_header *header)
+{
+	//Save the division
+	if (header->divType == 0)
+	{
+		d->division = header->division;
+		d->format = header->format;
+	} else
+	{
+		fprintf(stderr, "Error: SMTPE timing is not supported\n\n");
+		return false;
+	}
+	
+	printf("\nHeader chunk: length = %" PRIu32 ", format = %" PRIu16
+	       ", tracks = %" PRIu16 ", division = %" PRIu16 ", div type = %"
+		   PRIu16 "\n", length, header->format, header->tracks,
+		   header->division, header->divType);
+	return true;
+}
+
+
+//Print a meta event. If it's a Set Tempo event, print the new tempo too.
+void Process_Meta_Event(uint8_t metaType, const uint8_t *data, uint32_t length)
+{
+	printf("Meta event, type %02" PRIx8 "\n", metaType);
+	if (metaType == MIDI_META_SET_TEMPO && length >= 3)
+	{
+		printf("New tempo: %" PRIu32 "\n", (uint32_t)data[0] << 16 |
+		                                    (uint32_t)data[1] << 8  |
+		                                    (uint32_t)data[2]);
+	}
 }
 
 
 //Process a MIDI channel voice or mode message. These all have fixed lengths,
 //with one or two data bytes after the status byte.
-void Process_MIDI_Event(uint8_t status, uint8_t *data)
+bool Process_MIDI_Event(struct dump_state *d, uint8_t status, const uint8_t *data)
 {
-	static uint32_t noteStarts[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 	const char *note;
 	uint8_t msgType, msgIndex, channel, octave;
 
@@ -267,16 +461,22 @@ void Process_MIDI_Event(uint8_t status, uint8_t *data)
 	note = noteNames[data[0] % 12];
 	octave = data[0] / 12;
 
+	//A note on with a velocity of 0 is really a note off, so it gets timed like
+	//one. It still says Note On, since that's what's in the file.
+	if (Active_Is_Note_Off(status, data))
+		msgType = MIDI_EVENT_NOTE_OFF;
+
 	switch (msgType)
 	{
 		case MIDI_EVENT_NOTE_ON:
-			noteStarts[channel] = g_time;
+			Active_Start(&d->notes, channel, data[0], d->time);
 			printf("%-25s  %s%" PRIu8 "\tvel %02" PRIx8 "\n",
 				   midi_voice_messages[msgIndex], note, octave, data[1]);
 			break;
 		case MIDI_EVENT_NOTE_OFF:
 			printf("%-15s%-10" PRIu32 "  %s%" PRIu8 "\tvel %02" PRIx8 "\n",
-			       midi_voice_messages[msgIndex], g_time - noteStarts[channel],
+			       midi_voice_messages[msgIndex],
+			       d->time - Active_Stop(&d->notes, channel, data[0]),
 			       note, octave, data[1]);
 			break;
 		case MIDI_EVENT_POLY_KEY_PRESSURE:
@@ -300,9 +500,98 @@ void Process_MIDI_Event(uint8_t status, uint8_t *data)
 			break;
 		default:
 			fprintf(stderr, "Unknown MIDI event: %" PRIx8 "\n", msgType);
-			exit(EXIT_FAILURE);
+			return false;
 	}
+	return true;
 }
 			
 			
 			
+
+
+//Streaming callbacks. These do the same work as MIDI_State_Machine() and
+//Process_Events() for input that arrives through a pipe.
+//The tempo map is built as the tempo changes go by. That works for format 1
+//files because the changes are in the first track.
+static bool Dump_Stream_Header(void *user, uint32_t length, const struct midi_header *header)
+{
+	struct dump_state *d = user;
+
+	if (!Process_Header(d, length, header))
+		return false;
+	Tempo_Free(&d->tempoMap);
+	return Tempo_Init(&d->tempoMap, d->division);
+}
+
+static bool Dump_Stream_Track(void *user, uint32_t length)
+{
+	struct dump_state *d = user;
+
+	printf("\nTrack chunk: length = %" PRIu32 "\n", length);
+	d->time = 0;
+	Active_Clear(&d->notes, 0);
+	if (d->format == MIDI_FORMAT_SEQUENTIAL)
+	{
+		Tempo_Free(&d->tempoMap);
+		return Tempo_Init(&d->tempoMap, d->division);
+	}
+	return true;
+}
+
+static bool Dump_Stream_Event(void *user, uint32_t delta, uint8_t status, const uint8_t *data)
+{
+	struct dump_state *d = user;
+
+	d->time += delta;
+	Print_Time(d->time, Tempo_Time(&d->tempoMap, d->time));
+	return Process_MIDI_Event(d, status, data);
+}
+
+static bool Dump_Stream_SysEx(void *user, uint32_t delta, uint8_t status, uint32_t length)
+{
+	struct dump_state *d = user;
+
+	d->time += delta;
+	Print_Time(d->time, Tempo_Time(&d->tempoMap, d->time));
+	printf("SysEx event\n");
+	return true;
+}
+
+static bool Dump_Stream_Meta(void *user, uint32_t delta, uint8_t metaType,
+                             const uint8_t *data, uint32_t length)
+{
+	struct dump_state *d = user;
+
+	d->time += delta;
+	Print_Time(d->time, Tempo_Time(&d->tempoMap, d->time));
+	Process_Meta_Event(metaType, data, length);
+	if (metaType == MIDI_META_SET_TEMPO && length >= 3)
+		return Tempo_Add(&d->tempoMap, d->time, (uint32_t)data[0] << 16 |
+		                                        (uint32_t)data[1] << 8  |
+		                                        (uint32_t)data[2]);
+	return true;
+}
+
+static const struct midi_stream_handler dumpStreamHandler =
+{
+	Dump_Stream_Header,
+	Dump_Stream_Track,
+	Dump_Stream_Event,
+	Dump_Stream_SysEx,
+	Dump_Stream_Meta,
+};
+
+
+//Dump a file that can't be mapped, such as standard input
+bool Stream_File(struct dump_state *d, const char *filename)
+{
+	struct midi_stream stream;
+	bool ok;
+
+	if (!Tempo_Init(&d->tempoMap, d->division))
+		return false;
+	Stream_Init(&stream, &dumpStreamHandler, d);
+	ok = Stream_Run_File(&stream, filename);
+	Tempo_Free(&d->tempoMap);
+	return ok;
+}
@@ -0,0 +1,224 @@
+//Decoded event store. The tracks are decoded in parallel by midi_decode.c,
+//then copied into one table with a separate array for each field. Times are
+//converted to absolute ticks on the way in. Every track starts at tick 0, since
+//in a format 1 file the tracks all play at once.
+
+#include <stdlib.h>
+#include <string.h>
+#include "midi_events.h"
+
+
+//Allocate the field arrays for a given number of events
+static bool Events_Alloc(struct event_store *store, size_t count, size_t numTracks)
+{
+	size_t n = count ? count : 1;
+
+	store->tick = malloc(n * sizeof(uint32_t));
+	store->status = malloc(n);
+	store->data1 = malloc(n);
+	store->data2 = malloc(n);
+	store->track = malloc(n * sizeof(uint16_t));
+	store->payload = malloc(n * sizeof(uint32_t));
+	store->length = malloc(n * sizeof(uint32_t));
+	store->trackStart = malloc((numTracks + 1) * sizeof(size_t));
+
+	if (store->tick == NULL || store->status == NULL || store->data1 == NULL ||
+	    store->data2 == NULL || store->track == NULL || store->payload == NULL ||
+	    store->length == NULL || store->trackStart == NULL)
+	{
+		store->error = MIDI_ERROR_NO_MEMORY;
+		return false;
+	}
+
+	return true;
+}
+
+
+//Copy the decoded tracks into the store's table. Only tracks up to and
+//including the first bad one are kept, and its error becomes the store's.
+static bool Events_Fill(struct event_store *store, struct track_events *tracks)
+{
+	const struct track_event *e;
+	size_t total = 0, t, i, n = 0;
+
+	for (t = 0; t < store->index.numTracks; t++)
+	{
+		total += tracks[t].count;
+		store->numTracks++;
+		if (tracks[t].failed)
+		{
+			store->failed = true;
+			store->error = tracks[t].error;
+			break;
+		}
+	}
+
+	if (!Events_Alloc(store, total, store->numTracks))
+		return false;
+
+	//Copy everything into the table
+	for (t = 0; t < store->numTracks; t++)
+	{
+		store->trackStart[t] = n;
+		for (i = 0; i < tracks[t].count; i++, n++)
+		{
+			e = &tracks[t].events[i];
+			store->tick[n] = e->time;
+			store->status[n] = e->event.status;
+			store->data1[n] = e->event.data1;
+			store->data2[n] = e->event.data2;
+			store->track[n] = (uint16_t)t;
+			store->payload[n] = e->payload ? (uint32_t)(e->payload - store->base) : 0;
+			store->length[n] = e->length;
+		}
+	}
+	store->trackStart[store->numTracks] = n;
+	store->count = n;
+	return true;
+}
+
+
+//Decode a file and fill in the event store. Returns false if the file can't be
+//decoded at all. If a track has bad data, the store holds every event up to the
+//problem and store->failed is set. Either way, store->error says what went
+//wrong; nothing is printed here, so that's up to the caller.
+bool Events_Load(struct event_store *store, const uint8_t *data, size_t totalSize,
+                 unsigned numThreads)
+{
+	struct track_events *tracks;
+	bool ok;
+
+	memset(store, 0, sizeof(*store));
+	store->base = data;
+	store->to = SEEK_NO_END;
+
+	if (!Index_Chunks(&store->index, data, totalSize))
+	{
+		store->error = store->index.error;
+		return false;
+	}
+
+	tracks = Decode_All_Tracks(&store->index, numThreads);
+	if (tracks == NULL)
+	{
+		store->error = MIDI_ERROR_NO_MEMORY;
+		return false;
+	}
+
+	ok = Events_Fill(store, tracks);
+	Free_Tracks(tracks, store->index.numTracks);
+	return ok;
+}
+
+
+//Decode only a range of bars. The seek index for the file (see seek_index.h)
+//says where in each track the range starts, so the tracks are only decoded
+//from there to the end of the range. The index stays in the store for its
+//tempo changes. filename is where the data came from, for the index file, or
+//NULL if it didn't come from a MIDI file.
+bool Events_Load_Range(struct event_store *store, const uint8_t *data, size_t totalSize,
+                       const char *filename, uint32_t fromBar, uint32_t toBar,
+                       unsigned numThreads)
+{
+	const struct cursor_mark **starts;
+	struct track_events *tracks;
+	size_t t;
+	bool ok;
+
+	memset(store, 0, sizeof(*store));
+	store->base = data;
+	store->ranged = true;
+
+	if (!Index_Chunks(&store->index, data, totalSize))
+	{
+		store->error = store->index.error;
+		return false;
+	}
+
+	//Building the index only fails if it runs out of memory
+	if (!Seek_Open(&store->seek, filename, &store->index))
+	{
+		store->error = MIDI_ERROR_NO_MEMORY;
+		return false;
+	}
+	Seek_Bars(&store->seek, fromBar, toBar, &store->from, &store->to);
+
+	starts = malloc((store->index.numTracks ? store->index.numTracks : 1) *
+	                sizeof(struct cursor_mark *));
+	if (starts == NULL)
+	{
+		store->error = MIDI_ERROR_NO_MEMORY;
+		return false;
+	}
+	for (t = 0; t < store->index.numTracks; t++)
+		starts[t] = Seek_Find(&store->seek, t, store->from);
+
+	tracks = Decode_All_Tracks_Range(&store->index, starts, store->from, store->to,
+	                                 numThreads);
+	free(starts);
+	if (tracks == NULL)
+	{
+		store->error = MIDI_ERROR_NO_MEMORY;
+		return false;
+	}
+
+	ok = Events_Fill(store, tracks);
+	Free_Tracks(tracks, store->index.numTracks);
+	return ok;
+}
+
+
+void Events_Free(struct event_store *store)
+{
+	free(store->tick);
+	free(store->status);
+	free(store->data1);
+	free(store->data2);
+	free(store->track);
+	free(store->payload);
+	free(store->length);
+	free(store->trackStart);
+	Index_Free(&store->index);
+	Seek_Free(&store->seek);
+	memset(store, 0, sizeof(*store));
+}
+
+
+//Pick out the events that matter for a set of channels: those channels'
+//messages plus every meta event, since those carry the tempo. The channel set
+//is a bitmask with bit n for channel n. The indexes of the selected events go
+//into the selected array, which needs room for store->count entries. This only
+//looks at the status array, so it's a quick scan even for big files.
+size_t Events_Select_Channels(const struct event_store *store, uint16_t channels,
+                              uint32_t *selected)
+{
+	const uint8_t *status = store->status;
+	size_t i, n = 0;
+	uint8_t s;
+
+	for (i = 0; i < store->count; i++)
+	{
+		s = status[i];
+		selected[n] = (uint32_t)i;
+		n += ((s & 0xF0) < 0xF0) ? ((channels >> (s & 0x0F)) & 1) : (s == MIDI_EVENT_META);
+	}
+
+	return n;
+}
+
+
+//Return a bitmask of the channels that have any messages at all
+uint16_t Events_Active_Channels(const struct event_store *store)
+{
+	const uint8_t *status = store->status;
+	uint16_t channels = 0;
+	size_t i;
+
+	for (i = 0; i < store->count; i++)
+	{
+		if (status[i] < 0xF0)
+			channels |= (uint16_t)1 << (status[i] & 0x0F);
+	}
+
+	return channels;
+}
@@ -0,0 +1,49 @@
+//Decoded event store. The whole file is decoded once into a table of events,
+//with each field kept in its own array. The tools make as many passes over the
+//table as they like without going back to the byte stream, and passes that
+//only look at one or two fields (like picking out a channel) stay in cache.
+
+#ifndef MIDI_EVENTS_H
+#define MIDI_EVENTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "midi_types.h"
+#include "midi_decode.h"
+#include "seek_index.h"
+
+struct event_store
+{
+	size_t count;          //Number of events
+	uint32_t *tick;        //Absolute time in ticks
+	uint8_t *status;       //Status byte. Meta events use MIDI_EVENT_META.
+	uint8_t *data1;        //First data byte, or the meta type for meta events
+	uint8_t *data2;        //Second data byte, if there is one
+	uint16_t *track;       //Track number
+	uint32_t *payload;     //Offset of the SysEx/meta payload from the file start
+	uint32_t *length;      //Length of the SysEx/meta payload
+
+	const uint8_t *base;   //Start of the file data the payloads point into
+	struct midi_index index;
+	size_t numTracks;      //Tracks in the store. Stops at the first bad track.
+	size_t *trackStart;    //Index of each track's first event, plus one more
+	                       //entry for the end of the last track
+	bool failed;           //The file has bad data; events stop at the problem
+	enum midi_error error; //Why loading stopped or the store is short, if it is
+	bool ranged;           //Only a range of bars was loaded
+	uint32_t from, to;     //Tick range of the events that were loaded
+	struct seek_index seek;  //Seek index for the range
+};
+
+bool Events_Load(struct event_store *store, const uint8_t *data, size_t totalSize,
+                 unsigned numThreads);
+bool Events_Load_Range(struct event_store *store, const uint8_t *data, size_t totalSize,
+                       const char *filename, uint32_t fromBar, uint32_t toBar,
+                       unsigned numThreads);
+void Events_Free(struct event_store *store);
+size_t Events_Select_Channels(const struct event_store *store, uint16_t channels,
+                              uint32_t *selected);
+uint16_t Events_Active_Channels(const struct event_store *store);
+
+#endif
@@ -0,0 +1,208 @@
+//Shared input layer for the MIDI tools. We want all of the file data in memory
+//at once because it makes tokenizing much easier, but there's no need to copy
+//it there ourselves. For regular files, mmap() gives us a read-only view of the
+//page cache and the kernel handles the rest. Pipes can't be mapped, so those
+//get read into a buffer that grows as needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "midi_input.h"
+
+//Chunk size for reading from pipes
+#define INPUT_READ_SIZE 65536
+
+
+//Set up an input with no data and no buffer
+void Input_Init(struct midi_input *in)
+{
+	memset(in, 0, sizeof(*in));
+}
+
+
+//Check whether a file should be decoded as a stream rather than loaded into
+//memory. That's anything but a regular file, with "-" meaning standard input.
+//If the file doesn't exist, let Input_Open() report the error.
+bool Input_Is_Stream(const char *filename)
+{
+	struct stat info;
+
+	if (strcmp(filename, "-") == 0)
+		return fstat(STDIN_FILENO, &info) != 0 || !S_ISREG(info.st_mode);
+
+	return stat(filename, &info) == 0 && !S_ISREG(info.st_mode);
+}
+
+
+//Read everything from a file descriptor into the input's buffer. This is the
+//fallback for anything we can't map.
+static bool Input_Read_All(struct midi_input *in, int fd)
+{
+	uint8_t *newBuffer;
+	size_t used = 0;
+	ssize_t got;
+
+	while (1)
+	{
+		if (in->capacity - used < INPUT_READ_SIZE)
+		{
+			newBuffer = realloc(in->buffer, in->capacity + INPUT_READ_SIZE + in->capacity / 2);
+			if (newBuffer == NULL)
+			{
+				fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+				return false;
+			}
+			in->buffer = newBuffer;
+			in->capacity += INPUT_READ_SIZE + in->capacity / 2;
+		}
+
+		got = read(fd, in->buffer + used, in->capacity - used);
+		if (got == 0)
+			break;
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error reading from file: %s\n\n", strerror(errno));
+			return false;
+		}
+		used += (size_t)got;
+	}
+
+	in->data = in->buffer;
+	in->size = used;
+	return true;
+}
+
+
+//Open a file and make its contents available through in->data. A filename of
+//"-" means standard input.
+bool Input_Open(struct midi_input *in, const char *filename)
+{
+	struct stat info;
+	void *map;
+	int fd;
+	bool ok = true;
+
+	in->data = NULL;
+	in->size = 0;
+	in->mapping = NULL;
+
+	if (strcmp(filename, "-") == 0)
+	{
+		fd = STDIN_FILENO;
+	} else
+	{
+		fd = open(filename, O_RDONLY);
+		if (fd < 0)
+		{
+			fprintf(stderr, "Error opening file: %s\n\n", strerror(errno));
+			return false;
+		}
+	}
+
+	//Regular files get mapped. Empty files can't be mapped, but there's
+	//nothing to read from them anyway.
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+	{
+		if (info.st_size > 0)
+		{
+			map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED)
+			{
+				//We walk the file from front to back, so let the kernel read ahead
+				madvise(map, (size_t)info.st_size, MADV_SEQUENTIAL);
+				in->mapping = map;
+				in->data = map;
+				in->size = (size_t)info.st_size;
+			} else
+			{
+				ok = Input_Read_All(in, fd);
+			}
+		}
+	} else
+	{
+		ok = Input_Read_All(in, fd);
+	}
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	return ok;
+}
+
+
+//Release the current file's data. The fallback buffer is kept so the next
+//Input_Open() can reuse it.
+void Input_Close(struct midi_input *in)
+{
+	if (in->mapping != NULL)
+		munmap(in->mapping, in->size);
+	in->mapping = NULL;
+	in->data = NULL;
+	in->size = 0;
+}
+
+
+//Release everything, including the fallback buffer
+void Input_Free(struct midi_input *in)
+{
+	Input_Close(in);
+	free(in->buffer);
+	in->buffer = NULL;
+	in->capacity = 0;
+}
+
+
+//Hand a file to a streaming decoder one block at a time, so that only one
+//block is ever in memory. A filename of "-" means standard input.
+bool Input_Run_Blocks(const char *filename, input_feed feed, input_finish finish,
+                      void *decoder)
+{
+	uint8_t block[INPUT_READ_SIZE];
+	ssize_t got;
+	int fd;
+	bool ok = true;
+
+	if (strcmp(filename, "-") == 0)
+	{
+		fd = STDIN_FILENO;
+	} else
+	{
+		fd = open(filename, O_RDONLY);
+		if (fd < 0)
+		{
+			fprintf(stderr, "Error opening file: %s\n\n", strerror(errno));
+			return false;
+		}
+	}
+
+	while (ok)
+	{
+		got = read(fd, block, sizeof(block));
+		if (got == 0)
+		{
+			ok = finish(decoder);
+			break;
+		}
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error reading from file: %s\n\n", strerror(errno));
+			ok = false;
+			break;
+		}
+		ok = feed(decoder, block, (size_t)got);
+	}
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	return ok;
+}
@@ -0,0 +1,35 @@
+//Shared input layer for the MIDI tools. Regular files are memory-mapped so the
+//parser reads straight out of the page cache; anything that can't be mapped
+//(pipes, terminals, sockets) is read into a buffer instead.
+
+#ifndef MIDI_INPUT_H
+#define MIDI_INPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+struct midi_input
+{
+	const uint8_t *data;  //Start of the file data
+	size_t size;          //Length of the file data
+	void *mapping;        //Mapped region, or NULL if the data is in the buffer
+	uint8_t *buffer;      //Fallback buffer, kept between files for reuse
+	size_t capacity;      //Allocated size of the fallback buffer
+};
+
+//Decoder callbacks for Input_Run_Blocks(). feed gets each block as it's read
+//and finish gets called at the end of the input. Either one returns false to
+//stop.
+typedef bool (*input_feed)(void *decoder, const uint8_t *data, size_t size);
+typedef bool (*input_finish)(void *decoder);
+
+void Input_Init(struct midi_input *in);
+bool Input_Is_Stream(const char *filename);
+bool Input_Open(struct midi_input *in, const char *filename);
+void Input_Close(struct midi_input *in);
+void Input_Free(struct midi_input *in);
+bool Input_Run_Blocks(const char *filename, input_feed feed, input_finish finish,
+                      void *decoder);
+
+#endif
@@ -0,0 +1,109 @@
+//Track merging with a binary min-heap. The heap holds the track numbers of the
+//tracks that still have events, ordered by the time of each one's next event
+//and then by track number. Taking an event is a pop from the top, and the track
+//goes back in with its following event.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "midi_merge.h"
+
+
+//Whether track a's next event goes before track b's
+static bool Merge_Before(const struct track_merge *m, size_t a, size_t b)
+{
+	uint32_t timeA = m->tracks[a].next.time, timeB = m->tracks[b].next.time;
+
+	return timeA < timeB || (timeA == timeB && a < b);
+}
+
+static void Merge_Sift_Down(struct track_merge *m, size_t i)
+{
+	size_t child, top = m->heap[i];
+
+	while ((child = 2 * i + 1) < m->heapSize)
+	{
+		if (child + 1 < m->heapSize && Merge_Before(m, m->heap[child + 1], m->heap[child]))
+			child++;
+		if (!Merge_Before(m, m->heap[child], top))
+			break;
+		m->heap[i] = m->heap[child];
+		i = child;
+	}
+	m->heap[i] = top;
+}
+
+
+//Note a track that stopped because of bad data. The first problem is the one
+//that gets reported.
+static void Merge_Check(struct track_merge *m, const struct track_cursor *cursor)
+{
+	if (cursor->failed && !m->failed)
+		m->error = cursor->error;
+	m->failed = m->failed || cursor->failed;
+}
+
+
+//Get every track's first event and put the tracks in order
+bool Merge_Init(struct track_merge *m, const struct midi_index *index)
+{
+	size_t n = index->numTracks ? index->numTracks : 1, t, i;
+
+	memset(m, 0, sizeof(*m));
+	m->tracks = malloc(n * sizeof(struct merge_track));
+	m->heap = malloc(n * sizeof(size_t));
+	if (m->tracks == NULL || m->heap == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		Merge_Free(m);
+		return false;
+	}
+
+	for (t = 0; t < index->numTracks; t++)
+	{
+		Cursor_Init(&m->tracks[t].cursor, &index->tracks[t]);
+		if (Cursor_Next(&m->tracks[t].cursor, &m->tracks[t].next))
+			m->heap[m->heapSize++] = t;
+		else
+			Merge_Check(m, &m->tracks[t].cursor);
+	}
+
+	for (i = m->heapSize / 2; i > 0; i--)
+		Merge_Sift_Down(m, i - 1);
+	return true;
+}
+
+
+//Get the next event of the whole file, and which track it's from. Returns false
+//when every track is done. If a track has bad data, it stops at the problem
+//and m->failed is set, but the other tracks keep going.
+bool Merge_Next(struct track_merge *m, struct track_event *e, size_t *track)
+{
+	struct merge_track *source;
+
+	if (m->heapSize == 0)
+		return false;
+
+	*track = m->heap[0];
+	source = &m->tracks[*track];
+	*e = source->next;
+
+	//Put the track back in with its next event, or drop it if it's done
+	if (!Cursor_Next(&source->cursor, &source->next))
+	{
+		Merge_Check(m, &source->cursor);
+		m->heap[0] = m->heap[--m->heapSize];
+	}
+	if (m->heapSize > 0)
+		Merge_Sift_Down(m, 0);
+	return true;
+}
+
+
+void Merge_Free(struct track_merge *m)
+{
+	free(m->tracks);
+	free(m->heap);
+	memset(m, 0, sizeof(*m));
+}
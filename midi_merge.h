@@ -0,0 +1,35 @@
+//Track merging. Every track in a format 1 file counts time from its own start,
+//so to see what happens when, the tracks have to be interleaved. This decodes
+//the tracks side by side, one event at a time, and hands back the events in
+//time order. Only the next event of each track is kept, in a min-heap ordered
+//by time, so memory use depends on the number of tracks and not on the length
+//of the file. Events at the same time come out in track order.
+
+#ifndef MIDI_MERGE_H
+#define MIDI_MERGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "midi_decode.h"
+
+struct merge_track
+{
+	struct track_cursor cursor;
+	struct track_event next;   //Next event from this track
+};
+
+struct track_merge
+{
+	struct merge_track *tracks;
+	size_t *heap;              //Tracks with events left, soonest first
+	size_t heapSize;
+	bool failed;               //A track had bad data
+	enum midi_error error;     //What was wrong with the first bad track
+};
+
+bool Merge_Init(struct track_merge *m, const struct midi_index *index);
+bool Merge_Next(struct track_merge *m, struct track_event *e, size_t *track);
+void Merge_Free(struct track_merge *m);
+
+#endif
@@ -1,389 +1,2155 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "midi_types.h"
-#include "midi_strings.h"
-
-uint16_t BE_Read16(uint8_t *value);
-uint32_t BE_Read32(uint8_t *value);
-struct var_len VarLen_Read(uint8_t *value);
-void MIDI_State_Machine(uint8_t *data, size_t totalSize);
-size_t Process_Chunk(uint8_t *data);
-void Process_Track(uint8_t *data);
-void Process_MIDI_Event(uint8_t status, uint8_t *data);
+#include "midi_input.h"
+#include "midi_stream.h"
+#include "midi_events.h"
+#include "work_pool.h"
+#include "out_buffer.h"
+#include "note_lengths.h"
+#include "nsf_midi.h"
+#include "vgm_stream.h"
+#include "loop_detect.h"
+#include "seek_index.h"
+#include "conv_cache.h"
+#include "note_list.h"
+#include "active_notes.h"
+#include "voice_split.h"
+#include "score_out.h"
 
+//MIDI state variables. Everything that changes while a file is being converted
+//lives here instead of in globals so that batch mode can run several
+//conversions at once on different threads.
+struct notes_state
+{
+	const struct length_table *lengths;  //Note lengths for the PPQN we quantize against
+	uint32_t tempo;           //Current tempo in microseconds per quarter note
+	uint32_t time;            //Current time in ticks
+	uint16_t channels;        //Bitmask of the channels we're converting
+	uint16_t failedChannels;  //Channels that couldn't be converted
+	uint16_t usedChannels;    //Channels that had any messages
+	uint32_t noteStarts[16];  //Time the current note, chord, or rest started on
+	                          //each channel
+	struct active_notes active;  //Keys that are on right now
+	uint64_t chordKeys[16][2];   //Keys sounding since noteStarts[]. None is a rest.
+	uint64_t tiedKeys[16][2];    //Keys tied into the chord from the one before it
+	uint64_t endedKeys[16][2];   //Keys that ended at changeTimes[], even if
+	                             //they started again right away
+	uint32_t changeTimes[16];    //Time the keys last changed on each channel
+	uint16_t changed;            //Channels with changes that aren't written down
+	struct out_buffer *out[16];  //Where the notation goes for each channel
+	bool failed;              //Set when the file can't be converted
+	uint16_t loopBars;        //Channels that have had the loop start bar printed
+	bool haveLoopStart, haveLoopEnd;
+	uint32_t loopStart;       //Loop points in ticks. Everything after the end of
+	uint32_t loopEnd;         //the loop is a repeat, so it's left out.
+	uint32_t rangeStart;      //Tick the notation starts at if only some bars
+	                          //are being converted
+	struct note_list_writer *list;  //If set, notes go here instead of the text
+	struct voice_list *voices;  //If set, each channel's notes are collected here
+	                            //and split into voices at the end of each track
+	uint16_t voice;             //Voice being written down
+};
 
-//MIDI state variables. So far, this is just the timing parameters.
-static uint32_t g_ppqn = 30, tempo = 500000;
-static uint32_t g_time = 0;
-uint8_t g_userChannel = 0;
+void Notes_Init(struct notes_state *s, const struct length_table *lengths, uint16_t channels,
+                struct out_buffer *const out[16]);
+bool Parse_Channels(const char *list, uint16_t *channels, bool *allChannels);
+bool Print_Channels(struct out_buffer *const out[16], uint16_t usedChannels, bool allChannels,
+                    const char *title);
+bool Print_Cached(struct conv_cache *cache, const char *key, struct out_buffer *const out[16],
+                  uint16_t usedChannels, bool allChannels, bool single, bool store);
+void MIDI_State_Machine(struct notes_state *s, const uint8_t *data, size_t totalSize,
+                        unsigned numThreads);
+void Range_State_Machine(struct notes_state *s, const uint8_t *data, size_t totalSize,
+                         const char *filename, uint32_t fromBar, uint32_t toBar);
+bool Convert_Input(const uint8_t **data, size_t *size, int song, uint32_t seconds,
+                   uint32_t ppqn, uint8_t **converted);
+bool Process_Header(struct notes_state *s, uint32_t length, const struct midi_header *header);
+void Process_Meta_Event(struct notes_state *s, uint8_t metaType, const uint8_t *data,
+                        uint32_t length);
+void Process_Events(struct notes_state *s, const struct event_store *store);
+void Process_MIDI_Event(struct notes_state *s, uint8_t status, const uint8_t *data);
+void Notes_Flush(struct notes_state *s);
+void Notes_End(struct notes_state *s);
+bool Stream_File(struct notes_state *s, const char *filename);
+bool VGM_File(struct notes_state *s, const char *filename);
+bool All_Songs(const uint8_t *data, size_t size, const struct length_table *lengths,
+               uint16_t channels, bool allChannels, uint32_t seconds);
+int Batch_Main(int argc, char *argv[], struct conv_cache *cache);
 
 
 int main(int argc, char *argv[])
 {
-	FILE *inFile;
-	uint8_t *midiData;
-	size_t dataSize;
-	int nextByte, c;
-	
+	struct notes_state state;
+	struct note_list_writer list;
+	struct voice_list voices[16];
+	struct note_list_header listHeader;
+	struct midi_input input;
+	struct out_buffer buffers[16], *out[16] = {NULL};
+	const uint8_t *data;
+	uint8_t *converted = NULL;
+	size_t size;
+	int song = -1;
+	uint32_t seconds = NSF_DEFAULT_SECONDS;
+	const struct length_table *lengths;
+	uint16_t channels;
+	uint32_t fromBar, toBar;
+	bool allChannels, allSongs = false, single, ranged, seekFile, split, scores;
+	bool cached = false, ok = true;
+	struct conv_cache cache, *useCache = NULL;
+	struct cache_hash hash;
+	char key[CACHE_KEY_SIZE], params[128];
+	const char *cacheDir, *listName, *scoreNames[NUM_SCORE_FORMATS], *title;
+	uint64_t cacheBytes;
+	enum cache_result result;
+	int c;
+
+	//The cache works in both modes
+	if (!Cache_Parse_Options(&argc, argv, &cacheDir, &cacheBytes))
+		return EXIT_FAILURE;
+	if (!List_Parse_Option(&argc, argv, &listName))
+		return EXIT_FAILURE;
+	if (!Voices_Parse_Option(&argc, argv, &split))
+		return EXIT_FAILURE;
+	if (!Score_Parse_Options(&argc, argv, scoreNames, &scores))
+		return EXIT_FAILURE;
+	if ((listName != NULL || split || scores) && argc >= 2 && strcmp(argv[1], "-b") == 0)
+	{
+		fprintf(stderr, "Error: %s only works for one file\n\n",
+		        (listName != NULL) ? "--note-list" : split ? "--voices" : "Score output");
+		return EXIT_FAILURE;
+	}
+
+	//A note list or a score is a file of its own, so there's nothing to cache
+	if (cacheDir != NULL && listName == NULL && !scores)
+	{
+		if (!Cache_Init(&cache, cacheDir, cacheBytes))
+			return EXIT_FAILURE;
+		useCache = &cache;
+	}
+
+	//Batch mode has its own set of arguments
+	if (argc >= 2 && strcmp(argv[1], "-b") == 0)
+	{
+		c = Batch_Main(argc - 2, argv + 2, useCache);
+		if (useCache != NULL)
+			Cache_Free(useCache);
+		return c;
+	}
+
 	//Check for valid command line arguments
-	if (argc != 4)
+	if (!Seek_Parse_Range(&argc, argv, &fromBar, &toBar, &ranged, &seekFile))
+		return EXIT_FAILURE;
+	if (argc < 4 || argc > 6)
 	{
-		fprintf(stderr, "Usage:\n\tmidi_notes <input filename> <PPQN> <channel>\n\n");
+		fprintf(stderr, "Usage:\n\tmidi_notes [--from <bar>] [--to <bar>] [--no-seek-file] "
+		        "[--cache <dir>] [--note-list <file>] [--voices] [--lilypond <file>] [--musicxml <file>] "
+		        "[--abc <file>] <input filename> <PPQN> "
+		        "<channel[,channel...] or all> [NSF song or all] [NSF seconds]\n"
+		        "\tmidi_notes [--cache <dir>] -b <PPQN> <channel[,channel...] or all> <output dir> "
+		        "<input file, directory, or @list>...\n\n"
+		        "For NSF and VGM files, the PPQN is the number of frames in a quarter\n"
+		        "note. The NSF song is numbered from 1 and defaults to the file's\n"
+		        "starting song. \"all\" converts every song, using all of the cores.\n"
+		        "--from and --to convert only the bars from one to the other, counting\n"
+		        "from 1. A seek index gets saved next to a MIDI file to find them quickly;\n"
+		        "--no-seek-file builds it in memory instead, without reading or saving one.\n"
+		        "--cache <dir> saves the output in a cache directory and uses it again the\n"
+		        "next time the same file is converted the same way. --cache-size sets the\n"
+		        "cache's size limit in megabytes (default %d).\n"
+		        "--note-list <file> writes the notes to a binary note list (see note_list.h)\n"
+		        "instead of printing them. \"-\" writes it to standard output.\n"
+		        "--voices splits each channel into voices that can be written down one\n"
+		        "note or chord at a time, for channels where the notes overlap.\n"
+		        "--lilypond, --musicxml and --abc <file> write the notes as sheet music\n"
+		        "instead of printing them. Any number of them can be given, and the song\n"
+		        "only gets converted once. \"-\" writes to standard output.\n\n",
+		        CACHE_DEFAULT_MB);
 		return EXIT_FAILURE;
 	}
-	
+	if (argc >= 5 && strcmp(argv[4], "all") == 0)
+		allSongs = true;
+	else if (argc >= 5)
+		song = strtol(argv[4], NULL, 10) - 1;
+	if (argc >= 6)
+		seconds = strtoul(argv[5], NULL, 10);
+
 	//Save the PPQN and channel values
-	g_ppqn = strtol(argv[2], NULL, 10);
-	g_userChannel = strtol(argv[3], NULL, 10);
+	lengths = Lengths_Get(strtol(argv[2], NULL, 10));
+	if (lengths == NULL)
+		return EXIT_FAILURE;
+	if (!Parse_Channels(argv[3], &channels, &allChannels))
+		return EXIT_FAILURE;
 
-	//Open the input file
-	inFile = fopen(argv[1], "rb");
-	if (inFile == NULL)
+	//A single channel goes straight to stdout. With several channels, each one
+	//is kept in memory, and they're printed one after another at the end. So is
+	//everything that's going into the cache.
+	single = (channels & (channels - 1)) == 0;
+	for (c = 0; c < 16; c++)
 	{
-		fprintf(stderr, "Error opening file: %s\n\n", strerror(errno));
-		return EXIT_FAILURE;
+		if (!(channels & (1u << c)))
+			continue;
+		Out_Init(&buffers[c], (single && useCache == NULL) ? STDOUT_FILENO : -1);
+		out[c] = &buffers[c];
 	}
-	
-	//Read the input file into memory. We could parse it one byte at a time,
-	//but I prefer to read all of the data into memory. This makes it easier
-	//to tokenize later. But first, we need to allocate memory, and that means
-	//we need to know how big the file is. Unfortunately, there's no standard
-	//way to do this. We'll have to settle for POSIX compliance instead.
-	fseek(inFile, 0, SEEK_END);
-	dataSize = (size_t)ftell(inFile);
-	rewind(inFile);
-	
-	midiData = malloc(dataSize);
-	if (midiData == NULL)
+	Notes_Init(&state, lengths, channels, out);
+	if (listName != NULL || scores)
 	{
-		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
-		return EXIT_FAILURE;
+		List_Init(&list);
+		state.list = &list;
 	}
-	fread(midiData, sizeof(uint8_t), dataSize, inFile);
-	if (errno != 0)
+	if (split)
 	{
-		fprintf(stderr, "Error reading from file: %s\n\n", strerror(errno));
-		return EXIT_FAILURE;
+		for (c = 0; c < 16; c++)
+			Voices_Init(&voices[c]);
+		state.voices = voices;
+	}
+
+	if (ranged && (allSongs || VGM_Is_VGM_File(argv[1])))
+	{
+		fprintf(stderr, "Error: --from and --to only work for one MIDI file or NSF song\n\n");
+		ok = false;
+	} else if ((listName != NULL || split || scores) && allSongs)
+	{
+		fprintf(stderr, "Error: %s only works for one NSF song\n\n",
+		        (listName != NULL) ? "--note-list" : split ? "--voices" : "Score output");
+		ok = false;
+	} else if (Input_Is_Stream(argv[1]) && !ranged)
+	{
+		//Pipes get decoded a block at a time as the data arrives
+		ok = Stream_File(&state, argv[1]);
+	} else if (VGM_Is_VGM_File(argv[1]))
+	{
+		//VGM logs can be hours long, so they're always read a block at a time
+		ok = VGM_File(&state, argv[1]);
+	} else
+	{
+		//Map the input file into memory. This makes it easier to tokenize later.
+		Input_Init(&input);
+		ok = Input_Open(&input, argv[1]);
+
+		//If the cache has this conversion already, it's done
+		data = input.data;
+		size = input.size;
+		if (ok && useCache != NULL && !allSongs)
+		{
+			Cache_Hash(data, size, &hash);
+			snprintf(params, sizeof(params), "midi_notes ppqn=%" PRIu32 " channels=%04" PRIx16
+			         " all=%d song=%d seconds=%" PRIu32 " from=%" PRIu32 " to=%" PRIu32
+			         " voices=%d", lengths->ppqn, channels, allChannels, song, seconds,
+			         ranged ? fromBar : 0, ranged ? toBar : 0, split);
+			Cache_Key(useCache, &hash, params, key);
+			result = Cache_Fetch(useCache, key, STDOUT_FILENO);
+			cached = (result != CACHE_MISS);
+			ok = (result != CACHE_FAILED);
+		}
+
+		//NSF files get played and turned into MIDI data first
+		if (ok && allSongs)
+		{
+			ok = All_Songs(data, size, lengths, channels, allChannels, seconds);
+		} else if (!cached)
+		{
+			if (ok)
+				ok = Convert_Input(&data, &size, song, seconds, lengths->ppqn, &converted);
+
+			//Invoke the MIDI state machine to do the real work. The seek index
+			//only gets saved for real MIDI files.
+			if (ok && ranged)
+				Range_State_Machine(&state, data, size,
+				                    (seekFile && converted == NULL && !Input_Is_Stream(argv[1])) ?
+				                    argv[1] : NULL, fromBar, toBar);
+			else if (ok)
+				MIDI_State_Machine(&state, data, size, Pool_Default_Threads());
+		}
+
+		//It's a good habit to manually free the memory
+		free(converted);
+		Input_Free(&input);
+	}
+	Notes_End(&state);
+	if (split)
+	{
+		for (c = 0; c < 16; c++)
+			Voices_Free(&voices[c]);
+	}
+
+	//Print the buffered channels all at once. All_Songs() prints its own, and
+	//output from the cache has already been printed. A note list is saved even
+	//if some channels failed; the header says which ones. The scores are all
+	//written from the same list, so the song only gets converted once.
+	if (listName != NULL || scores)
+	{
+		if (ok && !state.failed)
+		{
+			listHeader.ppqn = lengths->ppqn;
+			listHeader.wholeNote = lengths->wholeNote;
+			listHeader.loopStart = state.haveLoopStart ? state.loopStart : NOTE_LIST_NO_LOOP;
+			listHeader.loopEnd = state.haveLoopEnd ? state.loopEnd : NOTE_LIST_NO_LOOP;
+			listHeader.channels = state.usedChannels & channels;
+			listHeader.failedChannels = state.failedChannels;
+			if (listName != NULL)
+				ok = List_Save(&list, listName, &listHeader);
+
+			//The score's title is the input file's name without the directory
+			title = strrchr(argv[1], '/');
+			title = (title != NULL) ? title + 1 : argv[1];
+			for (c = 0; c < NUM_SCORE_FORMATS; c++)
+			{
+				if (scoreNames[c] != NULL)
+					ok = Score_Write(c, scoreNames[c], title, &list, &listHeader) && ok;
+			}
+		}
+		List_Free(&list);
+	} else if (cached || allSongs)
+	{
+		//Nothing left to print
+	} else if (useCache != NULL)
+	{
+		ok = Print_Cached(useCache, key, out, state.usedChannels, allChannels, single,
+		                  ok && !state.failed && state.failedChannels == 0) && ok;
+	} else if (single)
+	{
+		for (c = 0; c < 16; c++)
+		{
+			if (out[c] != NULL)
+				ok = Out_Flush(out[c]) && ok;
+		}
+	} else
+	{
+		ok = Print_Channels(out, state.usedChannels, allChannels, NULL) && ok;
+	}
+	for (c = 0; c < 16; c++)
+	{
+		if (out[c] != NULL)
+			Out_Free(out[c]);
 	}
-	fclose(inFile);
-	
-	//Invoke the MIDI state machine to do the real work
-	MIDI_State_Machine(midiData, dataSize);
-	
-	//It's a good habit to manually free the memory
-	free(midiData);
+	Lengths_Free_All();
+	if (useCache != NULL)
+		Cache_Free(useCache);
+
+	return (ok && !state.failed && state.failedChannels == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 
-//MIDI state machine. This is the interface function for interpreting the MIDI
-//file and producing converted data.
-void MIDI_State_Machine(uint8_t *data, size_t totalSize)
+//Gather up the channels that were kept in memory, each with its own heading.
+//If we were asked for all of them, skip the ones that never had anything to
+//say. The title, if there is one, goes first. Returns the number of pieces.
+static int Channel_Vector(struct out_buffer *const out[16], uint16_t usedChannels,
+                          bool allChannels, const char *title, struct iovec iov[33],
+                          char headings[16][16])
 {
-	size_t usedSize = 0;
-	
-	while (usedSize < totalSize)
+	int c, n = 0;
+
+	if (title != NULL)
+	{
+		iov[n].iov_base = (void *)title;
+		iov[n++].iov_len = strlen(title);
+	}
+	for (c = 0; c < 16; c++)
 	{
-		usedSize += Process_Chunk(data + usedSize);
+		if (out[c] == NULL || (allChannels && !(usedChannels & (1u << c))))
+			continue;
+		iov[n].iov_base = headings[c];
+		iov[n++].iov_len = sprintf(headings[c], "\nChannel %d:\n", c);
+		iov[n].iov_base = out[c]->data;
+		iov[n++].iov_len = out[c]->used;
 	}
+	return n;
 }
 
 
-//Helper functions for reading big-endian values from the byte stream
-uint16_t BE_Read16(uint8_t *value)
+//Print the channels that were kept in memory all at once
+bool Print_Channels(struct out_buffer *const out[16], uint16_t usedChannels, bool allChannels,
+                    const char *title)
 {
-	return (uint16_t)value[0] << 8 |
-	       (uint16_t)value[1] << 0;
+	struct iovec iov[33];
+	char headings[16][16];
+	int n;
+
+	n = Channel_Vector(out, usedChannels, allChannels, title, iov, headings);
+	return n == 0 || Out_Write_Vector(STDOUT_FILENO, iov, n);
 }
 
-uint32_t BE_Read32(uint8_t *value)
+
+//Print the channels, and save what got printed in the cache if the conversion
+//worked. A single channel has no heading, the same as when it's printed as it
+//goes.
+bool Print_Cached(struct conv_cache *cache, const char *key, struct out_buffer *const out[16],
+                  uint16_t usedChannels, bool allChannels, bool single, bool store)
 {
-	return (uint32_t)value[0] << 24 |
-	       (uint32_t)value[1] << 16 |
-		   (uint32_t)value[2] << 8 |
-		   (uint32_t)value[3] << 0;
+	struct iovec iov[33];
+	char headings[16][16];
+	int c, n = 0;
+
+	if (single)
+	{
+		for (c = 0; c < 16; c++)
+		{
+			if (out[c] == NULL)
+				continue;
+			iov[n].iov_base = out[c]->data;
+			iov[n++].iov_len = out[c]->used;
+		}
+	} else
+	{
+		n = Channel_Vector(out, usedChannels, allChannels, NULL, iov, headings);
+	}
+
+	//Out_Write_Vector() uses up the vector, so the cache goes first. Not being
+	//able to save it isn't a problem for this run.
+	if (store)
+		Cache_Store(cache, key, iov, n);
+	return n == 0 || Out_Write_Vector(STDOUT_FILENO, iov, n);
 }
 
-//The MIDI standard allows for variable-length numbers. These are given as a
-//sequence of up to four bytes. The lower 7 bits are numerical data, and the
-//most-significant bit is a flag which indicates that more bytes are needed.
-//The maximum possible number of data bits is 28.
-struct var_len VarLen_Read(uint8_t *value)
+
+//Parse a comma-separated list of channels into a bitmask. "all" means every
+//channel, and sets allChannels so the caller can leave out unused ones.
+bool Parse_Channels(const char *list, uint16_t *channels, bool *allChannels)
 {
-	struct var_len v = {0, 0};
-	int c;
-	
-	for (c = 0; c < 4; c++)
-	{
-		v.value <<= 7;
-		v.value |= (value[c] & 0x7F);
-		v.size++;
-		
-		if ((value[c] & 0x80) == 0x00)
-			break;
+	char *end;
+	long channel;
+
+	*channels = 0;
+	*allChannels = (strcmp(list, "all") == 0);
+	if (*allChannels)
+	{
+		*channels = 0xFFFF;
+		return true;
 	}
-	
-	return v;
-}
-	
-
-//Process a chunk. First, get the type and length, then either process the
-//header (if it's a header chunk) or call a helper function to process events
-//(if it's a track chunk). Finally, return the number of bytes processed.
-size_t Process_Chunk(uint8_t *dataStart)
-{
-	struct midi_chunk chunk;
-	struct midi_header header;
-	uint16_t temp;
-	
-	//Read the chunk type and length. MIDI bytes are in big-endian order, so we
-	//can't just do 32-bit reads even if we wanted to be lazy.
-	chunk.type = BE_Read32(dataStart);
-	chunk.length = BE_Read32(dataStart + sizeof(uint32_t));
-	chunk.data = dataStart + 2*sizeof(uint32_t);
-
-	//Output the chunk type and length. If this is a header chunk, process it
-	//now. If it's a track chunk, call a helper function.
-	if (chunk.type == MIDI_HEADER_CHUNK)
-	{
-		header.format = BE_Read16(chunk.data);
-		header.tracks = BE_Read16(chunk.data + sizeof(uint16_t));
-		temp = BE_Read16(chunk.data + 2*sizeof(uint16_t));
-		header.division = temp & 0x7FFF;
-		header.divType = temp >> 15;
-		//Ignore any extra data as per the MIDI spec
-		
-		//Save the division
-		if (header.divType != 0)
+
+	while (*list != '\0')
+	{
+		channel = strtol(list, &end, 10);
+		if (end == list || channel < 0 || channel > 15)
 		{
-			fprintf(stderr, "Error: SMTPE timing is not supported\n\n");
-			exit(EXIT_FAILURE);
+			fprintf(stderr, "Error: Invalid channel list\n\n");
+			return false;
 		}
-		
-		printf("\nHeader chunk: length = %" PRIu32 ", format = %" PRIu16
-		       ", tracks = %" PRIu16 ", division = %" PRIu16 ", div type = %"
-			   PRIu16 "\n", chunk.length, header.format, header.tracks,
-			   header.division, header.divType);
-	} else if (chunk.type == MIDI_TRACK_CHUNK)
-	{
-		printf("\nTrack chunk: length = %" PRIu32 "\n", chunk.length);
-		Process_Track(chunk.data);
-	} else
+		*channels |= (uint16_t)1 << channel;
+		list = (*end == ',') ? end + 1 : end;
+	}
+
+	if (*channels == 0)
+	{
+		fprintf(stderr, "Error: Invalid channel list\n\n");
+		return false;
+	}
+	return true;
+}
+
+
+//Reset the conversion state for a new file. Only the entries of out[] for the
+//channels being converted are used.
+void Notes_Init(struct notes_state *s, const struct length_table *lengths, uint16_t channels,
+                struct out_buffer *const out[16])
+{
+	memset(s, 0, sizeof(*s));
+	s->lengths = lengths;
+	s->tempo = 500000;
+	s->channels = channels;
+	memcpy(s->out, out, sizeof(s->out));
+}
+
+
+//Print the same text to every channel that's still being converted. The file
+//and track information is repeated in each channel's output so that every one
+//reads the same as a single-channel conversion.
+static void Notes_Print_All(struct notes_state *s, const char *format, ...)
+{
+	uint16_t live = s->channels & ~s->failedChannels;
+	char text[256];
+	va_list args;
+	int length, c;
+
+	if (s->list != NULL)
+		return;
+	va_start(args, format);
+	length = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	if (length < 0)
+		return;
+	if ((size_t)length >= sizeof(text))
+		length = sizeof(text) - 1;
+
+	for (c = 0; c < 16; c++)
 	{
-		fprintf(stderr, "\nUnknown chunk type: %08" PRIx32 "\n", chunk.type);
-		exit(EXIT_FAILURE);
+		if (live & (1u << c))
+			Out_Append(s->out[c], text, (size_t)length);
 	}
+}
+
+
+//Stop converting a channel. Once every channel has failed, there's no point in
+//going on with the file.
+static void Notes_Fail_Channel(struct notes_state *s, uint8_t channel)
+{
+	s->failedChannels |= (uint16_t)1 << channel;
+	if ((s->channels & ~s->failedChannels) == 0)
+		s->failed = true;
+}
+
+
+//Start a new track. Every track counts time from its own start, so the notes
+//and rests start over too.
+static void Notes_Start_Track(struct notes_state *s, uint32_t length)
+{
+	int c;
+
+	Notes_Flush(s);
+	Notes_Print_All(s, "\nTrack chunk: length = %" PRIu32 "\n", length);
+	if (s->list != NULL)
+		List_Start_Track(s->list);
+	s->time = s->rangeStart;
+	Active_Clear(&s->active, s->rangeStart);
+	memset(s->chordKeys, 0, sizeof(s->chordKeys));
+	memset(s->tiedKeys, 0, sizeof(s->tiedKeys));
+	memset(s->endedKeys, 0, sizeof(s->endedKeys));
+	s->changed = 0;
+	for (c = 0; c < 16; c++)
+		s->noteStarts[c] = s->rangeStart;
+}
+
+
+//Say what was wrong with a file the event store couldn't hold all of, if it
+//couldn't. The batch modes give the file's name, since the message could be
+//about any of them.
+static void Store_Error(const struct event_store *store, const char *name)
+{
+	if (store->error == MIDI_OK)
+		return;
+	if (name != NULL)
+		fprintf(stderr, "%s: %s\n", name, MIDI_Error_String(store->error));
+	else
+		fprintf(stderr, "Error: %s\n", MIDI_Error_String(store->error));
+}
+
+
+//MIDI state machine. This is the interface function for interpreting the MIDI
+//file and producing converted data. The file is decoded into an event store on
+//up to numThreads threads, then converted.
+void MIDI_State_Machine(struct notes_state *s, const uint8_t *data, size_t totalSize,
+                        unsigned numThreads)
+{
+	struct event_store store;
+	bool ok;
 
-	return chunk.length + 2*sizeof(uint32_t);
+	ok = Events_Load(&store, data, totalSize, numThreads);
+	Store_Error(&store, NULL);
+	if (ok)
+		Process_Events(s, &store);
+	else
+		s->failed = true;
+
+	Events_Free(&store);
 }
 
 
-//Process a track. This involves reading a series of events, which may be MIDI
-//events, SysEx events, or meta events. The events are all different lengths, so
-//we have to keep track of the data position here. The track will conclude with
-//an End of Track meta event, so we don't need to know the overall length.
-void Process_Track(uint8_t *data)
+//Convert a range of bars. Only the events in the range get decoded, and the
+//notation starts at the start of the range. Notes that start before the range
+//are cut off at the start of it, and notes that are still on at the end of it
+//are left out. filename is where the data came from, for the seek index file,
+//or NULL if it didn't come from a MIDI file.
+void Range_State_Machine(struct notes_state *s, const uint8_t *data, size_t totalSize,
+                         const char *filename, uint32_t fromBar, uint32_t toBar)
 {
-	struct var_len v;
-	uint32_t eventLen;
-	uint8_t status, metaType;
-	size_t pos = 0;
-	
-	//Main event loop
-	while (1)
+	struct event_store store;
+	bool ok;
+
+	ok = Events_Load_Range(&store, data, totalSize, filename, fromBar, toBar,
+	                       Pool_Default_Threads());
+	Store_Error(&store, NULL);
+	if (ok)
 	{
-		//Get the delta time and print the current time
-		v = VarLen_Read(data + pos);
-		g_time += v.value;
-		pos += v.size;
+		s->rangeStart = store.from;
+		Process_Events(s, &store);
+	} else
+		s->failed = true;
 
-		//Figure out what kind of event this is
-		status = data[pos++];
-		if ((status & 0xF0) < 0xF0)
-		{
-			//MIDI event -- process
-			Process_MIDI_Event(status, data + pos);
-			if ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0)
-				pos++;
-			else
-				pos += 2;
-		} else if (status == 0xF0 || status == 0xF7)
+	Events_Free(&store);
+}
+
+
+//Other input formats are converted to MIDI data before anything else happens.
+//If the data is an NSF file, the song (numbered from 0, or -1 for the file's
+//starting song) is played for the given number of seconds, and data and size
+//are pointed at the resulting MIDI file. The caller frees *converted, which is
+//left NULL for input that's already MIDI.
+bool Convert_Input(const uint8_t **data, size_t *size, int song, uint32_t seconds,
+                   uint32_t ppqn, uint8_t **converted)
+{
+	struct nsf_file nsf;
+
+	*converted = NULL;
+	if (!NSF_Is_NSF(*data, *size))
+		return true;
+
+	if (!NSF_Parse(&nsf, *data, *size) || !NSF_Load(&nsf))
+		return false;
+	if (song < 0)
+		song = nsf.startSong - 1;
+	if (!NSF_To_MIDI(&nsf, (unsigned)song, seconds, ppqn, true, converted, size))
+	{
+		NSF_Free(&nsf);
+		return false;
+	}
+
+	NSF_Free(&nsf);
+	*data = *converted;
+	return true;
+}
+
+
+//Check whether a marker's text is one of the loop markers. Different tools
+//capitalize them differently.
+static bool Is_Marker(const uint8_t *data, uint32_t length, const char *name)
+{
+	return length == strlen(name) && strncasecmp((const char *)data, name, length) == 0;
+}
+
+
+//A note event for loop detection
+struct loop_event
+{
+	uint32_t tick;
+	uint64_t hash;
+	bool start;
+};
+
+static int Compare_Loop_Events(const void *a, const void *b)
+{
+	const struct loop_event *x = a, *y = b;
+
+	if (x->tick != y->tick)
+		return (x->tick < y->tick) ? -1 : 1;
+	if (x->hash != y->hash)
+		return (x->hash < y->hash) ? -1 : 1;
+	return 0;
+}
+
+
+//Find the loop in a MIDI file before converting it. Loop markers win if there
+//are any. Otherwise, we look for a stretch at the end of the file that's the
+//same notes over and over, which is what a rip with the loop written out
+//several times looks like. The notes are put in time order across all of the
+//tracks, and each tick with notes on it gets a signature made of its notes and
+//the time until the next one. The repeat has to be at least LOOP_MIN_QUARTERS
+//quarter notes long so that a bar of repeated eighth notes doesn't count.
+#define LOOP_MIN_QUARTERS 8
+
+static void Find_Loop(struct notes_state *s, const struct event_store *store,
+                      const uint32_t *selected, size_t numSelected)
+{
+	struct loop_event *events;
+	uint64_t *signatures;
+	uint32_t *times, division;
+	uint8_t *active;
+	size_t numEvents = 0, numTicks = 0, i, start, length;
+	uint32_t e;
+	uint8_t type;
+
+	for (i = 0; i < numSelected; i++)
+	{
+		e = selected[i];
+		if (store->status[e] != MIDI_EVENT_META || store->data1[e] != MIDI_META_MARKER)
+			continue;
+		if (Is_Marker(store->base + store->payload[e], store->length[e], MIDI_MARKER_LOOP_START))
 		{
-			//SysEx event -- ignore
-			v = VarLen_Read(data + pos);
-			eventLen = v.value;
-			pos += v.size;
-			pos += eventLen;
-		} else if (status == 0xFF)
+			s->haveLoopStart = true;
+			s->loopStart = store->tick[e];
+		} else if (Is_Marker(store->base + store->payload[e], store->length[e],
+		                     MIDI_MARKER_LOOP_END))
 		{
-			//Meta event -- process if it sets the tempo or ends the track
-			metaType = data[pos++];
-			v = VarLen_Read(data + pos);
-			eventLen = v.value;
-			pos += v.size;
-			
-			//If this is a Set Tempo event, update the tempo
-			if (metaType == MIDI_META_SET_TEMPO)
-			{
-				tempo = (uint32_t)data[pos+0] << 16 |
-				        (uint32_t)data[pos+1] << 8  |
-						(uint32_t)data[pos+2];
-				printf("New tempo: %" PRIu32 "\n", tempo);
-			}
-			
-			pos += eventLen;
+			s->haveLoopEnd = true;
+			s->loopEnd = store->tick[e];
+		}
+	}
+	if (s->haveLoopStart || s->haveLoopEnd)
+		return;
 
-			if (metaType == MIDI_META_END_OF_TRACK)
-				break;
-		} else
+	events = malloc((numSelected ? numSelected : 1) * sizeof(struct loop_event));
+	if (events == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		return;
+	}
+	for (i = 0; i < numSelected; i++)
+	{
+		e = selected[i];
+		type = store->status[e] & 0xF0;
+		if (type != MIDI_EVENT_NOTE_ON && type != MIDI_EVENT_NOTE_OFF)
+			continue;
+		events[numEvents].tick = store->tick[e];
+		events[numEvents].hash = Loop_Hash(Loop_Hash(store->status[e], store->data1[e]),
+		                                   store->data2[e]);
+		//A note on with a velocity of 0 is a note off
+		events[numEvents].start = (type == MIDI_EVENT_NOTE_ON && store->data2[e] != 0);
+		numEvents++;
+	}
+	qsort(events, numEvents, sizeof(struct loop_event), Compare_Loop_Events);
+
+	//One signature per tick with notes on it. The last tick has nothing after
+	//it, so it only gets a time.
+	signatures = malloc((numEvents + 1) * sizeof(uint64_t));
+	times = malloc((numEvents + 1) * sizeof(uint32_t));
+	active = malloc(numEvents + 1);
+	if (signatures == NULL || times == NULL || active == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		numEvents = 0;
+	}
+	for (i = 0; i < numEvents; i++)
+	{
+		if (i == 0 || events[i].tick != events[i - 1].tick)
 		{
-			fprintf(stderr, "Unknown event type %02" PRIx8 "\n", status);
-			exit(EXIT_FAILURE);
+			if (numTicks > 0)
+				signatures[numTicks - 1] = Loop_Hash(signatures[numTicks - 1],
+				                                     events[i].tick - times[numTicks - 1]);
+			times[numTicks] = events[i].tick;
+			signatures[numTicks] = 0;
+			active[numTicks] = false;
+			numTicks++;
 		}
+		signatures[numTicks - 1] = Loop_Hash(signatures[numTicks - 1], events[i].hash);
+		active[numTicks - 1] |= events[i].start;
+	}
+
+	division = store->index.haveHeader ? store->index.header.division : s->lengths->ppqn;
+	if (numTicks > 1 && Loop_Find_Suffix(signatures, active, times, numTicks - 1,
+	                                     LOOP_MIN_QUARTERS * division, &start, &length))
+	{
+		s->haveLoopStart = s->haveLoopEnd = true;
+		s->loopStart = times[start];
+		s->loopEnd = times[start + length];
 	}
+
+	free(events);
+	free(signatures);
+	free(times);
+	free(active);
 }
 
-struct NoteLength {float duration; const char *string;};
 
-static const struct NoteLength noteLengths[] =
+//Convert every song in an NSF file. The file is loaded once and shared by all
+//of the songs, and each song gets its own player and notation, so they can all
+//be played at the same time on the worker pool. The songs are printed in order
+//once they're all done.
+struct song_result
+{
+	struct notes_state state;
+	struct out_buffer buffers[16];
+	bool ok;
+};
+
+struct song_batch
 {
-	{0.015625,  "64"},
-	{0.0234375, "64."},
-	{0.03125,   "32"},
-	{0.046875,  "32."},
-	{0.0625,    "16"},
-	{0.09735,   "16."},
-	{0.125,     "8"},
-	{0.1875,    "8."},
-	{0.25,      "4"},
-	{0.375,     "4."},
-	{0.5,       "2"},
-	{0.75,      "2."},
-	{1.0,       "1"},
+	struct nsf_file nsf;
+	const struct length_table *lengths;
+	uint16_t channels;
+	uint32_t seconds;
+	struct song_result *results;
 };
 
-static const size_t numNotes = sizeof(noteLengths)/sizeof(struct NoteLength);
+static void Song_Job(void *context, size_t index, unsigned workerNum)
+{
+	struct song_batch *b = context;
+	struct song_result *r = &b->results[index];
+	struct out_buffer *out[16] = {NULL};
+	struct event_store store;
+	uint8_t *data;
+	size_t size;
+	int c;
+
+	for (c = 0; c < 16; c++)
+	{
+		if (!(b->channels & (1u << c)))
+			continue;
+		Out_Init(&r->buffers[c], -1);
+		out[c] = &r->buffers[c];
+	}
+	Notes_Init(&r->state, b->lengths, b->channels, out);
+
+	r->ok = NSF_To_MIDI(&b->nsf, (unsigned)index, b->seconds, b->lengths->ppqn, true,
+	                    &data, &size);
+	if (!r->ok)
+		return;
+	r->ok = Events_Load(&store, data, size, 1);
+	Store_Error(&store, NULL);
+	if (r->ok)
+	{
+		Process_Events(&r->state, &store);
+		Notes_End(&r->state);
+	}
 
-static const float durationTolerance = 0.1;
+	Events_Free(&store);
+	free(data);
+}
 
-//Return the longest single note (dotted or bare) that can fit into the duration
-const struct NoteLength *Convert_Duration(float duration)
+bool All_Songs(const uint8_t *data, size_t size, const struct length_table *lengths,
+               uint16_t channels, bool allChannels, uint32_t seconds)
 {
-	int d;
-	
-	//Check for an exact match
-	for (d = 0; d < numNotes; d++)
+	struct song_batch b;
+	struct song_result *r;
+	struct out_buffer *out[16];
+	char title[32];
+	size_t song;
+	int c;
+	bool ok = true;
+
+	if (!NSF_Is_NSF(data, size))
+	{
+		fprintf(stderr, "Error: Only NSF files have more than one song\n\n");
+		return false;
+	}
+	if (!NSF_Parse(&b.nsf, data, size) || !NSF_Load(&b.nsf))
+		return false;
+	b.lengths = lengths;
+	b.channels = channels;
+	b.seconds = seconds;
+	b.results = calloc(b.nsf.totalSongs, sizeof(struct song_result));
+	if (b.results == NULL)
 	{
-		if (duration > (1-durationTolerance)*noteLengths[d].duration &&
-		    duration < (1+durationTolerance)*noteLengths[d].duration)
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		NSF_Free(&b.nsf);
+		return false;
+	}
+
+	Pool_Run(b.nsf.totalSongs, Pool_Default_Threads(), Song_Job, &b);
+
+	for (song = 0; song < b.nsf.totalSongs; song++)
+	{
+		r = &b.results[song];
+		if (!r->ok || r->state.failed || r->state.failedChannels != 0)
+		{
+			fprintf(stderr, "Song %zu: failed\n", song + 1);
+			ok = false;
+		}
+		for (c = 0; c < 16; c++)
+			out[c] = (channels & (1u << c)) ? &r->buffers[c] : NULL;
+		snprintf(title, sizeof(title), "\nSong %zu:\n", song + 1);
+		ok = Print_Channels(out, r->state.usedChannels, allChannels, title) && ok;
+		for (c = 0; c < 16; c++)
 		{
-			return &noteLengths[d];
+			if (out[c] != NULL)
+				Out_Free(out[c]);
 		}
 	}
-	
-	//If there's no exact match, return the longest possible note
-	for (d = 0; d < numNotes; d++)
+
+	free(b.results);
+	NSF_Free(&b.nsf);
+	return ok;
+}
+
+
+//Convert the requested channels from the event store. We only need those
+//channels' messages and the tempo changes, so those get picked out first. All of
+//the channels are converted in the same pass.
+void Process_Events(struct notes_state *s, const struct event_store *store)
+{
+	uint32_t *selected;
+	size_t numSelected, i = 0, t;
+	uint32_t e;
+	uint8_t data[2];
+
+	if (store->index.haveHeader && !Process_Header(s, store->index.headerLength,
+	                                               &store->index.header))
+		return;
+
+	selected = malloc((store->count ? store->count : 1) * sizeof(uint32_t));
+	if (selected == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		s->failed = true;
+		return;
+	}
+	numSelected = Events_Select_Channels(store, s->channels, selected);
+
+	//A loop can't be found from only part of the song
+	if (!store->ranged)
+		Find_Loop(s, store, selected, numSelected);
+
+	for (t = 0; t < store->numTracks && !s->failed; t++)
 	{
-		//We already checked with tolerances above, so we don't have to worry about them here
-		if (noteLengths[d].duration > duration)
+		Notes_Start_Track(s, store->index.tracks[t].length);
+
+		for (; i < numSelected && selected[i] < store->trackStart[t+1] && !s->failed; i++)
 		{
-			if (d > 0)
+			e = selected[i];
+			s->time = store->tick[e];
+
+			if (store->status[e] == MIDI_EVENT_META)
 			{
-				return &noteLengths[d-1];
+				//Meta event -- process if it sets the tempo
+				Process_Meta_Event(s, store->data1[e], store->base + store->payload[e],
+				                   store->length[e]);
 			} else
 			{
-				fprintf(stderr, "Error: Note duration too short: %f\n", duration);
-				exit(EXIT_FAILURE);
+				//MIDI event -- process
+				data[0] = store->data1[e];
+				data[1] = store->data2[e];
+				Process_MIDI_Event(s, store->status[e], data);
 			}
 		}
 	}
-	
-	//If we run out of notes, return a breve
-	return &noteLengths[numNotes-1];
+
+	if (store->failed)
+		s->failed = true;
+	free(selected);
 }
 
 
+//Process the header chunk. Returns false if we can't handle the file.
+bool Process_Header(struct notes_state *s, uint32_t length, const struct midi_header *header)
+{
+	//Save the division
+	if (header->divType != 0)
+	{
+		fprintf(stderr, "Error: SMTPE timing is not supported\n\n");
+		s->failed = true;
+		return false;
+	}
 
+	Notes_Print_All(s, "\nHeader chunk: length = %" PRIu32 ", format = %" PRIu16
+	                ", tracks = %" PRIu16 ", division = %" PRIu16 ", div type = %"
+	                PRIu16 "\n", length, header->format, header->tracks,
+	                header->division, header->divType);
+	return true;
+}
 
-//Process a MIDI channel voice or mode message. These all have fixed lengths,
-//with one or two data bytes after the status byte.
-void Process_MIDI_Event(uint8_t status, uint8_t *data)
-{
-	static uint32_t noteStarts[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-	const struct NoteLength *length;
-	const char *note;
-	uint32_t dTime;
-	uint8_t msgType, msgIndex, channel;
-	int8_t octave;
-	int o;
-	float duration;
 
-	//Parse the status byte
-	msgType = status & 0xF0;
-	msgIndex = (msgType >> 4) - 0x8;
-	channel = status & 0x0F;
-	dTime = g_time - noteStarts[channel];
-	duration = (float)dTime / (float)(4 * g_ppqn);
-	
-	//Only process messages from the desired channel
-	if (channel != g_userChannel)
+//Process a meta event. The ones we care about are Set Tempo and the loop
+//markers. The markers were already found if the whole file was loaded, but
+//streamed files only find out about them here.
+void Process_Meta_Event(struct notes_state *s, uint8_t metaType, const uint8_t *data,
+                        uint32_t length)
+{
+	if (metaType == MIDI_META_SET_TEMPO && length >= 3)
+	{
+		s->tempo = (uint32_t)data[0] << 16 |
+		           (uint32_t)data[1] << 8  |
+		           (uint32_t)data[2];
+		Notes_Print_All(s, "New tempo: %" PRIu32 "\n", s->tempo);
+	} else if (metaType == MIDI_META_MARKER && !s->haveLoopStart &&
+	           Is_Marker(data, length, MIDI_MARKER_LOOP_START))
+	{
+		s->haveLoopStart = true;
+		s->loopStart = s->time;
+	} else if (metaType == MIDI_META_MARKER && !s->haveLoopEnd &&
+	           Is_Marker(data, length, MIDI_MARKER_LOOP_END))
+	{
+		s->haveLoopEnd = true;
+		s->loopEnd = s->time;
+	}
+}
+
+//Pitch names for every key, with the octave marks already attached. MIDI
+//starts its note numbers in octave -1 even though C0 is below the typical lower
+//limit of human hearing. Octave 3 gets no marks; lower octaves get a comma for
+//each octave down and higher octaves get an apostrophe for each octave up.
+struct PitchName {char string[12]; uint8_t size;};
+
+#define PITCH(s) {s, sizeof(s) - 1}
+
+static const struct PitchName pitchNames[128] =
+{
+	PITCH("c,,,,"), PITCH("cs,,,,"), PITCH("d,,,,"), PITCH("ds,,,,"), PITCH("e,,,,"), PITCH("f,,,,"),
+	PITCH("fs,,,,"), PITCH("g,,,,"), PITCH("gs,,,,"), PITCH("a,,,,"), PITCH("as,,,,"), PITCH("b,,,,"),
+	PITCH("c,,,"), PITCH("cs,,,"), PITCH("d,,,"), PITCH("ds,,,"), PITCH("e,,,"), PITCH("f,,,"),
+	PITCH("fs,,,"), PITCH("g,,,"), PITCH("gs,,,"), PITCH("a,,,"), PITCH("as,,,"), PITCH("b,,,"),
+	PITCH("c,,"), PITCH("cs,,"), PITCH("d,,"), PITCH("ds,,"), PITCH("e,,"), PITCH("f,,"),
+	PITCH("fs,,"), PITCH("g,,"), PITCH("gs,,"), PITCH("a,,"), PITCH("as,,"), PITCH("b,,"),
+	PITCH("c,"), PITCH("cs,"), PITCH("d,"), PITCH("ds,"), PITCH("e,"), PITCH("f,"),
+	PITCH("fs,"), PITCH("g,"), PITCH("gs,"), PITCH("a,"), PITCH("as,"), PITCH("b,"),
+	PITCH("c"), PITCH("cs"), PITCH("d"), PITCH("ds"), PITCH("e"), PITCH("f"),
+	PITCH("fs"), PITCH("g"), PITCH("gs"), PITCH("a"), PITCH("as"), PITCH("b"),
+	PITCH("c'"), PITCH("cs'"), PITCH("d'"), PITCH("ds'"), PITCH("e'"), PITCH("f'"),
+	PITCH("fs'"), PITCH("g'"), PITCH("gs'"), PITCH("a'"), PITCH("as'"), PITCH("b'"),
+	PITCH("c''"), PITCH("cs''"), PITCH("d''"), PITCH("ds''"), PITCH("e''"), PITCH("f''"),
+	PITCH("fs''"), PITCH("g''"), PITCH("gs''"), PITCH("a''"), PITCH("as''"), PITCH("b''"),
+	PITCH("c'''"), PITCH("cs'''"), PITCH("d'''"), PITCH("ds'''"), PITCH("e'''"), PITCH("f'''"),
+	PITCH("fs'''"), PITCH("g'''"), PITCH("gs'''"), PITCH("a'''"), PITCH("as'''"), PITCH("b'''"),
+	PITCH("c''''"), PITCH("cs''''"), PITCH("d''''"), PITCH("ds''''"), PITCH("e''''"), PITCH("f''''"),
+	PITCH("fs''''"), PITCH("g''''"), PITCH("gs''''"), PITCH("a''''"), PITCH("as''''"), PITCH("b''''"),
+	PITCH("c'''''"), PITCH("cs'''''"), PITCH("d'''''"), PITCH("ds'''''"), PITCH("e'''''"), PITCH("f'''''"),
+	PITCH("fs'''''"), PITCH("g'''''"), PITCH("gs'''''"), PITCH("a'''''"), PITCH("as'''''"), PITCH("b'''''"),
+	PITCH("c''''''"), PITCH("cs''''''"), PITCH("d''''''"), PITCH("ds''''''"), PITCH("e''''''"), PITCH("f''''''"),
+	PITCH("fs''''''"), PITCH("g''''''"),
+};
+
+#undef PITCH
+
+//Print a rest on a channel. It started at the channel's last note on or off.
+static void Print_Rest(struct notes_state *s, uint8_t channel, uint32_t dTime)
+{
+	struct note_record rest = {0};
+
+	if (s->list != NULL)
+	{
+		rest.onset = s->noteStarts[channel];
+		rest.ticks = dTime;
+		rest.length = NOTE_LENGTH_NONE;
+		rest.flags = NOTE_REST;
+		rest.channel = channel;
+		rest.voice = s->voice;
+		List_Add(s->list, &rest);
 		return;
-	
-	//Parse the first data byte as a key (note) just in case. MIDI starts its
-	//note numbers in octave -1 even though C0 is below the typical lower limit
-	//of human hearing.
-	note = noteNames[data[0] % 12];
-	octave = (data[0] / 12) - 1;
+	}
+	Out_Printf(s->out[channel], "ch %2" PRIu8 "  Rest: %" PRIu32  "      \t%1.4f\n",
+	           channel, dTime, (float)dTime / (float)s->lengths->wholeNote);
+}
+
+
+static bool Has_Key(const uint64_t keys[2], uint8_t key)
+{
+	return (keys[key >> 6] >> (key & 63)) & 1;
+}
+
+
+//Add a chord that's just ended to the note list. Every key gets one record for
+//each of the tied lengths the chord takes, and the records go a part at a time
+//so they stay in time order. The parts' times are worked out from their
+//lengths, and the last one ends when the chord did.
+static bool List_Chord(struct notes_state *s, uint8_t channel, const uint64_t ties[2],
+                       uint32_t dTime)
+{
+	const struct note_split *split;
+	struct note_record note = {0};
+	uint32_t wholeNotes, p, parts, onset, units = 0;
+	uint64_t bits;
+	bool tied;
+	int w;
 
-	switch (msgType)
+	split = Lengths_Split(s->lengths, dTime, &wholeNotes);
+	parts = wholeNotes + split->count;
+	onset = s->noteStarts[channel];
+	note.channel = channel;
+	note.voice = s->voice;
+	for (p = 0; p < parts; p++)
 	{
-		case MIDI_EVENT_NOTE_ON:
-			if (g_time > noteStarts[channel])
-			{
-				printf("ch %2" PRIu8 "  ", channel);
-				printf("Rest: %" PRIu32  "      \t%1.4f\n", dTime, duration);
-			}
-			noteStarts[channel] = g_time;
-			break;
-		case MIDI_EVENT_NOTE_OFF:
-//			printf("ch %2" PRIu8 "  ", channel);
-//			printf("Note: %-4" PRIu32 "  %s%" PRIu8 "\t%1.4f   ", dTime, note, octave, duration);
-			noteStarts[channel] = g_time;
-			
-			//Convert the duration to one or more note times
-			while (duration > 0.005)
+		note.length = (p < wholeNotes) ? NOTE_WHOLE : split->parts[p - wholeNotes];
+		note.onset = onset + (uint32_t)((uint64_t)units * s->lengths->wholeNote / 128);
+		units += noteLengths[note.length].units;
+		tied = (p + 1 < parts || split->tooShort);
+		if (tied)
+			note.ticks = onset + (uint32_t)((uint64_t)units * s->lengths->wholeNote / 128) -
+			             note.onset;
+		else
+			note.ticks = onset + dTime - note.onset;
+
+		for (w = 0; w < 2; w++)
+		{
+			for (bits = s->chordKeys[channel][w]; bits != 0; bits &= bits - 1)
 			{
-				printf("%s%", note);
-				if (octave < 3)
-				{
-					for (o = 2; o >= octave; o--)
-					{
-						printf(",");
-					}
-				} else if (octave > 3)
-				{
-					for (o = 4; o <= octave; o++)
-					{
-						printf("'");
-					}
-				}
-				length = Convert_Duration(duration);
-				duration -= length->duration;
-				printf("%s", length->string);
-				if (duration >= 0.005)
-					printf("~ ");
+				note.key = (uint8_t)(w * 64 + __builtin_ctzll(bits));
+				note.flags = ((p > 0 || Has_Key(s->tiedKeys[channel], note.key)) ? NOTE_TIED : 0) |
+				             ((tied || Has_Key(ties, note.key)) ? NOTE_TIE : 0);
+				List_Add(s->list, &note);
 			}
-			printf(" ");
-			break;
-		default:
-			//Ignore all other events
-			break;
+		}
+	}
+	if (split->tooShort)
+	{
+		fprintf(stderr, "Error: Note duration too short: %f\n",
+		        Lengths_Remainder(s->lengths, dTime));
+		Notes_Fail_Channel(s, channel);
+		return false;
+	}
+	return true;
+}
+
+
+//Longest chord text: every key with a tie after it, plus the brackets
+#define CHORD_TEXT_SIZE (128 * 10 + 3)
+
+//Write out a chord's pitches. More than one key goes in angle brackets, lowest
+//first, and a tie on a chord has to be marked key by key inside the brackets.
+//If ties is NULL, none of the keys get one.
+static size_t Chord_Text(const uint64_t keys[2], const uint64_t ties[2], char *text)
+{
+	const struct PitchName *pitch;
+	uint64_t bits;
+	size_t size = 0;
+	uint8_t key;
+	int w;
+
+	text[size++] = '<';
+	for (w = 0; w < 2; w++)
+	{
+		for (bits = keys[w]; bits != 0; bits &= bits - 1)
+		{
+			key = (uint8_t)(w * 64 + __builtin_ctzll(bits));
+			pitch = &pitchNames[key];
+			if (size > 1)
+				text[size++] = ' ';
+			memcpy(text + size, pitch->string, pitch->size);
+			size += pitch->size;
+			if (ties != NULL && Has_Key(ties, key))
+				text[size++] = '~';
+		}
+	}
+	text[size++] = '>';
+	return size;
+}
+
+
+//Print a chord that's just ended, tied across however many note lengths it
+//takes. A chord with only one key in it is printed as a plain note. Keys in
+//ties go on into the next chord. Returns false if the chord can't be written
+//down.
+static bool Print_Chord(struct notes_state *s, uint8_t channel, const uint64_t ties[2],
+                        uint32_t dTime)
+{
+	const uint64_t *keys = s->chordKeys[channel];
+	const struct note_split *split;
+	const struct note_length *length;
+	struct out_buffer *out = s->out[channel];
+	char chord[CHORD_TEXT_SIZE], last[CHORD_TEXT_SIZE];
+	const char *ending = " ";
+	size_t chordSize, lastSize;
+	uint32_t wholeNotes, p;
+	uint8_t key;
+
+	if (__builtin_popcountll(keys[0]) + __builtin_popcountll(keys[1]) == 1)
+	{
+		key = (uint8_t)(keys[0] ? __builtin_ctzll(keys[0]) : 64 + __builtin_ctzll(keys[1]));
+		chordSize = lastSize = pitchNames[key].size;
+		memcpy(chord, pitchNames[key].string, chordSize);
+		memcpy(last, chord, lastSize);
+		if (Has_Key(ties, key))
+			ending = "~ ";
+	} else
+	{
+		chordSize = Chord_Text(keys, NULL, chord);
+		lastSize = Chord_Text(keys, ties, last);
+	}
+
+	//Look up the note or tied notes that make up the duration. Really long
+	//notes start with a run of tied whole notes.
+	split = Lengths_Split(s->lengths, dTime, &wholeNotes);
+	for (p = 0; p < wholeNotes; p++)
+	{
+		Out_Append(out, chord, chordSize);
+		Out_Append(out, "1~ ", 3);
+	}
+	for (p = 0; p < split->count; p++)
+	{
+		length = &noteLengths[split->parts[p]];
+		if (p + 1 < split->count || split->tooShort)
+		{
+			Out_Append(out, chord, chordSize);
+			Out_Append(out, length->string, length->size);
+			Out_Append(out, "~ ", 2);
+		} else
+		{
+			Out_Append(out, last, lastSize);
+			Out_Append(out, length->string, length->size);
+			Out_Append(out, ending, strlen(ending));
+		}
+	}
+	if (split->tooShort)
+	{
+		Out_Append(out, chord, chordSize);
+		fprintf(stderr, "Error: Note duration too short: %f\n",
+		        Lengths_Remainder(s->lengths, dTime));
+		Notes_Fail_Channel(s, channel);
+		return false;
+	}
+	return true;
+}
+
+
+//Write down whatever's been sounding on a channel since noteStarts[], now that
+//the keys have changed. Keys that are still on afterwards are tied into the
+//next chord, unless they ended and started again. If held is false, the track
+//is over and nothing gets tied. Returns false if the chord can't be written
+//down.
+static bool Chord_Flush(struct notes_state *s, uint8_t channel, bool held)
+{
+	uint16_t bit = (uint16_t)1 << channel;
+	uint32_t dTime = s->changeTimes[channel] - s->noteStarts[channel];
+	uint64_t ties[2];
+	bool ok = true;
+	int w;
+
+	if (!(s->changed & bit))
+		return true;
+	s->changed &= ~bit;
+	for (w = 0; w < 2; w++)
+		ties[w] = held ? s->chordKeys[channel][w] & s->active.keys[channel][w] &
+		                 ~s->endedKeys[channel][w] : 0;
+
+	if (dTime > 0 && ((s->channels & ~s->failedChannels) & bit))
+	{
+		if ((s->chordKeys[channel][0] | s->chordKeys[channel][1]) == 0)
+			Print_Rest(s, channel, dTime);
+		else if (s->list != NULL)
+			ok = List_Chord(s, channel, ties, dTime);
+		else
+			ok = Print_Chord(s, channel, ties, dTime);
+	}
+
+	s->noteStarts[channel] = s->changeTimes[channel];
+	for (w = 0; w < 2; w++)
+	{
+		s->chordKeys[channel][w] = s->active.keys[channel][w];
+		s->tiedKeys[channel][w] = ties[w];
+		s->endedKeys[channel][w] = 0;
+	}
+	return ok;
+}
+
+
+//Note that a channel's keys changed just now. If the key ended, it's marked so
+//it doesn't get tied over even if it starts again at the same time.
+static void Chord_Change(struct notes_state *s, uint8_t channel, uint8_t key, bool ended)
+{
+	if (ended)
+		s->endedKeys[channel][key >> 6] |= (uint64_t)1 << (key & 63);
+	s->changeTimes[channel] = s->time;
+	s->changed |= (uint16_t)1 << channel;
+}
+
+
+//Print the repeat bar at the start of the loop once a channel gets there. A
+//rest that runs into the loop is split at the bar. A note that's still on
+//can't be split, so the bar waits until it's over.
+static void Loop_Start_Bar(struct notes_state *s, uint8_t channel)
+{
+	uint16_t bit = (uint16_t)1 << channel;
+
+	if (!s->haveLoopStart || (s->loopBars & bit) || (s->active.sounding & bit) ||
+	    s->time < s->loopStart)
+		return;
+
+	if (s->noteStarts[channel] < s->loopStart)
+	{
+		Print_Rest(s, channel, s->loopStart - s->noteStarts[channel]);
+		s->noteStarts[channel] = s->loopStart;
+	}
+	if (s->list == NULL)
+		Out_Append(s->out[channel], "\\bar \".|:\" ", 11);
+	s->loopBars |= bit;
+}
+
+
+//Process a message on a channel that's being written down as it goes. The
+//keys sounding between one change and the next are written down as a chord, so
+//notes that start together come out as one chord, and a note that's held while
+//others come and go gets tied across them. Nothing is written until the time
+//moves on, since more notes could still start or stop at the same time.
+static void Chord_Event(struct notes_state *s, uint8_t channel, uint8_t msgType, uint8_t key,
+                        bool noteOff)
+{
+	uint16_t bit = (uint16_t)1 << channel;
+
+	//Whatever changed before now is settled, so it can be written down
+	if (s->time > s->changeTimes[channel] && !Chord_Flush(s, channel, true))
+		return;
+	Loop_Start_Bar(s, channel);
+
+	if (noteOff)
+	{
+		//A note off for a key that isn't on is a note that was already on when
+		//the track started, like one cut off by the start of a range. If
+		//anything else has happened on the channel since then, it's too late
+		//to fit it in, so it's dropped.
+		if (!Active_Is_On(&s->active, channel, key))
+		{
+			if (s->noteStarts[channel] != s->rangeStart || (s->changed & bit) ||
+			    (s->chordKeys[channel][0] | s->chordKeys[channel][1]) != 0)
+				return;
+			s->chordKeys[channel][key >> 6] |= (uint64_t)1 << (key & 63);
+		}
+		Active_Stop(&s->active, channel, key);
+		Chord_Change(s, channel, key, true);
+
+		//Once the channel has gone quiet, nothing else can be tied onto what
+		//was sounding, so it doesn't have to wait
+		if (!(s->active.sounding & bit) && Chord_Flush(s, channel, true))
+			Loop_Start_Bar(s, channel);
+	} else if (msgType == MIDI_EVENT_NOTE_ON)
+	{
+		//A key that's struck again while it's still on ends the note it was
+		//already playing
+		Chord_Change(s, channel, key, !Active_Start(&s->active, channel, key, s->time));
+	}
+
+	//Ignore all other events
+}
+
+
+//Collect a note on a channel that's being split into voices. Nothing is written
+//down until the whole track has been collected. A note off for a key that isn't
+//on is a note that was already on when the track started, which only happens
+//when a range cut it off. Like with chords, that only counts if nothing else has
+//happened on the channel yet, other than more notes like it ending at the same
+//time. Otherwise it's just a stray note off.
+static void Voice_Event(struct notes_state *s, uint8_t channel, uint8_t msgType, uint8_t key,
+                        bool noteOff)
+{
+	const struct voice_list *v = &s->voices[channel];
+	const struct voice_note *last = (v->count > 0) ? &v->notes[v->count - 1] : NULL;
+	uint32_t start;
+	bool cutOff;
+
+	if (!noteOff && msgType != MIDI_EVENT_NOTE_ON)
+		return;
+
+	cutOff = noteOff && s->rangeStart > 0 && !(s->active.sounding & ((uint16_t)1 << channel)) &&
+	         (last == NULL || (last->onset == s->rangeStart && last->end == s->time));
+
+	//A key that's struck again while it's still on ends the note it was
+	//already playing
+	if (Active_Is_On(&s->active, channel, key) || cutOff)
+	{
+		start = Active_Stop(&s->active, channel, key);
+		if (!Voices_Add(&s->voices[channel], start, s->time, key))
+			Notes_Fail_Channel(s, channel);
+	}
+	if (!noteOff)
+		Active_Start(&s->active, channel, key, s->time);
+}
+
+
+//Process a MIDI channel voice or mode message. These all have fixed lengths,
+//with one or two data bytes after the status byte. Every channel can have any
+//number of keys on at once. They're either written down as chords as they go,
+//or collected and split into voices at the end of the track.
+void Process_MIDI_Event(struct notes_state *s, uint8_t status, const uint8_t *data)
+{
+	uint8_t msgType, channel, key;
+	uint16_t bit;
+	bool noteOff;
+
+	//Parse the status byte
+	msgType = status & 0xF0;
+	channel = status & 0x0F;
+	bit = (uint16_t)1 << channel;
+	key = data[0] & 0x7F;
+	noteOff = Active_Is_Note_Off(status, data);
+
+	//Only process messages from the desired channels
+	if (!((s->channels & ~s->failedChannels) & bit))
+		return;
+	s->usedChannels |= bit;
+
+	//Everything after the end of the loop is the loop again. The only thing we
+	//still need from there is the end of a note that was on when the loop ended,
+	//and that gets cut off at the end of the loop.
+	if (s->haveLoopEnd && s->time >= s->loopEnd)
+	{
+		if (!noteOff || !Active_Is_On(&s->active, channel, key))
+			return;
+		s->time = s->loopEnd;
+	}
+
+	if (s->voices != NULL)
+		Voice_Event(s, channel, msgType, key, noteOff);
+	else
+		Chord_Event(s, channel, msgType, key, noteOff);
+}
+
+
+//Close the loop on one channel. It gets the rest of the loop and the closing
+//repeat bar.
+static void Loop_End_Bar(struct notes_state *s, uint8_t channel)
+{
+	uint16_t bit = (uint16_t)1 << channel;
+
+	if (!s->haveLoopStart && !s->haveLoopEnd)
+		return;
+
+	if (s->haveLoopStart && !(s->loopBars & bit))
+	{
+		//Nothing happened on this channel after the loop started
+		s->time = s->loopStart;
+		Active_Stop_Channel(&s->active, channel);
+		Loop_Start_Bar(s, channel);
+	}
+	if (s->haveLoopEnd && !(s->active.sounding & bit) && s->noteStarts[channel] < s->loopEnd)
+		Print_Rest(s, channel, s->loopEnd - s->noteStarts[channel]);
+	if (s->list == NULL)
+		Out_Append(s->out[channel], "\\bar \":|.\"\n", 11);
+}
+
+
+//Split a channel's notes from the track that just ended into voices, and write
+//each voice down in turn. Within a voice, the notes never overlap, so each one
+//can go through the chord writer as if it were the only thing on the channel.
+//If last is set, this is the end of the file, and each voice gets the loop
+//closed off.
+static void Write_Voices(struct notes_state *s, uint8_t channel, bool last)
+{
+	struct voice_list *v = &s->voices[channel];
+	const struct voice_note *n;
+	uint16_t bit = (uint16_t)1 << channel;
+	size_t i, j, end;
+
+	if (!Voices_Split(v))
+	{
+		Notes_Fail_Channel(s, channel);
+		Voices_Clear(v);
+		return;
+	}
+
+	for (s->voice = 0; s->voice < v->numVoices; s->voice++)
+	{
+		if (!((s->channels & ~s->failedChannels) & bit))
+			break;
+		if (s->list == NULL)
+			Out_Printf(s->out[channel], "\nVoice %" PRIu16 ":\n", s->voice + 1);
+
+		//Every voice starts over from the start of the track
+		s->noteStarts[channel] = s->changeTimes[channel] = s->rangeStart;
+		memset(s->chordKeys[channel], 0, sizeof(s->chordKeys[channel]));
+		memset(s->tiedKeys[channel], 0, sizeof(s->tiedKeys[channel]));
+		memset(s->endedKeys[channel], 0, sizeof(s->endedKeys[channel]));
+		s->changed &= ~bit;
+		s->loopBars &= ~bit;
+		Active_Stop_Channel(&s->active, channel);
+
+		end = v->voiceStart[s->voice + 1];
+		for (i = v->voiceStart[s->voice]; i < end; i = j)
+		{
+			n = &v->notes[i];
+			s->time = n->onset;
+			for (j = i; j < end && v->notes[j].onset == n->onset; j++)
+				Chord_Event(s, channel, MIDI_EVENT_NOTE_ON, v->notes[j].key, false);
+			s->time = n->end;
+			for (j = i; j < end && v->notes[j].onset == n->onset; j++)
+				Chord_Event(s, channel, MIDI_EVENT_NOTE_OFF, v->notes[j].key, true);
+		}
+		if (last && (s->channels & ~s->failedChannels & bit))
+			Loop_End_Bar(s, channel);
+	}
+
+	s->voice = 0;
+	Voices_Clear(v);
+}
+
+
+//Write down what's been sounding on every channel. This is for the end of a
+//track, so notes that are still on never ended and are left out from there on.
+void Notes_Flush(struct notes_state *s)
+{
+	uint8_t c;
+
+	for (c = 0; c < 16; c++)
+	{
+		if (s->voices != NULL && s->voices[c].count > 0)
+			Write_Voices(s, c, false);
+		else
+			Chord_Flush(s, c, false);
+	}
+}
+
+
+//Finish off the notation once the whole file has been converted. If the song
+//loops, every channel (or every voice) gets the rest of the loop and the
+//closing repeat bar.
+void Notes_End(struct notes_state *s)
+{
+	uint16_t live = s->channels & ~s->failedChannels & s->usedChannels;
+	uint8_t c;
+
+	for (c = 0; c < 16; c++)
+	{
+		if (s->voices != NULL && s->voices[c].count > 0)
+		{
+			Write_Voices(s, c, true);
+			continue;
+		}
+		Chord_Flush(s, c, false);
+		if (live & (1u << c))
+			Loop_End_Bar(s, c);
+	}
+}
+
+
+//Streaming callbacks. These do the same work as MIDI_State_Machine() and
+//Process_Events() for input that arrives through a pipe.
+static bool Notes_Stream_Header(void *user, uint32_t length, const struct midi_header *header)
+{
+	return Process_Header(user, length, header);
+}
+
+static bool Notes_Stream_Track(void *user, uint32_t length)
+{
+	Notes_Start_Track(user, length);
+	return true;
+}
+
+static bool Notes_Stream_Event(void *user, uint32_t delta, uint8_t status, const uint8_t *data)
+{
+	struct notes_state *s = user;
+
+	s->time += delta;
+	Process_MIDI_Event(s, status, data);
+	return !s->failed;
+}
+
+static bool Notes_Stream_SysEx(void *user, uint32_t delta, uint8_t status, uint32_t length)
+{
+	struct notes_state *s = user;
+
+	//SysEx event -- ignore
+	s->time += delta;
+	return true;
+}
+
+static bool Notes_Stream_Meta(void *user, uint32_t delta, uint8_t metaType,
+                              const uint8_t *data, uint32_t length)
+{
+	struct notes_state *s = user;
+
+	s->time += delta;
+	Process_Meta_Event(s, metaType, data, length);
+	return true;
+}
+
+static const struct midi_stream_handler notesStreamHandler =
+{
+	Notes_Stream_Header,
+	Notes_Stream_Track,
+	Notes_Stream_Event,
+	Notes_Stream_SysEx,
+	Notes_Stream_Meta,
+};
+
+
+//Streaming input can be MIDI or VGM data. There's no looking ahead in a pipe,
+//so the first four bytes are held back until we know which decoder to give
+//them to.
+struct notes_stream
+{
+	struct midi_stream midi;
+	struct vgm_stream vgm;
+	uint8_t ident[4];
+	size_t have;          //Bytes of the identifier so far
+};
+
+static bool Notes_Stream_Block(struct notes_stream *n, const uint8_t *data, size_t size)
+{
+	if (VGM_Is_VGM(n->ident, n->have))
+		return VGM_Feed(&n->vgm, data, size);
+	return Stream_Feed(&n->midi, data, size);
+}
+
+static bool Notes_Stream_Feed(void *decoder, const uint8_t *data, size_t size)
+{
+	struct notes_stream *n = decoder;
+	size_t take;
+
+	if (n->have < sizeof(n->ident))
+	{
+		take = sizeof(n->ident) - n->have;
+		if (take > size)
+			take = size;
+		memcpy(n->ident + n->have, data, take);
+		n->have += take;
+		data += take;
+		size -= take;
+		if (n->have < sizeof(n->ident))
+			return true;
+		if (!Notes_Stream_Block(n, n->ident, n->have))
+			return false;
+	}
+
+	return size == 0 || Notes_Stream_Block(n, data, size);
+}
+
+static bool Notes_Stream_Finish(void *decoder)
+{
+	struct notes_stream *n = decoder;
+
+	//Anything too short to identify is a truncated MIDI file as far as we know
+	if (n->have < sizeof(n->ident))
+		return Stream_Feed(&n->midi, n->ident, n->have) && Stream_Finish(&n->midi);
+	if (VGM_Is_VGM(n->ident, n->have))
+		return VGM_Finish(&n->vgm);
+	return Stream_Finish(&n->midi);
+}
+
+
+//Convert a file that can't be mapped, such as standard input
+bool Stream_File(struct notes_state *s, const char *filename)
+{
+	struct notes_stream n;
+
+	Stream_Init(&n.midi, &notesStreamHandler, s);
+	VGM_Init(&n.vgm, &notesStreamHandler, s, s->lengths->ppqn);
+	n.have = 0;
+	if (Input_Run_Blocks(filename, Notes_Stream_Feed, Notes_Stream_Finish, &n))
+		return true;
+
+	//The VGM decoder says what went wrong on its own
+	if (!VGM_Is_VGM(n.ident, n.have))
+		Stream_Print_Error(&n.midi);
+	return false;
+}
+
+
+//Convert a VGM file. The reader turns the chip writes into the same callbacks
+//the streaming MIDI decoder makes.
+bool VGM_File(struct notes_state *s, const char *filename)
+{
+	struct vgm_stream vgm;
+
+	VGM_Init(&vgm, &notesStreamHandler, s, s->lengths->ppqn);
+	return VGM_Run_File(&vgm, filename);
+}
+
+
+//Batch mode. Instead of converting one file per process, we take any number of
+//files, directories, and @list files, and convert every input on a pool of
+//worker threads. Each input gets one output file per requested channel in the
+//output directory, named <input name>.ch<channel>.txt. Asking for "all"
+//channels writes a file for each channel that's used in the input. The names
+//leave out the input's directory, so no two inputs can have the same name.
+struct batch
+{
+	char **inputs;
+	size_t numInputs;
+	size_t maxInputs;
+	uint16_t channels;
+	bool allChannels;
+	const struct length_table *lengths;
+	const char *outDir;
+	struct batch_worker *workers;
+	struct conv_cache *cache;  //NULL if there's no cache
+};
+
+//Per-thread scratch state. Regular files are mapped, but the input's fallback
+//buffer is kept from one file to the next in case some inputs are pipes.
+struct batch_worker
+{
+	struct midi_input input;
+	struct out_buffer out[16];
+	size_t failures;
+};
+
+
+//Add one input filename to the batch
+static bool Batch_Add_Input(struct batch *b, const char *filename)
+{
+	char **newInputs;
+
+	if (b->numInputs == b->maxInputs)
+	{
+		b->maxInputs = b->maxInputs ? 2 * b->maxInputs : 64;
+		newInputs = realloc(b->inputs, b->maxInputs * sizeof(char *));
+		if (newInputs == NULL)
+		{
+			fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+			return false;
+		}
+		b->inputs = newInputs;
+	}
+
+	b->inputs[b->numInputs] = strdup(filename);
+	if (b->inputs[b->numInputs] == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		return false;
+	}
+	b->numInputs++;
+
+	return true;
+}
+
+
+//Add every MIDI, NSF, and VGM file in a directory to the batch. Subdirectories are not
+//searched.
+static bool Batch_Add_Directory(struct batch *b, const char *dirName)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat info;
+	const char *ext;
+	char *path;
+	bool ok = true;
+
+	dir = opendir(dirName);
+	if (dir == NULL)
+	{
+		fprintf(stderr, "Error opening directory %s: %s\n\n", dirName, strerror(errno));
+		return false;
+	}
+
+	while (ok && (entry = readdir(dir)) != NULL)
+	{
+		ext = strrchr(entry->d_name, '.');
+		if (ext == NULL || (strcasecmp(ext, ".mid") != 0 && strcasecmp(ext, ".midi") != 0 &&
+		                    strcasecmp(ext, ".nsf") != 0 && strcasecmp(ext, ".vgm") != 0))
+			continue;
+
+		path = malloc(strlen(dirName) + strlen(entry->d_name) + 2);
+		if (path == NULL)
+		{
+			fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+			ok = false;
+			break;
+		}
+		sprintf(path, "%s/%s", dirName, entry->d_name);
+		if (stat(path, &info) == 0 && S_ISREG(info.st_mode))
+			ok = Batch_Add_Input(b, path);
+		free(path);
+	}
+
+	closedir(dir);
+	return ok;
+}
+
+
+//Add every file named in a list file (one per line) to the batch
+static bool Batch_Add_List(struct batch *b, const char *listName)
+{
+	FILE *list;
+	char line[4096];
+	size_t len;
+	bool ok = true;
+
+	list = fopen(listName, "r");
+	if (list == NULL)
+	{
+		fprintf(stderr, "Error opening file list %s: %s\n\n", listName, strerror(errno));
+		return false;
+	}
+
+	while (ok && fgets(line, sizeof(line), list) != NULL)
+	{
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (len > 0)
+			ok = Batch_Add_Input(b, line);
+	}
+
+	fclose(list);
+	return ok;
+}
+
+
+//Name an input's output files start with: the input's name without its
+//directory
+static const char *Batch_Base_Name(const char *input)
+{
+	const char *baseName = strrchr(input, '/');
+
+	return (baseName != NULL) ? baseName + 1 : input;
+}
+
+//Sort inputs by name, then by path so that clashes get reported in order
+static int Batch_Compare_Inputs(const void *a, const void *b)
+{
+	const char *inputA = *(char *const *)a, *inputB = *(char *const *)b;
+	int order = strcmp(Batch_Base_Name(inputA), Batch_Base_Name(inputB));
+
+	return (order != 0) ? order : strcmp(inputA, inputB);
+}
+
+
+//Make sure no two inputs would write the same output files. Two files with the
+//same name in different directories (or one file given twice) would otherwise
+//write over each other, maybe on two threads at once, and the cache would fill
+//in the rest of them from whichever one got there first.
+static bool Batch_Check_Names(const struct batch *b)
+{
+	char **sorted;
+	size_t i;
+	bool ok = true;
+
+	if (b->numInputs < 2)
+		return true;
+	sorted = malloc(b->numInputs * sizeof(char *));
+	if (sorted == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		return false;
+	}
+	memcpy(sorted, b->inputs, b->numInputs * sizeof(char *));
+	qsort(sorted, b->numInputs, sizeof(char *), Batch_Compare_Inputs);
+
+	for (i = 1; i < b->numInputs; i++)
+	{
+		if (strcmp(Batch_Base_Name(sorted[i - 1]), Batch_Base_Name(sorted[i])) != 0)
+			continue;
+		fprintf(stderr, "Error: %s and %s would both be written to %s/%s.ch*.txt\n",
+		        sorted[i - 1], sorted[i], b->outDir, Batch_Base_Name(sorted[i]));
+		ok = false;
+	}
+	if (!ok)
+		fprintf(stderr, "\n");
+
+	free(sorted);
+	return ok;
+}
+
+
+//Convert a VGM file in batch mode. The reader streams the file, so we don't
+//know which channels are used until it's done. The notation is kept in memory
+//and the output files are written at the end.
+static void Batch_VGM_Job(struct batch *b, struct batch_worker *worker, const char *input)
+{
+	struct notes_state state;
+	const char *baseName;
+	char *outName;
+	struct out_buffer *out[16] = {NULL};
+	uint16_t channels;
+	int c, fd;
+	bool ok;
+
+	baseName = Batch_Base_Name(input);
+	outName = malloc(strlen(b->outDir) + strlen(baseName) + 16);
+	if (outName == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		worker->failures++;
+		return;
+	}
+
+	channels = b->allChannels ? 0xFFFF : b->channels;
+	for (c = 0; c < 16; c++)
+	{
+		if (!(channels & (1u << c)))
+			continue;
+		Out_Reset(&worker->out[c], -1);
+		out[c] = &worker->out[c];
+	}
+	Notes_Init(&state, b->lengths, channels, out);
+	ok = VGM_File(&state, input);
+	Notes_End(&state);
+	if (!ok)
+	{
+		fprintf(stderr, "%s: failed\n", input);
+		worker->failures++;
+	}
+
+	//If we were asked for all of the channels, only write the ones with
+	//something in them
+	if (b->allChannels)
+		channels = state.usedChannels;
+	for (c = 0; ok && c < 16; c++)
+	{
+		if (!(channels & (1u << c)))
+			continue;
+		if (state.failed || (state.failedChannels & (1u << c)))
+		{
+			fprintf(stderr, "%s: channel %d failed\n", input, c);
+			worker->failures++;
+		}
+
+		sprintf(outName, "%s/%s.ch%d.txt", b->outDir, baseName, c);
+		fd = open(outName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0)
+		{
+			fprintf(stderr, "Error opening file %s: %s\n\n", outName, strerror(errno));
+			worker->failures++;
+			continue;
+		}
+		out[c]->fd = fd;
+		if (!Out_Flush(out[c]) || close(fd) != 0)
+		{
+			fprintf(stderr, "Error writing file %s: %s\n\n", outName, strerror(errno));
+			worker->failures++;
+		}
+	}
+
+	free(outName);
+}
+
+
+//Cache keys for batch mode. Each channel's file gets its own entry, and the
+//list of channels that were written gets one too, with a channel of -1.
+static void Batch_Key(const struct batch *b, const struct cache_hash *hash, int channel,
+                      char key[CACHE_KEY_SIZE])
+{
+	char params[128];
+
+	snprintf(params, sizeof(params), "midi_notes -b ppqn=%" PRIu32 " channels=%04" PRIx16
+	         " all=%d channel=%d", b->lengths->ppqn, b->channels, b->allChannels, channel);
+	Cache_Key(b->cache, hash, params, key);
+}
+
+
+//Write a file's output files straight from the cache. Returns false if any of
+//them aren't there, and then the file gets converted like normal.
+static bool Batch_From_Cache(struct batch *b, const struct cache_hash *hash, const char *input)
+{
+	char key[CACHE_KEY_SIZE], list[16], *outName, *end;
+	enum cache_result result = CACHE_HIT;
+	const char *baseName;
+	unsigned long channels;
+	int c, fd;
+
+	Batch_Key(b, hash, -1, key);
+	if (!Cache_Read(b->cache, key, list, sizeof(list)))
+		return false;
+	channels = strtoul(list, &end, 16);
+	if (end == list || channels > 0xFFFF)
+		return false;
+
+	baseName = Batch_Base_Name(input);
+	outName = malloc(strlen(b->outDir) + strlen(baseName) + 16);
+	if (outName == NULL)
+		return false;
+
+	for (c = 0; c < 16 && result == CACHE_HIT; c++)
+	{
+		if (!(channels & (1u << c)))
+			continue;
+		sprintf(outName, "%s/%s.ch%d.txt", b->outDir, baseName, c);
+		fd = open(outName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0)
+		{
+			result = CACHE_FAILED;
+			break;
+		}
+		Batch_Key(b, hash, c, key);
+		result = Cache_Fetch(b->cache, key, fd);
+		if (close(fd) != 0)
+			result = CACHE_FAILED;
+	}
+
+	free(outName);
+	return result == CACHE_HIT;
+}
+
+
+//Save a file's output files in the cache, with the list of channels last so
+//that it's never there without them. outName is room for the file names.
+static void Batch_To_Cache(struct batch *b, const struct cache_hash *hash, char *outName,
+                           const char *baseName, uint16_t channels)
+{
+	char key[CACHE_KEY_SIZE], list[16];
+	struct iovec iov;
+	int c;
+
+	for (c = 0; c < 16; c++)
+	{
+		if (!(channels & (1u << c)))
+			continue;
+		sprintf(outName, "%s/%s.ch%d.txt", b->outDir, baseName, c);
+		Batch_Key(b, hash, c, key);
+		if (!Cache_Store_File(b->cache, key, outName))
+			return;
+	}
+
+	iov.iov_base = list;
+	iov.iov_len = sprintf(list, "%04" PRIx16 "\n", channels);
+	Batch_Key(b, hash, -1, key);
+	Cache_Store(b->cache, key, &iov, 1);
+}
+
+
+//Convert one input file to one output file per requested channel. The file is
+//decoded once and every channel is converted in the same pass.
+static void Batch_Job(void *context, size_t index, unsigned workerNum)
+{
+	struct batch *b = context;
+	struct batch_worker *worker = &b->workers[workerNum];
+	struct notes_state state;
+	struct event_store store;
+	struct cache_hash hash;
+	const char *input = b->inputs[index];
+	const char *baseName;
+	char *outName;
+	struct out_buffer *out[16] = {NULL};
+	const uint8_t *data;
+	uint8_t *converted = NULL;
+	size_t size, failures = worker->failures;
+	uint16_t channels;
+	int c, fd;
+	bool ok;
+
+	if (VGM_Is_VGM_File(input))
+	{
+		Batch_VGM_Job(b, worker, input);
+		return;
+	}
+
+	if (!Input_Open(&worker->input, input))
+	{
+		fprintf(stderr, "%s: skipped\n", input);
+		worker->failures++;
+		return;
+	}
+
+	//Files that haven't changed since last time come straight out of the cache
+	if (b->cache != NULL)
+	{
+		Cache_Hash(worker->input.data, worker->input.size, &hash);
+		if (Batch_From_Cache(b, &hash, input))
+		{
+			Input_Close(&worker->input);
+			return;
+		}
+	}
+
+	//NSF files play their starting song for the default length. We're already
+	//running one file per core, so don't split up the tracks.
+	data = worker->input.data;
+	size = worker->input.size;
+	if (!Convert_Input(&data, &size, -1, NSF_DEFAULT_SECONDS, b->lengths->ppqn, &converted))
+	{
+		fprintf(stderr, "%s: failed\n", input);
+		worker->failures++;
+		Input_Close(&worker->input);
+		return;
+	}
+	ok = Events_Load(&store, data, size, 1);
+	Store_Error(&store, input);
+	if (!ok)
+	{
+		worker->failures++;
+		Events_Free(&store);
+		free(converted);
+		Input_Close(&worker->input);
+		return;
 	}
+
+	baseName = Batch_Base_Name(input);
+	outName = malloc(strlen(b->outDir) + strlen(baseName) + 16);
+	if (outName == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		worker->failures++;
+		Events_Free(&store);
+		free(converted);
+		Input_Close(&worker->input);
+		return;
+	}
+
+	//If we were asked for all of the channels, only write the ones with
+	//something in them
+	channels = b->allChannels ? Events_Active_Channels(&store) : b->channels;
+	for (c = 0; c < 16; c++)
+	{
+		if (!(channels & (1u << c)))
+			continue;
+		sprintf(outName, "%s/%s.ch%d.txt", b->outDir, baseName, c);
+		fd = open(outName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0)
+		{
+			fprintf(stderr, "Error opening file %s: %s\n\n", outName, strerror(errno));
+			worker->failures++;
+			channels &= ~(1u << c);
+			continue;
+		}
+		Out_Reset(&worker->out[c], fd);
+		out[c] = &worker->out[c];
+	}
+
+	if (channels != 0)
+	{
+		Notes_Init(&state, b->lengths, channels, out);
+		Process_Events(&state, &store);
+		Notes_End(&state);
+	}
+
+	for (c = 0; c < 16; c++)
+	{
+		if (out[c] == NULL)
+			continue;
+		if (state.failed || (state.failedChannels & (1u << c)))
+		{
+			fprintf(stderr, "%s: channel %d failed\n", input, c);
+			worker->failures++;
+		}
+		if (!Out_Flush(out[c]) || close(out[c]->fd) != 0)
+		{
+			sprintf(outName, "%s/%s.ch%d.txt", b->outDir, baseName, c);
+			fprintf(stderr, "Error writing file %s: %s\n\n", outName, strerror(errno));
+			worker->failures++;
+		}
+	}
+
+	//Only a clean conversion goes in the cache
+	if (b->cache != NULL && worker->failures == failures)
+		Batch_To_Cache(b, &hash, outName, baseName, channels);
+
+	free(outName);
+	Events_Free(&store);
+	free(converted);
+	Input_Close(&worker->input);
+}
+
+
+//Batch mode entry point. The arguments are everything after the -b flag.
+int Batch_Main(int argc, char *argv[], struct conv_cache *cache)
+{
+	struct batch b;
+	struct stat info;
+	unsigned numThreads, t;
+	size_t failures = 0, i;
+	int a, c;
+	bool ok = true;
+
+	if (argc < 4)
+	{
+		fprintf(stderr, "Usage:\n\tmidi_notes [--cache <dir>] -b <PPQN> <channel[,channel...] or all> "
+		        "<output dir> <input file, directory, or @list>...\n\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.lengths = Lengths_Get(strtol(argv[0], NULL, 10));
+	if (b.lengths == NULL)
+		return EXIT_FAILURE;
+	if (!Parse_Channels(argv[1], &b.channels, &b.allChannels))
+		return EXIT_FAILURE;
+	b.outDir = argv[2];
+	b.cache = cache;
+
+	//Gather up all of the inputs before starting any work
+	for (a = 3; a < argc && ok; a++)
+	{
+		if (argv[a][0] == '@')
+			ok = Batch_Add_List(&b, argv[a] + 1);
+		else if (stat(argv[a], &info) == 0 && S_ISDIR(info.st_mode))
+			ok = Batch_Add_Directory(&b, argv[a]);
+		else
+			ok = Batch_Add_Input(&b, argv[a]);
+	}
+	ok = ok && Batch_Check_Names(&b);
+
+	numThreads = Pool_Default_Threads();
+	b.workers = calloc(numThreads, sizeof(struct batch_worker));
+	if (ok && b.workers == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		ok = false;
+	}
+
+	if (ok)
+	{
+		Pool_Run(b.numInputs, numThreads, Batch_Job, &b);
+		for (t = 0; t < numThreads; t++)
+		{
+			failures += b.workers[t].failures;
+			Input_Free(&b.workers[t].input);
+			for (c = 0; c < 16; c++)
+				Out_Free(&b.workers[t].out[c]);
+		}
+		fprintf(stderr, "Converted %zu files, %zu failures\n", b.numInputs, failures);
+	}
+
+	for (i = 0; i < b.numInputs; i++)
+		free(b.inputs[i]);
+	free(b.inputs);
+	free(b.workers);
+	Lengths_Free_All();
+
+	return (ok && failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
-			
-			
-			
@@ -0,0 +1,98 @@
+//Embeddable MIDI parser. The chunks are found with Chunk_Read() and the tracks
+//are decoded with a track cursor, which are the same pieces the rest of the
+//decoders are made of. The cursor gives absolute times, so they're turned back
+//into delta times for the callbacks.
+
+#include <string.h>
+#include "midi_parse.h"
+#include "midi_decode.h"
+
+
+void Parser_Init(struct midi_parser *p, const struct midi_stream_handler *handler, void *user)
+{
+	memset(p, 0, sizeof(*p));
+	p->handler = handler;
+	p->user = user;
+}
+
+
+//Pass the header chunk's fields on
+static enum midi_error Parse_Header(struct midi_parser *p, const struct midi_chunk *chunk)
+{
+	struct midi_header header;
+	enum midi_error error;
+
+	error = Header_Read(chunk, &header);
+	if (error != MIDI_OK)
+		return error;
+	if (p->handler->header != NULL && !p->handler->header(p->user, chunk->length, &header))
+		return MIDI_ERROR_STOPPED;
+	return MIDI_OK;
+}
+
+
+//Pass one event on to the callback for its kind
+static bool Parse_Event(struct midi_parser *p, const struct track_event *e, uint32_t delta)
+{
+	const struct midi_stream_handler *h = p->handler;
+	uint8_t status = e->event.status, data[2] = {e->event.data1, e->event.data2};
+
+	if ((status & 0xF0) < 0xF0)
+		return h->event == NULL || h->event(p->user, delta, status, data);
+	if (status == MIDI_EVENT_META)
+		return h->meta == NULL || h->meta(p->user, delta, e->event.data1, e->payload, e->length);
+	return h->sysex == NULL || h->sysex(p->user, delta, status, e->length);
+}
+
+
+//Decode a track chunk and pass on each event
+static enum midi_error Parse_Track(struct midi_parser *p, const struct midi_chunk *chunk)
+{
+	struct track_cursor c;
+	struct track_event e;
+	uint32_t lastTime = 0;
+
+	p->tracks++;
+	if (p->handler->track != NULL && !p->handler->track(p->user, chunk->length))
+		return MIDI_ERROR_STOPPED;
+
+	Cursor_Init(&c, chunk);
+	while (Cursor_Next(&c, &e))
+	{
+		if (!Parse_Event(p, &e, e.time - lastTime))
+		{
+			p->errorPos = (size_t)(chunk->data - p->data) + c.pos;
+			return MIDI_ERROR_STOPPED;
+		}
+		lastTime = e.time;
+	}
+
+	p->errorPos = (size_t)(chunk->data - p->data) + c.pos;
+	return c.error;
+}
+
+
+//Parse a whole file. Returns MIDI_OK if every chunk was good and no callback
+//asked to stop. Otherwise p->errorPos is about where the parse stopped.
+enum midi_error Parse_Buffer(struct midi_parser *p, const uint8_t *data, size_t size)
+{
+	struct midi_chunk chunk;
+	size_t pos = 0;
+
+	p->data = data;
+	p->tracks = 0;
+	p->error = MIDI_OK;
+	while (pos < size && p->error == MIDI_OK)
+	{
+		p->errorPos = pos;
+		p->error = Chunk_Read(data, size, &pos, &chunk);
+		if (p->error != MIDI_OK)
+			break;
+		if (chunk.type == MIDI_HEADER_CHUNK)
+			p->error = Parse_Header(p, &chunk);
+		else
+			p->error = Parse_Track(p, &chunk);
+	}
+
+	return p->error;
+}
@@ -0,0 +1,31 @@
+//Embeddable MIDI parser. This walks a MIDI file that's already in memory and
+//calls back for every chunk and event, with the same callbacks as the streaming
+//decoder (struct midi_stream_handler). It's meant for programs that want to
+//read MIDI files themselves instead of running midi_dump and reading its text:
+//nothing gets printed, nothing gets allocated, and nothing calls exit(). If
+//anything goes wrong, the parse stops and the error code says why. All of the
+//state is in struct midi_parser, so any number of files can be parsed at once
+//on different threads.
+
+#ifndef MIDI_PARSE_H
+#define MIDI_PARSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "midi_types.h"
+#include "midi_stream.h"
+
+struct midi_parser
+{
+	const struct midi_stream_handler *handler;
+	void *user;
+	const uint8_t *data;     //File being parsed
+	size_t tracks;           //Track chunks started so far
+	enum midi_error error;   //Why the parse stopped
+	size_t errorPos;         //Offset in the file where it stopped
+};
+
+void Parser_Init(struct midi_parser *p, const struct midi_stream_handler *handler, void *user);
+enum midi_error Parse_Buffer(struct midi_parser *p, const uint8_t *data, size_t size);
+
+#endif
@@ -0,0 +1,361 @@
+//Streaming MIDI decoder. This is the same format logic as Index_Chunks() and
+//Decode_Track(), but turned inside out: rather than walking a buffer, we get
+//handed one block at a time and have to remember exactly where we were when it
+//ran out. That's what lets the tools read from pipes without knowing the file
+//size or keeping more than one block in memory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "midi_types.h"
+#include "midi_stream.h"
+#include "midi_input.h"
+#include "midi_decode.h"
+
+
+//Set up a decoder to start at the beginning of a file
+void Stream_Init(struct midi_stream *s, const struct midi_stream_handler *handler,
+                 void *user)
+{
+	memset(s, 0, sizeof(*s));
+	s->handler = handler;
+	s->user = user;
+	s->state = STREAM_CHUNK_TYPE;
+	s->needed = 2*sizeof(uint32_t);
+}
+
+
+//Stop decoding for good, and remember why
+static bool Stream_Fail(struct midi_stream *s, enum midi_error error)
+{
+	s->state = STREAM_ERROR;
+	s->error = error;
+	return false;
+}
+
+
+//Move to a new state and reset whatever that state collects into
+static void Stream_Enter(struct midi_stream *s, enum stream_state next)
+{
+	s->state = next;
+	s->varLen = 0;
+	s->varLenSize = 0;
+	s->have = 0;
+	if (next == STREAM_CHUNK_TYPE)
+		s->needed = 2*sizeof(uint32_t);
+}
+
+
+//Skip some bytes of the current chunk, then move on to the next state
+static bool Stream_Skip(struct midi_stream *s, uint32_t count, enum stream_state next)
+{
+	if (count > s->chunkLeft)
+	{
+		return Stream_Fail(s, MIDI_ERROR_EVENT_LENGTH);
+	}
+
+	if (count > 0)
+	{
+		s->skip = count;
+		s->afterSkip = next;
+		s->state = STREAM_SKIP;
+	} else
+	{
+		Stream_Enter(s, next);
+	}
+	return true;
+}
+
+
+//Add one byte to a variable-length value. Returns true when the value is
+//complete. See VarLen_Read() for the format.
+static bool Stream_VarLen(struct midi_stream *s, uint8_t byte)
+{
+	s->varLen = (s->varLen << 7) | (byte & 0x7F);
+	s->varLenSize++;
+
+	return (byte & 0x80) == 0x00 || s->varLenSize == 4;
+}
+
+
+//We have a complete chunk type and length in the buffer. Figure out what to do
+//with the chunk.
+static bool Stream_Chunk_Start(struct midi_stream *s)
+{
+	uint32_t type, length;
+
+	type = (uint32_t)s->buffer[0] << 24 | (uint32_t)s->buffer[1] << 16 |
+	       (uint32_t)s->buffer[2] << 8  | (uint32_t)s->buffer[3];
+	length = (uint32_t)s->buffer[4] << 24 | (uint32_t)s->buffer[5] << 16 |
+	         (uint32_t)s->buffer[6] << 8  | (uint32_t)s->buffer[7];
+	s->chunkLeft = length;
+
+	if (type == MIDI_HEADER_CHUNK)
+	{
+		if (length < 3*sizeof(uint16_t))
+		{
+			return Stream_Fail(s, MIDI_ERROR_SHORT_HEADER);
+		}
+		Stream_Enter(s, STREAM_HEADER);
+		s->needed = 3*sizeof(uint16_t);
+	} else if (type == MIDI_TRACK_CHUNK)
+	{
+		if (s->handler->track != NULL && !s->handler->track(s->user, length))
+			return Stream_Fail(s, MIDI_ERROR_STOPPED);
+		s->running = 0;
+		Stream_Enter(s, STREAM_DELTA);
+	} else
+	{
+		return Stream_Fail(s, MIDI_ERROR_UNKNOWN_CHUNK);
+	}
+
+	return true;
+}
+
+
+//We have the header fields in the buffer
+static bool Stream_Header(struct midi_stream *s)
+{
+	struct midi_header header;
+	uint16_t temp;
+
+	header.format = (uint16_t)s->buffer[0] << 8 | s->buffer[1];
+	header.tracks = (uint16_t)s->buffer[2] << 8 | s->buffer[3];
+	temp = (uint16_t)s->buffer[4] << 8 | s->buffer[5];
+	header.division = temp & 0x7FFF;
+	header.divType = temp >> 15;
+
+	if (s->handler->header != NULL &&
+	    !s->handler->header(s->user, s->chunkLeft + 3*sizeof(uint16_t), &header))
+		return Stream_Fail(s, MIDI_ERROR_STOPPED);
+
+	//Ignore any extra data as per the MIDI spec
+	return Stream_Skip(s, s->chunkLeft, STREAM_CHUNK_TYPE);
+}
+
+
+//Add a data byte to a channel message, and pass the message on once it's
+//complete
+static bool Stream_Data(struct midi_stream *s, uint8_t byte)
+{
+	s->buffer[s->have++] = byte;
+	if (s->have < s->needed)
+		return true;
+
+	if (s->handler->event != NULL &&
+	    !s->handler->event(s->user, s->delta, s->status, s->buffer))
+		return Stream_Fail(s, MIDI_ERROR_STOPPED);
+	Stream_Enter(s, STREAM_DELTA);
+	return true;
+}
+
+
+//We have a status byte. Set up to read the rest of the event. A data byte
+//instead means running status: it's the first data byte of a channel message
+//with the same status as the last one. Running status carries on past SysEx
+//and meta events, the same as in Cursor_Next().
+static bool Stream_Status(struct midi_stream *s, uint8_t status)
+{
+	if (statusClass[status] == STATUS_RUNNING && s->running != 0)
+	{
+		s->status = s->running;
+		Stream_Enter(s, STREAM_DATA);
+		s->needed = (statusClass[s->status] == STATUS_CHANNEL1) ? 1 : 2;
+		return Stream_Data(s, status);
+	}
+
+	s->status = status;
+	switch (statusClass[status])
+	{
+		case STATUS_CHANNEL1:
+		case STATUS_CHANNEL2:
+			s->running = status;
+			Stream_Enter(s, STREAM_DATA);
+			s->needed = (statusClass[status] == STATUS_CHANNEL1) ? 1 : 2;
+			return true;
+		case STATUS_SYSEX:
+			Stream_Enter(s, STREAM_SYSEX_LENGTH);
+			return true;
+		case STATUS_META:
+			s->state = STREAM_META_TYPE;
+			return true;
+		default:
+			return Stream_Fail(s, MIDI_ERROR_UNKNOWN_EVENT);
+	}
+}
+
+
+//We have as much of a meta event's data as we're going to keep. Pass it on and
+//skip whatever's left. If this is the end of the track, skip anything else in
+//the track chunk too.
+static bool Stream_Meta(struct midi_stream *s)
+{
+	if (s->handler->meta != NULL &&
+	    !s->handler->meta(s->user, s->delta, s->metaType, s->buffer, s->eventLen))
+		return Stream_Fail(s, MIDI_ERROR_STOPPED);
+
+	if (s->metaType == MIDI_META_END_OF_TRACK)
+		return Stream_Skip(s, s->chunkLeft, STREAM_CHUNK_TYPE);
+
+	return Stream_Skip(s, s->eventLen - s->have, STREAM_DELTA);
+}
+
+
+//Decode a block of input. Returns false if the data is bad or a callback asked
+//us to stop; after that, the decoder ignores any further input.
+bool Stream_Feed(struct midi_stream *s, const uint8_t *data, size_t size)
+{
+	size_t pos = 0;
+	uint32_t take;
+	uint8_t byte;
+
+	while (pos < size)
+	{
+		//Skips can cover lots of bytes at once
+		if (s->state == STREAM_SKIP)
+		{
+			take = (s->skip < size - pos) ? s->skip : (uint32_t)(size - pos);
+			pos += take;
+			s->skip -= take;
+			s->chunkLeft -= take;
+			if (s->skip == 0)
+				Stream_Enter(s, s->afterSkip);
+			continue;
+		}
+
+		if (s->state == STREAM_ERROR)
+			return false;
+
+		//A track that runs out of data without an End of Track event just ends
+		if (s->state == STREAM_DELTA && s->varLenSize == 0 && s->chunkLeft == 0)
+		{
+			Stream_Enter(s, STREAM_CHUNK_TYPE);
+			continue;
+		}
+
+		//Every other state takes one byte. Everything except the chunk type and
+		//length comes out of the current chunk.
+		byte = data[pos++];
+		if (s->state != STREAM_CHUNK_TYPE)
+		{
+			if (s->chunkLeft == 0)
+			{
+				return Stream_Fail(s, MIDI_ERROR_EVENT_LENGTH);
+			}
+			s->chunkLeft--;
+		}
+
+		switch (s->state)
+		{
+			case STREAM_CHUNK_TYPE:
+				s->buffer[s->have++] = byte;
+				if (s->have == s->needed && !Stream_Chunk_Start(s))
+					return false;
+				break;
+			case STREAM_HEADER:
+				s->buffer[s->have++] = byte;
+				if (s->have == s->needed && !Stream_Header(s))
+					return false;
+				break;
+			case STREAM_DELTA:
+				if (Stream_VarLen(s, byte))
+				{
+					s->delta = s->varLen;
+					s->state = STREAM_STATUS;
+				}
+				break;
+			case STREAM_STATUS:
+				if (!Stream_Status(s, byte))
+					return false;
+				break;
+			case STREAM_DATA:
+				if (!Stream_Data(s, byte))
+					return false;
+				break;
+			case STREAM_SYSEX_LENGTH:
+				if (Stream_VarLen(s, byte))
+				{
+					if (s->handler->sysex != NULL &&
+					    !s->handler->sysex(s->user, s->delta, s->status, s->varLen))
+						return Stream_Fail(s, MIDI_ERROR_STOPPED);
+					if (!Stream_Skip(s, s->varLen, STREAM_DELTA))
+						return false;
+				}
+				break;
+			case STREAM_META_TYPE:
+				s->metaType = byte;
+				Stream_Enter(s, STREAM_META_LENGTH);
+				break;
+			case STREAM_META_LENGTH:
+				if (Stream_VarLen(s, byte))
+				{
+					s->eventLen = s->varLen;
+					Stream_Enter(s, STREAM_META_DATA);
+					s->needed = (s->eventLen < MIDI_STREAM_META_MAX) ?
+					            s->eventLen : MIDI_STREAM_META_MAX;
+					if (s->needed == 0 && !Stream_Meta(s))
+						return false;
+				}
+				break;
+			case STREAM_META_DATA:
+				s->buffer[s->have++] = byte;
+				if (s->have == s->needed && !Stream_Meta(s))
+					return false;
+				break;
+			default:
+				return Stream_Fail(s, MIDI_ERROR_STOPPED);
+		}
+	}
+
+	return s->state != STREAM_ERROR;
+}
+
+
+//Call this at the end of the input. The file is only complete if we ended
+//cleanly between two chunks.
+bool Stream_Finish(struct midi_stream *s)
+{
+	if (s->state == STREAM_ERROR)
+		return false;
+
+	//A track without an End of Track event can end right at the end of the file
+	if (s->state == STREAM_DELTA && s->varLenSize == 0 && s->chunkLeft == 0)
+		return true;
+
+	if (s->state != STREAM_CHUNK_TYPE || s->have != 0)
+	{
+		return Stream_Fail(s, MIDI_ERROR_TRUNCATED);
+	}
+
+	return true;
+}
+
+
+//Decode a whole file one block at a time. A filename of "-" means standard
+//input, which is the main reason this exists.
+static bool Stream_Feed_Block(void *decoder, const uint8_t *data, size_t size)
+{
+	return Stream_Feed(decoder, data, size);
+}
+
+static bool Stream_Finish_Input(void *decoder)
+{
+	return Stream_Finish(decoder);
+}
+
+bool Stream_Run_File(struct midi_stream *s, const char *filename)
+{
+	if (Input_Run_Blocks(filename, Stream_Feed_Block, Stream_Finish_Input, s))
+		return true;
+	Stream_Print_Error(s);
+	return false;
+}
+
+
+//Print why the decoder stopped. If a callback stopped it, the callback has
+//already had its say.
+void Stream_Print_Error(const struct midi_stream *s)
+{
+	if (s->state == STREAM_ERROR && s->error != MIDI_ERROR_STOPPED)
+		fprintf(stderr, "Error: %s\n", MIDI_Error_String(s->error));
+}
@@ -0,0 +1,87 @@
+//Streaming MIDI decoder. Instead of needing the whole file in memory, this
+//takes the input in blocks of any size and calls back for each chunk and event
+//as soon as it's complete. All of the decoder state fits in a fixed-size
+//struct, so memory use doesn't depend on the size of the file.
+
+#ifndef MIDI_STREAM_H
+#define MIDI_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "midi_types.h"
+
+//How many bytes of each meta event's data are kept and passed to the callback.
+//The rest is skipped. The longest meta event we care about is Set Tempo.
+#define MIDI_STREAM_META_MAX 16
+
+//Event callbacks. Every callback returns true to keep going or false to stop
+//the decoder. Delta times are passed as-is; it's up to the caller to keep the
+//running time. Any callback can be NULL if the caller doesn't care.
+struct midi_stream_handler
+{
+	//Header chunk, with the chunk length and the parsed header fields
+	bool (*header)(void *user, uint32_t length, const struct midi_header *header);
+
+	//Start of a track chunk
+	bool (*track)(void *user, uint32_t length);
+
+	//MIDI channel message. data[1] is only valid for three-byte messages.
+	bool (*event)(void *user, uint32_t delta, uint8_t status, const uint8_t *data);
+
+	//SysEx event. The payload is skipped.
+	bool (*sysex)(void *user, uint32_t delta, uint8_t status, uint32_t length);
+
+	//Meta event. Only the first MIDI_STREAM_META_MAX bytes of data are kept,
+	//but length is the full length from the file.
+	bool (*meta)(void *user, uint32_t delta, uint8_t type, const uint8_t *data,
+	             uint32_t length);
+};
+
+//Decoder states. The decoder can stop at any byte and pick up where it left off
+//when the next block arrives, including in the middle of a variable-length
+//value or a long SysEx payload.
+enum stream_state
+{
+	STREAM_CHUNK_TYPE,    //Reading a chunk's type and length
+	STREAM_HEADER,        //Reading the header chunk's fields
+	STREAM_DELTA,         //Reading an event's delta time
+	STREAM_STATUS,        //Reading an event's status byte
+	STREAM_DATA,          //Reading a channel message's data bytes
+	STREAM_SYSEX_LENGTH,  //Reading a SysEx event's length
+	STREAM_META_TYPE,     //Reading a meta event's type
+	STREAM_META_LENGTH,   //Reading a meta event's length
+	STREAM_META_DATA,     //Reading a meta event's data
+	STREAM_SKIP,          //Skipping bytes we don't need
+	STREAM_ERROR,         //Bad data or a callback asked us to stop
+};
+
+struct midi_stream
+{
+	const struct midi_stream_handler *handler;
+	void *user;
+	enum stream_state state;
+	enum stream_state afterSkip;  //Where to go once the skip is done
+	uint32_t skip;                //Bytes left to skip
+	uint32_t chunkLeft;           //Bytes left in the current chunk
+	uint32_t varLen;              //Variable-length value in progress
+	uint8_t varLenSize;           //Bytes of it read so far
+	uint32_t delta;               //Delta time of the current event
+	uint32_t eventLen;            //Length of the current meta event
+	uint8_t status;               //Status byte of the current event
+	uint8_t running;              //Status byte of the last channel message
+	uint8_t metaType;             //Type of the current meta event
+	uint32_t needed;              //Bytes wanted in the buffer
+	uint32_t have;                //Bytes in the buffer so far
+	uint8_t buffer[MIDI_STREAM_META_MAX];
+	enum midi_error error;        //Why the decoder stopped, in STREAM_ERROR
+};
+
+void Stream_Init(struct midi_stream *s, const struct midi_stream_handler *handler,
+                 void *user);
+bool Stream_Feed(struct midi_stream *s, const uint8_t *data, size_t size);
+bool Stream_Finish(struct midi_stream *s);
+bool Stream_Run_File(struct midi_stream *s, const char *filename);
+void Stream_Print_Error(const struct midi_stream *s);
+
+#endif
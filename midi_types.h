@@ -1,6 +1,10 @@
 //MIDI standard file data structures
 
+#ifndef MIDI_TYPES_H
+#define MIDI_TYPES_H
+
 #include <stdint.h>
+#include <stddef.h>
 
 //Variable-length values can be from 1-4 bytes long, with 1 bit per byte used as
 //a flag. It's helpful to be able to return both the numerical value and its
@@ -17,7 +21,7 @@ struct midi_chunk
 {
 	uint32_t type;
 	uint32_t length;
-	uint8_t *data;
+	const uint8_t *data;
 };
 
 //Chunk types. These are ASCII for "Mthd" and "Mtrk".
@@ -91,6 +95,27 @@ struct midi_event
 #define MIDI_META_KEY_SIGNATURE      0x59
 #define MIDI_META_SEQUENCER_SPECIFIC 0x7F
 
+//Marker text for loop points. There's no standard way to mark a loop, but lots
+//of game music rips use markers with these names, so that's what we write too.
+#define MIDI_MARKER_LOOP_START "loopStart"
+#define MIDI_MARKER_LOOP_END   "loopEnd"
 
+//Everything that can go wrong while decoding a file. The decoders hand these
+//back instead of printing anything, so they can be used by programs that don't
+//have a terminal. MIDI_Error_String() turns one into a message.
+enum midi_error
+{
+	MIDI_OK,
+	MIDI_ERROR_TRUNCATED,        //The file ends in the middle of a chunk
+	MIDI_ERROR_CHUNK_LENGTH,     //A chunk runs past the end of the file
+	MIDI_ERROR_SHORT_HEADER,     //The header chunk is too short
+	MIDI_ERROR_UNKNOWN_CHUNK,
+	MIDI_ERROR_UNKNOWN_EVENT,
+	MIDI_ERROR_EVENT_LENGTH,     //An event runs past the end of its track chunk
+	MIDI_ERROR_NO_END_OF_TRACK,  //A track's data runs out in the middle of an event
+	MIDI_ERROR_BAD_SEEK,         //A saved spot is past the end of its track
+	MIDI_ERROR_NO_MEMORY,
+	MIDI_ERROR_STOPPED,          //A callback asked to stop
+};
 
-
+#endif
@@ -0,0 +1,134 @@
+//MIDI file writer. Events are given with absolute times, and the writer turns
+//them into delta times. Events have to be written in time order within each
+//track.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "midi_write.h"
+#include "midi_types.h"
+
+
+static void Put_BE32(struct midi_writer *w, uint32_t value)
+{
+	char bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+
+	Out_Append(&w->out, bytes, sizeof(bytes));
+}
+
+//Write a variable-length value. See VarLen_Read() for the format.
+static void Put_VarLen(struct midi_writer *w, uint32_t value)
+{
+	char bytes[4];
+	int n = 0;
+
+	do
+	{
+		bytes[3 - n] = (value & 0x7F) | (n > 0 ? 0x80 : 0x00);
+		value >>= 7;
+		n++;
+	} while (value != 0 && n < 4);
+	Out_Append(&w->out, bytes + 4 - n, n);
+}
+
+static void Put_Delta(struct midi_writer *w, uint32_t time)
+{
+	Put_VarLen(w, time >= w->lastTime ? time - w->lastTime : 0);
+	if (time > w->lastTime)
+		w->lastTime = time;
+}
+
+
+//Start with an empty file in memory
+void Writer_Init(struct midi_writer *w)
+{
+	Out_Init(&w->out, -1);
+	w->trackStart = 0;
+	w->lastTime = 0;
+}
+
+void Writer_Header(struct midi_writer *w, uint16_t format, uint16_t tracks, uint16_t division)
+{
+	char header[6] = {format >> 8, format, tracks >> 8, tracks, (division >> 8) & 0x7F, division};
+
+	Put_BE32(w, MIDI_HEADER_CHUNK);
+	Put_BE32(w, sizeof(header));
+	Out_Append(&w->out, header, sizeof(header));
+}
+
+//Start a track chunk. The length is filled in by Writer_End_Track().
+void Writer_Begin_Track(struct midi_writer *w)
+{
+	Put_BE32(w, MIDI_TRACK_CHUNK);
+	w->trackStart = w->out.used;
+	Put_BE32(w, 0);
+	w->lastTime = 0;
+}
+
+//Write a channel message. Program change and channel pressure only have one
+//data byte, so data2 is ignored for those.
+void Writer_Event(struct midi_writer *w, uint32_t time, uint8_t status, uint8_t data1,
+                  uint8_t data2)
+{
+	char bytes[3] = {status, data1 & 0x7F, data2 & 0x7F};
+
+	Put_Delta(w, time);
+	if ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0)
+		Out_Append(&w->out, bytes, 2);
+	else
+		Out_Append(&w->out, bytes, 3);
+}
+
+void Writer_Meta(struct midi_writer *w, uint32_t time, uint8_t type, const void *data,
+                 uint32_t length)
+{
+	char bytes[2] = {MIDI_EVENT_META, type};
+
+	Put_Delta(w, time);
+	Out_Append(&w->out, bytes, sizeof(bytes));
+	Put_VarLen(w, length);
+	if (length > 0)
+		Out_Append(&w->out, data, length);
+}
+
+void Writer_Tempo(struct midi_writer *w, uint32_t time, uint32_t tempo)
+{
+	uint8_t bytes[3] = {tempo >> 16, tempo >> 8, tempo};
+
+	Writer_Meta(w, time, MIDI_META_SET_TEMPO, bytes, sizeof(bytes));
+}
+
+//End the track with an End of Track event and fill in the chunk length
+void Writer_End_Track(struct midi_writer *w, uint32_t time)
+{
+	uint32_t length;
+	uint8_t bytes[4];
+
+	Writer_Meta(w, time, MIDI_META_END_OF_TRACK, NULL, 0);
+	if (w->out.failed)
+		return;
+
+	length = (uint32_t)(w->out.used - w->trackStart - sizeof(uint32_t));
+	bytes[0] = length >> 24;
+	bytes[1] = length >> 16;
+	bytes[2] = length >> 8;
+	bytes[3] = length;
+	memcpy(w->out.data + w->trackStart, bytes, sizeof(bytes));
+}
+
+//Hand over the finished file. The caller frees *data. Returns false if we ran
+//out of memory along the way.
+bool Writer_Finish(struct midi_writer *w, uint8_t **data, size_t *size)
+{
+	if (w->out.failed)
+	{
+		Out_Free(&w->out);
+		return false;
+	}
+
+	*data = (uint8_t *)w->out.data;
+	*size = w->out.used;
+	w->out.data = NULL;
+	Out_Free(&w->out);
+	return true;
+}
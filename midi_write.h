@@ -0,0 +1,31 @@
+//MIDI file writer. This builds a Standard MIDI File in memory, which is how the
+//other input formats get converted: they're turned into a MIDI file and run
+//through the same code as real MIDI files.
+
+#ifndef MIDI_WRITE_H
+#define MIDI_WRITE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "out_buffer.h"
+
+struct midi_writer
+{
+	struct out_buffer out;
+	size_t trackStart;    //Where the current track's length goes
+	uint32_t lastTime;    //Time of the last event in the current track
+};
+
+void Writer_Init(struct midi_writer *w);
+void Writer_Header(struct midi_writer *w, uint16_t format, uint16_t tracks, uint16_t division);
+void Writer_Begin_Track(struct midi_writer *w);
+void Writer_Event(struct midi_writer *w, uint32_t time, uint8_t status, uint8_t data1,
+                  uint8_t data2);
+void Writer_Meta(struct midi_writer *w, uint32_t time, uint8_t type, const void *data,
+                 uint32_t length);
+void Writer_Tempo(struct midi_writer *w, uint32_t time, uint32_t tempo);
+void Writer_End_Track(struct midi_writer *w, uint32_t time);
+bool Writer_Finish(struct midi_writer *w, uint8_t **data, size_t *size);
+
+#endif
@@ -0,0 +1,337 @@
+//NES APU register model. Register writes update the channel state right away,
+//and APU_Run() clocks the frame sequencer for however many CPU cycles have gone
+//by. The sequencer is what counts down the length counters and envelopes, so
+//it decides when notes end if the sound driver leaves that up to the hardware.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "nes_apu.h"
+
+//Length counter values, indexed by the top five bits of the length register
+static const uint8_t lengthTable[32] =
+{
+	10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+	12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+
+//Pitch of every pulse channel period, for each clock rate. A pulse channel
+//plays at the CPU clock divided by 16 times the period plus one. The triangle
+//divides by 32, which is an octave lower. The pitches are in cents above MIDI
+//key 0, so the key is the pitch divided by 100, rounded. Drivers change the
+//period for every step of a slide or vibrato, so it's worth doing the log math
+//ahead of time.
+static uint16_t g_pitchesNTSC[APU_PERIODS];
+static uint16_t g_pitchesPAL[APU_PERIODS];
+static pthread_once_t g_pitchesOnce = PTHREAD_ONCE_INIT;
+
+static void Build_Pitches(uint16_t *pitches, uint32_t clock)
+{
+	double cents;
+	int p;
+
+	for (p = 0; p < APU_PERIODS; p++)
+	{
+		cents = 6900 + 1200 * log2((double)clock / (16.0 * (p + 1)) / 440.0);
+		pitches[p] = (cents < 0) ? 0 : (cents > 12700) ? 12700 : (uint16_t)lround(cents);
+	}
+}
+
+static void Build_All_Pitches(void)
+{
+	Build_Pitches(g_pitchesNTSC, APU_CLOCK_NTSC);
+	Build_Pitches(g_pitchesPAL, APU_CLOCK_PAL);
+}
+
+
+void APU_Reset(struct nes_apu *apu, bool pal)
+{
+	pthread_once(&g_pitchesOnce, Build_All_Pitches);
+
+	memset(apu, 0, sizeof(*apu));
+	apu->quarterFrame = pal ? APU_QUARTER_FRAME_PAL : APU_QUARTER_FRAME_NTSC;
+	apu->pitches = pal ? g_pitchesPAL : g_pitchesNTSC;
+}
+
+
+//Where a pulse channel's sweep unit wants to take the period. The first pulse
+//channel subtracts one extra when sweeping down.
+static uint16_t Sweep_Target(const struct apu_pulse *p, int channel)
+{
+	uint16_t change = p->period >> (p->sweep & 0x07);
+
+	if (p->sweep & 0x08)
+		return p->period - change - (channel == 0 ? 1 : 0);
+	return p->period + change;
+}
+
+static bool Sweep_Muted(const struct apu_pulse *p, int channel)
+{
+	return p->period < 8 || (!(p->sweep & 0x08) && Sweep_Target(p, channel) > 0x7FF);
+}
+
+
+void APU_Write(struct nes_apu *apu, uint16_t address, uint8_t value)
+{
+	struct apu_pulse *p;
+	int c;
+
+	switch (address)
+	{
+		case 0x4000:
+		case 0x4004:
+			apu->pulse[(address >> 2) & 1].control = value;
+			break;
+		case 0x4001:
+		case 0x4005:
+			p = &apu->pulse[(address >> 2) & 1];
+			p->sweep = value;
+			p->sweepReload = true;
+			break;
+		case 0x4002:
+		case 0x4006:
+			p = &apu->pulse[(address >> 2) & 1];
+			p->period = (p->period & 0x700) | value;
+			break;
+		case 0x4003:
+		case 0x4007:
+			c = (address >> 2) & 1;
+			p = &apu->pulse[c];
+			p->period = (p->period & 0x0FF) | (uint16_t)(value & 0x07) << 8;
+			if (apu->enabled & (1 << c))
+				p->length = lengthTable[value >> 3];
+			p->envelope.start = true;
+			p->restarted = true;
+			break;
+		case 0x4008:
+			apu->triangle.control = value;
+			break;
+		case 0x400A:
+			apu->triangle.period = (apu->triangle.period & 0x700) | value;
+			break;
+		case 0x400B:
+			apu->triangle.period = (apu->triangle.period & 0x0FF) | (uint16_t)(value & 0x07) << 8;
+			if (apu->enabled & 0x04)
+				apu->triangle.length = lengthTable[value >> 3];
+			apu->triangle.linearReload = true;
+			break;
+		case 0x400C:
+			apu->noise.control = value;
+			break;
+		case 0x400E:
+			apu->noise.mode = value;
+			break;
+		case 0x400F:
+			if (apu->enabled & 0x08)
+				apu->noise.length = lengthTable[value >> 3];
+			apu->noise.envelope.start = true;
+			apu->noise.restarted = true;
+			break;
+		case 0x4015:
+			//Turning a channel off clears its length counter
+			apu->enabled = value & 0x1F;
+			if (!(value & 0x01))
+				apu->pulse[0].length = 0;
+			if (!(value & 0x02))
+				apu->pulse[1].length = 0;
+			if (!(value & 0x04))
+				apu->triangle.length = 0;
+			if (!(value & 0x08))
+				apu->noise.length = 0;
+			break;
+		case 0x4017:
+			apu->fiveStep = (value & 0x80) != 0;
+			apu->step = 0;
+			apu->cycles = 0;
+			break;
+		default:
+			//DMC and unused registers
+			break;
+	}
+}
+
+
+//Which channels still have time left on their length counters
+uint8_t APU_Read_Status(const struct nes_apu *apu)
+{
+	return (apu->pulse[0].length ? 0x01 : 0) |
+	       (apu->pulse[1].length ? 0x02 : 0) |
+	       (apu->triangle.length ? 0x04 : 0) |
+	       (apu->noise.length ? 0x08 : 0);
+}
+
+
+static void Clock_Envelope(struct apu_envelope *e, uint8_t control)
+{
+	if (e->start)
+	{
+		e->start = false;
+		e->decay = 15;
+		e->divider = control & 0x0F;
+	} else if (e->divider == 0)
+	{
+		e->divider = control & 0x0F;
+		if (e->decay > 0)
+			e->decay--;
+		else if (control & 0x20)
+			e->decay = 15;
+	} else
+	{
+		e->divider--;
+	}
+}
+
+//Envelopes and the triangle's linear counter
+static void Quarter_Frame(struct nes_apu *apu)
+{
+	struct apu_triangle *t = &apu->triangle;
+
+	Clock_Envelope(&apu->pulse[0].envelope, apu->pulse[0].control);
+	Clock_Envelope(&apu->pulse[1].envelope, apu->pulse[1].control);
+	Clock_Envelope(&apu->noise.envelope, apu->noise.control);
+
+	if (t->linearReload)
+		t->linear = t->control & 0x7F;
+	else if (t->linear > 0)
+		t->linear--;
+	if (!(t->control & 0x80))
+		t->linearReload = false;
+}
+
+//Length counters and sweep units
+static void Half_Frame(struct nes_apu *apu)
+{
+	struct apu_pulse *p;
+	int c;
+
+	for (c = 0; c < 2; c++)
+	{
+		p = &apu->pulse[c];
+		if (!(p->control & 0x20) && p->length > 0)
+			p->length--;
+
+		if (p->sweepDivider == 0 && (p->sweep & 0x80) && (p->sweep & 0x07) &&
+		    !Sweep_Muted(p, c))
+		{
+			p->period = Sweep_Target(p, c);
+		}
+		if (p->sweepDivider == 0 || p->sweepReload)
+		{
+			p->sweepDivider = (p->sweep >> 4) & 0x07;
+			p->sweepReload = false;
+		} else
+		{
+			p->sweepDivider--;
+		}
+	}
+
+	if (!(apu->triangle.control & 0x80) && apu->triangle.length > 0)
+		apu->triangle.length--;
+	if (!(apu->noise.control & 0x20) && apu->noise.length > 0)
+		apu->noise.length--;
+}
+
+
+//Clock the frame sequencer. In four-step mode, every step is a quarter frame
+//and every second one is a half frame too. Five-step mode leaves out the
+//fourth step, so it runs a little slower.
+void APU_Run(struct nes_apu *apu, uint32_t cycles)
+{
+	apu->cycles += cycles;
+	while (apu->cycles >= apu->quarterFrame)
+	{
+		apu->cycles -= apu->quarterFrame;
+		if (apu->fiveStep)
+		{
+			if (apu->step != 3)
+				Quarter_Frame(apu);
+			if (apu->step == 1 || apu->step == 4)
+				Half_Frame(apu);
+			apu->step = (apu->step + 1) % 5;
+		} else
+		{
+			Quarter_Frame(apu);
+			if (apu->step == 1 || apu->step == 3)
+				Half_Frame(apu);
+			apu->step = (apu->step + 1) % 4;
+		}
+	}
+}
+
+
+//Work out the MIDI key for a channel. While the pitch is sliding or wobbling,
+//the key only changes once the pitch is well past the halfway point to the
+//next one, so vibrato doesn't make new notes. The noise channel doesn't have a
+//pitch as such, so its period index is used to pick a key, with lower periods
+//(higher sounds) on higher keys.
+static uint8_t APU_Key(struct nes_apu *apu, int channel, const struct apu_voice *v)
+{
+	int32_t pitch, distance;
+	uint8_t *key = &apu->keys[channel];
+
+	if (!v->audible)
+	{
+		*key = 0;
+		return 0;
+	}
+	if (channel == APU_NOISE)
+	{
+		*key = 50 - (v->period & 0x0F) + ((v->period & 0x10) ? 16 : 0);
+		return *key;
+	}
+
+	pitch = apu->pitches[v->period & (APU_PERIODS - 1)];
+	if (channel == APU_TRIANGLE)
+		pitch = (pitch < 1200) ? 0 : pitch - 1200;
+
+	distance = pitch - *key * 100;
+	if (*key == 0 || abs(pitch - apu->lastPitches[channel]) >= APU_PITCH_JUMP ||
+	    abs(distance) > 50 + APU_PITCH_HYSTERESIS)
+		*key = (uint8_t)((pitch + 50) / 100);
+	apu->lastPitches[channel] = (uint16_t)pitch;
+	return *key;
+}
+
+
+//Report what each channel is doing, and clear the retrigger flags. Writing the
+//last register of a channel only counts as a retrigger if you can hear it,
+//which is when it restarts the hardware envelope. Plenty of drivers rewrite
+//the register every frame with constant volume, and the triangle doesn't
+//sound any different when it's retriggered.
+void APU_Voices(struct nes_apu *apu, struct apu_voice voices[APU_NUM_CHANNELS])
+{
+	struct apu_pulse *p;
+	struct apu_envelope *e;
+	int c;
+
+	for (c = 0; c < 2; c++)
+	{
+		p = &apu->pulse[c];
+		e = &p->envelope;
+		voices[c].period = p->period;
+		voices[c].volume = (p->control & 0x10) ? (p->control & 0x0F) : e->decay;
+		voices[c].audible = p->length > 0 && voices[c].volume > 0 && !Sweep_Muted(p, c);
+		voices[c].restarted = p->restarted && !(p->control & 0x10);
+		p->restarted = false;
+	}
+
+	//The triangle has no volume control. Periods under 2 are too high to
+	//hear, and drivers use them to silence it.
+	voices[APU_TRIANGLE].period = apu->triangle.period;
+	voices[APU_TRIANGLE].volume = 15;
+	voices[APU_TRIANGLE].audible = apu->triangle.length > 0 && apu->triangle.linear > 0 &&
+	                               apu->triangle.period >= 2;
+	voices[APU_TRIANGLE].restarted = false;
+
+	e = &apu->noise.envelope;
+	voices[APU_NOISE].period = (apu->noise.mode & 0x0F) | ((apu->noise.mode & 0x80) ? 0x10 : 0);
+	voices[APU_NOISE].volume = (apu->noise.control & 0x10) ? (apu->noise.control & 0x0F) : e->decay;
+	voices[APU_NOISE].audible = apu->noise.length > 0 && voices[APU_NOISE].volume > 0;
+	voices[APU_NOISE].restarted = apu->noise.restarted && !(apu->noise.control & 0x10);
+	apu->noise.restarted = false;
+
+	for (c = 0; c < APU_NUM_CHANNELS; c++)
+		voices[c].key = APU_Key(apu, c, &voices[c]);
+}
@@ -0,0 +1,110 @@
+//NES APU (2A03) register model. This doesn't make any sound. It keeps track of
+//the pulse, triangle, and noise channels' registers, along with the length
+//counters, envelopes, sweep units, and linear counter that decide when a
+//channel is audible, so that register writes can be turned into notes. The DMC
+//channel isn't tracked.
+
+#ifndef NES_APU_H
+#define NES_APU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum apu_channel
+{
+	APU_PULSE1,
+	APU_PULSE2,
+	APU_TRIANGLE,
+	APU_NOISE,
+	APU_NUM_CHANNELS
+};
+
+//CPU cycles between quarter-frame clocks of the frame sequencer
+#define APU_QUARTER_FRAME_NTSC 7457
+#define APU_QUARTER_FRAME_PAL  8313
+
+//CPU clock rates in Hz
+#define APU_CLOCK_NTSC 1789773
+#define APU_CLOCK_PAL  1662607
+
+//Timer periods are 11 bits
+#define APU_PERIODS 2048
+
+//How far past the halfway point to the next key a channel's pitch has to go,
+//in cents, before the key changes. Vibrato that wobbles around the halfway
+//point would turn into a string of short notes otherwise. A pitch that jumps by
+//APU_PITCH_JUMP cents or more from one frame to the next is a new note, and
+//goes straight to the nearest key.
+#define APU_PITCH_HYSTERESIS 20
+#define APU_PITCH_JUMP 50
+
+struct apu_envelope
+{
+	bool start;
+	uint8_t divider;
+	uint8_t decay;
+};
+
+struct apu_pulse
+{
+	uint8_t control;      //$4000: duty, halt, constant volume, volume
+	uint8_t sweep;        //$4001: enable, period, negate, shift
+	uint16_t period;      //$4002/$4003: 11-bit timer period
+	uint8_t length;       //Length counter
+	struct apu_envelope envelope;
+	uint8_t sweepDivider;
+	bool sweepReload;
+	bool restarted;       //$4003 was written since the last APU_Voices()
+};
+
+struct apu_triangle
+{
+	uint8_t control;      //$4008: halt/control, linear counter reload value
+	uint16_t period;
+	uint8_t length;
+	uint8_t linear;       //Linear counter
+	bool linearReload;
+};
+
+struct apu_noise
+{
+	uint8_t control;      //$400C: halt, constant volume, volume
+	uint8_t mode;         //$400E: mode and period index
+	uint8_t length;
+	struct apu_envelope envelope;
+	bool restarted;
+};
+
+struct nes_apu
+{
+	struct apu_pulse pulse[2];
+	struct apu_triangle triangle;
+	struct apu_noise noise;
+	uint8_t enabled;          //$4015 channel enable bits
+	bool fiveStep;            //$4017 sequencer mode
+	uint8_t step;             //Frame sequencer step
+	uint32_t quarterFrame;    //Cycles per sequencer step
+	uint32_t cycles;          //Cycles since the last step
+	const uint16_t *pitches;  //Pitch of each pulse period, in cents from key 0
+	uint8_t keys[APU_NUM_CHANNELS];  //Key each channel is on, or 0 if it's quiet
+	uint16_t lastPitches[APU_NUM_CHANNELS];  //Pitch on the last frame
+};
+
+//What a channel is doing right now
+struct apu_voice
+{
+	bool audible;
+	uint16_t period;     //Timer period. For noise, the period index plus 16
+	                     //if the short mode is on.
+	uint8_t key;         //MIDI key, or 0 if the channel isn't audible
+	uint8_t volume;      //0-15
+	bool restarted;      //The envelope was restarted since the last check
+};
+
+void APU_Reset(struct nes_apu *apu, bool pal);
+void APU_Write(struct nes_apu *apu, uint16_t address, uint8_t value);
+uint8_t APU_Read_Status(const struct nes_apu *apu);
+void APU_Run(struct nes_apu *apu, uint32_t cycles);
+void APU_Voices(struct nes_apu *apu, struct apu_voice voices[APU_NUM_CHANNELS]);
+
+#endif
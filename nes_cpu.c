@@ -0,0 +1,503 @@
+//6502 interpreter. Each opcode has an entry in a 256-entry table giving its
+//handler, addressing mode, and cycle count. Decoding an instruction is one
+//table lookup; the addressing mode works out the operand address, and the
+//handler does the rest. Page-crossing penalties and the exact timing of each
+//bus access aren't emulated, since all we need to know is roughly how long the
+//NSF routines take and what they write to the sound registers.
+//
+//The unofficial opcodes that some sound drivers use (LAX, SAX, DCP, ISC, SLO,
+//RLA, SRE, RRA, and the multi-byte NOPs) are included. Anything else locks up
+//the CPU, like it would on the real thing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nes_cpu.h"
+
+enum address_mode
+{
+	MODE_IMP,  //Implied or accumulator
+	MODE_IMM,  //Immediate
+	MODE_ZP,   //Zero page
+	MODE_ZPX,  //Zero page,X
+	MODE_ZPY,  //Zero page,Y
+	MODE_ABS,  //Absolute
+	MODE_ABX,  //Absolute,X
+	MODE_ABY,  //Absolute,Y
+	MODE_IND,  //(Indirect), only for JMP
+	MODE_IZX,  //(Indirect,X)
+	MODE_IZY,  //(Indirect),Y
+	MODE_REL,  //Relative, for branches
+};
+
+typedef void (*cpu_op)(struct nes_cpu *c, uint16_t address);
+
+struct opcode
+{
+	cpu_op op;
+	uint8_t mode;
+	uint8_t cycles;
+};
+
+
+//Memory access. RAM and ROM are handled here directly since they're nearly
+//every access; the rest goes to the I/O handlers.
+static inline uint8_t Read(struct nes_cpu *c, uint16_t address)
+{
+	if (address < 0x2000)
+		return c->ram[address & 0x7FF];
+	if (address >= 0x8000)
+		return c->rom[(address >> 12) - 8][address & 0xFFF];
+	if (address >= 0x6000)
+		return c->wram[address - 0x6000];
+	return c->ioRead ? c->ioRead(c->user, address) : 0;
+}
+
+static inline void Write(struct nes_cpu *c, uint16_t address, uint8_t value)
+{
+	if (address < 0x2000)
+		c->ram[address & 0x7FF] = value;
+	else if (address >= 0x8000)
+		return;
+	else if (address >= 0x6000)
+		c->wram[address - 0x6000] = value;
+	else if (c->ioWrite)
+		c->ioWrite(c->user, address, value);
+}
+
+static inline uint16_t Read16(struct nes_cpu *c, uint16_t address)
+{
+	return Read(c, address) | (uint16_t)Read(c, address + 1) << 8;
+}
+
+//Zero page pointers wrap around within the zero page
+static inline uint16_t Read16_ZP(struct nes_cpu *c, uint8_t address)
+{
+	return c->ram[address] | (uint16_t)c->ram[(uint8_t)(address + 1)] << 8;
+}
+
+static inline void Push(struct nes_cpu *c, uint8_t value)
+{
+	c->ram[0x100 + c->s--] = value;
+}
+
+static inline uint8_t Pull(struct nes_cpu *c)
+{
+	return c->ram[0x100 + ++c->s];
+}
+
+static inline void Set_ZN(struct nes_cpu *c, uint8_t value)
+{
+	c->p &= ~(CPU_FLAG_Z | CPU_FLAG_N);
+	c->p |= (value == 0 ? CPU_FLAG_Z : 0) | (value & CPU_FLAG_N);
+}
+
+
+//Work out the operand address for an addressing mode. The PC is left pointing
+//at the next instruction.
+static inline uint16_t Address(struct nes_cpu *c, uint8_t mode)
+{
+	uint16_t address, pointer;
+	int8_t offset;
+
+	switch (mode)
+	{
+		case MODE_IMM:
+			return c->pc++;
+		case MODE_ZP:
+			return Read(c, c->pc++);
+		case MODE_ZPX:
+			return (uint8_t)(Read(c, c->pc++) + c->x);
+		case MODE_ZPY:
+			return (uint8_t)(Read(c, c->pc++) + c->y);
+		case MODE_ABS:
+			address = Read16(c, c->pc);
+			c->pc += 2;
+			return address;
+		case MODE_ABX:
+			address = Read16(c, c->pc) + c->x;
+			c->pc += 2;
+			return address;
+		case MODE_ABY:
+			address = Read16(c, c->pc) + c->y;
+			c->pc += 2;
+			return address;
+		case MODE_IND:
+			//The high byte of the pointer doesn't carry into the next page
+			pointer = Read16(c, c->pc);
+			c->pc += 2;
+			return Read(c, pointer) |
+			       (uint16_t)Read(c, (pointer & 0xFF00) | ((pointer + 1) & 0x00FF)) << 8;
+		case MODE_IZX:
+			return Read16_ZP(c, Read(c, c->pc++) + c->x);
+		case MODE_IZY:
+			return Read16_ZP(c, Read(c, c->pc++)) + c->y;
+		case MODE_REL:
+			offset = (int8_t)Read(c, c->pc++);
+			return c->pc + offset;
+		default:
+			return 0;
+	}
+}
+
+
+//Shared pieces of the arithmetic and shift instructions
+static inline void Do_ADC(struct nes_cpu *c, uint8_t value)
+{
+	unsigned sum = c->a + value + (c->p & CPU_FLAG_C);
+
+	c->p &= ~(CPU_FLAG_C | CPU_FLAG_V);
+	c->p |= (sum > 0xFF ? CPU_FLAG_C : 0) |
+	        ((~(c->a ^ value) & (c->a ^ sum) & 0x80) ? CPU_FLAG_V : 0);
+	c->a = (uint8_t)sum;
+	Set_ZN(c, c->a);
+}
+
+static inline void Do_Compare(struct nes_cpu *c, uint8_t reg, uint8_t value)
+{
+	c->p = (c->p & ~CPU_FLAG_C) | (reg >= value ? CPU_FLAG_C : 0);
+	Set_ZN(c, reg - value);
+}
+
+static inline uint8_t Do_ASL(struct nes_cpu *c, uint8_t value)
+{
+	c->p = (c->p & ~CPU_FLAG_C) | (value >> 7);
+	value <<= 1;
+	Set_ZN(c, value);
+	return value;
+}
+
+static inline uint8_t Do_LSR(struct nes_cpu *c, uint8_t value)
+{
+	c->p = (c->p & ~CPU_FLAG_C) | (value & 0x01);
+	value >>= 1;
+	Set_ZN(c, value);
+	return value;
+}
+
+static inline uint8_t Do_ROL(struct nes_cpu *c, uint8_t value)
+{
+	uint8_t carry = c->p & CPU_FLAG_C;
+
+	c->p = (c->p & ~CPU_FLAG_C) | (value >> 7);
+	value = (value << 1) | carry;
+	Set_ZN(c, value);
+	return value;
+}
+
+static inline uint8_t Do_ROR(struct nes_cpu *c, uint8_t value)
+{
+	uint8_t carry = c->p & CPU_FLAG_C;
+
+	c->p = (c->p & ~CPU_FLAG_C) | (value & 0x01);
+	value = (value >> 1) | (carry << 7);
+	Set_ZN(c, value);
+	return value;
+}
+
+static inline void Branch(struct nes_cpu *c, uint16_t address, bool taken)
+{
+	if (taken)
+	{
+		c->cycles += ((c->pc ^ address) & 0xFF00) ? 2 : 1;
+		c->pc = address;
+	}
+}
+
+
+//Instruction handlers
+static void Op_ADC(struct nes_cpu *c, uint16_t a) { Do_ADC(c, Read(c, a)); }
+static void Op_SBC(struct nes_cpu *c, uint16_t a) { Do_ADC(c, Read(c, a) ^ 0xFF); }
+static void Op_AND(struct nes_cpu *c, uint16_t a) { c->a &= Read(c, a); Set_ZN(c, c->a); }
+static void Op_ORA(struct nes_cpu *c, uint16_t a) { c->a |= Read(c, a); Set_ZN(c, c->a); }
+static void Op_EOR(struct nes_cpu *c, uint16_t a) { c->a ^= Read(c, a); Set_ZN(c, c->a); }
+static void Op_CMP(struct nes_cpu *c, uint16_t a) { Do_Compare(c, c->a, Read(c, a)); }
+static void Op_CPX(struct nes_cpu *c, uint16_t a) { Do_Compare(c, c->x, Read(c, a)); }
+static void Op_CPY(struct nes_cpu *c, uint16_t a) { Do_Compare(c, c->y, Read(c, a)); }
+static void Op_LDA(struct nes_cpu *c, uint16_t a) { c->a = Read(c, a); Set_ZN(c, c->a); }
+static void Op_LDX(struct nes_cpu *c, uint16_t a) { c->x = Read(c, a); Set_ZN(c, c->x); }
+static void Op_LDY(struct nes_cpu *c, uint16_t a) { c->y = Read(c, a); Set_ZN(c, c->y); }
+static void Op_STA(struct nes_cpu *c, uint16_t a) { Write(c, a, c->a); }
+static void Op_STX(struct nes_cpu *c, uint16_t a) { Write(c, a, c->x); }
+static void Op_STY(struct nes_cpu *c, uint16_t a) { Write(c, a, c->y); }
+
+static void Op_ASL(struct nes_cpu *c, uint16_t a) { Write(c, a, Do_ASL(c, Read(c, a))); }
+static void Op_LSR(struct nes_cpu *c, uint16_t a) { Write(c, a, Do_LSR(c, Read(c, a))); }
+static void Op_ROL(struct nes_cpu *c, uint16_t a) { Write(c, a, Do_ROL(c, Read(c, a))); }
+static void Op_ROR(struct nes_cpu *c, uint16_t a) { Write(c, a, Do_ROR(c, Read(c, a))); }
+static void Op_ASL_A(struct nes_cpu *c, uint16_t a) { c->a = Do_ASL(c, c->a); }
+static void Op_LSR_A(struct nes_cpu *c, uint16_t a) { c->a = Do_LSR(c, c->a); }
+static void Op_ROL_A(struct nes_cpu *c, uint16_t a) { c->a = Do_ROL(c, c->a); }
+static void Op_ROR_A(struct nes_cpu *c, uint16_t a) { c->a = Do_ROR(c, c->a); }
+
+static void Op_INC(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Read(c, a) + 1;
+
+	Write(c, a, value);
+	Set_ZN(c, value);
+}
+
+static void Op_DEC(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Read(c, a) - 1;
+
+	Write(c, a, value);
+	Set_ZN(c, value);
+}
+
+static void Op_INX(struct nes_cpu *c, uint16_t a) { Set_ZN(c, ++c->x); }
+static void Op_INY(struct nes_cpu *c, uint16_t a) { Set_ZN(c, ++c->y); }
+static void Op_DEX(struct nes_cpu *c, uint16_t a) { Set_ZN(c, --c->x); }
+static void Op_DEY(struct nes_cpu *c, uint16_t a) { Set_ZN(c, --c->y); }
+static void Op_TAX(struct nes_cpu *c, uint16_t a) { c->x = c->a; Set_ZN(c, c->x); }
+static void Op_TAY(struct nes_cpu *c, uint16_t a) { c->y = c->a; Set_ZN(c, c->y); }
+static void Op_TXA(struct nes_cpu *c, uint16_t a) { c->a = c->x; Set_ZN(c, c->a); }
+static void Op_TYA(struct nes_cpu *c, uint16_t a) { c->a = c->y; Set_ZN(c, c->a); }
+static void Op_TSX(struct nes_cpu *c, uint16_t a) { c->x = c->s; Set_ZN(c, c->x); }
+static void Op_TXS(struct nes_cpu *c, uint16_t a) { c->s = c->x; }
+
+static void Op_BIT(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Read(c, a);
+
+	c->p &= ~(CPU_FLAG_Z | CPU_FLAG_V | CPU_FLAG_N);
+	c->p |= ((c->a & value) == 0 ? CPU_FLAG_Z : 0) | (value & (CPU_FLAG_V | CPU_FLAG_N));
+}
+
+static void Op_BPL(struct nes_cpu *c, uint16_t a) { Branch(c, a, !(c->p & CPU_FLAG_N)); }
+static void Op_BMI(struct nes_cpu *c, uint16_t a) { Branch(c, a, c->p & CPU_FLAG_N); }
+static void Op_BVC(struct nes_cpu *c, uint16_t a) { Branch(c, a, !(c->p & CPU_FLAG_V)); }
+static void Op_BVS(struct nes_cpu *c, uint16_t a) { Branch(c, a, c->p & CPU_FLAG_V); }
+static void Op_BCC(struct nes_cpu *c, uint16_t a) { Branch(c, a, !(c->p & CPU_FLAG_C)); }
+static void Op_BCS(struct nes_cpu *c, uint16_t a) { Branch(c, a, c->p & CPU_FLAG_C); }
+static void Op_BNE(struct nes_cpu *c, uint16_t a) { Branch(c, a, !(c->p & CPU_FLAG_Z)); }
+static void Op_BEQ(struct nes_cpu *c, uint16_t a) { Branch(c, a, c->p & CPU_FLAG_Z); }
+
+static void Op_CLC(struct nes_cpu *c, uint16_t a) { c->p &= ~CPU_FLAG_C; }
+static void Op_CLD(struct nes_cpu *c, uint16_t a) { c->p &= ~CPU_FLAG_D; }
+static void Op_CLI(struct nes_cpu *c, uint16_t a) { c->p &= ~CPU_FLAG_I; }
+static void Op_CLV(struct nes_cpu *c, uint16_t a) { c->p &= ~CPU_FLAG_V; }
+static void Op_SEC(struct nes_cpu *c, uint16_t a) { c->p |= CPU_FLAG_C; }
+static void Op_SED(struct nes_cpu *c, uint16_t a) { c->p |= CPU_FLAG_D; }
+static void Op_SEI(struct nes_cpu *c, uint16_t a) { c->p |= CPU_FLAG_I; }
+
+static void Op_PHA(struct nes_cpu *c, uint16_t a) { Push(c, c->a); }
+static void Op_PHP(struct nes_cpu *c, uint16_t a) { Push(c, c->p | CPU_FLAG_B | CPU_FLAG_U); }
+static void Op_PLA(struct nes_cpu *c, uint16_t a) { c->a = Pull(c); Set_ZN(c, c->a); }
+static void Op_PLP(struct nes_cpu *c, uint16_t a) { c->p = (Pull(c) & ~CPU_FLAG_B) | CPU_FLAG_U; }
+
+static void Op_JMP(struct nes_cpu *c, uint16_t a) { c->pc = a; }
+
+static void Op_JSR(struct nes_cpu *c, uint16_t a)
+{
+	c->pc--;
+	Push(c, c->pc >> 8);
+	Push(c, c->pc & 0xFF);
+	c->pc = a;
+}
+
+static void Op_RTS(struct nes_cpu *c, uint16_t a)
+{
+	c->pc = Pull(c);
+	c->pc |= (uint16_t)Pull(c) << 8;
+	c->pc++;
+}
+
+static void Op_RTI(struct nes_cpu *c, uint16_t a)
+{
+	c->p = (Pull(c) & ~CPU_FLAG_B) | CPU_FLAG_U;
+	c->pc = Pull(c);
+	c->pc |= (uint16_t)Pull(c) << 8;
+}
+
+static void Op_BRK(struct nes_cpu *c, uint16_t a)
+{
+	c->pc++;
+	Push(c, c->pc >> 8);
+	Push(c, c->pc & 0xFF);
+	Push(c, c->p | CPU_FLAG_B | CPU_FLAG_U);
+	c->p |= CPU_FLAG_I;
+	c->pc = Read16(c, 0xFFFE);
+}
+
+static void Op_NOP(struct nes_cpu *c, uint16_t a) { }
+
+//Unofficial opcodes. Most of these are a read-modify-write followed by an ALU
+//operation on the result.
+static void Op_LAX(struct nes_cpu *c, uint16_t a) { c->a = c->x = Read(c, a); Set_ZN(c, c->a); }
+static void Op_SAX(struct nes_cpu *c, uint16_t a) { Write(c, a, c->a & c->x); }
+
+static void Op_DCP(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Read(c, a) - 1;
+
+	Write(c, a, value);
+	Do_Compare(c, c->a, value);
+}
+
+static void Op_ISC(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Read(c, a) + 1;
+
+	Write(c, a, value);
+	Do_ADC(c, value ^ 0xFF);
+}
+
+static void Op_SLO(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Do_ASL(c, Read(c, a));
+
+	Write(c, a, value);
+	c->a |= value;
+	Set_ZN(c, c->a);
+}
+
+static void Op_RLA(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Do_ROL(c, Read(c, a));
+
+	Write(c, a, value);
+	c->a &= value;
+	Set_ZN(c, c->a);
+}
+
+static void Op_SRE(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Do_LSR(c, Read(c, a));
+
+	Write(c, a, value);
+	c->a ^= value;
+	Set_ZN(c, c->a);
+}
+
+static void Op_RRA(struct nes_cpu *c, uint16_t a)
+{
+	uint8_t value = Do_ROR(c, Read(c, a));
+
+	Write(c, a, value);
+	Do_ADC(c, value);
+}
+
+//Stay on the same instruction forever
+static void Op_JAM(struct nes_cpu *c, uint16_t a)
+{
+	c->pc--;
+	c->jammed = true;
+}
+
+
+#define OP(name, mode, cycles) {Op_##name, MODE_##mode, cycles}
+
+static const struct opcode opcodes[256] =
+{
+	/* 00 */ OP(BRK, IMP, 7), OP(ORA, IZX, 6), OP(JAM, IMP, 2), OP(SLO, IZX, 8),
+	/* 04 */ OP(NOP, ZP, 3), OP(ORA, ZP, 3), OP(ASL, ZP, 5), OP(SLO, ZP, 5),
+	/* 08 */ OP(PHP, IMP, 3), OP(ORA, IMM, 2), OP(ASL_A, IMP, 2), OP(JAM, IMP, 2),
+	/* 0C */ OP(NOP, ABS, 4), OP(ORA, ABS, 4), OP(ASL, ABS, 6), OP(SLO, ABS, 6),
+	/* 10 */ OP(BPL, REL, 2), OP(ORA, IZY, 5), OP(JAM, IMP, 2), OP(SLO, IZY, 8),
+	/* 14 */ OP(NOP, ZPX, 4), OP(ORA, ZPX, 4), OP(ASL, ZPX, 6), OP(SLO, ZPX, 6),
+	/* 18 */ OP(CLC, IMP, 2), OP(ORA, ABY, 4), OP(NOP, IMP, 2), OP(SLO, ABY, 7),
+	/* 1C */ OP(NOP, ABX, 4), OP(ORA, ABX, 4), OP(ASL, ABX, 7), OP(SLO, ABX, 7),
+	/* 20 */ OP(JSR, ABS, 6), OP(AND, IZX, 6), OP(JAM, IMP, 2), OP(RLA, IZX, 8),
+	/* 24 */ OP(BIT, ZP, 3), OP(AND, ZP, 3), OP(ROL, ZP, 5), OP(RLA, ZP, 5),
+	/* 28 */ OP(PLP, IMP, 4), OP(AND, IMM, 2), OP(ROL_A, IMP, 2), OP(JAM, IMP, 2),
+	/* 2C */ OP(BIT, ABS, 4), OP(AND, ABS, 4), OP(ROL, ABS, 6), OP(RLA, ABS, 6),
+	/* 30 */ OP(BMI, REL, 2), OP(AND, IZY, 5), OP(JAM, IMP, 2), OP(RLA, IZY, 8),
+	/* 34 */ OP(NOP, ZPX, 4), OP(AND, ZPX, 4), OP(ROL, ZPX, 6), OP(RLA, ZPX, 6),
+	/* 38 */ OP(SEC, IMP, 2), OP(AND, ABY, 4), OP(NOP, IMP, 2), OP(RLA, ABY, 7),
+	/* 3C */ OP(NOP, ABX, 4), OP(AND, ABX, 4), OP(ROL, ABX, 7), OP(RLA, ABX, 7),
+	/* 40 */ OP(RTI, IMP, 6), OP(EOR, IZX, 6), OP(JAM, IMP, 2), OP(SRE, IZX, 8),
+	/* 44 */ OP(NOP, ZP, 3), OP(EOR, ZP, 3), OP(LSR, ZP, 5), OP(SRE, ZP, 5),
+	/* 48 */ OP(PHA, IMP, 3), OP(EOR, IMM, 2), OP(LSR_A, IMP, 2), OP(JAM, IMP, 2),
+	/* 4C */ OP(JMP, ABS, 3), OP(EOR, ABS, 4), OP(LSR, ABS, 6), OP(SRE, ABS, 6),
+	/* 50 */ OP(BVC, REL, 2), OP(EOR, IZY, 5), OP(JAM, IMP, 2), OP(SRE, IZY, 8),
+	/* 54 */ OP(NOP, ZPX, 4), OP(EOR, ZPX, 4), OP(LSR, ZPX, 6), OP(SRE, ZPX, 6),
+	/* 58 */ OP(CLI, IMP, 2), OP(EOR, ABY, 4), OP(NOP, IMP, 2), OP(SRE, ABY, 7),
+	/* 5C */ OP(NOP, ABX, 4), OP(EOR, ABX, 4), OP(LSR, ABX, 7), OP(SRE, ABX, 7),
+	/* 60 */ OP(RTS, IMP, 6), OP(ADC, IZX, 6), OP(JAM, IMP, 2), OP(RRA, IZX, 8),
+	/* 64 */ OP(NOP, ZP, 3), OP(ADC, ZP, 3), OP(ROR, ZP, 5), OP(RRA, ZP, 5),
+	/* 68 */ OP(PLA, IMP, 4), OP(ADC, IMM, 2), OP(ROR_A, IMP, 2), OP(JAM, IMP, 2),
+	/* 6C */ OP(JMP, IND, 5), OP(ADC, ABS, 4), OP(ROR, ABS, 6), OP(RRA, ABS, 6),
+	/* 70 */ OP(BVS, REL, 2), OP(ADC, IZY, 5), OP(JAM, IMP, 2), OP(RRA, IZY, 8),
+	/* 74 */ OP(NOP, ZPX, 4), OP(ADC, ZPX, 4), OP(ROR, ZPX, 6), OP(RRA, ZPX, 6),
+	/* 78 */ OP(SEI, IMP, 2), OP(ADC, ABY, 4), OP(NOP, IMP, 2), OP(RRA, ABY, 7),
+	/* 7C */ OP(NOP, ABX, 4), OP(ADC, ABX, 4), OP(ROR, ABX, 7), OP(RRA, ABX, 7),
+	/* 80 */ OP(NOP, IMM, 2), OP(STA, IZX, 6), OP(NOP, IMM, 2), OP(SAX, IZX, 6),
+	/* 84 */ OP(STY, ZP, 3), OP(STA, ZP, 3), OP(STX, ZP, 3), OP(SAX, ZP, 3),
+	/* 88 */ OP(DEY, IMP, 2), OP(NOP, IMM, 2), OP(TXA, IMP, 2), OP(JAM, IMP, 2),
+	/* 8C */ OP(STY, ABS, 4), OP(STA, ABS, 4), OP(STX, ABS, 4), OP(SAX, ABS, 4),
+	/* 90 */ OP(BCC, REL, 2), OP(STA, IZY, 6), OP(JAM, IMP, 2), OP(JAM, IMP, 2),
+	/* 94 */ OP(STY, ZPX, 4), OP(STA, ZPX, 4), OP(STX, ZPY, 4), OP(SAX, ZPY, 4),
+	/* 98 */ OP(TYA, IMP, 2), OP(STA, ABY, 5), OP(TXS, IMP, 2), OP(JAM, IMP, 2),
+	/* 9C */ OP(JAM, IMP, 2), OP(STA, ABX, 5), OP(JAM, IMP, 2), OP(JAM, IMP, 2),
+	/* A0 */ OP(LDY, IMM, 2), OP(LDA, IZX, 6), OP(LDX, IMM, 2), OP(LAX, IZX, 6),
+	/* A4 */ OP(LDY, ZP, 3), OP(LDA, ZP, 3), OP(LDX, ZP, 3), OP(LAX, ZP, 3),
+	/* A8 */ OP(TAY, IMP, 2), OP(LDA, IMM, 2), OP(TAX, IMP, 2), OP(JAM, IMP, 2),
+	/* AC */ OP(LDY, ABS, 4), OP(LDA, ABS, 4), OP(LDX, ABS, 4), OP(LAX, ABS, 4),
+	/* B0 */ OP(BCS, REL, 2), OP(LDA, IZY, 5), OP(JAM, IMP, 2), OP(LAX, IZY, 5),
+	/* B4 */ OP(LDY, ZPX, 4), OP(LDA, ZPX, 4), OP(LDX, ZPY, 4), OP(LAX, ZPY, 4),
+	/* B8 */ OP(CLV, IMP, 2), OP(LDA, ABY, 4), OP(TSX, IMP, 2), OP(JAM, IMP, 2),
+	/* BC */ OP(LDY, ABX, 4), OP(LDA, ABX, 4), OP(LDX, ABY, 4), OP(LAX, ABY, 4),
+	/* C0 */ OP(CPY, IMM, 2), OP(CMP, IZX, 6), OP(NOP, IMM, 2), OP(DCP, IZX, 8),
+	/* C4 */ OP(CPY, ZP, 3), OP(CMP, ZP, 3), OP(DEC, ZP, 5), OP(DCP, ZP, 5),
+	/* C8 */ OP(INY, IMP, 2), OP(CMP, IMM, 2), OP(DEX, IMP, 2), OP(JAM, IMP, 2),
+	/* CC */ OP(CPY, ABS, 4), OP(CMP, ABS, 4), OP(DEC, ABS, 6), OP(DCP, ABS, 6),
+	/* D0 */ OP(BNE, REL, 2), OP(CMP, IZY, 5), OP(JAM, IMP, 2), OP(DCP, IZY, 8),
+	/* D4 */ OP(NOP, ZPX, 4), OP(CMP, ZPX, 4), OP(DEC, ZPX, 6), OP(DCP, ZPX, 6),
+	/* D8 */ OP(CLD, IMP, 2), OP(CMP, ABY, 4), OP(NOP, IMP, 2), OP(DCP, ABY, 7),
+	/* DC */ OP(NOP, ABX, 4), OP(CMP, ABX, 4), OP(DEC, ABX, 7), OP(DCP, ABX, 7),
+	/* E0 */ OP(CPX, IMM, 2), OP(SBC, IZX, 6), OP(NOP, IMM, 2), OP(ISC, IZX, 8),
+	/* E4 */ OP(CPX, ZP, 3), OP(SBC, ZP, 3), OP(INC, ZP, 5), OP(ISC, ZP, 5),
+	/* E8 */ OP(INX, IMP, 2), OP(SBC, IMM, 2), OP(NOP, IMP, 2), OP(SBC, IMM, 2),
+	/* EC */ OP(CPX, ABS, 4), OP(SBC, ABS, 4), OP(INC, ABS, 6), OP(ISC, ABS, 6),
+	/* F0 */ OP(BEQ, REL, 2), OP(SBC, IZY, 5), OP(JAM, IMP, 2), OP(ISC, IZY, 8),
+	/* F4 */ OP(NOP, ZPX, 4), OP(SBC, ZPX, 4), OP(INC, ZPX, 6), OP(ISC, ZPX, 6),
+	/* F8 */ OP(SED, IMP, 2), OP(SBC, ABY, 4), OP(NOP, IMP, 2), OP(ISC, ABY, 7),
+	/* FC */ OP(NOP, ABX, 4), OP(SBC, ABX, 4), OP(INC, ABX, 7), OP(ISC, ABX, 7),
+};
+
+#undef OP
+
+
+//Power-on state. Memory and the I/O handlers are left alone.
+void CPU_Reset(struct nes_cpu *c)
+{
+	c->pc = 0;
+	c->a = c->x = c->y = 0;
+	c->s = 0xFF;
+	c->p = CPU_FLAG_I | CPU_FLAG_U;
+	c->cycles = 0;
+	c->jammed = false;
+}
+
+
+//Run one instruction
+void CPU_Step(struct nes_cpu *c)
+{
+	const struct opcode *o = &opcodes[Read(c, c->pc++)];
+
+	o->op(c, Address(c, o->mode));
+	c->cycles += o->cycles;
+}
+
+
+//Call a subroutine and run until it returns. Returns false if it takes more
+//than maxCycles or the CPU locks up.
+bool CPU_Call(struct nes_cpu *c, uint16_t address, uint64_t maxCycles)
+{
+	uint64_t limit = c->cycles + maxCycles;
+
+	Push(c, (CPU_RETURN_TRAP - 1) >> 8);
+	Push(c, (CPU_RETURN_TRAP - 1) & 0xFF);
+	c->pc = address;
+
+	while (c->pc != CPU_RETURN_TRAP)
+	{
+		if (c->cycles >= limit || c->jammed)
+			return false;
+		CPU_Step(c);
+	}
+
+	return true;
+}
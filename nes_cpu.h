@@ -0,0 +1,48 @@
+//6502 interpreter for playing NSF files. The NES CPU is a 6502 without decimal
+//mode. Only the parts of the NES an NSF player needs are here: 2 KiB of RAM,
+//8 KiB of cartridge RAM at $6000, and 32 KiB of ROM at $8000 in 4 KiB banks.
+//Everything from $2000 to $5FFF goes to the I/O callbacks, which is where the
+//APU registers and the NSF bank switching registers live.
+
+#ifndef NES_CPU_H
+#define NES_CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Status flags
+#define CPU_FLAG_C 0x01
+#define CPU_FLAG_Z 0x02
+#define CPU_FLAG_I 0x04
+#define CPU_FLAG_D 0x08
+#define CPU_FLAG_B 0x10
+#define CPU_FLAG_U 0x20
+#define CPU_FLAG_V 0x40
+#define CPU_FLAG_N 0x80
+
+//CPU_Call() pushes this address (minus one) as the return address and stops
+//when an RTS lands on it. Nothing is mapped here, so real code never runs it.
+#define CPU_RETURN_TRAP 0x4100
+
+struct nes_cpu
+{
+	uint16_t pc;
+	uint8_t a, x, y, s, p;
+	uint64_t cycles;           //Cycles run since reset
+	bool jammed;               //Hit an opcode that locks up the CPU
+
+	uint8_t ram[0x800];        //Internal RAM, mirrored up to $1FFF
+	uint8_t wram[0x2000];      //Cartridge RAM at $6000-$7FFF
+	const uint8_t *rom[8];     //4 KiB ROM banks at $8000-$FFFF
+
+	//I/O handlers for $2000-$5FFF. Either can be NULL.
+	uint8_t (*ioRead)(void *user, uint16_t address);
+	void (*ioWrite)(void *user, uint16_t address, uint8_t value);
+	void *user;
+};
+
+void CPU_Reset(struct nes_cpu *c);
+void CPU_Step(struct nes_cpu *c);
+bool CPU_Call(struct nes_cpu *c, uint16_t address, uint64_t maxCycles);
+
+#endif
@@ -0,0 +1,208 @@
+//Note length quantizer. This used to be done with floats on every note, by
+//scanning the list of note lengths for one within 10% of the duration, or
+//failing that, the longest one that fits, and repeating until the duration ran
+//out. The rules are the same here, but everything is scaled up so that it's all
+//done with integers, and the answers for a PPQN are worked out once up front.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "note_lengths.h"
+
+const struct note_length noteLengths[NUM_NOTE_LENGTHS] =
+{
+	{2,   "64",  2},
+	{3,   "64.", 3},
+	{4,   "32",  2},
+	{6,   "32.", 3},
+	{8,   "16",  2},
+	{12,  "16.", 3},
+	{16,  "8",   1},
+	{24,  "8.",  2},
+	{32,  "4",   1},
+	{48,  "4.",  2},
+	{64,  "2",   1},
+	{96,  "2.",  2},
+	{128, "1",   1},
+};
+
+//Lengths within 10% of a note's length count as a match for that note
+#define TOLERANCE_TENTHS 1
+
+//Anything shorter than 1/200th of a whole note is treated as nothing at all
+#define MIN_DURATION_DIVISOR 200
+
+//Largest PPQN we'll build a table for. This is the most the MIDI header can
+//hold, and keeps the tables to a few megabytes.
+#define MAX_PPQN 0x7FFF
+
+static struct length_table *g_tables = NULL;
+static pthread_mutex_t g_tablesLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+//Work out how a duration is split into tied notes. The remaining duration is
+//kept in 128ths of a tick, so a note's share of it is just its units times the
+//ticks in a whole note. The remainder can go negative if a note that's a bit
+//too long was picked as a match, which simply ends the note.
+static void Split_Duration(uint32_t ticks, uint32_t wholeNote, struct note_split *split)
+{
+	int64_t remaining = (int64_t)ticks * 128;
+	int64_t minimum = (int64_t)wholeNote * 128;
+	int64_t length;
+	int d, match;
+
+	memset(split, 0, sizeof(*split));
+
+	while (remaining * MIN_DURATION_DIVISOR > minimum && split->count < NOTE_MAX_PARTS)
+	{
+		//Check for a match within the tolerance
+		match = -1;
+		for (d = 0; d < NUM_NOTE_LENGTHS; d++)
+		{
+			length = (int64_t)noteLengths[d].units * wholeNote;
+			if (remaining * 10 > length * (10 - TOLERANCE_TENTHS) &&
+			    remaining * 10 < length * (10 + TOLERANCE_TENTHS))
+			{
+				match = d;
+				break;
+			}
+		}
+
+		//If there's no match, take the longest note that fits, or a whole note
+		//if they all do
+		if (match < 0)
+		{
+			for (d = 0; d < NUM_NOTE_LENGTHS; d++)
+			{
+				if ((int64_t)noteLengths[d].units * wholeNote > remaining)
+					break;
+			}
+			match = d - 1;
+			if (match < 0)
+			{
+				split->tooShort = true;
+				return;
+			}
+		}
+
+		split->parts[split->count++] = (uint8_t)match;
+		remaining -= (int64_t)noteLengths[match].units * wholeNote;
+	}
+}
+
+
+static struct length_table *Build_Table(uint32_t ppqn)
+{
+	struct length_table *table;
+	uint32_t t;
+
+	table = malloc(sizeof(*table));
+	if (table == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		return NULL;
+	}
+	table->ppqn = ppqn;
+	table->wholeNote = 4 * ppqn;
+	table->size = 2 * table->wholeNote;
+	table->splits = malloc(table->size * sizeof(struct note_split));
+	if (table->splits == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		free(table);
+		return NULL;
+	}
+
+	for (t = 0; t < table->size; t++)
+		Split_Duration(t, table->wholeNote, &table->splits[t]);
+
+	return table;
+}
+
+
+//Get the table for a PPQN, building it if this is the first time it's been
+//asked for. Safe to call from several threads. Returns NULL if the PPQN is out
+//of range or we're out of memory.
+const struct length_table *Lengths_Get(uint32_t ppqn)
+{
+	struct length_table *table;
+
+	if (ppqn == 0 || ppqn > MAX_PPQN)
+	{
+		fprintf(stderr, "Error: PPQN must be between 1 and %d\n\n", MAX_PPQN);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&g_tablesLock);
+	for (table = g_tables; table != NULL; table = table->next)
+	{
+		if (table->ppqn == ppqn)
+			break;
+	}
+	if (table == NULL)
+	{
+		table = Build_Table(ppqn);
+		if (table != NULL)
+		{
+			table->next = g_tables;
+			g_tables = table;
+		}
+	}
+	pthread_mutex_unlock(&g_tablesLock);
+
+	return table;
+}
+
+
+//Look up how a duration is split into tied notes. Anything two whole notes or
+//longer starts with a run of tied whole notes, which is returned in wholeNotes;
+//the split covers whatever is left after them.
+const struct note_split *Lengths_Split(const struct length_table *table, uint32_t ticks,
+                                       uint32_t *wholeNotes)
+{
+	*wholeNotes = 0;
+	if (ticks >= table->size)
+	{
+		*wholeNotes = ticks / table->wholeNote - 1;
+		ticks -= *wholeNotes * table->wholeNote;
+	}
+
+	return &table->splits[ticks];
+}
+
+
+//Return how much of a duration is left over after it's been split, as a
+//fraction of a whole note. This is only needed for error messages.
+double Lengths_Remainder(const struct length_table *table, uint32_t ticks)
+{
+	const struct note_split *split;
+	uint32_t wholeNotes;
+	double remaining;
+	int p;
+
+	split = Lengths_Split(table, ticks, &wholeNotes);
+	remaining = (double)ticks / table->wholeNote - wholeNotes;
+	for (p = 0; p < split->count; p++)
+		remaining -= noteLengths[split->parts[p]].units / 128.0;
+
+	return remaining;
+}
+
+
+void Lengths_Free_All(void)
+{
+	struct length_table *table;
+
+	pthread_mutex_lock(&g_tablesLock);
+	while (g_tables != NULL)
+	{
+		table = g_tables;
+		g_tables = table->next;
+		free(table->splits);
+		free(table);
+	}
+	pthread_mutex_unlock(&g_tablesLock);
+}
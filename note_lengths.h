@@ -0,0 +1,56 @@
+//Note length quantizer. Durations are worked out in integer ticks instead of
+//floating-point fractions of a whole note, so the results are exact and don't
+//depend on the compiler. For a given PPQN, every tick count up to two whole
+//notes is split into tied notes ahead of time, and converting a note is just a
+//table lookup.
+
+#ifndef NOTE_LENGTHS_H
+#define NOTE_LENGTHS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Most tied notes a single table entry can hold. Anything that fits in the table
+//needs four at most.
+#define NOTE_MAX_PARTS 6
+
+//A note length that can be written down. Lengths are given in 128ths of a whole
+//note so that dotted 64ths come out to a whole number.
+struct note_length
+{
+	uint8_t units;       //Length in 128ths of a whole note
+	const char *string;  //Length as written, like "8." for a dotted eighth
+	uint8_t size;        //Length of the string
+};
+
+#define NUM_NOTE_LENGTHS 13
+#define NOTE_WHOLE (NUM_NOTE_LENGTHS - 1)
+extern const struct note_length noteLengths[NUM_NOTE_LENGTHS];
+
+//How one duration is split into tied notes. The parts are indexes into
+//noteLengths[], longest first. If tooShort is set, whatever is left after the
+//parts is too short to write down.
+struct note_split
+{
+	uint8_t count;
+	bool tooShort;
+	uint8_t parts[NOTE_MAX_PARTS];
+};
+
+//All of the splits for one PPQN. Tables are built once and shared.
+struct length_table
+{
+	uint32_t ppqn;
+	uint32_t wholeNote;          //Ticks in a whole note
+	uint32_t size;               //Entries in splits[], two whole notes' worth
+	struct note_split *splits;
+	struct length_table *next;   //Next table in the cache
+};
+
+const struct length_table *Lengths_Get(uint32_t ppqn);
+const struct note_split *Lengths_Split(const struct length_table *table, uint32_t ticks,
+                                       uint32_t *wholeNotes);
+double Lengths_Remainder(const struct length_table *table, uint32_t ticks);
+void Lengths_Free_All(void);
+
+#endif
@@ -0,0 +1,291 @@
+//Binary note list reader and writer. See note_list.h for the file format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "note_list.h"
+
+
+//Little-endian helpers. The file format doesn't depend on the machine, but on
+//a little-endian machine these all come out to plain copies.
+static void Put_LE16(uint8_t *p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void Put_LE32(uint8_t *p, uint32_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static uint16_t Get_LE16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t Get_LE32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool Little_Endian(void)
+{
+	uint16_t one = 1;
+
+	return *(const uint8_t *)&one == 1;
+}
+
+
+//Take the --note-list option out of a command line. It can go anywhere, and
+//whatever's left is moved down to fill the gap. *filename is left NULL if
+//there's no --note-list.
+bool List_Parse_Option(int *argc, char *argv[], const char **filename)
+{
+	int i, n = 1;
+
+	*filename = NULL;
+	for (i = 1; i < *argc; i++)
+	{
+		if (strcmp(argv[i], "--note-list") != 0)
+		{
+			argv[n++] = argv[i];
+			continue;
+		}
+		if (i + 1 >= *argc)
+		{
+			fprintf(stderr, "Error: %s needs a value\n\n", argv[i]);
+			return false;
+		}
+		*filename = argv[++i];
+	}
+
+	*argc = n;
+	argv[n] = NULL;
+	return true;
+}
+
+
+//Set up an empty list. Nothing is allocated until the first record.
+void List_Init(struct note_list_writer *w)
+{
+	int c;
+
+	for (c = 0; c < 16; c++)
+	{
+		Out_Init(&w->channels[c], -1);
+		w->counts[c] = 0;
+	}
+	w->tracks = 0;
+}
+
+
+//Start a new track chunk. Records added after this are marked with it.
+void List_Start_Track(struct note_list_writer *w)
+{
+	w->tracks++;
+}
+
+
+//Add a record to the end of its channel. The track field is filled in here.
+void List_Add(struct note_list_writer *w, const struct note_record *record)
+{
+	uint8_t bytes[NOTE_LIST_RECORD_SIZE];
+	uint8_t channel = record->channel & 0x0F;
+
+	Put_LE32(bytes + 0, record->onset);
+	Put_LE32(bytes + 4, record->ticks);
+	Put_LE16(bytes + 8, w->tracks > 0 ? w->tracks - 1 : 0);
+	bytes[10] = record->key;
+	bytes[11] = record->length;
+	bytes[12] = record->flags;
+	bytes[13] = channel;
+	Put_LE16(bytes + 14, record->voice);
+	Out_Append(&w->channels[channel], (const char *)bytes, sizeof(bytes));
+	w->counts[channel]++;
+}
+
+
+//Write the list to a file, or to standard output if the name is "-". A file is
+//written under a temporary name and then renamed, so a program that has the
+//old one mapped never sees it change underneath it. The header gives the
+//timing, loop points and channels; the rest of it is filled in here.
+bool List_Save(struct note_list_writer *w, const char *filename,
+               const struct note_list_header *header)
+{
+	uint8_t bytes[NOTE_LIST_HEADER_SIZE];
+	struct iovec iov[17];
+	uint32_t start = 0;
+	int c;
+
+	memcpy(bytes, NOTE_LIST_MAGIC, 4);
+	Put_LE16(bytes + 4, NOTE_LIST_VERSION);
+	Put_LE16(bytes + 6, NOTE_LIST_RECORD_SIZE);
+	Put_LE32(bytes + 8, header->ppqn);
+	Put_LE32(bytes + 12, header->wholeNote);
+	Put_LE32(bytes + 16, header->loopStart);
+	Put_LE32(bytes + 20, header->loopEnd);
+	Put_LE16(bytes + 24, header->channels);
+	Put_LE16(bytes + 26, header->failedChannels);
+	iov[0].iov_base = bytes;
+	iov[0].iov_len = sizeof(bytes);
+	for (c = 0; c < 16; c++)
+	{
+		if (w->channels[c].failed)
+		{
+			fprintf(stderr, "Error: Out of memory for the note list\n\n");
+			return false;
+		}
+		Put_LE32(bytes + 28 + 4 * c, start);
+		start += w->counts[c];
+		iov[c + 1].iov_base = w->channels[c].data;
+		iov[c + 1].iov_len = w->channels[c].used;
+	}
+	Put_LE32(bytes + 28 + 4 * 16, start);
+
+	return Out_Save_Vector(filename, iov, 17);
+}
+
+
+//Unpack a record from file format
+static void List_Decode(const uint8_t *p, struct note_record *record)
+{
+	record->onset = Get_LE32(p + 0);
+	record->ticks = Get_LE32(p + 4);
+	record->track = Get_LE16(p + 8);
+	record->key = p[10];
+	record->length = p[11];
+	record->flags = p[12];
+	record->channel = p[13];
+	record->voice = Get_LE16(p + 14);
+}
+
+
+//Get a record back from the list being collected, so it can be written out in
+//some other form too. index counts from the channel's first record.
+void List_Get(const struct note_list_writer *w, uint8_t channel, uint32_t index,
+              struct note_record *record)
+{
+	List_Decode((const uint8_t *)w->channels[channel & 0x0F].data +
+	            (size_t)index * NOTE_LIST_RECORD_SIZE, record);
+}
+
+
+void List_Free(struct note_list_writer *w)
+{
+	int c;
+
+	for (c = 0; c < 16; c++)
+		Out_Free(&w->channels[c]);
+}
+
+
+//Check a list's header and find its records. Returns false if the file isn't a
+//note list this version can read.
+static bool List_Check(struct note_list *list, const char *filename)
+{
+	const uint8_t *data = list->input.data;
+	struct note_list_header *h = &list->header;
+	int c;
+
+	if (list->input.size < NOTE_LIST_HEADER_SIZE || memcmp(data, NOTE_LIST_MAGIC, 4) != 0)
+	{
+		fprintf(stderr, "Error: %s is not a note list\n\n", filename);
+		return false;
+	}
+	memcpy(h->magic, data, 4);
+	h->version = Get_LE16(data + 4);
+	h->recordSize = Get_LE16(data + 6);
+	if (h->version != NOTE_LIST_VERSION || h->recordSize != NOTE_LIST_RECORD_SIZE)
+	{
+		fprintf(stderr, "Error: %s is note list version %u, and only version %u can be read\n\n",
+		        filename, h->version, NOTE_LIST_VERSION);
+		return false;
+	}
+	h->ppqn = Get_LE32(data + 8);
+	h->wholeNote = Get_LE32(data + 12);
+	h->loopStart = Get_LE32(data + 16);
+	h->loopEnd = Get_LE32(data + 20);
+	h->channels = Get_LE16(data + 24);
+	h->failedChannels = Get_LE16(data + 26);
+	for (c = 0; c <= 16; c++)
+	{
+		h->channelStart[c] = Get_LE32(data + 28 + 4 * c);
+		if (c > 0 && h->channelStart[c] < h->channelStart[c - 1])
+			break;
+	}
+
+	list->numRecords = (list->input.size - NOTE_LIST_HEADER_SIZE) / NOTE_LIST_RECORD_SIZE;
+	if (c <= 16 || h->channelStart[0] != 0 || h->channelStart[16] != list->numRecords ||
+	    (list->input.size - NOTE_LIST_HEADER_SIZE) % NOTE_LIST_RECORD_SIZE != 0)
+	{
+		fprintf(stderr, "Error: %s is damaged\n\n", filename);
+		return false;
+	}
+	return true;
+}
+
+
+//Open a note list. A file is mapped into memory, and standard input ("-") is
+//read in. On a big-endian machine the records get converted once up front, so
+//they can still be indexed directly.
+bool List_Open(struct note_list *list, const char *filename)
+{
+	const uint8_t *p;
+	size_t r;
+
+	Input_Init(&list->input);
+	list->records = NULL;
+	list->numRecords = 0;
+	list->swapped = NULL;
+	if (!Input_Open(&list->input, filename))
+		return false;
+	if (!List_Check(list, filename))
+	{
+		Input_Free(&list->input);
+		return false;
+	}
+
+	p = list->input.data + NOTE_LIST_HEADER_SIZE;
+	if (Little_Endian())
+	{
+		list->records = (const struct note_record *)p;
+		return true;
+	}
+
+	list->swapped = malloc(list->numRecords * sizeof(struct note_record) + 1);
+	if (list->swapped == NULL)
+	{
+		fprintf(stderr, "Error: Out of memory\n\n");
+		Input_Free(&list->input);
+		return false;
+	}
+	for (r = 0; r < list->numRecords; r++, p += NOTE_LIST_RECORD_SIZE)
+		List_Decode(p, &list->swapped[r]);
+	list->records = list->swapped;
+	return true;
+}
+
+
+//Get one channel's records. Returns NULL with a count of 0 if the channel has
+//none.
+const struct note_record *List_Channel(const struct note_list *list, uint8_t channel,
+                                       size_t *count)
+{
+	uint32_t start = list->header.channelStart[channel & 0x0F];
+
+	*count = list->header.channelStart[(channel & 0x0F) + 1] - start;
+	return *count > 0 ? list->records + start : NULL;
+}
+
+
+void List_Close(struct note_list *list)
+{
+	free(list->swapped);
+	list->swapped = NULL;
+	list->records = NULL;
+	Input_Free(&list->input);
+}
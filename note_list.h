@@ -0,0 +1,104 @@
+//Binary note list. This is the same thing midi_notes prints, but as fixed-size
+//records instead of text, so other programs can map the file and index straight
+//into it without parsing anything.
+//
+//Everything in the file is little-endian. The file starts with a 96-byte header
+//(struct note_list_header), and the records come right after it, 16 bytes each
+//(struct note_record). The records are grouped by channel, channel 0 first, and
+//the header says where each channel's records start. Within a channel they're
+//in the order they were converted: track by track, and in time order within a
+//track. The notes of a chord all have the same onset, lowest key first. If the
+//notes were split into voices, each track's voices come one after another, in
+//time order within each voice. Every track's times start from 0, the same as
+//the text.
+
+#ifndef NOTE_LIST_H
+#define NOTE_LIST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "out_buffer.h"
+#include "midi_input.h"
+
+#define NOTE_LIST_MAGIC "VGNL"
+#define NOTE_LIST_VERSION 1
+#define NOTE_LIST_HEADER_SIZE 96
+#define NOTE_LIST_RECORD_SIZE 16
+
+//Loop points for a song that doesn't loop
+#define NOTE_LIST_NO_LOOP UINT32_MAX
+
+//Record flags
+#define NOTE_REST  0x01  //A rest. The key means nothing.
+#define NOTE_TIE   0x02  //Tied to the next record for the same key in the channel
+#define NOTE_TIED  0x04  //Tied from the last record for the same key in the channel
+
+//Length code for rests, which aren't quantized
+#define NOTE_LENGTH_NONE 0xFF
+
+struct note_list_header
+{
+	char magic[4];                //NOTE_LIST_MAGIC, with no terminator
+	uint16_t version;
+	uint16_t recordSize;
+	uint32_t ppqn;                //Ticks in a quarter note
+	uint32_t wholeNote;           //Ticks in a whole note
+	uint32_t loopStart;           //Loop points in ticks, or NOTE_LIST_NO_LOOP
+	uint32_t loopEnd;
+	uint16_t channels;            //Bitmask of the channels that had anything
+	uint16_t failedChannels;      //Channels that couldn't all be written down
+	uint32_t channelStart[17];    //Index of each channel's first record, plus
+	                              //one more entry for the end of channel 15
+};
+
+//One note or rest. A note too long for one length is split into several
+//records tied together, the same as "c4~ c16" in the text.
+struct note_record
+{
+	uint32_t onset;     //Start time in ticks
+	uint32_t ticks;     //Length in ticks
+	uint16_t track;     //Track chunk it came from, counting from 0
+	uint8_t key;        //MIDI key number
+	uint8_t length;     //Index into noteLengths[], or NOTE_LENGTH_NONE
+	uint8_t flags;
+	uint8_t channel;
+	uint16_t voice;     //Voice it was put in, counting from 0. Always 0 unless
+	                    //the notes were split into voices.
+};
+
+//Records being collected during a conversion. Each channel's records are kept
+//in their own buffer, already in file format, so saving is just one write.
+struct note_list_writer
+{
+	struct out_buffer channels[16];
+	uint32_t counts[16];
+	uint16_t tracks;    //Track chunks started so far
+};
+
+//A note list that's been opened for reading. On a little-endian machine the
+//records point straight into the mapped file.
+struct note_list
+{
+	struct midi_input input;
+	struct note_list_header header;
+	const struct note_record *records;
+	size_t numRecords;
+	struct note_record *swapped;   //Converted copy for big-endian machines
+};
+
+bool List_Parse_Option(int *argc, char *argv[], const char **filename);
+void List_Init(struct note_list_writer *w);
+void List_Start_Track(struct note_list_writer *w);
+void List_Add(struct note_list_writer *w, const struct note_record *record);
+bool List_Save(struct note_list_writer *w, const char *filename,
+               const struct note_list_header *header);
+void List_Get(const struct note_list_writer *w, uint8_t channel, uint32_t index,
+              struct note_record *record);
+void List_Free(struct note_list_writer *w);
+bool List_Open(struct note_list *list, const char *filename);
+const struct note_record *List_Channel(const struct note_list *list, uint8_t channel,
+                                       size_t *count);
+void List_Close(struct note_list *list);
+
+#endif
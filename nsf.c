@@ -0,0 +1,236 @@
+//NSF player. The program data is copied into a ROM image made of 4 KiB banks.
+//Files without bank switching just get loaded at their load address in a flat
+//32 KiB image. Files with bank switching are split into banks starting at the
+//load address's offset within a bank, and the bank registers at $5FF8-$5FFF
+//pick which bank shows up in each 4 KiB slot.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "nsf.h"
+
+//How long INIT and PLAY get to return before we give up on them
+#define INIT_SECONDS 2
+#define PLAY_FRAMES 20
+
+//Where the bank switching registers are
+#define BANK_REGISTERS 0x5FF8
+
+
+static uint16_t LE_Read16(const uint8_t *value)
+{
+	return (uint16_t)value[0] | (uint16_t)value[1] << 8;
+}
+
+static void Copy_String(char *dest, const uint8_t *src)
+{
+	memcpy(dest, src, 32);
+	dest[32] = '\0';
+}
+
+
+bool NSF_Is_NSF(const uint8_t *data, size_t size)
+{
+	return size >= 5 && memcmp(data, "NESM\x1A", 5) == 0;
+}
+
+
+//Read the header. The data pointer in the result points into the caller's
+//buffer, so that has to stay around. Call NSF_Load() before playing anything.
+bool NSF_Parse(struct nsf_file *nsf, const uint8_t *data, size_t size)
+{
+	int b;
+
+	memset(nsf, 0, sizeof(*nsf));
+	if (!NSF_Is_NSF(data, size) || size < NSF_HEADER_SIZE)
+	{
+		fprintf(stderr, "Error: Not an NSF file\n");
+		return false;
+	}
+
+	nsf->version = data[0x05];
+	nsf->totalSongs = data[0x06];
+	nsf->startSong = data[0x07];
+	nsf->loadAddress = LE_Read16(data + 0x08);
+	nsf->initAddress = LE_Read16(data + 0x0A);
+	nsf->playAddress = LE_Read16(data + 0x0C);
+	Copy_String(nsf->name, data + 0x0E);
+	Copy_String(nsf->artist, data + 0x2E);
+	Copy_String(nsf->copyright, data + 0x4E);
+	nsf->speedNTSC = LE_Read16(data + 0x6E);
+	memcpy(nsf->banks, data + 0x70, sizeof(nsf->banks));
+	nsf->speedPAL = LE_Read16(data + 0x78);
+	nsf->pal = (data[0x7A] & 0x03) == 0x01;
+	nsf->chips = data[0x7B];
+	nsf->data = data + NSF_HEADER_SIZE;
+	nsf->size = size - NSF_HEADER_SIZE;
+
+	for (b = 0; b < 8; b++)
+	{
+		if (nsf->banks[b] != 0)
+			nsf->bankSwitched = true;
+	}
+
+	if (nsf->totalSongs == 0 || nsf->startSong == 0 || nsf->startSong > nsf->totalSongs)
+		nsf->startSong = 1;
+	if (nsf->loadAddress < 0x8000 && !nsf->bankSwitched)
+	{
+		fprintf(stderr, "Error: NSF load address %04X is below $8000\n", nsf->loadAddress);
+		return false;
+	}
+	if (nsf->chips & NSF_CHIP_FDS)
+	{
+		fprintf(stderr, "Error: FDS sound isn't supported\n");
+		return false;
+	}
+	if (nsf->chips != 0)
+		fprintf(stderr, "Warning: Expansion sound isn't supported; only the APU channels "
+		        "will be converted\n");
+
+	return true;
+}
+
+
+//Bank switching register writes and APU register writes. Nothing else in
+//$2000-$5FFF matters to an NSF.
+static void NSF_IO_Write(void *user, uint16_t address, uint8_t value)
+{
+	struct nsf_player *player = user;
+
+	if (address >= 0x4000 && address <= 0x4017)
+	{
+		APU_Write(&player->apu, address, value);
+	} else if (address >= BANK_REGISTERS && player->nsf->bankSwitched)
+	{
+		player->cpu.rom[address - BANK_REGISTERS] =
+			player->nsf->image + (value % player->nsf->numBanks) * 0x1000;
+	}
+}
+
+static uint8_t NSF_IO_Read(void *user, uint16_t address)
+{
+	struct nsf_player *player = user;
+
+	if (address == 0x4015)
+		return APU_Read_Status(&player->apu);
+	return 0;
+}
+
+
+//Lay out the program data in banks. The image is never written to after this,
+//so any number of players can share it, even on different threads.
+bool NSF_Load(struct nsf_file *nsf)
+{
+	size_t padding, imageSize, copySize;
+
+	if (nsf->bankSwitched)
+	{
+		padding = nsf->loadAddress & 0x0FFF;
+		nsf->numBanks = (padding + nsf->size + 0x0FFF) / 0x1000;
+		if (nsf->numBanks == 0)
+			nsf->numBanks = 1;
+		imageSize = nsf->numBanks * 0x1000;
+		copySize = nsf->size;
+	} else
+	{
+		padding = nsf->loadAddress - 0x8000;
+		nsf->numBanks = 8;
+		imageSize = 0x8000;
+		copySize = nsf->size < imageSize - padding ? nsf->size : imageSize - padding;
+	}
+
+	nsf->image = calloc(imageSize, 1);
+	if (nsf->image == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		return false;
+	}
+	memcpy(nsf->image + padding, nsf->data, copySize);
+	return true;
+}
+
+void NSF_Free(struct nsf_file *nsf)
+{
+	free(nsf->image);
+	nsf->image = NULL;
+}
+
+
+//Hook a player up to a loaded file. Each player has its own CPU and APU, so
+//every song can be played at the same time.
+void NSF_Player_Init(struct nsf_player *player, const struct nsf_file *nsf)
+{
+	uint16_t speed;
+
+	memset(player, 0, sizeof(*player));
+	player->nsf = nsf;
+
+	player->cpu.ioRead = NSF_IO_Read;
+	player->cpu.ioWrite = NSF_IO_Write;
+	player->cpu.user = player;
+
+	player->clock = nsf->pal ? NSF_CLOCK_PAL : NSF_CLOCK_NTSC;
+	speed = nsf->pal ? nsf->speedPAL : nsf->speedNTSC;
+	if (speed == 0)
+		speed = nsf->pal ? 20000 : 16639;
+	player->frameMicroseconds = speed;
+	player->frameCycles = (uint32_t)((uint64_t)player->clock * speed / 1000000);
+}
+
+
+//Reset everything and run the INIT routine for a song, numbered from 0. This
+//follows the NSF spec: clear the RAM, reset the APU, set up the banks, and call
+//INIT with the song number in A and the region in X.
+bool NSF_Start_Song(struct nsf_player *player, unsigned song)
+{
+	struct nes_cpu *cpu = &player->cpu;
+	uint16_t address;
+	int b;
+
+	CPU_Reset(cpu);
+	memset(cpu->ram, 0, sizeof(cpu->ram));
+	memset(cpu->wram, 0, sizeof(cpu->wram));
+
+	APU_Reset(&player->apu, player->nsf->pal);
+	for (address = 0x4000; address <= 0x4013; address++)
+		APU_Write(&player->apu, address, 0x00);
+	APU_Write(&player->apu, 0x4015, 0x00);
+	APU_Write(&player->apu, 0x4015, 0x0F);
+	APU_Write(&player->apu, 0x4017, 0x40);
+
+	for (b = 0; b < 8; b++)
+	{
+		if (player->nsf->bankSwitched)
+			NSF_IO_Write(player, BANK_REGISTERS + b, player->nsf->banks[b]);
+		else
+			cpu->rom[b] = player->nsf->image + b * 0x1000;
+	}
+
+	cpu->a = (uint8_t)song;
+	cpu->x = player->nsf->pal ? 1 : 0;
+	if (!CPU_Call(cpu, player->nsf->initAddress, (uint64_t)INIT_SECONDS * player->clock))
+	{
+		fprintf(stderr, "Error: NSF INIT routine didn't return\n");
+		return false;
+	}
+
+	return true;
+}
+
+
+//Advance one frame. The APU runs through the frame that just ended, then PLAY
+//sets up the next one, so the APU state afterwards is what's heard at the start
+//of the new frame.
+bool NSF_Play_Frame(struct nsf_player *player)
+{
+	APU_Run(&player->apu, player->frameCycles);
+	if (!CPU_Call(&player->cpu, player->nsf->playAddress,
+	              (uint64_t)PLAY_FRAMES * player->frameCycles))
+	{
+		fprintf(stderr, "Error: NSF PLAY routine didn't return\n");
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,67 @@
+//NSF (NES Sound Format) player. An NSF file is the music code and data ripped
+//from a game, plus a header saying where to load it and which routines to
+//call. The INIT routine sets up a song, and the PLAY routine is called once per
+//frame to keep it going. We run those on the 6502 core and keep track of what
+//they write to the APU.
+
+#ifndef NSF_H
+#define NSF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "nes_cpu.h"
+#include "nes_apu.h"
+
+#define NSF_HEADER_SIZE 0x80
+
+//CPU clock rates in Hz
+#define NSF_CLOCK_NTSC APU_CLOCK_NTSC
+#define NSF_CLOCK_PAL  APU_CLOCK_PAL
+
+//Expansion sound chip bits. None of these are emulated, but only FDS needs
+//hardware we don't have.
+#define NSF_CHIP_FDS 0x04
+
+struct nsf_file
+{
+	uint8_t version;
+	uint8_t totalSongs;
+	uint8_t startSong;         //First song to play, starting from 1
+	uint16_t loadAddress;
+	uint16_t initAddress;
+	uint16_t playAddress;
+	char name[33];
+	char artist[33];
+	char copyright[33];
+	uint16_t speedNTSC;        //Microseconds between PLAY calls
+	uint16_t speedPAL;
+	uint8_t banks[8];          //Initial banks, if bank switching is used
+	bool bankSwitched;
+	bool pal;                  //Plays at the PAL rate
+	uint8_t chips;             //Expansion sound chips
+	const uint8_t *data;       //Program data after the header
+	size_t size;
+	uint8_t *image;            //Program data laid out in 4 KiB banks
+	size_t numBanks;
+};
+
+struct nsf_player
+{
+	struct nes_cpu cpu;
+	struct nes_apu apu;
+	const struct nsf_file *nsf;
+	uint32_t frameCycles;      //CPU cycles per PLAY call
+	uint32_t frameMicroseconds;
+	uint32_t clock;
+};
+
+bool NSF_Is_NSF(const uint8_t *data, size_t size);
+bool NSF_Parse(struct nsf_file *nsf, const uint8_t *data, size_t size);
+bool NSF_Load(struct nsf_file *nsf);
+void NSF_Free(struct nsf_file *nsf);
+void NSF_Player_Init(struct nsf_player *player, const struct nsf_file *nsf);
+bool NSF_Start_Song(struct nsf_player *player, unsigned song);
+bool NSF_Play_Frame(struct nsf_player *player);
+
+#endif
@@ -0,0 +1,193 @@
+//NSF to MIDI conversion. After each frame, every channel's state is checked
+//and turned into notes by the voice tracker.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nsf_midi.h"
+#include "midi_write.h"
+#include "midi_types.h"
+#include "voice_track.h"
+#include "loop_detect.h"
+
+//MIDI channel for each APU channel
+static const uint8_t midiChannels[APU_NUM_CHANNELS] = {0, 1, 2, 9};
+
+
+//Play one frame and work out what every channel sounds like
+static bool Play_Frame(struct nsf_player *player, struct voice_frame frames[APU_NUM_CHANNELS])
+{
+	struct apu_voice voices[APU_NUM_CHANNELS];
+	bool ok;
+	int c;
+
+	ok = NSF_Play_Frame(player);
+	APU_Voices(&player->apu, voices);
+	for (c = 0; c < APU_NUM_CHANNELS; c++)
+	{
+		frames[c].audible = voices[c].audible;
+		frames[c].key = voices[c].key;
+		frames[c].volume = voices[c].volume;
+		frames[c].restarted = voices[c].restarted;
+	}
+	return ok;
+}
+
+
+//Play the song once without writing anything to find out how long it really
+//is. A song ends when it loops or when it's been silent for a while after
+//playing something. Otherwise it gets cut off at numFrames. If the song loops,
+//loopStart is set to the first frame of the loop.
+static bool Find_Song_End(struct nsf_player *player, unsigned song, uint32_t numFrames,
+                          uint32_t *end, uint32_t *loopStart, bool *looped)
+{
+	struct loop_detector detector;
+	struct voice_frame frames[APU_NUM_CHANNELS];
+	struct voice_track tracks[APU_NUM_CHANNELS];
+	struct voice_change change;
+	uint32_t frame, framesPerSecond, silentSince = 0;
+	uint64_t signature;
+	bool ok, active, audible, played = false;
+	int c;
+
+	*end = numFrames;
+	*looped = false;
+	framesPerSecond = 1000000 / player->frameMicroseconds;
+	if (!Loop_Init(&detector, NSF_LOOP_WINDOW_SECONDS * framesPerSecond,
+	               NSF_LOOP_REPEAT_SECONDS * framesPerSecond, numFrames))
+		return false;
+
+	memset(tracks, 0, sizeof(tracks));
+	ok = NSF_Start_Song(player, song);
+	for (frame = 0; ok && frame < numFrames; frame++)
+	{
+		ok = Play_Frame(player, frames);
+
+		//The signature is what every channel sounds like. The detector only
+		//looks for loops around frames where notes start.
+		signature = 0;
+		active = audible = false;
+		for (c = 0; c < APU_NUM_CHANNELS; c++)
+		{
+			signature = Loop_Hash(signature, (uint64_t)frames[c].audible << 24 |
+			                      (uint64_t)frames[c].key << 16 |
+			                      (uint64_t)frames[c].volume << 8 | frames[c].restarted);
+			if (Voice_Track_Update(&tracks[c], &frames[c], &change) && change.start)
+				active = true;
+			audible = audible || frames[c].audible;
+		}
+
+		if (Loop_Add(&detector, signature, active))
+		{
+			*end = detector.start + detector.length;
+			*loopStart = detector.start;
+			*looped = true;
+			break;
+		}
+
+		if (audible)
+		{
+			played = true;
+			silentSince = frame + 1;
+		} else if (played && frame + 1 - silentSince >= NSF_SILENCE_SECONDS * framesPerSecond)
+		{
+			*end = silentSince;
+			break;
+		}
+	}
+
+	Loop_Free(&detector);
+	return ok;
+}
+
+
+//Write any note changes for one channel
+static void Update_Channel(struct midi_writer *w, uint32_t frame, int channel,
+                           const struct voice_frame *f, struct voice_track *track)
+{
+	struct voice_change change;
+	uint8_t status = midiChannels[channel];
+
+	if (!Voice_Track_Update(track, f, &change))
+		return;
+
+	if (change.stop)
+		Writer_Event(w, frame, MIDI_EVENT_NOTE_OFF | status, change.stopKey, 0);
+	if (change.start)
+		Writer_Event(w, frame, MIDI_EVENT_NOTE_ON | status, change.startKey, change.velocity);
+}
+
+
+//Play a song (numbered from 0) for up to the given number of seconds and return
+//the notes as a MIDI file in memory. The file has to be loaded with NSF_Load()
+//first. The caller frees *data. If findLoop is set, the song is played twice:
+//once to find where it loops or ends, and again to write out everything up to
+//the end of the first time through the loop. The loop is marked with
+//"loopStart" and "loopEnd" markers.
+bool NSF_To_MIDI(const struct nsf_file *nsf, unsigned song, uint32_t seconds, uint32_t ppqn,
+                 bool findLoop, uint8_t **data, size_t *size)
+{
+	struct nsf_player player;
+	struct midi_writer w;
+	struct voice_frame frames[APU_NUM_CHANNELS];
+	struct voice_track tracks[APU_NUM_CHANNELS];
+	struct voice_change change;
+	char title[128];
+	uint32_t frame = 0, numFrames, loopStart = 0;
+	int c;
+	bool ok = true, looped = false;
+
+	if (song >= nsf->totalSongs)
+	{
+		fprintf(stderr, "Error: Song %u is out of range; the file has %u songs\n",
+		        song + 1, nsf->totalSongs);
+		return false;
+	}
+
+	NSF_Player_Init(&player, nsf);
+	numFrames = (uint32_t)((uint64_t)seconds * 1000000 / player.frameMicroseconds);
+	if (findLoop)
+		ok = Find_Song_End(&player, song, numFrames, &numFrames, &loopStart, &looped);
+
+	//One track, with the song name and the tempo up front. A quarter note is
+	//ppqn frames long.
+	Writer_Init(&w);
+	Writer_Header(&w, 0, 1, ppqn);
+	Writer_Begin_Track(&w);
+	snprintf(title, sizeof(title), "%s - song %u", nsf->name, song + 1);
+	Writer_Meta(&w, 0, MIDI_META_TRACK_NAME, title, strlen(title));
+	Writer_Tempo(&w, 0, ppqn * player.frameMicroseconds);
+
+	memset(tracks, 0, sizeof(tracks));
+	if (ok)
+		ok = NSF_Start_Song(&player, song);
+	for (frame = 0; ok && frame < numFrames; frame++)
+	{
+		if (looped && frame == loopStart)
+			Writer_Meta(&w, frame, MIDI_META_MARKER, MIDI_MARKER_LOOP_START,
+			            strlen(MIDI_MARKER_LOOP_START));
+		ok = Play_Frame(&player, frames);
+		for (c = 0; c < APU_NUM_CHANNELS; c++)
+			Update_Channel(&w, frame, c, &frames[c], &tracks[c]);
+	}
+	if (looped)
+		Writer_Meta(&w, frame, MIDI_META_MARKER, MIDI_MARKER_LOOP_END,
+		            strlen(MIDI_MARKER_LOOP_END));
+
+	//Stop anything that's still playing
+	for (c = 0; c < APU_NUM_CHANNELS; c++)
+	{
+		if (Voice_Track_End(&tracks[c], &change))
+			Writer_Event(&w, frame, MIDI_EVENT_NOTE_OFF | midiChannels[c], change.stopKey, 0);
+	}
+	Writer_End_Track(&w, frame);
+
+	if (!Writer_Finish(&w, data, size))
+		return false;
+	if (!ok)
+	{
+		free(*data);
+		return false;
+	}
+	return true;
+}
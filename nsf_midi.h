@@ -0,0 +1,29 @@
+//NSF to MIDI conversion. A song is played for a set number of frames, and the
+//APU channels are turned into note on/off events: pulse 1 and 2 on MIDI
+//channels 0 and 1, the triangle on channel 2, and the noise channel on
+//channel 9 like a drum track. Time is counted in frames, so the PPQN for
+//midi_notes is the number of frames in a quarter note.
+
+#ifndef NSF_MIDI_H
+#define NSF_MIDI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "nsf.h"
+
+//How long to play a song if nobody says otherwise. With loop detection, this
+//is the longest we'll play a song that doesn't loop or end.
+#define NSF_DEFAULT_SECONDS 120
+
+//Loop detection settings. A loop has to repeat for at least a full loop and
+//NSF_LOOP_REPEAT_SECONDS before we believe it, and a song that goes quiet for
+//NSF_SILENCE_SECONDS after playing something is over.
+#define NSF_LOOP_WINDOW_SECONDS 1
+#define NSF_LOOP_REPEAT_SECONDS 15
+#define NSF_SILENCE_SECONDS 5
+
+bool NSF_To_MIDI(const struct nsf_file *nsf, unsigned song, uint32_t seconds, uint32_t ppqn,
+                 bool findLoop, uint8_t **data, size_t *size);
+
+#endif
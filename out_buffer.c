@@ -0,0 +1,235 @@
+//Buffered text output. This replaces a pile of tiny printf() calls with
+//memcpy() into one buffer per output. Buffers with a file descriptor are
+//flushed whenever they fill up; buffers without one keep everything so the
+//caller can write it out later, usually with Out_Write_Vector().
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "out_buffer.h"
+
+
+//Set up an empty buffer. Nothing is allocated until the first append.
+void Out_Init(struct out_buffer *b, int fd)
+{
+	b->data = NULL;
+	b->used = 0;
+	b->capacity = 0;
+	b->fd = fd;
+	b->failed = false;
+}
+
+
+//Empty the buffer and point it at a new file, keeping its memory for reuse
+void Out_Reset(struct out_buffer *b, int fd)
+{
+	b->used = 0;
+	b->fd = fd;
+	b->failed = false;
+}
+
+
+//Make room for at least extra more bytes. Returns false if we're out of memory,
+//in which case the buffer is marked as failed and further output is dropped.
+bool Out_Grow(struct out_buffer *b, size_t extra)
+{
+	size_t newCapacity;
+	char *newData;
+
+	if (b->failed)
+		return false;
+	if (b->capacity - b->used >= extra)
+		return true;
+
+	newCapacity = b->capacity ? b->capacity : OUT_FLUSH_SIZE;
+	while (newCapacity - b->used < extra)
+		newCapacity *= 2;
+
+	newData = realloc(b->data, newCapacity);
+	if (newData == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		b->failed = true;
+		return false;
+	}
+	b->data = newData;
+	b->capacity = newCapacity;
+	return true;
+}
+
+
+//Append formatted text. This is for the odd bits of output that aren't worth
+//building by hand, like headers and rests.
+void Out_Printf(struct out_buffer *b, const char *format, ...)
+{
+	va_list args;
+	int length;
+
+	//Try to format straight into the buffer. If it doesn't fit, grow the
+	//buffer and try again.
+	if (!Out_Grow(b, 128))
+		return;
+	va_start(args, format);
+	length = vsnprintf(b->data + b->used, b->capacity - b->used, format, args);
+	va_end(args);
+	if (length < 0)
+		return;
+
+	if ((size_t)length >= b->capacity - b->used)
+	{
+		if (!Out_Grow(b, (size_t)length + 1))
+			return;
+		va_start(args, format);
+		vsnprintf(b->data + b->used, b->capacity - b->used, format, args);
+		va_end(args);
+	}
+
+	b->used += (size_t)length;
+	if (b->used >= OUT_FLUSH_SIZE && b->fd >= 0)
+		Out_Flush(b);
+}
+
+
+//Write a whole set of buffers to a file, picking up after partial writes
+bool Out_Write_Vector(int fd, struct iovec *iov, int count)
+{
+	ssize_t written;
+
+	while (count > 0)
+	{
+		written = writev(fd, iov, count);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error writing output: %s\n\n", strerror(errno));
+			return false;
+		}
+
+		//Skip past whatever got written
+		while (count > 0 && (size_t)written >= iov->iov_len)
+		{
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
+
+//Make a file to write under a temporary name before renaming it into place.
+//The name ends in "XXXXXX", which gets filled in with something no other file
+//has, like mkstemp() does. But mkstemp() makes files only the owner can read,
+//and these are ordinary output, so the file is made with open() instead and
+//gets what any new file would: 0666 less the umask. Returns the file
+//descriptor, or -1 with errno set.
+int Out_Temp_File(char *tempName)
+{
+	static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	char *x = tempName + strlen(tempName) - 6;
+	struct timespec now;
+	uint64_t value;
+	int tries, i, fd;
+
+	//O_EXCL makes sure we never take over a file that's already there, so
+	//the name only needs to be unlikely to be taken. If it is, try another.
+	for (tries = 0; tries < 100; tries++)
+	{
+		clock_gettime(CLOCK_REALTIME, &now);
+		value = ((uint64_t)now.tv_nsec ^ (uint64_t)now.tv_sec << 30 ^
+		         (uint64_t)getpid() << 40) * UINT64_C(0x9E3779B97F4A7C15) + (uint64_t)tries;
+		value >>= 28;
+		for (i = 0; i < 6; i++, value /= 62)
+			x[i] = letters[value % 62];
+
+		fd = open(tempName, O_RDWR | O_CREAT | O_EXCL, 0666);
+		if (fd >= 0 || errno != EEXIST)
+			return fd;
+	}
+	return -1;
+}
+
+
+//Save a whole set of buffers as a file, or to standard output if the name is
+//"-". A file is written under a temporary name and then renamed, so a program
+//that has the old one open never sees it change underneath it, and a write
+//that fails doesn't leave half a file behind.
+bool Out_Save_Vector(const char *filename, struct iovec *iov, int count)
+{
+	char *tempName;
+	int fd;
+	bool ok;
+
+	if (strcmp(filename, "-") == 0)
+		return Out_Write_Vector(STDOUT_FILENO, iov, count);
+
+	//Every save gets its own temporary file, so two programs saving the same
+	//file can't rename each other's half-written data into place
+	tempName = malloc(strlen(filename) + sizeof(".XXXXXX"));
+	if (tempName == NULL)
+	{
+		fprintf(stderr, "Error: Out of memory\n\n");
+		return false;
+	}
+	sprintf(tempName, "%s.XXXXXX", filename);
+
+	fd = Out_Temp_File(tempName);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Error making a temporary file for %s: %s\n\n", filename,
+		        strerror(errno));
+		free(tempName);
+		return false;
+	}
+	ok = Out_Write_Vector(fd, iov, count);
+	ok = (close(fd) == 0) && ok;
+	if (ok && rename(tempName, filename) != 0)
+	{
+		fprintf(stderr, "Error writing %s: %s\n\n", filename, strerror(errno));
+		ok = false;
+	}
+
+	if (!ok)
+		remove(tempName);
+	free(tempName);
+	return ok;
+}
+
+
+//Write everything in the buffer to its file
+bool Out_Flush(struct out_buffer *b)
+{
+	struct iovec iov;
+
+	if (b->fd < 0 || b->used == 0)
+		return !b->failed;
+
+	iov.iov_base = b->data;
+	iov.iov_len = b->used;
+	if (!Out_Write_Vector(b->fd, &iov, 1))
+		b->failed = true;
+	b->used = 0;
+
+	return !b->failed;
+}
+
+
+//Release the buffer's memory. Doesn't flush or close anything.
+void Out_Free(struct out_buffer *b)
+{
+	free(b->data);
+	Out_Init(b, b->fd);
+}
@@ -0,0 +1,47 @@
+//Buffered text output. Text is appended to a big buffer in memory and written
+//out with a few large write() calls instead of going through stdio a few bytes
+//at a time.
+
+#ifndef OUT_BUFFER_H
+#define OUT_BUFFER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/uio.h>
+
+//Flush to the file once this much text is waiting
+#define OUT_FLUSH_SIZE 65536
+
+struct out_buffer
+{
+	char *data;
+	size_t used;
+	size_t capacity;
+	int fd;       //Where to flush to, or -1 to keep everything in memory
+	bool failed;  //Ran out of memory or a write failed
+};
+
+void Out_Init(struct out_buffer *b, int fd);
+void Out_Reset(struct out_buffer *b, int fd);
+bool Out_Grow(struct out_buffer *b, size_t extra);
+void Out_Printf(struct out_buffer *b, const char *format, ...);
+bool Out_Flush(struct out_buffer *b);
+void Out_Free(struct out_buffer *b);
+bool Out_Write_Vector(int fd, struct iovec *iov, int count);
+int Out_Temp_File(char *tempName);
+bool Out_Save_Vector(const char *filename, struct iovec *iov, int count);
+
+//Append text to the buffer. This is on the hot path for every note, so it's
+//inline and only calls out when the buffer needs to grow or be flushed.
+static inline void Out_Append(struct out_buffer *b, const char *text, size_t length)
+{
+	if (b->capacity - b->used < length && !Out_Grow(b, length))
+		return;
+	memcpy(b->data + b->used, text, length);
+	b->used += length;
+	if (b->used >= OUT_FLUSH_SIZE && b->fd >= 0)
+		Out_Flush(b);
+}
+
+#endif
@@ -0,0 +1,158 @@
+//ABC score writer. Every voice in every part becomes an ABC voice, numbered
+//through the whole tune. There's no meter (M:none) and no bar lines, and the
+//unit note length is a quarter note.
+//
+//In ABC an accidental lasts until the next bar line, the same as on paper. With
+//no bar lines, that would be the rest of the tune, so the sharps still in
+//effect are tracked, and a natural sign goes on any note that needs one.
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "score_out.h"
+#include "note_lengths.h"
+
+static const char abcLetters[12] = {'C', 'C', 'D', 'D', 'E', 'F', 'F', 'G', 'G', 'A', 'A', 'B'};
+static const bool abcSharps[12] = {0, 1, 0, 1, 0, 0, 1, 0, 1, 0, 1, 0};
+
+
+//Add a pitch. Middle C is "C" and the octave above it is "c"; further up gets
+//an apostrophe per octave, and further down a comma.
+static void ABC_Pitch(struct score_out *out, uint8_t key)
+{
+	struct out_buffer *text = &out->text;
+	uint8_t natural = key - abcSharps[key % 12];
+	int octave = key / 12 - 5;
+	char letter = abcLetters[key % 12];
+
+	if (abcSharps[key % 12] && !out->accidentals[natural])
+		Out_Append(text, "^", 1);
+	else if (!abcSharps[key % 12] && out->accidentals[natural])
+		Out_Append(text, "=", 1);
+	out->accidentals[natural] = abcSharps[key % 12];
+
+	if (octave > 0)
+		letter += 'a' - 'A';
+	Out_Append(text, &letter, 1);
+	for (; octave > 1; octave--)
+		Out_Append(text, "'", 1);
+	for (; octave < 0; octave++)
+		Out_Append(text, ",", 1);
+}
+
+
+//Add a length as a multiple of a quarter note, like "2" for a half note, "/2"
+//for an eighth, or "3/4" for a dotted eighth. A quarter note is just nothing.
+static void ABC_Length(struct out_buffer *text, uint8_t length)
+{
+	unsigned numerator = noteLengths[length].units, denominator = 32;
+
+	while (numerator % 2 == 0 && denominator > 1)
+	{
+		numerator /= 2;
+		denominator /= 2;
+	}
+	if (denominator == 1 && numerator != 1)
+		Out_Printf(text, "%u", numerator);
+	else if (denominator != 1 && numerator == 1)
+		Out_Printf(text, "/%u", denominator);
+	else if (denominator != 1)
+		Out_Printf(text, "%u/%u", numerator, denominator);
+}
+
+
+static void ABC_Start(struct score_out *out)
+{
+	const char *c;
+
+	//The title has to fit on one line
+	Out_Append(&out->text, "X:1\nT:", 6);
+	for (c = out->title; *c != '\0'; c++)
+		Out_Append(&out->text, (*c == '\n' || *c == '\r') ? " " : c, 1);
+	Out_Printf(&out->text, "\nM:none\nL:1/4\nK:C\n");
+}
+
+static void ABC_Start_Part(struct score_out *out)
+{
+}
+
+static void ABC_Start_Voice(struct score_out *out)
+{
+	Out_Printf(&out->text, "V:%u name=\"Ch %" PRIu8, out->voiceNumber, out->channel);
+	if (out->numVoices > 1)
+		Out_Printf(&out->text, " voice %" PRIu16, out->voice + 1);
+	Out_Printf(&out->text, "\"\n");
+}
+
+static void ABC_Event(struct score_out *out, const struct score_event *e)
+{
+	struct out_buffer *text = &out->text;
+	uint8_t k;
+
+	if (out->column > 0 && out->column % 16 == 0)
+		Out_Append(text, "\n", 1);
+
+	if (e->count == 0)
+	{
+		Out_Append(text, "z", 1);
+		ABC_Length(text, e->length);
+	} else if (e->count == 1)
+	{
+		ABC_Pitch(out, e->keys[0]);
+		ABC_Length(text, e->length);
+		if (e->flags[0] & NOTE_TIE)
+			Out_Append(text, "-", 1);
+	} else
+	{
+		Out_Append(text, "[", 1);
+		for (k = 0; k < e->count; k++)
+		{
+			ABC_Pitch(out, e->keys[k]);
+			if (e->flags[k] & NOTE_TIE)
+				Out_Append(text, "-", 1);
+		}
+		Out_Append(text, "]", 1);
+		ABC_Length(text, e->length);
+	}
+	Out_Append(text, " ", 1);
+}
+
+//Bar lines clear the accidentals
+static void ABC_Loop_Start(struct score_out *out)
+{
+	Out_Append(&out->text, "|: ", 3);
+	memset(out->accidentals, 0, sizeof(out->accidentals));
+}
+
+static void ABC_Loop_End(struct score_out *out)
+{
+	Out_Append(&out->text, ":|", 2);
+	memset(out->accidentals, 0, sizeof(out->accidentals));
+}
+
+static void ABC_End_Voice(struct score_out *out)
+{
+	Out_Append(&out->text, "\n", 1);
+}
+
+static void ABC_End_Part(struct score_out *out)
+{
+}
+
+static void ABC_End(struct score_out *out)
+{
+}
+
+const struct score_writer abcWriter =
+{
+	"--abc",
+	ABC_Start,
+	ABC_Start_Part,
+	ABC_Start_Voice,
+	ABC_Event,
+	ABC_Loop_Start,
+	ABC_Loop_End,
+	ABC_End_Voice,
+	ABC_End_Part,
+	ABC_End,
+};
@@ -0,0 +1,140 @@
+//LilyPond score writer. This is the same notation midi_notes prints, wrapped up
+//into a file LilyPond can typeset: one staff per channel, with a Voice in it
+//for each voice. English note names are used, so sharps are "cs" and so on.
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "score_out.h"
+#include "note_lengths.h"
+#include "midi_strings.h"
+
+
+//Add a string in double quotes, with the characters LilyPond cares about
+//escaped
+static void Lily_String(struct out_buffer *text, const char *string)
+{
+	Out_Append(text, "\"", 1);
+	for (; *string != '\0'; string++)
+	{
+		if (*string == '"' || *string == '\\')
+			Out_Append(text, "\\", 1);
+		Out_Append(text, string, 1);
+	}
+	Out_Append(text, "\"", 1);
+}
+
+
+//Add a pitch. Octave 3 gets no marks; lower octaves get a comma for each octave
+//down and higher octaves get an apostrophe for each octave up.
+static void Lily_Pitch(struct out_buffer *text, uint8_t key)
+{
+	int octave;
+
+	Out_Append(text, noteNames[key % 12], strlen(noteNames[key % 12]));
+	for (octave = key / 12 - 1; octave > 3; octave--)
+		Out_Append(text, "'", 1);
+	for (; octave < 3; octave++)
+		Out_Append(text, ",", 1);
+}
+
+
+static void Lily_Start(struct score_out *out)
+{
+	Out_Printf(&out->text, "\\version \"2.24.0\"\n\\language \"english\"\n\n\\header {\n  title = ");
+	Lily_String(&out->text, out->title);
+	Out_Printf(&out->text, "\n  tagline = ##f\n}\n\n\\score {\n  <<\n");
+}
+
+static void Lily_Start_Part(struct score_out *out)
+{
+	Out_Printf(&out->text, "    \\new Staff \\with { instrumentName = \"Ch %" PRIu8 "\" } <<\n",
+	           out->channel);
+}
+
+//The first four voices get LilyPond's usual stem directions so they don't run
+//into each other
+static void Lily_Start_Voice(struct score_out *out)
+{
+	static const char *const voiceCommands[4] =
+		{"\\voiceOne ", "\\voiceTwo ", "\\voiceThree ", "\\voiceFour "};
+
+	Out_Printf(&out->text, "      \\new Voice { %s\\cadenzaOn\n        ",
+	           (out->numVoices > 1 && out->voice < 4) ? voiceCommands[out->voice] : "");
+}
+
+static void Lily_Event(struct score_out *out, const struct score_event *e)
+{
+	const struct note_length *length = &noteLengths[e->length];
+	struct out_buffer *text = &out->text;
+	uint8_t k;
+
+	if (out->column > 0 && out->column % 16 == 0)
+		Out_Append(text, "\n        ", 9);
+
+	if (e->count == 0)
+	{
+		Out_Append(text, "r", 1);
+		Out_Append(text, length->string, length->size);
+	} else if (e->count == 1)
+	{
+		Lily_Pitch(text, e->keys[0]);
+		Out_Append(text, length->string, length->size);
+		if (e->flags[0] & NOTE_TIE)
+			Out_Append(text, "~", 1);
+	} else
+	{
+		//A tie on a chord has to be marked key by key inside the brackets
+		Out_Append(text, "<", 1);
+		for (k = 0; k < e->count; k++)
+		{
+			if (k > 0)
+				Out_Append(text, " ", 1);
+			Lily_Pitch(text, e->keys[k]);
+			if (e->flags[k] & NOTE_TIE)
+				Out_Append(text, "~", 1);
+		}
+		Out_Append(text, ">", 1);
+		Out_Append(text, length->string, length->size);
+	}
+	Out_Append(text, " ", 1);
+}
+
+static void Lily_Loop_Start(struct score_out *out)
+{
+	Out_Append(&out->text, "\\bar \".|:\" ", 11);
+}
+
+static void Lily_Loop_End(struct score_out *out)
+{
+	Out_Append(&out->text, "\\bar \":|.\"", 10);
+}
+
+static void Lily_End_Voice(struct score_out *out)
+{
+	Out_Append(&out->text, "\n      }\n", 9);
+}
+
+static void Lily_End_Part(struct score_out *out)
+{
+	Out_Append(&out->text, "    >>\n", 7);
+}
+
+static void Lily_End(struct score_out *out)
+{
+	Out_Append(&out->text, "  >>\n  \\layout { }\n}\n", 21);
+}
+
+const struct score_writer lilypondWriter =
+{
+	"--lilypond",
+	Lily_Start,
+	Lily_Start_Part,
+	Lily_Start_Voice,
+	Lily_Event,
+	Lily_Loop_Start,
+	Lily_Loop_End,
+	Lily_End_Voice,
+	Lily_End_Part,
+	Lily_End,
+};
@@ -0,0 +1,180 @@
+//MusicXML score writer. Each channel is a part, and since nothing is lined up
+//with bars, each part is one long measure with no time signature (senza
+//misura). Durations are counted in 128ths of a whole note, so the divisions
+//are 32 to the quarter note. The voices of a part come one after another, with
+//a backup to the start of the measure between them. A loop is marked with a
+//segno and a D.S., since a repeat bar can't go in the middle of a measure.
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "score_out.h"
+#include "note_lengths.h"
+
+static const char *const xmlSteps[12] = {"C", "C", "D", "D", "E", "F", "F", "G", "G", "A", "A", "B"};
+static const bool xmlSharps[12] = {0, 1, 0, 1, 0, 0, 1, 0, 1, 0, 1, 0};
+
+
+//Add text with the characters XML cares about escaped
+static void XML_String(struct out_buffer *text, const char *string)
+{
+	for (; *string != '\0'; string++)
+	{
+		if (*string == '&')
+			Out_Append(text, "&amp;", 5);
+		else if (*string == '<')
+			Out_Append(text, "&lt;", 4);
+		else if (*string == '>')
+			Out_Append(text, "&gt;", 4);
+		else if (*string == '"')
+			Out_Append(text, "&quot;", 6);
+		else
+			Out_Append(text, string, 1);
+	}
+}
+
+
+//Get the note type for a length, and whether it's dotted. A dotted length is
+//half again as long as the plain one.
+static const char *XML_Type(uint8_t length, bool *dotted)
+{
+	const struct note_length *l = &noteLengths[length];
+	unsigned units;
+
+	*dotted = (l->string[l->size - 1] == '.');
+	units = *dotted ? l->units * 2 / 3 : l->units;
+	switch (units)
+	{
+		case 128: return "whole";
+		case 64:  return "half";
+		case 32:  return "quarter";
+		case 16:  return "eighth";
+		case 8:   return "16th";
+		case 4:   return "32nd";
+		default:  return "64th";
+	}
+}
+
+
+static void XML_Start(struct score_out *out)
+{
+	int c;
+
+	Out_Printf(&out->text,
+	           "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+	           "<!DOCTYPE score-partwise PUBLIC \"-//Recordare//DTD MusicXML 3.1 Partwise//EN\" "
+	           "\"http://www.musicxml.org/dtds/partwise.dtd\">\n"
+	           "<score-partwise version=\"3.1\">\n  <work>\n    <work-title>");
+	XML_String(&out->text, out->title);
+	Out_Printf(&out->text, "</work-title>\n  </work>\n  <part-list>\n");
+	for (c = 0; c < 16; c++)
+	{
+		if (out->parts & (1u << c))
+			Out_Printf(&out->text, "    <score-part id=\"P%d\">\n"
+			           "      <part-name>Channel %d</part-name>\n    </score-part>\n", c, c);
+	}
+	Out_Printf(&out->text, "  </part-list>\n");
+}
+
+static void XML_Start_Part(struct score_out *out)
+{
+	Out_Printf(&out->text, "  <part id=\"P%" PRIu8 "\">\n    <measure number=\"1\">\n"
+	           "      <attributes>\n        <divisions>32</divisions>\n"
+	           "        <key><fifths>0</fifths></key>\n"
+	           "        <time print-object=\"no\"><senza-misura/></time>\n"
+	           "        <clef><sign>G</sign><line>2</line></clef>\n      </attributes>\n",
+	           out->channel);
+}
+
+//Go back to the start of the measure for the next voice
+static void XML_Start_Voice(struct score_out *out)
+{
+	if (out->voice > 0 && out->lastUnits > 0)
+		Out_Printf(&out->text, "      <backup><duration>%" PRIu32 "</duration></backup>\n",
+		           out->lastUnits);
+}
+
+static void XML_Event(struct score_out *out, const struct score_event *e)
+{
+	struct out_buffer *text = &out->text;
+	const char *type;
+	bool dotted;
+	uint8_t k = 0, key, flags;
+
+	type = XML_Type(e->length, &dotted);
+	do
+	{
+		key = (e->count > 0) ? e->keys[k] : 0;
+		flags = (e->count > 0) ? e->flags[k] : 0;
+		Out_Printf(text, "      <note>\n");
+		if (k > 0)
+			Out_Printf(text, "        <chord/>\n");
+		if (e->count == 0)
+			Out_Printf(text, "        <rest/>\n");
+		else
+			Out_Printf(text, "        <pitch><step>%s</step>%s<octave>%d</octave></pitch>\n",
+			           xmlSteps[key % 12], xmlSharps[key % 12] ? "<alter>1</alter>" : "",
+			           key / 12 - 1);
+		Out_Printf(text, "        <duration>%" PRIu8 "</duration>\n", noteLengths[e->length].units);
+		if (flags & NOTE_TIED)
+			Out_Printf(text, "        <tie type=\"stop\"/>\n");
+		if (flags & NOTE_TIE)
+			Out_Printf(text, "        <tie type=\"start\"/>\n");
+		Out_Printf(text, "        <voice>%" PRIu16 "</voice>\n        <type>%s</type>\n%s",
+		           out->voice + 1, type, dotted ? "        <dot/>\n" : "");
+		if (flags & (NOTE_TIE | NOTE_TIED))
+			Out_Printf(text, "        <notations>%s%s</notations>\n",
+			           (flags & NOTE_TIED) ? "<tied type=\"stop\"/>" : "",
+			           (flags & NOTE_TIE) ? "<tied type=\"start\"/>" : "");
+		Out_Printf(text, "      </note>\n");
+	} while (++k < e->count);
+}
+
+static void XML_Loop_Start(struct score_out *out)
+{
+	Out_Printf(&out->text, "      <direction placement=\"above\">\n"
+	           "        <direction-type><segno/></direction-type>\n"
+	           "        <voice>%" PRIu16 "</voice>\n        <sound segno=\"loop\"/>\n"
+	           "      </direction>\n", out->voice + 1);
+}
+
+//A loop with no start goes back to the beginning
+static void XML_Loop_End(struct score_out *out)
+{
+	bool segno = (out->header->loopStart != NOTE_LIST_NO_LOOP);
+
+	Out_Printf(&out->text, "      <direction placement=\"above\">\n"
+	           "        <direction-type><words>%s</words></direction-type>\n"
+	           "        <voice>%" PRIu16 "</voice>\n        <sound %s/>\n"
+	           "      </direction>\n", segno ? "D.S." : "D.C.", out->voice + 1,
+	           segno ? "dalsegno=\"loop\"" : "dacapo=\"yes\"");
+}
+
+static void XML_End_Voice(struct score_out *out)
+{
+}
+
+static void XML_End_Part(struct score_out *out)
+{
+	Out_Printf(&out->text, "      <barline location=\"right\"><bar-style>light-heavy</bar-style>"
+	           "</barline>\n    </measure>\n  </part>\n");
+}
+
+static void XML_End(struct score_out *out)
+{
+	Out_Printf(&out->text, "</score-partwise>\n");
+}
+
+const struct score_writer musicXMLWriter =
+{
+	"--musicxml",
+	XML_Start,
+	XML_Start_Part,
+	XML_Start_Voice,
+	XML_Event,
+	XML_Loop_Start,
+	XML_Loop_End,
+	XML_End_Voice,
+	XML_End_Part,
+	XML_End,
+};
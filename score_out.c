@@ -0,0 +1,220 @@
+//Sheet music output driver. This walks the note list records and hands them to
+//a writer as notes, chords and rests. See score_out.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "score_out.h"
+#include "note_lengths.h"
+
+static const struct score_writer *const scoreWriters[NUM_SCORE_FORMATS] =
+{
+	&lilypondWriter,
+	&musicXMLWriter,
+	&abcWriter,
+};
+
+
+//Take the score options (--lilypond, --musicxml and --abc, each with a file
+//name) out of a command line. They can go anywhere, and whatever's left is
+//moved down to fill the gap. *any is set if there were any.
+bool Score_Parse_Options(int *argc, char *argv[], const char *filenames[NUM_SCORE_FORMATS],
+                         bool *any)
+{
+	int i, f, n = 1;
+
+	*any = false;
+	for (f = 0; f < NUM_SCORE_FORMATS; f++)
+		filenames[f] = NULL;
+	for (i = 1; i < *argc; i++)
+	{
+		for (f = 0; f < NUM_SCORE_FORMATS; f++)
+		{
+			if (strcmp(argv[i], scoreWriters[f]->option) == 0)
+				break;
+		}
+		if (f == NUM_SCORE_FORMATS)
+		{
+			argv[n++] = argv[i];
+			continue;
+		}
+		if (i + 1 >= *argc)
+		{
+			fprintf(stderr, "Error: %s needs a value\n\n", argv[i]);
+			return false;
+		}
+		filenames[f] = argv[++i];
+		*any = true;
+	}
+
+	*argc = n;
+	argv[n] = NULL;
+	return true;
+}
+
+
+//Hand one event to the writer and keep track of how far along the voice is
+static void Score_Event(const struct score_writer *w, struct score_out *out,
+                        const struct score_event *e)
+{
+	w->event(out, e);
+	out->units += noteLengths[e->length].units;
+	out->column++;
+}
+
+
+//Write down a rest. Rests in the list are in ticks, so they get split into
+//lengths here the same way notes are. Whatever's too short to write down is
+//left out.
+static void Score_Rest(const struct score_writer *w, struct score_out *out,
+                       const struct length_table *lengths, const struct note_record *r)
+{
+	const struct note_split *split;
+	struct score_event e;
+	uint32_t wholeNotes, p;
+
+	split = Lengths_Split(lengths, r->ticks, &wholeNotes);
+	e.onset = r->onset;
+	e.count = 0;
+	for (p = 0; p < wholeNotes + split->count; p++)
+	{
+		e.length = (p < wholeNotes) ? NOTE_WHOLE : split->parts[p - wholeNotes];
+		Score_Event(w, out, &e);
+		e.onset += (uint32_t)((uint64_t)noteLengths[e.length].units * lengths->wholeNote / 128);
+	}
+}
+
+
+//Write down one channel as a part. The records for each voice of each track
+//are all together, so a part is a run of voices one after another.
+static void Score_Part(const struct score_writer *w, struct score_out *out,
+                       const struct note_list_writer *list, const struct length_table *lengths)
+{
+	const struct note_list_header *h = out->header;
+	struct note_record r, first;
+	struct score_event e;
+	uint32_t i, n = list->counts[out->channel];
+	bool loops = (h->loopStart != NOTE_LIST_NO_LOOP || h->loopEnd != NOTE_LIST_NO_LOOP);
+	bool looped, tied;
+
+	//Count the voices first, since some formats need to know up front
+	out->numVoices = 0;
+	for (i = 0; i < n; i++)
+	{
+		List_Get(list, out->channel, i, &r);
+		if (i == 0 || r.track != first.track || r.voice != first.voice)
+			out->numVoices++;
+		first = r;
+	}
+
+	w->start_part(out);
+	i = 0;
+	for (out->voice = 0; out->voice < out->numVoices; out->voice++)
+	{
+		List_Get(list, out->channel, i, &first);
+		out->voiceNumber++;
+		out->units = 0;
+		out->column = 0;
+		memset(out->accidentals, 0, sizeof(out->accidentals));
+		w->start_voice(out);
+
+		looped = tied = false;
+		while (i < n)
+		{
+			List_Get(list, out->channel, i, &r);
+			if (r.track != first.track || r.voice != first.voice)
+				break;
+
+			//A note that's tied over the loop point is still going, so the
+			//repeat starts once it's over, the same as in the text output
+			if (h->loopStart != NOTE_LIST_NO_LOOP && !looped && !tied &&
+			    r.onset >= h->loopStart)
+			{
+				w->loop_start(out);
+				looped = true;
+			}
+			if (r.flags & NOTE_REST)
+			{
+				Score_Rest(w, out, lengths, &r);
+				tied = false;
+				i++;
+				continue;
+			}
+
+			//The records for the keys in a chord are all together
+			e.onset = r.onset;
+			e.length = r.length;
+			e.count = 0;
+			tied = false;
+			while (i < n && e.count < 128)
+			{
+				List_Get(list, out->channel, i, &r);
+				if (r.track != first.track || r.voice != first.voice || (r.flags & NOTE_REST) ||
+				    r.onset != e.onset || r.length != e.length)
+					break;
+				e.keys[e.count] = r.key & 0x7F;
+				e.flags[e.count] = r.flags;
+				tied = tied || (r.flags & NOTE_TIE);
+				e.count++;
+				i++;
+			}
+			if (e.length < NUM_NOTE_LENGTHS)
+				Score_Event(w, out, &e);
+		}
+
+		if (loops)
+			w->loop_end(out);
+		w->end_voice(out);
+		out->lastUnits = out->units;
+	}
+	w->end_part(out);
+}
+
+
+//Write the notes collected in a note list out as a score in one format, to a
+//file or to standard output if the name is "-". The header gives the timing
+//and loop points.
+bool Score_Write(enum score_format format, const char *filename, const char *title,
+                 const struct note_list_writer *list, const struct note_list_header *header)
+{
+	const struct score_writer *w = scoreWriters[format];
+	const struct length_table *lengths;
+	struct score_out out;
+	struct iovec iov;
+	bool ok;
+	int c;
+
+	lengths = Lengths_Get(header->ppqn);
+	if (lengths == NULL)
+		return false;
+
+	memset(&out, 0, sizeof(out));
+	Out_Init(&out.text, -1);
+	out.header = header;
+	out.title = title;
+	for (c = 0; c < 16; c++)
+	{
+		if (list->counts[c] > 0)
+			out.parts |= (uint16_t)1 << c;
+	}
+
+	w->start(&out);
+	for (c = 0; c < 16; c++)
+	{
+		if (!(out.parts & (1u << c)))
+			continue;
+		out.channel = c;
+		Score_Part(w, &out, list, lengths);
+	}
+	w->end(&out);
+
+	ok = !out.text.failed;
+	if (ok)
+	{
+		iov.iov_base = out.text.data;
+		iov.iov_len = out.text.used;
+		ok = Out_Save_Vector(filename, &iov, 1);
+	}
+	Out_Free(&out.text);
+	return ok;
+}
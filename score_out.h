@@ -0,0 +1,85 @@
+//Sheet music output. midi_notes collects its notes as note list records (see
+//note_list.h) when it's asked for a note list or a score, which makes them a
+//handy in-between form: every note is already quantized into lengths that can
+//be written down, and each record says which track and voice it's in. The
+//writers here turn one set of records into sheet music in different formats,
+//so a single conversion can produce all of them.
+//
+//Each format is a struct score_writer full of callbacks. The driver in
+//score_out.c walks the records a channel at a time, groups them into notes,
+//chords and rests, and calls the writer for each one. Every channel is a part,
+//and every voice in every track is a voice in that part, since the tracks all
+//start at the same time.
+//
+//The notes aren't lined up with bars, so none of the formats get bar lines or a
+//time signature. If the song loops, the loop is marked with repeats.
+
+#ifndef SCORE_OUT_H
+#define SCORE_OUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "out_buffer.h"
+#include "note_list.h"
+
+enum score_format
+{
+	SCORE_LILYPOND,
+	SCORE_MUSICXML,
+	SCORE_ABC,
+	NUM_SCORE_FORMATS
+};
+
+//One thing to write down: a note, a chord, or a rest
+struct score_event
+{
+	uint32_t onset;        //Start time in ticks
+	uint8_t length;        //Index into noteLengths[]
+	uint8_t count;         //Number of keys. A rest has none.
+	uint8_t keys[128];     //MIDI key numbers, lowest first
+	uint8_t flags[128];    //NOTE_TIE and NOTE_TIED for each key
+};
+
+//A score being written. The driver keeps track of where it is, and the
+//writers can keep anything else they need here too.
+struct score_out
+{
+	struct out_buffer text;
+	const struct note_list_header *header;
+	const char *title;
+	uint16_t parts;            //Channels that have anything, one part each
+	uint8_t channel;           //Channel of the current part
+	uint16_t voice;            //Voice in the current part, counting from 0
+	uint16_t numVoices;        //Voices in the current part
+	unsigned voiceNumber;      //Voices so far in the whole score, counting this one
+	uint32_t units;            //Length of the voice so far, in 128ths of a whole note
+	uint32_t lastUnits;        //Length of the last voice that finished
+	unsigned column;           //Events so far on the current line
+	uint8_t accidentals[128];  //Sharps still in effect, for formats that carry
+	                           //them over like a printed score does
+};
+
+struct score_writer
+{
+	const char *option;        //Command line option that asks for this format
+	void (*start)(struct score_out *out);
+	void (*start_part)(struct score_out *out);
+	void (*start_voice)(struct score_out *out);
+	void (*event)(struct score_out *out, const struct score_event *e);
+	void (*loop_start)(struct score_out *out);
+	void (*loop_end)(struct score_out *out);
+	void (*end_voice)(struct score_out *out);
+	void (*end_part)(struct score_out *out);
+	void (*end)(struct score_out *out);
+};
+
+extern const struct score_writer lilypondWriter;
+extern const struct score_writer musicXMLWriter;
+extern const struct score_writer abcWriter;
+
+bool Score_Parse_Options(int *argc, char *argv[], const char *filenames[NUM_SCORE_FORMATS],
+                         bool *any);
+bool Score_Write(enum score_format format, const char *filename, const char *title,
+                 const struct note_list_writer *list, const struct note_list_header *header);
+
+#endif
@@ -0,0 +1,492 @@
+//Seek index. Each track gets a mark at the first event on or after every bar
+//line. A mark is the cursor state just before that event, so everything after
+//a mark is at or after its bar line, and everything before it is earlier.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "seek_index.h"
+#include "tempo_map.h"
+#include "out_buffer.h"
+
+//The index file is only ever read back on the machine that wrote it, so it's
+//written in the machine's own byte order. A file from somewhere else won't
+//have the right magic number and gets rebuilt.
+#define SEEK_MAGIC   0x4B534756  //"VGSK" on little-endian machines
+#define SEEK_VERSION 1
+
+struct seek_file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t fileSize;       //Size and modification time of the MIDI file, so
+	int64_t modifiedSec;     //we can tell when it's changed
+	int64_t modifiedNsec;
+	uint32_t interval;
+	uint32_t numTracks;
+	uint32_t numMarks;
+	uint32_t numTempos;
+	//Then the length of each track chunk, each track's first mark plus the end,
+	//the marks, and the tempo changes
+};
+
+
+//Work out how long a bar is from the time signature at the start of the first
+//track. Without one, it's 4/4 like MIDI says.
+static uint32_t Seek_Bar_Ticks(const struct midi_index *index)
+{
+	uint32_t division = SEEK_DEFAULT_DIVISION, quarters4 = 16;
+	struct track_cursor c;
+	struct track_event e;
+
+	if (index->haveHeader && index->header.divType == 0 && index->header.division > 0)
+		division = index->header.division;
+
+	//The time signature's denominator is a power of two, so a bar is
+	//numerator * 4 / 2^denominator quarter notes. quarters4 counts quarter
+	//notes times 4 so that 6/8 and friends come out even.
+	if (index->numTracks > 0)
+	{
+		Cursor_Init(&c, &index->tracks[0]);
+		while (Cursor_Next(&c, &e) && e.time == 0)
+		{
+			if (e.event.status == MIDI_EVENT_META && e.event.data1 == MIDI_META_TIME_SIGNATURE &&
+			    e.length >= 2 && e.payload[0] > 0 && e.payload[1] <= 4)
+			{
+				quarters4 = (uint32_t)e.payload[0] * 16 >> e.payload[1];
+				break;
+			}
+		}
+	}
+
+	return (quarters4 * division / 4 > 0) ? quarters4 * division / 4 : 1;
+}
+
+
+//Grow an array by one entry if it's full
+static bool Seek_Grow(void **array, size_t count, size_t *size, size_t entrySize)
+{
+	void *newArray;
+	size_t newSize;
+
+	if (count < *size)
+		return true;
+
+	newSize = *size ? 2 * *size : 64;
+	newArray = realloc(*array, newSize * entrySize);
+	if (newArray == NULL)
+		return false;
+	*array = newArray;
+	*size = newSize;
+	return true;
+}
+
+
+//Walk one track, adding a mark at the start of every bar and saving the tempo
+//changes
+static bool Seek_Track(struct seek_index *seek, const struct midi_chunk *chunk, size_t track,
+                       size_t *marksSize, size_t *temposSize)
+{
+	struct track_cursor c;
+	struct track_event e;
+	struct cursor_mark mark;
+	uint64_t nextBar = 0;
+
+	Cursor_Init(&c, chunk);
+	for (;;)
+	{
+		Cursor_Mark(&c, &mark);
+		if (!Cursor_Next(&c, &e))
+			return true;
+
+		//First event of a new bar
+		if (e.time >= nextBar)
+		{
+			if (!Seek_Grow((void **)&seek->marks, seek->numMarks, marksSize,
+			               sizeof(struct cursor_mark)))
+				return false;
+			seek->marks[seek->numMarks++] = mark;
+			nextBar = ((uint64_t)e.time / seek->interval + 1) * seek->interval;
+		}
+
+		if (e.event.status == MIDI_EVENT_META && e.event.data1 == MIDI_META_SET_TEMPO &&
+		    e.length >= 3)
+		{
+			if (!Seek_Grow((void **)&seek->tempos, seek->numTempos, temposSize,
+			               sizeof(struct seek_tempo)))
+				return false;
+			seek->tempos[seek->numTempos].tick = e.time;
+			seek->tempos[seek->numTempos].tempo = (uint32_t)e.payload[0] << 16 |
+			                                      (uint32_t)e.payload[1] << 8  |
+			                                      (uint32_t)e.payload[2];
+			seek->tempos[seek->numTempos++].track = (uint32_t)track;
+		}
+	}
+}
+
+
+//Build the index by walking every track once. Nothing gets stored but the
+//marks and tempo changes, so this is quick even for big files. A track with bad
+//data just gets marks up to the problem; decoding will stop there anyway. The
+//only way this fails is running out of memory, and it's up to the caller to
+//say so.
+bool Seek_Build(struct seek_index *seek, const struct midi_index *index)
+{
+	size_t marksSize = 0, temposSize = 0, t;
+
+	memset(seek, 0, sizeof(*seek));
+	seek->interval = Seek_Bar_Ticks(index);
+	seek->numTracks = index->numTracks;
+	seek->trackStart = malloc((index->numTracks + 1) * sizeof(size_t));
+	if (seek->trackStart == NULL)
+		return false;
+
+	for (t = 0; t < index->numTracks; t++)
+	{
+		seek->trackStart[t] = seek->numMarks;
+		if (!Seek_Track(seek, &index->tracks[t], t, &marksSize, &temposSize))
+		{
+			Seek_Free(seek);
+			return false;
+		}
+	}
+	seek->trackStart[index->numTracks] = seek->numMarks;
+	return true;
+}
+
+
+//Name of the index file for a MIDI file. The caller frees it.
+static char *Seek_File_Name(const char *filename)
+{
+	char *name = malloc(strlen(filename) + sizeof(".seek"));
+
+	if (name == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		return NULL;
+	}
+	strcpy(name, filename);
+	strcat(name, ".seek");
+	return name;
+}
+
+
+//Fill in the parts of the index file header that describe the MIDI file
+static bool Seek_File_Info(struct seek_file_header *h, const char *filename)
+{
+	struct stat info;
+
+	if (stat(filename, &info) != 0)
+		return false;
+	memset(h, 0, sizeof(*h));
+	h->magic = SEEK_MAGIC;
+	h->version = SEEK_VERSION;
+	h->fileSize = (uint64_t)info.st_size;
+	h->modifiedSec = (int64_t)info.st_mtim.tv_sec;
+	h->modifiedNsec = (int64_t)info.st_mtim.tv_nsec;
+	return true;
+}
+
+
+//Read the rest of an index file once the header checks out, and make sure
+//everything points where it should, so a damaged index file can't send the
+//decoder off into the weeds
+static bool Seek_Read(struct seek_index *seek, FILE *file, const struct seek_file_header *h,
+                      const struct midi_index *index)
+{
+	uint32_t *counts;
+	size_t n = h->numTracks, t, m;
+	bool ok;
+
+	//Track lengths, then where each track's marks start
+	counts = malloc((2 * n + 1) * sizeof(uint32_t));
+	seek->trackStart = malloc((n + 1) * sizeof(size_t));
+	seek->marks = malloc(((size_t)h->numMarks + 1) * sizeof(struct cursor_mark));
+	seek->tempos = malloc(((size_t)h->numTempos + 1) * sizeof(struct seek_tempo));
+	if (counts == NULL || seek->trackStart == NULL || seek->marks == NULL || seek->tempos == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		free(counts);
+		return false;
+	}
+	ok = fread(counts, sizeof(uint32_t), 2 * n + 1, file) == 2 * n + 1 &&
+	     fread(seek->marks, sizeof(struct cursor_mark), h->numMarks, file) == h->numMarks &&
+	     fread(seek->tempos, sizeof(struct seek_tempo), h->numTempos, file) == h->numTempos &&
+	     counts[2 * n] == h->numMarks;
+
+	for (t = 0; t <= n && ok; t++)
+	{
+		seek->trackStart[t] = counts[n + t];
+		ok = seek->trackStart[t] <= h->numMarks &&
+		     (t == 0 || seek->trackStart[t] >= seek->trackStart[t-1]);
+	}
+	for (t = 0; t < n && ok; t++)
+	{
+		ok = counts[t] == index->tracks[t].length;
+		for (m = seek->trackStart[t]; m < seek->trackStart[t+1] && ok; m++)
+			ok = seek->marks[m].pos <= counts[t];
+	}
+
+	free(counts);
+	return ok;
+}
+
+
+//Read a saved index for a MIDI file. Returns false, without saying anything,
+//if there's no index file or it's for a different version of the file. Then
+//the caller can build a new one.
+bool Seek_Load(struct seek_index *seek, const char *filename, const struct midi_index *index)
+{
+	struct seek_file_header h, expected;
+	char *name;
+	FILE *file;
+	bool ok;
+
+	memset(seek, 0, sizeof(*seek));
+	if (!Seek_File_Info(&expected, filename) || (name = Seek_File_Name(filename)) == NULL)
+		return false;
+	file = fopen(name, "rb");
+	free(name);
+	if (file == NULL)
+		return false;
+
+	ok = fread(&h, sizeof(h), 1, file) == 1 && h.magic == expected.magic &&
+	     h.version == expected.version && h.fileSize == expected.fileSize &&
+	     h.modifiedSec == expected.modifiedSec && h.modifiedNsec == expected.modifiedNsec &&
+	     h.numTracks == index->numTracks && h.interval > 0 &&
+	     Seek_Read(seek, file, &h, index);
+	fclose(file);
+
+	if (!ok)
+	{
+		Seek_Free(seek);
+		return false;
+	}
+	seek->interval = h.interval;
+	seek->numTracks = h.numTracks;
+	seek->numMarks = h.numMarks;
+	seek->numTempos = h.numTempos;
+	return true;
+}
+
+
+//Write the index next to the MIDI file. It's written to a temporary file and
+//renamed into place, so another conversion of the same file never reads half
+//of one. Nothing is printed if it can't be saved, since it's only there to
+//save time.
+bool Seek_Save(const struct seek_index *seek, const char *filename, const struct midi_index *index)
+{
+	struct seek_file_header h;
+	uint32_t value;
+	char *name, *tempName;
+	FILE *file;
+	size_t t;
+	int fd;
+	bool ok;
+
+	if (!Seek_File_Info(&h, filename) || (name = Seek_File_Name(filename)) == NULL)
+		return false;
+	h.interval = seek->interval;
+	h.numTracks = (uint32_t)seek->numTracks;
+	h.numMarks = (uint32_t)seek->numMarks;
+	h.numTempos = (uint32_t)seek->numTempos;
+
+	tempName = malloc(strlen(name) + sizeof(".XXXXXX"));
+	if (tempName == NULL)
+	{
+		free(name);
+		return false;
+	}
+	strcpy(tempName, name);
+	strcat(tempName, ".XXXXXX");
+
+	fd = Out_Temp_File(tempName);
+	if (fd < 0)
+	{
+		free(tempName);
+		free(name);
+		return false;
+	}
+	file = fdopen(fd, "wb");
+	if (file == NULL)
+	{
+		close(fd);
+		unlink(tempName);
+		free(tempName);
+		free(name);
+		return false;
+	}
+
+	ok = fwrite(&h, sizeof(h), 1, file) == 1;
+	for (t = 0; t < seek->numTracks && ok; t++)
+	{
+		value = index->tracks[t].length;
+		ok = fwrite(&value, sizeof(value), 1, file) == 1;
+	}
+	for (t = 0; t <= seek->numTracks && ok; t++)
+	{
+		value = (uint32_t)seek->trackStart[t];
+		ok = fwrite(&value, sizeof(value), 1, file) == 1;
+	}
+	ok = ok && fwrite(seek->marks, sizeof(struct cursor_mark), seek->numMarks, file) ==
+	           seek->numMarks;
+	ok = ok && fwrite(seek->tempos, sizeof(struct seek_tempo), seek->numTempos, file) ==
+	           seek->numTempos;
+	ok = (fclose(file) == 0) && ok;
+	ok = ok && rename(tempName, name) == 0;
+
+	//Don't leave a partial index around
+	if (!ok)
+		unlink(tempName);
+	free(tempName);
+	free(name);
+	return ok;
+}
+
+
+//Get the index for a MIDI file, from its index file if there's a good one, or
+//by building a new one and saving it. Not being able to save it isn't a
+//problem; it just gets built again next time. If filename is NULL, the data
+//didn't come from a MIDI file, so the index is only built.
+bool Seek_Open(struct seek_index *seek, const char *filename, const struct midi_index *index)
+{
+	if (filename != NULL && Seek_Load(seek, filename, index))
+		return true;
+	if (!Seek_Build(seek, index))
+		return false;
+	if (filename != NULL)
+		Seek_Save(seek, filename, index);
+	return true;
+}
+
+
+void Seek_Free(struct seek_index *seek)
+{
+	free(seek->trackStart);
+	free(seek->marks);
+	free(seek->tempos);
+	memset(seek, 0, sizeof(*seek));
+}
+
+
+//Find where to start decoding a track to get every event from a tick on. That's
+//the last mark before the tick, or the start of the track if there isn't one.
+const struct cursor_mark *Seek_Find(const struct seek_index *seek, size_t track, uint32_t tick)
+{
+	size_t low, high, mid;
+
+	if (track >= seek->numTracks || seek->trackStart[track] == seek->trackStart[track + 1])
+		return NULL;
+
+	//Marks are in tick order, so binary search for the last one before the tick
+	low = seek->trackStart[track];
+	high = seek->trackStart[track + 1];
+	if (seek->marks[low].time >= tick)
+		return &seek->marks[low];
+	while (high - low > 1)
+	{
+		mid = low + (high - low) / 2;
+		if (seek->marks[mid].time < tick)
+			low = mid;
+		else
+			high = mid;
+	}
+	return &seek->marks[low];
+}
+
+
+//Add the tempo changes for a track to a tempo map, or the ones from every track
+//if track is TEMPO_ALL_TRACKS
+bool Seek_Tempo_Map(const struct seek_index *seek, struct tempo_map *map, size_t track)
+{
+	size_t i;
+
+	for (i = 0; i < seek->numTempos; i++)
+	{
+		if (track != TEMPO_ALL_TRACKS && seek->tempos[i].track != track)
+			continue;
+		if (!Tempo_Add(map, seek->tempos[i].tick, seek->tempos[i].tempo))
+			return false;
+	}
+	return true;
+}
+
+
+//Turn a range of bars into a range of ticks. Bars are numbered from 1, and the
+//range includes both ends. The end of the range is exclusive in ticks.
+void Seek_Bars(const struct seek_index *seek, uint32_t fromBar, uint32_t toBar,
+               uint32_t *from, uint32_t *to)
+{
+	uint64_t ticks;
+
+	ticks = (uint64_t)(fromBar > 0 ? fromBar - 1 : 0) * seek->interval;
+	*from = (ticks < SEEK_NO_END) ? (uint32_t)ticks : SEEK_NO_END;
+	ticks = (uint64_t)toBar * seek->interval;
+	*to = (toBar != SEEK_NO_END && ticks < SEEK_NO_END) ? (uint32_t)ticks : SEEK_NO_END;
+}
+
+
+//Take the --from, --to and --no-seek-file options out of a command line. They
+//can go anywhere, and whatever's left is moved down to fill the gap. Returns
+//false if one of them doesn't have a good bar number. *seekFile is cleared by
+//--no-seek-file, which means the index shouldn't be kept in a file.
+bool Seek_Parse_Range(int *argc, char *argv[], uint32_t *fromBar, uint32_t *toBar,
+                      bool *haveRange, bool *seekFile)
+{
+	unsigned long bar;
+	uint32_t *target;
+	char *end;
+	int i, n = 1;
+
+	*fromBar = 1;
+	*toBar = SEEK_NO_END;
+	*haveRange = false;
+	*seekFile = true;
+
+	for (i = 1; i < *argc; i++)
+	{
+		if (strcmp(argv[i], "--no-seek-file") == 0)
+		{
+			*seekFile = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--from") == 0)
+			target = fromBar;
+		else if (strcmp(argv[i], "--to") == 0)
+			target = toBar;
+		else
+		{
+			argv[n++] = argv[i];
+			continue;
+		}
+
+		if (i + 1 >= *argc)
+		{
+			fprintf(stderr, "Error: %s needs a bar number\n\n", argv[i]);
+			return false;
+		}
+		errno = 0;
+		bar = strtoul(argv[i + 1], &end, 10);
+		if (errno != 0 || *end != '\0' || end == argv[i + 1] || bar == 0 || bar >= SEEK_NO_END)
+		{
+			fprintf(stderr, "Error: Bad bar number for %s: %s\n\n", argv[i], argv[i + 1]);
+			return false;
+		}
+		*target = (uint32_t)bar;
+		*haveRange = true;
+		i++;
+	}
+
+	*argc = n;
+	argv[n] = NULL;
+	if (*fromBar > *toBar)
+	{
+		fprintf(stderr, "Error: The range starts after it ends\n\n");
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,60 @@
+//Seek index. Delta times only say how far an event is from the one before it,
+//so normally the only way to get to bar 40 of a track is to decode the 39 bars
+//before it. The seek index saves a spot in each track at every bar line, so a
+//range of bars can be decoded starting from the closest spot instead. Building
+//the index takes one pass over the file, so it's kept in a file next to the
+//MIDI file (the same name with ".seek" on the end) for next time, unless
+//--no-seek-file says not to. The index also keeps every tempo change, since a
+//range still needs the tempo from before it started.
+
+#ifndef SEEK_INDEX_H
+#define SEEK_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "midi_decode.h"
+
+struct tempo_map;
+
+//Ticks per quarter note to use if the file has no header
+#define SEEK_DEFAULT_DIVISION 120
+
+//No end to a range
+#define SEEK_NO_END UINT32_MAX
+
+//A tempo change, and which track it came from. Format 2 tracks each have their
+//own tempo.
+struct seek_tempo
+{
+	uint32_t tick;
+	uint32_t tempo;
+	uint32_t track;
+};
+
+struct seek_index
+{
+	uint32_t interval;           //Ticks between marks. This is one bar.
+	size_t numTracks;
+	size_t *trackStart;          //Index of each track's first mark, plus one more
+	                             //entry for the end of the last track
+	struct cursor_mark *marks;   //Each track's marks, in tick order
+	size_t numMarks;
+	struct seek_tempo *tempos;   //Every tempo change in the file, in file order
+	size_t numTempos;
+};
+
+bool Seek_Build(struct seek_index *seek, const struct midi_index *index);
+bool Seek_Load(struct seek_index *seek, const char *filename, const struct midi_index *index);
+bool Seek_Save(const struct seek_index *seek, const char *filename,
+               const struct midi_index *index);
+bool Seek_Open(struct seek_index *seek, const char *filename, const struct midi_index *index);
+void Seek_Free(struct seek_index *seek);
+const struct cursor_mark *Seek_Find(const struct seek_index *seek, size_t track, uint32_t tick);
+bool Seek_Tempo_Map(const struct seek_index *seek, struct tempo_map *map, size_t track);
+void Seek_Bars(const struct seek_index *seek, uint32_t fromBar, uint32_t toBar,
+               uint32_t *from, uint32_t *to);
+bool Seek_Parse_Range(int *argc, char *argv[], uint32_t *fromBar, uint32_t *toBar,
+                      bool *haveRange, bool *seekFile);
+
+#endif
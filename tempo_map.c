@@ -0,0 +1,172 @@
+//Tempo map. The changes are kept in a sorted array along with the time each one
+//starts at, so converting a tick only has to find the last change before it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "tempo_map.h"
+
+
+//Start a map with the default tempo at tick 0
+bool Tempo_Init(struct tempo_map *map, uint32_t division)
+{
+	map->division = (division > 0) ? division : 1;
+	map->size = 16;
+	map->count = 1;
+	map->changes = malloc(map->size * sizeof(struct tempo_change));
+	if (map->changes == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		map->size = map->count = 0;
+		return false;
+	}
+
+	map->changes[0].tick = 0;
+	map->changes[0].tempo = TEMPO_DEFAULT;
+	map->changes[0].time = 0;
+	return true;
+}
+
+void Tempo_Free(struct tempo_map *map)
+{
+	free(map->changes);
+	map->changes = NULL;
+	map->count = map->size = 0;
+}
+
+
+//Microseconds from a tempo change to a later tick
+static uint64_t Tempo_Since(const struct tempo_map *map, const struct tempo_change *c,
+                            uint32_t tick)
+{
+	return (uint64_t)(tick - c->tick) * c->tempo / map->division;
+}
+
+
+//Add a tempo change. Changes usually come in order, but a format 1 file can
+//have them in any track, so one that goes before the end of the map is put in
+//its place and the times after it are worked out again. A second change at the
+//same tick replaces the first.
+bool Tempo_Add(struct tempo_map *map, uint32_t tick, uint32_t tempo)
+{
+	struct tempo_change *newChanges;
+	size_t i;
+
+	if (map->changes == NULL)
+		return false;
+
+	//Find the first change after this tick
+	i = map->count;
+	while (i > 0 && map->changes[i - 1].tick > tick)
+		i--;
+
+	if (i > 0 && map->changes[i - 1].tick == tick)
+	{
+		i--;
+	} else
+	{
+		if (map->count == map->size)
+		{
+			newChanges = realloc(map->changes, 2 * map->size * sizeof(struct tempo_change));
+			if (newChanges == NULL)
+			{
+				fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+				return false;
+			}
+			map->changes = newChanges;
+			map->size *= 2;
+		}
+		memmove(&map->changes[i + 1], &map->changes[i],
+		        (map->count - i) * sizeof(struct tempo_change));
+		map->count++;
+		map->changes[i].tick = tick;
+	}
+	map->changes[i].tempo = tempo;
+
+	//Work out the times of this change and the ones after it
+	for (i = (i > 0) ? i : 1; i < map->count; i++)
+		map->changes[i].time = map->changes[i - 1].time +
+		                       Tempo_Since(map, &map->changes[i - 1], map->changes[i].tick);
+	return true;
+}
+
+
+//Build a map from the Set Tempo events in one track of the store, or in every
+//track if track is TEMPO_ALL_TRACKS. The map has to be initialized first.
+//Events are in file order, so they're in tick order within each track, and
+//usually every change is in the first track anyway.
+bool Tempo_Build(struct tempo_map *map, const struct event_store *store, size_t track)
+{
+	const uint8_t *data;
+	size_t first = 0, last = store->count, i;
+
+	if (track != TEMPO_ALL_TRACKS)
+	{
+		if (track >= store->numTracks)
+			return true;
+		first = store->trackStart[track];
+		last = store->trackStart[track + 1];
+	}
+
+	for (i = first; i < last; i++)
+	{
+		if (store->status[i] != MIDI_EVENT_META || store->data1[i] != MIDI_META_SET_TEMPO ||
+		    store->length[i] < 3)
+			continue;
+		data = store->base + store->payload[i];
+		if (!Tempo_Add(map, store->tick[i], (uint32_t)data[0] << 16 |
+		                                    (uint32_t)data[1] << 8  |
+		                                    (uint32_t)data[2]))
+			return false;
+	}
+
+	return true;
+}
+
+
+//Find the last tempo change at or before a tick
+static size_t Tempo_Find(const struct tempo_map *map, uint32_t tick)
+{
+	size_t low = 0, high = map->count, mid;
+
+	//The first change is at tick 0, so the answer is always in [low, high)
+	while (high - low > 1)
+	{
+		mid = low + (high - low) / 2;
+		if (map->changes[mid].tick <= tick)
+			low = mid;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+
+//Microseconds from the start of the file to a tick
+uint64_t Tempo_Time(const struct tempo_map *map, uint32_t tick)
+{
+	const struct tempo_change *c = &map->changes[Tempo_Find(map, tick)];
+
+	return c->time + Tempo_Since(map, c, tick);
+}
+
+
+//Convert a whole array of ticks at once. A track's ticks only go up, so
+//instead of searching for every tick, we step forward through the tempo
+//changes as we go. We only search again if a tick goes backwards.
+void Tempo_Times(const struct tempo_map *map, const uint32_t *ticks, size_t count,
+                 uint64_t *times)
+{
+	const struct tempo_change *changes = map->changes;
+	size_t i, c = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		if (ticks[i] < changes[c].tick)
+			c = Tempo_Find(map, ticks[i]);
+		while (c + 1 < map->count && changes[c + 1].tick <= ticks[i])
+			c++;
+		times[i] = changes[c].time + Tempo_Since(map, &changes[c], ticks[i]);
+	}
+}
@@ -0,0 +1,45 @@
+//Tempo map. MIDI files count time in ticks, and Set Tempo events say how long
+//a quarter note is from then on. The map is a list of every tempo change with
+//the real time it happens at, so the time of any tick is a binary search and
+//one multiply away. In a format 1 file, the tempo changes are all in the first
+//track but apply to every track, so the map is built from the whole file once
+//instead of walking the first track again for each of the others.
+
+#ifndef TEMPO_MAP_H
+#define TEMPO_MAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "midi_events.h"
+
+//Tempo until the first Set Tempo event, in microseconds per quarter note
+#define TEMPO_DEFAULT 500000
+
+//Pass this as the track to build a map from every track
+#define TEMPO_ALL_TRACKS SIZE_MAX
+
+struct tempo_change
+{
+	uint32_t tick;
+	uint32_t tempo;       //Microseconds per quarter note from here on
+	uint64_t time;        //Microseconds from the start to this tick
+};
+
+struct tempo_map
+{
+	uint32_t division;    //Ticks per quarter note
+	struct tempo_change *changes;  //Sorted by tick. The first one is at tick 0.
+	size_t count;
+	size_t size;          //Entries allocated
+};
+
+bool Tempo_Init(struct tempo_map *map, uint32_t division);
+void Tempo_Free(struct tempo_map *map);
+bool Tempo_Add(struct tempo_map *map, uint32_t tick, uint32_t tempo);
+bool Tempo_Build(struct tempo_map *map, const struct event_store *store, size_t track);
+uint64_t Tempo_Time(const struct tempo_map *map, uint32_t tick);
+void Tempo_Times(const struct tempo_map *map, const uint32_t *ticks, size_t count,
+                 uint64_t *times);
+
+#endif
@@ -0,0 +1,255 @@
+//Register models for the sound chips found in VGM files. Each chip has a write
+//function that takes register writes straight from the VGM command stream and a
+//voices function that reports what each channel sounds like right now.
+
+#include <string.h>
+#include <math.h>
+#include "vgm_chips.h"
+
+
+//SN76489. Every channel starts out silent.
+void PSG_Reset(struct psg *psg)
+{
+	memset(psg, 0, sizeof(*psg));
+	memset(psg->attenuation, 0x0F, sizeof(psg->attenuation));
+}
+
+//Writes with the top bit set latch a channel and register type and
+//carry the low four bits of the value. Writes without it carry the upper six
+//bits of a tone period, or replace the latched register's value.
+void PSG_Write(struct psg *psg, uint8_t value)
+{
+	uint8_t channel, data;
+	bool volume;
+
+	if (value & 0x80)
+	{
+		psg->latch = (value >> 4) & 0x07;
+		data = value & 0x0F;
+	} else
+	{
+		data = value & 0x3F;
+	}
+	channel = psg->latch >> 1;
+	volume = psg->latch & 0x01;
+
+	if (volume)
+	{
+		psg->attenuation[channel] = data & 0x0F;
+	} else if (channel == 3)
+	{
+		//Writing the noise register resets the shift register
+		psg->noise = data & 0x07;
+		psg->restarted = true;
+	} else if (value & 0x80)
+	{
+		psg->period[channel] = (psg->period[channel] & 0x3F0) | data;
+	} else
+	{
+		psg->period[channel] = (psg->period[channel] & 0x00F) | (uint16_t)data << 4;
+	}
+}
+
+//The tone channels run at the clock divided by 32 times the period. There are
+//only four noise settings, so the noise channel gets a key for each, with
+//faster shift rates on higher keys and periodic noise an octave and a bit up.
+void PSG_Voices(struct psg *psg, uint32_t clock, struct voice_frame voices[PSG_VOICES])
+{
+	int c;
+
+	for (c = 0; c < 3; c++)
+	{
+		voices[c].audible = psg->attenuation[c] < 15 && psg->period[c] > 0;
+		voices[c].key = voices[c].audible ?
+		                Voice_Frequency_Key((double)clock / (32.0 * psg->period[c])) : 0;
+		voices[c].volume = 15 - psg->attenuation[c];
+		voices[c].restarted = false;
+	}
+
+	voices[3].audible = psg->attenuation[3] < 15;
+	voices[3].key = 46 - 2 * (psg->noise & 0x03) + ((psg->noise & 0x04) ? 0 : 16);
+	voices[3].volume = 15 - psg->attenuation[3];
+	voices[3].restarted = psg->restarted;
+	psg->restarted = false;
+}
+
+
+//YM2413. Each channel's F-number, block, and key bit are spread over three
+//register banks.
+void OPLL_Write(struct opll *opll, uint8_t reg, uint8_t value)
+{
+	uint8_t c = reg & 0x0F;
+
+	if (reg == 0x0E)
+	{
+		opll->rhythm = (value & 0x20) != 0;
+		return;
+	}
+	if (c >= OPLL_VOICES)
+		return;
+
+	switch (reg & 0xF0)
+	{
+		case 0x10:
+			opll->fnum[c] = (opll->fnum[c] & 0x100) | value;
+			break;
+		case 0x20:
+			if ((value & 0x10) && !(opll->control[c] & 0x10))
+				opll->restarted[c] = true;
+			opll->control[c] = value;
+			opll->fnum[c] = (opll->fnum[c] & 0x0FF) | (uint16_t)(value & 0x01) << 8;
+			break;
+		case 0x30:
+			opll->volume[c] = value & 0x0F;
+			break;
+		default:
+			break;
+	}
+}
+
+//The output rate is the clock divided by 72, and the F-number is a phase step
+//in units of 2^-19 at block 0
+void OPLL_Voices(struct opll *opll, uint32_t clock, struct voice_frame voices[OPLL_VOICES])
+{
+	uint8_t block;
+	int c;
+
+	for (c = 0; c < OPLL_VOICES; c++)
+	{
+		block = (opll->control[c] >> 1) & 0x07;
+		voices[c].audible = (opll->control[c] & 0x10) && opll->fnum[c] > 0 &&
+		                    !(opll->rhythm && c >= 6);
+		voices[c].key = voices[c].audible ?
+		                Voice_Frequency_Key((double)opll->fnum[c] * clock /
+		                                    (72.0 * (1 << (19 - block)))) : 0;
+		voices[c].volume = 15 - opll->volume[c];
+		voices[c].restarted = opll->restarted[c];
+		opll->restarted[c] = false;
+	}
+}
+
+
+//YM2612. Port 0 has the global registers and channels 0-2, and port 1 has
+//channels 3-5. The high F-number bits and block are latched and only take
+//effect when the low F-number byte is written.
+void OPN2_Write(struct opn2 *opn2, int port, uint8_t reg, uint8_t value)
+{
+	uint8_t c;
+
+	if (port == 0 && reg == 0x28)
+	{
+		//Key on/off. Channel numbers 3 and 7 don't exist.
+		if ((value & 0x03) == 0x03)
+			return;
+		c = (value & 0x03) + ((value & 0x04) ? 3 : 0);
+		if ((value & 0xF0) && opn2->slots[c] == 0)
+			opn2->restarted[c] = true;
+		opn2->slots[c] = value >> 4;
+	} else if (port == 0 && reg == 0x2B)
+	{
+		opn2->dac = (value & 0x80) != 0;
+	} else if (reg >= 0xA4 && reg <= 0xA6)
+	{
+		opn2->latch[port] = value;
+	} else if (reg >= 0xA0 && reg <= 0xA2)
+	{
+		c = (reg - 0xA0) + 3 * port;
+		opn2->fnum[c] = (uint16_t)(opn2->latch[port] & 0x07) << 8 | value;
+		opn2->block[c] = (opn2->latch[port] >> 3) & 0x07;
+	}
+}
+
+//The output rate is the clock divided by 144, and the F-number is a phase step
+//in units of 2^-21 at block 0
+void OPN2_Voices(struct opn2 *opn2, uint32_t clock, struct voice_frame voices[OPN2_VOICES])
+{
+	int c;
+
+	for (c = 0; c < OPN2_VOICES; c++)
+	{
+		voices[c].audible = opn2->slots[c] != 0 && opn2->fnum[c] > 0 &&
+		                    !(opn2->dac && c == 5);
+		voices[c].key = voices[c].audible ?
+		                Voice_Frequency_Key((double)opn2->fnum[c] * clock /
+		                                    (144.0 * (1 << (21 - opn2->block[c])))) : 0;
+		voices[c].volume = 15;
+		voices[c].restarted = opn2->restarted[c];
+		opn2->restarted[c] = false;
+	}
+}
+
+
+//YM2151. Pitches are set with a key code (octave and note) instead of a
+//frequency.
+void OPM_Write(struct opm *opm, uint8_t reg, uint8_t value)
+{
+	uint8_t c;
+
+	if (reg == 0x08)
+	{
+		c = value & 0x07;
+		if ((value & 0x78) && opm->slots[c] == 0)
+			opm->restarted[c] = true;
+		opm->slots[c] = (value >> 3) & 0x0F;
+	} else if (reg >= 0x28 && reg <= 0x2F)
+	{
+		opm->keyCode[reg - 0x28] = value & 0x7F;
+	}
+}
+
+//The note codes skip every fourth value and start at C#. At the usual 3.58 MHz
+//clock, key code $4A is A4. Other clocks shift everything up or down.
+void OPM_Voices(struct opm *opm, uint32_t clock, struct voice_frame voices[OPM_VOICES])
+{
+	static const uint8_t semitones[16] = {1, 2, 3, 3, 4, 5, 6, 6, 7, 8, 9, 9, 10, 11, 12, 12};
+	int c, key, shift;
+
+	shift = (int)lround(12 * log2((double)clock / 3579545.0));
+	for (c = 0; c < OPM_VOICES; c++)
+	{
+		key = 12 * ((opm->keyCode[c] >> 4) + 1) + semitones[opm->keyCode[c] & 0x0F] + shift;
+		voices[c].audible = opm->slots[c] != 0;
+		voices[c].key = (key < 0) ? 0 : (key > 127) ? 127 : key;
+		voices[c].volume = 15;
+		voices[c].restarted = opm->restarted[c];
+		opm->restarted[c] = false;
+	}
+}
+
+
+//AY-3-8910. All of the registers are kept as-is.
+void AY_Write(struct ay8910 *ay, uint8_t reg, uint8_t value)
+{
+	if (reg >= 16)
+		return;
+	ay->regs[reg] = value;
+
+	//Writing the envelope shape restarts the envelope
+	if (reg == 13)
+		ay->restarted = true;
+}
+
+//Tone periods are 12 bits, and the tone runs at the clock divided by 16 times
+//the period. A channel is audible if its tone is enabled in the mixer and it has
+//some volume, either fixed or from the envelope.
+void AY_Voices(struct ay8910 *ay, uint32_t clock, struct voice_frame voices[AY_VOICES])
+{
+	uint16_t period;
+	uint8_t amplitude;
+	bool envelope;
+	int c;
+
+	for (c = 0; c < AY_VOICES; c++)
+	{
+		period = ay->regs[2*c] | (uint16_t)(ay->regs[2*c + 1] & 0x0F) << 8;
+		amplitude = ay->regs[8 + c];
+		envelope = (amplitude & 0x10) != 0;
+		voices[c].audible = !(ay->regs[7] & (1 << c)) && period > 0 &&
+		                    (envelope || (amplitude & 0x0F) > 0);
+		voices[c].key = voices[c].audible ?
+		                Voice_Frequency_Key((double)clock / (16.0 * period)) : 0;
+		voices[c].volume = envelope ? 15 : (amplitude & 0x0F);
+		voices[c].restarted = envelope && ay->restarted;
+	}
+	ay->restarted = false;
+}
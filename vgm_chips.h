@@ -0,0 +1,83 @@
+//Register models for the sound chips found in VGM files. Like the NES APU
+//model, none of these make any sound. They keep just enough of each chip's
+//registers to say which channels are keyed on and what pitch they're playing.
+//Volumes are only tracked where the chip has a simple per-channel volume; the
+//FM chips are always reported at full volume.
+
+#ifndef VGM_CHIPS_H
+#define VGM_CHIPS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "voice_track.h"
+
+//Texas Instruments SN76489 PSG: three square wave channels and a noise channel
+#define PSG_VOICES 4
+
+struct psg
+{
+	uint16_t period[3];   //10-bit tone periods
+	uint8_t noise;        //Noise control: white noise flag and shift rate
+	uint8_t attenuation[4];
+	uint8_t latch;        //Channel and register type of the last latch byte
+	bool restarted;       //The noise register was written
+};
+
+//Yamaha YM2413 (OPLL): nine FM channels. The rhythm section is ignored, and
+//channels 6-8 go quiet while it's on.
+#define OPLL_VOICES 9
+
+struct opll
+{
+	uint16_t fnum[OPLL_VOICES];
+	uint8_t control[OPLL_VOICES];   //$20-$28: sustain, key on, block, F-number bit 8
+	uint8_t volume[OPLL_VOICES];    //Low nybble of $30-$38
+	bool rhythm;
+	bool restarted[OPLL_VOICES];
+};
+
+//Yamaha YM2612 (OPN2): six FM channels, the last of which can be a DAC instead
+#define OPN2_VOICES 6
+
+struct opn2
+{
+	uint16_t fnum[OPN2_VOICES];
+	uint8_t block[OPN2_VOICES];
+	uint8_t latch[2];               //$A4-$A6 high bits, one per port
+	uint8_t slots[OPN2_VOICES];     //Operators that are keyed on
+	bool dac;
+	bool restarted[OPN2_VOICES];
+};
+
+//Yamaha YM2151 (OPM): eight FM channels that take their pitch as a key code
+#define OPM_VOICES 8
+
+struct opm
+{
+	uint8_t keyCode[OPM_VOICES];
+	uint8_t slots[OPM_VOICES];
+	bool restarted[OPM_VOICES];
+};
+
+//General Instrument AY-3-8910: three square wave channels. Noise is ignored.
+#define AY_VOICES 3
+
+struct ay8910
+{
+	uint8_t regs[16];
+	bool restarted;       //The envelope shape was written
+};
+
+void PSG_Reset(struct psg *psg);
+void PSG_Write(struct psg *psg, uint8_t value);
+void PSG_Voices(struct psg *psg, uint32_t clock, struct voice_frame voices[PSG_VOICES]);
+void OPLL_Write(struct opll *opll, uint8_t reg, uint8_t value);
+void OPLL_Voices(struct opll *opll, uint32_t clock, struct voice_frame voices[OPLL_VOICES]);
+void OPN2_Write(struct opn2 *opn2, int port, uint8_t reg, uint8_t value);
+void OPN2_Voices(struct opn2 *opn2, uint32_t clock, struct voice_frame voices[OPN2_VOICES]);
+void OPM_Write(struct opm *opm, uint8_t reg, uint8_t value);
+void OPM_Voices(struct opm *opm, uint32_t clock, struct voice_frame voices[OPM_VOICES]);
+void AY_Write(struct ay8910 *ay, uint8_t reg, uint8_t value);
+void AY_Voices(struct ay8910 *ay, uint32_t clock, struct voice_frame voices[AY_VOICES]);
+
+#endif
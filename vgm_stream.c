@@ -0,0 +1,653 @@
+//Streaming VGM reader. Every command byte is looked up in a 256-entry table that
+//says how many operand bytes follow it and what to do with them, so the command
+//stream gets decoded in one pass without any searching. Register writes go to
+//the chip models, and waits move the clock forward. Every time the clock
+//crosses into a new frame, each voice is checked and any note changes are
+//passed on, the same way the NSF player checks the APU after every frame.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "vgm_stream.h"
+#include "midi_input.h"
+
+//What to do with each command
+enum vgm_action
+{
+	VGM_CMD_BAD,          //Not a valid command
+	VGM_CMD_SKIP,         //A chip or feature we don't handle
+	VGM_CMD_PSG,
+	VGM_CMD_OPLL,
+	VGM_CMD_OPN2_0,       //YM2612 port 0
+	VGM_CMD_OPN2_1,       //YM2612 port 1
+	VGM_CMD_OPM,
+	VGM_CMD_AY,
+	VGM_CMD_NES,
+	VGM_CMD_WAIT,         //Wait for a 16-bit number of samples
+	VGM_CMD_WAIT_60,      //Wait for one 60 Hz frame
+	VGM_CMD_WAIT_50,      //Wait for one 50 Hz frame
+	VGM_CMD_WAIT_SHORT,   //Wait for 1-16 samples
+	VGM_CMD_DAC_WAIT,     //YM2612 DAC write from the data bank, then wait 0-15 samples
+	VGM_CMD_END,          //End of the sound data
+	VGM_CMD_DATA,         //Data block
+};
+
+struct vgm_command
+{
+	uint8_t action;
+	uint8_t operands;     //Bytes after the command byte
+};
+
+#define C(action, operands) {VGM_CMD_##action, operands}
+
+static const struct vgm_command commands[256] =
+{
+	C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0),
+	C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0),
+	C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0),
+	C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0),
+	C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0),
+	C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0),
+	C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1),
+	C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1), C(SKIP, 1),
+	C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2),
+	C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 1),
+	C(PSG, 1), C(OPLL, 2), C(OPN2_0, 2), C(OPN2_1, 2), C(OPM, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2),
+	C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2),
+	C(BAD, 0), C(WAIT, 2), C(WAIT_60, 0), C(WAIT_50, 0), C(BAD, 0), C(BAD, 0), C(END, 0), C(DATA, 6),
+	C(SKIP, 11), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0),
+	C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0),
+	C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0), C(WAIT_SHORT, 0),
+	C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0),
+	C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0), C(DAC_WAIT, 0),
+	C(SKIP, 4), C(SKIP, 4), C(SKIP, 5), C(SKIP, 10), C(SKIP, 1), C(SKIP, 4), C(BAD, 0), C(BAD, 0),
+	C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0), C(BAD, 0),
+	C(AY, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2),
+	C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2),
+	C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(NES, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2),
+	C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2), C(SKIP, 2),
+	C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3),
+	C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3),
+	C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3),
+	C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3), C(SKIP, 3),
+	C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4),
+	C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4),
+	C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4),
+	C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4), C(SKIP, 4),
+};
+
+#undef C
+
+//Voices on each chip, and which of them is a noise channel
+static const uint8_t chipVoices[VGM_NUM_CHIPS] =
+	{PSG_VOICES, OPLL_VOICES, OPN2_VOICES, OPM_VOICES, AY_VOICES, APU_NUM_CHANNELS};
+static const int8_t noiseVoices[VGM_NUM_CHIPS] = {3, -1, -1, -1, -1, APU_NOISE};
+
+//Where each chip's clock is in the header
+static const uint8_t clockOffsets[VGM_NUM_CHIPS] = {0x0C, 0x10, 0x2C, 0x30, 0x74, 0x84};
+
+
+static uint32_t LE_Read32(const uint8_t *value)
+{
+	return (uint32_t)value[0]       | (uint32_t)value[1] << 8 |
+	       (uint32_t)value[2] << 16 | (uint32_t)value[3] << 24;
+}
+
+
+//Set up a reader to start at the beginning of a file
+void VGM_Init(struct vgm_stream *v, const struct midi_stream_handler *handler, void *user,
+              uint32_t ppqn)
+{
+	memset(v, 0, sizeof(*v));
+	v->handler = handler;
+	v->user = user;
+	v->ppqn = ppqn;
+	v->state = VGM_HEADER;
+	v->needed = 0x40;
+}
+
+
+//Stop reading for good
+static bool VGM_Fail(struct vgm_stream *v)
+{
+	v->state = VGM_ERROR;
+	return false;
+}
+
+
+//Skip some bytes, then move on to the next state
+static void VGM_Skip(struct vgm_stream *v, uint32_t count, enum vgm_state next)
+{
+	if (count > 0)
+	{
+		v->skip = count;
+		v->afterSkip = next;
+		v->state = VGM_SKIP;
+	} else
+	{
+		v->state = next;
+	}
+}
+
+
+//Pass a note on or off to the handler at the current frame
+static bool VGM_Event(struct vgm_stream *v, uint8_t status, uint8_t key, uint8_t velocity)
+{
+	uint8_t data[2] = {key, velocity};
+	uint32_t delta = v->tick - v->lastTick;
+
+	v->lastTick = v->tick;
+	if (v->handler->event != NULL && !v->handler->event(v->user, delta, status, data))
+		return VGM_Fail(v);
+	return true;
+}
+
+//Pass a marker to the handler at the current frame
+static bool VGM_Marker(struct vgm_stream *v, const char *text)
+{
+	uint32_t delta = v->tick - v->lastTick;
+
+	v->lastTick = v->tick;
+	if (v->handler->meta != NULL &&
+	    !v->handler->meta(v->user, delta, MIDI_META_MARKER, (const uint8_t *)text,
+	                      (uint32_t)strlen(text)))
+		return VGM_Fail(v);
+	return true;
+}
+
+static bool VGM_Change(struct vgm_stream *v, const struct vgm_voice *voice,
+                       const struct voice_change *change)
+{
+	if (change->stop &&
+	    !VGM_Event(v, MIDI_EVENT_NOTE_OFF | voice->channel, change->stopKey, 0))
+		return false;
+	if (change->start &&
+	    !VGM_Event(v, MIDI_EVENT_NOTE_ON | voice->channel, change->startKey, change->velocity))
+		return false;
+	return true;
+}
+
+
+//Hand out MIDI channels to a chip's voices the first time it's written to.
+//Channel 9 is saved for noise channels unless there's nothing else left.
+static void VGM_Start_Chip(struct vgm_stream *v, enum vgm_chip chip)
+{
+	uint8_t i, c;
+
+	v->started[chip] = true;
+	if (chip == VGM_PSG)
+	{
+		PSG_Reset(&v->psg);
+	} else if (chip == VGM_NES)
+	{
+		//The PAL CPU runs at 1.66 MHz and the NTSC one at 1.79 MHz
+		APU_Reset(&v->apu, v->clocks[chip] < 1720000);
+	}
+
+	for (i = 0; i < chipVoices[chip]; i++)
+	{
+		if (i == noiseVoices[chip] && !(v->usedChannels & (1u << 9)))
+		{
+			c = 9;
+		} else
+		{
+			for (c = 0; c < 16; c++)
+			{
+				if (c != 9 && !(v->usedChannels & (1u << c)))
+					break;
+			}
+			if (c == 16 && !(v->usedChannels & (1u << 9)))
+				c = 9;
+		}
+
+		if (c == 16)
+		{
+			if (!v->dropped)
+				fprintf(stderr, "Warning: Too many voices for 16 MIDI channels; "
+				        "some will be left out\n");
+			v->dropped = true;
+			return;
+		}
+
+		v->usedChannels |= (uint16_t)(1u << c);
+		v->voices[v->numVoices].chip = chip;
+		v->voices[v->numVoices].index = i;
+		v->voices[v->numVoices].channel = c;
+		v->numVoices++;
+	}
+}
+
+
+//Check that a chip is in the file before writing to it. Chips with no clock
+//in the header aren't there.
+static bool VGM_Chip_Ready(struct vgm_stream *v, enum vgm_chip chip)
+{
+	if (v->clocks[chip] == 0)
+		return false;
+	if (!v->started[chip])
+		VGM_Start_Chip(v, chip);
+	v->dirty = true;
+	return true;
+}
+
+
+//Get the current state of every voice on a chip
+static void VGM_Chip_Voices(struct vgm_stream *v, enum vgm_chip chip,
+                            struct voice_frame *frames)
+{
+	struct apu_voice apuVoices[APU_NUM_CHANNELS];
+	int c;
+
+	switch (chip)
+	{
+		case VGM_PSG:
+			PSG_Voices(&v->psg, v->clocks[chip], frames);
+			break;
+		case VGM_OPLL:
+			OPLL_Voices(&v->opll, v->clocks[chip], frames);
+			break;
+		case VGM_OPN2:
+			OPN2_Voices(&v->opn2, v->clocks[chip], frames);
+			break;
+		case VGM_OPM:
+			OPM_Voices(&v->opm, v->clocks[chip], frames);
+			break;
+		case VGM_AY:
+			AY_Voices(&v->ay, v->clocks[chip], frames);
+			break;
+		case VGM_NES:
+			APU_Voices(&v->apu, apuVoices);
+			for (c = 0; c < APU_NUM_CHANNELS; c++)
+			{
+				frames[c].audible = apuVoices[c].audible;
+				frames[c].key = apuVoices[c].key;
+				frames[c].volume = apuVoices[c].volume;
+				frames[c].restarted = apuVoices[c].restarted;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+
+//A frame is over. Check every voice and pass on the note changes.
+static bool VGM_End_Frame(struct vgm_stream *v)
+{
+	struct voice_frame frames[VGM_NUM_CHIPS][OPLL_VOICES];
+	struct voice_change change;
+	struct vgm_voice *voice;
+	int chip;
+	uint8_t i;
+
+	for (chip = 0; chip < VGM_NUM_CHIPS; chip++)
+	{
+		if (v->started[chip])
+			VGM_Chip_Voices(v, chip, frames[chip]);
+	}
+
+	for (i = 0; i < v->numVoices; i++)
+	{
+		voice = &v->voices[i];
+		if (Voice_Track_Update(&voice->track, &frames[voice->chip][voice->index], &change) &&
+		    !VGM_Change(v, voice, &change))
+			return false;
+	}
+
+	v->dirty = false;
+	return true;
+}
+
+
+//Move the clock forward. The NES APU has its own timers, so it gets run for
+//the time that passes; the other chips only change when they're written to.
+static bool VGM_Wait(struct vgm_stream *v, uint32_t samples)
+{
+	uint32_t step, cycles;
+
+	while (samples > 0)
+	{
+		step = v->samplesPerTick - (uint32_t)(v->samples % v->samplesPerTick);
+		if (step > samples)
+			step = samples;
+
+		if (v->started[VGM_NES])
+		{
+			v->apuCycles += (uint64_t)step * v->clocks[VGM_NES];
+			cycles = (uint32_t)(v->apuCycles / VGM_SAMPLE_RATE);
+			v->apuCycles %= VGM_SAMPLE_RATE;
+			APU_Run(&v->apu, cycles);
+		}
+
+		v->samples += step;
+		samples -= step;
+		if (v->samples % v->samplesPerTick == 0)
+		{
+			if ((v->dirty || v->started[VGM_NES]) && !VGM_End_Frame(v))
+				return false;
+			v->tick++;
+		}
+	}
+
+	return true;
+}
+
+
+//The song is over. Anything written since the last frame ended gets a frame
+//of its own, and then every note still playing is stopped.
+static bool VGM_End_Song(struct vgm_stream *v)
+{
+	struct voice_change change;
+	uint8_t i;
+
+	if (v->dirty || v->samples % v->samplesPerTick != 0)
+	{
+		if (!VGM_End_Frame(v))
+			return false;
+		v->tick++;
+	}
+	if (v->looped && !VGM_Marker(v, MIDI_MARKER_LOOP_END))
+		return false;
+
+	for (i = 0; i < v->numVoices; i++)
+	{
+		if (Voice_Track_End(&v->voices[i].track, &change) &&
+		    !VGM_Change(v, &v->voices[i], &change))
+			return false;
+	}
+
+	if (v->handler->meta != NULL &&
+	    !v->handler->meta(v->user, v->tick - v->lastTick, MIDI_META_END_OF_TRACK,
+	                      v->operands, 0))
+		return VGM_Fail(v);
+
+	v->state = VGM_DONE;
+	return true;
+}
+
+
+//We have a whole command. Do whatever it says.
+static bool VGM_Execute(struct vgm_stream *v)
+{
+	const uint8_t *o = v->operands;
+
+	switch (commands[v->command].action)
+	{
+		case VGM_CMD_PSG:
+			if (VGM_Chip_Ready(v, VGM_PSG))
+				PSG_Write(&v->psg, o[0]);
+			break;
+		case VGM_CMD_OPLL:
+			if (VGM_Chip_Ready(v, VGM_OPLL))
+				OPLL_Write(&v->opll, o[0], o[1]);
+			break;
+		case VGM_CMD_OPN2_0:
+		case VGM_CMD_OPN2_1:
+			if (VGM_Chip_Ready(v, VGM_OPN2))
+				OPN2_Write(&v->opn2, v->command & 0x01, o[0], o[1]);
+			break;
+		case VGM_CMD_OPM:
+			if (VGM_Chip_Ready(v, VGM_OPM))
+				OPM_Write(&v->opm, o[0], o[1]);
+			break;
+		case VGM_CMD_AY:
+			//The top bit of the register picks the second chip
+			if (!(o[0] & 0x80) && VGM_Chip_Ready(v, VGM_AY))
+				AY_Write(&v->ay, o[0], o[1]);
+			break;
+		case VGM_CMD_NES:
+			//Registers are numbered from $4000. $3F is the FDS, which we skip.
+			if (o[0] <= 0x17 && VGM_Chip_Ready(v, VGM_NES))
+				APU_Write(&v->apu, 0x4000 + o[0], o[1]);
+			break;
+		case VGM_CMD_WAIT:
+			return VGM_Wait(v, o[0] | (uint32_t)o[1] << 8);
+		case VGM_CMD_WAIT_60:
+			return VGM_Wait(v, VGM_SAMPLE_RATE / 60);
+		case VGM_CMD_WAIT_50:
+			return VGM_Wait(v, VGM_SAMPLE_RATE / 50);
+		case VGM_CMD_WAIT_SHORT:
+			return VGM_Wait(v, (v->command & 0x0F) + 1);
+		case VGM_CMD_DAC_WAIT:
+			return VGM_Wait(v, v->command & 0x0F);
+		case VGM_CMD_END:
+			return VGM_End_Song(v);
+		case VGM_CMD_DATA:
+			//$67 $66 type size, then the data, which we don't need
+			if (o[0] != 0x66)
+			{
+				fprintf(stderr, "Error: Bad VGM data block\n");
+				return VGM_Fail(v);
+			}
+			VGM_Skip(v, LE_Read32(o + 2) & 0x7FFFFFFF, VGM_COMMAND);
+			break;
+		default:
+			break;
+	}
+
+	return true;
+}
+
+
+//We have as much of the header as we need. Find out which chips are there and
+//how fast the frames are, and tell the handler what kind of file this is.
+static bool VGM_Header(struct vgm_stream *v)
+{
+	struct midi_header header;
+	uint32_t version, dataStart, eof, rate, tempo;
+	uint8_t tempoData[3];
+	int chip;
+
+	if (!VGM_Is_VGM(v->header, v->have))
+	{
+		if (v->header[0] == 0x1F && v->header[1] == 0x8B)
+			fprintf(stderr, "Error: Compressed VGM files aren't supported; unpack it first\n");
+		else
+			fprintf(stderr, "Error: Not a VGM file\n");
+		return VGM_Fail(v);
+	}
+
+	//Before version 1.50, the commands always start at $40
+	version = LE_Read32(v->header + 0x08);
+	dataStart = 0x40;
+	if (version >= 0x150 && LE_Read32(v->header + 0x34) != 0)
+		dataStart = 0x34 + LE_Read32(v->header + 0x34);
+	if (dataStart < 0x40)
+	{
+		fprintf(stderr, "Error: Bad VGM data offset\n");
+		return VGM_Fail(v);
+	}
+
+	//Newer files have longer headers. Get the rest if it's there. Fields that
+	//would be past the end of the header stay zeroed.
+	if (v->have < dataStart && v->have < VGM_HEADER_MAX)
+	{
+		v->needed = (dataStart < VGM_HEADER_MAX) ? dataStart : VGM_HEADER_MAX;
+		return true;
+	}
+
+	//The top bits of the clocks are flags. Files before version 1.10 used the
+	//YM2413 clock for all of the FM chips.
+	for (chip = 0; chip < VGM_NUM_CHIPS; chip++)
+		v->clocks[chip] = LE_Read32(v->header + clockOffsets[chip]) & 0x3FFFFFFF;
+	if (version < 0x110)
+		v->clocks[VGM_OPN2] = v->clocks[VGM_OPM] = v->clocks[VGM_OPLL];
+
+	rate = (version >= 0x101) ? LE_Read32(v->header + 0x24) : 0;
+	if (rate == 0 || rate > VGM_SAMPLE_RATE)
+		rate = 60;
+	v->samplesPerTick = VGM_SAMPLE_RATE / rate;
+
+	//The loop offset is relative to where it's stored, like the data offset
+	if (LE_Read32(v->header + 0x1C) != 0)
+		v->loopOffset = 0x1C + LE_Read32(v->header + 0x1C);
+
+	//Pretend to be a one-track MIDI file with a quarter note every ppqn frames
+	header.format = MIDI_FORMAT_ONETRACK;
+	header.tracks = 1;
+	header.division = (uint16_t)v->ppqn;
+	header.divType = 0;
+	if (v->handler->header != NULL && !v->handler->header(v->user, 6, &header))
+		return VGM_Fail(v);
+
+	eof = LE_Read32(v->header + 0x04) + 4;
+	if (v->handler->track != NULL &&
+	    !v->handler->track(v->user, (eof > dataStart) ? eof - dataStart : 0))
+		return VGM_Fail(v);
+
+	tempo = (uint32_t)((uint64_t)v->ppqn * 1000000 / rate);
+	if (tempo > 0xFFFFFF)
+		tempo = 0xFFFFFF;
+	tempoData[0] = (uint8_t)(tempo >> 16);
+	tempoData[1] = (uint8_t)(tempo >> 8);
+	tempoData[2] = (uint8_t)tempo;
+	if (v->handler->meta != NULL &&
+	    !v->handler->meta(v->user, 0, MIDI_META_SET_TEMPO, tempoData, 3))
+		return VGM_Fail(v);
+
+	VGM_Skip(v, dataStart - v->have, VGM_COMMAND);
+	return true;
+}
+
+
+//Decode a block of input. Returns false if the data is bad or a callback asked
+//us to stop; after that, the reader ignores any further input. Anything after
+//the end of the sound data (usually the GD3 tag) is ignored too.
+bool VGM_Feed(struct vgm_stream *v, const uint8_t *data, size_t size)
+{
+	size_t pos = 0;
+	uint32_t take;
+	uint8_t byte;
+
+	while (pos < size)
+	{
+		if (v->state == VGM_SKIP)
+		{
+			take = (v->skip < size - pos) ? v->skip : (uint32_t)(size - pos);
+			pos += take;
+			v->offset += take;
+			v->skip -= take;
+			if (v->skip == 0)
+				v->state = v->afterSkip;
+			continue;
+		}
+
+		if (v->state == VGM_ERROR)
+			return false;
+		if (v->state == VGM_DONE)
+			return true;
+
+		byte = data[pos++];
+		v->offset++;
+		switch (v->state)
+		{
+			case VGM_HEADER:
+				v->header[v->have++] = byte;
+				if (v->have == v->needed && !VGM_Header(v))
+					return false;
+				break;
+			case VGM_COMMAND:
+				//The loop starts with this command. Time spent waiting before it
+				//still counts as part of the intro.
+				if (v->offset - 1 == v->loopOffset && !v->looped)
+				{
+					v->looped = true;
+					if (!VGM_Marker(v, MIDI_MARKER_LOOP_START))
+						return false;
+				}
+				v->command = byte;
+				if (commands[byte].action == VGM_CMD_BAD)
+				{
+					fprintf(stderr, "Error: Unknown VGM command %02X\n", byte);
+					return VGM_Fail(v);
+				}
+				if (commands[byte].operands == 0)
+				{
+					if (!VGM_Execute(v))
+						return false;
+				} else
+				{
+					v->state = VGM_OPERANDS;
+					v->have = 0;
+					v->needed = commands[byte].operands;
+				}
+				break;
+			case VGM_OPERANDS:
+				v->operands[v->have++] = byte;
+				if (v->have == v->needed)
+				{
+					v->state = VGM_COMMAND;
+					if (!VGM_Execute(v))
+						return false;
+				}
+				break;
+			default:
+				return VGM_Fail(v);
+		}
+	}
+
+	return v->state != VGM_ERROR;
+}
+
+
+//Call this at the end of the input. A file that stops between two commands
+//without an end command is fine; anything else is cut off.
+bool VGM_Finish(struct vgm_stream *v)
+{
+	if (v->state == VGM_ERROR)
+		return false;
+	if (v->state == VGM_DONE)
+		return true;
+
+	if (v->state != VGM_COMMAND)
+	{
+		fprintf(stderr, "Error: Unexpected end of file\n");
+		return VGM_Fail(v);
+	}
+
+	return VGM_End_Song(v);
+}
+
+
+//Read a whole file one block at a time. A filename of "-" means standard input.
+static bool VGM_Feed_Block(void *decoder, const uint8_t *data, size_t size)
+{
+	return VGM_Feed(decoder, data, size);
+}
+
+static bool VGM_Finish_Input(void *decoder)
+{
+	return VGM_Finish(decoder);
+}
+
+bool VGM_Run_File(struct vgm_stream *v, const char *filename)
+{
+	return Input_Run_Blocks(filename, VGM_Feed_Block, VGM_Finish_Input, v);
+}
+
+
+//Check whether the start of a file looks like VGM data
+bool VGM_Is_VGM(const uint8_t *data, size_t size)
+{
+	return size >= 4 && memcmp(data, "Vgm ", 4) == 0;
+}
+
+
+//Check whether a regular file is a VGM file, without reading any more of it
+//than the identifier at the start
+bool VGM_Is_VGM_File(const char *filename)
+{
+	uint8_t ident[4];
+	ssize_t got;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	got = read(fd, ident, sizeof(ident));
+	close(fd);
+
+	return got > 0 && VGM_Is_VGM(ident, (size_t)got);
+}
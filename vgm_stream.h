@@ -0,0 +1,122 @@
+//Streaming VGM reader. A VGM file is a log of sound chip register writes with
+//waits in between, counted in samples at 44.1 kHz. This reads the log a block
+//at a time like the streaming MIDI decoder, runs the writes through register
+//models of the chips, and calls the same handler callbacks with a MIDI-style
+//note on/off timeline. Nothing but the current command is kept in memory, so
+//memory use doesn't depend on the length of the log.
+//
+//Time is counted in frames at the file's refresh rate (60 Hz unless the header
+//says otherwise), so the PPQN is the number of frames in a quarter note, the
+//same as for NSF files. Each chip's voices get MIDI channels in order the first
+//time the chip is written to. Noise channels go on channel 9 if it's free, and
+//voices that don't fit in 16 channels are dropped.
+//
+//A log of a looping song has the loop in it once, and the header says where it
+//starts. The loop is marked with "loopStart" and "loopEnd" markers, the same as
+//the NSF player uses.
+//
+//Supported chips are the SN76489, YM2413, YM2612, YM2151, AY-3-8910, and the
+//NES APU. Writes to any other chip, or to the second chip of a pair, are
+//skipped. Compressed (.vgz) files have to be unpacked first, e.g. with
+//"gunzip -c file.vgz | midi_notes - ...".
+
+#ifndef VGM_STREAM_H
+#define VGM_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "midi_stream.h"
+#include "vgm_chips.h"
+#include "nes_apu.h"
+
+//VGM files always count time at this rate
+#define VGM_SAMPLE_RATE 44100
+
+//How much of the header we look at. Anything past this is skipped.
+#define VGM_HEADER_MAX 0x100
+
+//The longest command we keep in memory, not counting the command byte
+#define VGM_OPERANDS_MAX 11
+
+//Every voice we can track, across all of the chips
+#define VGM_MAX_VOICES 16
+
+enum vgm_chip
+{
+	VGM_PSG,
+	VGM_OPLL,
+	VGM_OPN2,
+	VGM_OPM,
+	VGM_AY,
+	VGM_NES,
+	VGM_NUM_CHIPS
+};
+
+enum vgm_state
+{
+	VGM_HEADER,         //Reading the header
+	VGM_COMMAND,        //Reading a command byte
+	VGM_OPERANDS,       //Reading a command's operands
+	VGM_SKIP,           //Skipping bytes we don't need
+	VGM_DONE,           //Past the end of the command stream
+	VGM_ERROR,          //Bad data or a callback asked us to stop
+};
+
+//One chip channel and the MIDI channel it's been given
+struct vgm_voice
+{
+	uint8_t chip;
+	uint8_t index;      //Channel number on the chip
+	uint8_t channel;    //MIDI channel
+	struct voice_track track;
+};
+
+struct vgm_stream
+{
+	const struct midi_stream_handler *handler;
+	void *user;
+	uint32_t ppqn;
+	enum vgm_state state;
+	enum vgm_state afterSkip;
+	uint32_t skip;                //Bytes left to skip
+	uint32_t needed;              //Bytes wanted in the buffer
+	uint32_t have;                //Bytes in the buffer so far
+	uint8_t header[VGM_HEADER_MAX];
+	uint8_t command;              //Command byte of the current command
+	uint8_t operands[VGM_OPERANDS_MAX];
+	uint32_t offset;              //Bytes read from the file so far
+	uint32_t loopOffset;          //Where the loop starts, or 0 if it doesn't loop
+	bool looped;                  //The loop start has been marked
+
+	uint64_t samples;             //Time in samples since the start
+	uint32_t samplesPerTick;
+	uint32_t tick;                //Frame we're in right now
+	uint32_t lastTick;            //Time of the last event we passed on
+	bool dirty;                   //Registers changed since the last frame ended
+
+	uint32_t clocks[VGM_NUM_CHIPS];
+	bool started[VGM_NUM_CHIPS];  //The chip has been written to
+	struct psg psg;
+	struct opll opll;
+	struct opn2 opn2;
+	struct opm opm;
+	struct ay8910 ay;
+	struct nes_apu apu;
+	uint64_t apuCycles;           //Leftover APU cycles, times the sample rate
+
+	struct vgm_voice voices[VGM_MAX_VOICES];
+	uint8_t numVoices;
+	uint16_t usedChannels;
+	bool dropped;                 //Some voices didn't get a channel
+};
+
+void VGM_Init(struct vgm_stream *v, const struct midi_stream_handler *handler, void *user,
+              uint32_t ppqn);
+bool VGM_Feed(struct vgm_stream *v, const uint8_t *data, size_t size);
+bool VGM_Finish(struct vgm_stream *v);
+bool VGM_Run_File(struct vgm_stream *v, const char *filename);
+bool VGM_Is_VGM(const uint8_t *data, size_t size);
+bool VGM_Is_VGM_File(const char *filename);
+
+#endif
@@ -0,0 +1,260 @@
+//Voice separation. See voice_split.h for how the notes get split up.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "voice_split.h"
+
+//Notes that start and end together, which go in a voice as one
+struct voice_chord
+{
+	size_t first;       //Index of its lowest note
+	size_t count;
+	uint32_t onset;
+	uint32_t end;
+	uint8_t top;        //Highest key in it
+};
+
+//A heap entry for a voice. Busy voices are ordered by when they come free, and
+//free voices all have an end of 0, so they're ordered by number.
+struct voice_end
+{
+	uint32_t end;
+	uint16_t voice;
+};
+
+
+//Take the --voices option out of a command line. It can go anywhere, and
+//whatever's left is moved down to fill the gap.
+bool Voices_Parse_Option(int *argc, char *argv[], bool *split)
+{
+	int i, n = 1;
+
+	*split = false;
+	for (i = 1; i < *argc; i++)
+	{
+		if (strcmp(argv[i], "--voices") == 0)
+			*split = true;
+		else
+			argv[n++] = argv[i];
+	}
+
+	*argc = n;
+	argv[n] = NULL;
+	return true;
+}
+
+
+void Voices_Init(struct voice_list *v)
+{
+	v->notes = NULL;
+	v->count = v->size = 0;
+	v->voiceStart = NULL;
+	v->numVoices = 0;
+}
+
+
+//Add a note. Notes with no length can't be written down, so they're left out.
+bool Voices_Add(struct voice_list *v, uint32_t onset, uint32_t end, uint8_t key)
+{
+	struct voice_note *notes;
+
+	if (end <= onset)
+		return true;
+	if (v->count == v->size)
+	{
+		notes = realloc(v->notes, (v->size ? v->size * 2 : 256) * sizeof(struct voice_note));
+		if (notes == NULL)
+		{
+			fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+			return false;
+		}
+		v->notes = notes;
+		v->size = v->size ? v->size * 2 : 256;
+	}
+
+	v->notes[v->count].onset = onset;
+	v->notes[v->count].end = end;
+	v->notes[v->count].voice = 0;
+	v->notes[v->count].key = key;
+	v->count++;
+	return true;
+}
+
+
+//Sort notes by start time, then end time, so each chord's notes end up next
+//to each other, lowest first
+static int Compare_Notes(const void *a, const void *b)
+{
+	const struct voice_note *x = a, *y = b;
+
+	if (x->onset != y->onset)
+		return (x->onset < y->onset) ? -1 : 1;
+	if (x->end != y->end)
+		return (x->end < y->end) ? -1 : 1;
+	return (int)x->key - (int)y->key;
+}
+
+//Sort chords by start time, and the highest first when they start together
+static int Compare_Chords(const void *a, const void *b)
+{
+	const struct voice_chord *x = a, *y = b;
+
+	if (x->onset != y->onset)
+		return (x->onset < y->onset) ? -1 : 1;
+	if (x->top != y->top)
+		return (int)y->top - (int)x->top;
+	if (x->end != y->end)
+		return (x->end < y->end) ? -1 : 1;
+	return 0;
+}
+
+
+static bool Earlier(const struct voice_end *a, const struct voice_end *b)
+{
+	return a->end < b->end || (a->end == b->end && a->voice < b->voice);
+}
+
+static void Heap_Push(struct voice_end *heap, size_t *count, struct voice_end e)
+{
+	size_t i = (*count)++, parent;
+
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (!Earlier(&e, &heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = e;
+}
+
+static struct voice_end Heap_Pop(struct voice_end *heap, size_t *count)
+{
+	struct voice_end top = heap[0], last = heap[--(*count)];
+	size_t i = 0, child;
+
+	while ((child = 2 * i + 1) < *count)
+	{
+		if (child + 1 < *count && Earlier(&heap[child + 1], &heap[child]))
+			child++;
+		if (!Earlier(&heap[child], &last))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+
+//Split the notes into voices. Afterwards, the notes are grouped by voice and
+//voiceStart says where each voice starts. A key can only be on once at a time,
+//so there are never more voices than keys.
+bool Voices_Split(struct voice_list *v)
+{
+	struct voice_chord *chords;
+	struct voice_end *busy, *freeVoices, e;
+	struct voice_note *sorted;
+	size_t *next, numChords = 0, numBusy = 0, numFree = 0, i, j, n = v->count ? v->count : 1;
+
+	free(v->voiceStart);
+	v->numVoices = 0;
+	chords = malloc(n * sizeof(struct voice_chord));
+	busy = malloc(n * sizeof(struct voice_end));
+	freeVoices = malloc(n * sizeof(struct voice_end));
+	sorted = malloc(n * sizeof(struct voice_note));
+	next = malloc(n * sizeof(size_t));
+	v->voiceStart = calloc(n + 1, sizeof(size_t));
+	if (chords == NULL || busy == NULL || freeVoices == NULL || sorted == NULL ||
+	    next == NULL || v->voiceStart == NULL)
+	{
+		fprintf(stderr, "Error allocating memory: %s\n\n", strerror(errno));
+		free(chords);
+		free(busy);
+		free(freeVoices);
+		free(sorted);
+		free(next);
+		free(v->voiceStart);
+		v->voiceStart = NULL;
+		return false;
+	}
+
+	//Find the chords
+	qsort(v->notes, v->count, sizeof(struct voice_note), Compare_Notes);
+	for (i = 0; i < v->count; i = j)
+	{
+		for (j = i + 1; j < v->count && v->notes[j].onset == v->notes[i].onset &&
+		                v->notes[j].end == v->notes[i].end; j++)
+			;
+		chords[numChords].first = i;
+		chords[numChords].count = j - i;
+		chords[numChords].onset = v->notes[i].onset;
+		chords[numChords].end = v->notes[i].end;
+		chords[numChords].top = v->notes[j - 1].key;
+		numChords++;
+	}
+	qsort(chords, numChords, sizeof(struct voice_chord), Compare_Chords);
+
+	//Sweep through them in time order. Every voice that's come free by the
+	//time a chord starts moves over to the free heap first.
+	for (i = 0; i < numChords; i++)
+	{
+		while (numBusy > 0 && busy[0].end <= chords[i].onset)
+		{
+			e = Heap_Pop(busy, &numBusy);
+			e.end = 0;
+			Heap_Push(freeVoices, &numFree, e);
+		}
+		if (numFree > 0)
+			e = Heap_Pop(freeVoices, &numFree);
+		else
+			e.voice = (uint16_t)v->numVoices++;
+		e.end = chords[i].end;
+		Heap_Push(busy, &numBusy, e);
+		for (j = chords[i].first; j < chords[i].first + chords[i].count; j++)
+			v->notes[j].voice = e.voice;
+	}
+
+	//Group the notes by voice. Going through the chords in time order keeps
+	//each voice in time order.
+	for (i = 0; i < v->count; i++)
+		v->voiceStart[v->notes[i].voice + 1]++;
+	for (i = 0; i < v->numVoices; i++)
+	{
+		v->voiceStart[i + 1] += v->voiceStart[i];
+		next[i] = v->voiceStart[i];
+	}
+	for (i = 0; i < numChords; i++)
+	{
+		for (j = chords[i].first; j < chords[i].first + chords[i].count; j++)
+			sorted[next[v->notes[j].voice]++] = v->notes[j];
+	}
+	free(v->notes);
+	v->notes = sorted;
+	v->size = n;
+
+	free(chords);
+	free(busy);
+	free(freeVoices);
+	free(next);
+	return true;
+}
+
+
+//Empty the list for the next track. The memory is kept for reuse.
+void Voices_Clear(struct voice_list *v)
+{
+	v->count = 0;
+	v->numVoices = 0;
+}
+
+
+void Voices_Free(struct voice_list *v)
+{
+	free(v->notes);
+	free(v->voiceStart);
+	Voices_Init(v);
+}
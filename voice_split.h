@@ -0,0 +1,48 @@
+//Voice separation. Notes that overlap can't be written down in one line of
+//notation, so a channel's notes get split into voices, each of which only ever
+//has one note or chord on at a time. Notes that start and end together are a
+//chord and stay in the same voice.
+//
+//The notes are sorted by when they start, and then swept in that order with a
+//heap of the voices that are still busy, ordered by when they come free. Each
+//chord goes in the lowest-numbered voice that's free by the time it starts, or
+//a new voice if none are. That's O(n log n) for the sort and O(n log v) for the
+//sweep, and it never uses more voices than the most chords that are ever on at
+//once. At the same start time, higher chords get the lower voices, so the tune
+//tends to stay in voice 1.
+
+#ifndef VOICE_SPLIT_H
+#define VOICE_SPLIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+struct voice_note
+{
+	uint32_t onset;     //Start time in ticks
+	uint32_t end;       //End time in ticks
+	uint16_t voice;     //Voice it was put in, counting from 0
+	uint8_t key;
+};
+
+//Notes collected from one channel. After a split, the notes are grouped by
+//voice, and each voice's notes are in time order, lowest key first in a chord.
+struct voice_list
+{
+	struct voice_note *notes;
+	size_t count;
+	size_t size;            //Entries allocated
+	size_t *voiceStart;     //Index of each voice's first note, plus one more
+	                        //entry for the end of the last voice
+	size_t numVoices;
+};
+
+bool Voices_Parse_Option(int *argc, char *argv[], bool *split);
+void Voices_Init(struct voice_list *v);
+bool Voices_Add(struct voice_list *v, uint32_t onset, uint32_t end, uint8_t key);
+bool Voices_Split(struct voice_list *v);
+void Voices_Clear(struct voice_list *v);
+void Voices_Free(struct voice_list *v);
+
+#endif
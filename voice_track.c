@@ -0,0 +1,74 @@
+//Note tracking for sound chips. See voice_track.h for how notes are found.
+
+#include <string.h>
+#include <math.h>
+#include "voice_track.h"
+
+
+//Compare a channel with what it was doing last frame. Returns true if any
+//notes need to be stopped or started.
+bool Voice_Track_Update(struct voice_track *t, const struct voice_frame *f,
+                        struct voice_change *change)
+{
+	memset(change, 0, sizeof(*change));
+
+	if (f->audible)
+	{
+		change->start = !t->on || f->key != t->key || f->restarted ||
+		                (f->volume > t->volume && t->falling);
+	}
+
+	if (t->on && (!f->audible || change->start))
+	{
+		change->stop = true;
+		change->stopKey = t->key;
+		t->on = false;
+	}
+	if (change->start)
+	{
+		change->startKey = f->key;
+		change->velocity = 7 + 8 * f->volume;
+		t->on = true;
+		t->key = f->key;
+		t->falling = false;
+	} else if (f->audible)
+	{
+		if (f->volume < t->volume)
+			t->falling = true;
+		else if (f->volume > t->volume)
+			t->falling = false;
+	}
+	t->volume = f->audible ? f->volume : 0;
+
+	return change->stop || change->start;
+}
+
+
+//Stop whatever's still playing at the end of a song
+bool Voice_Track_End(struct voice_track *t, struct voice_change *change)
+{
+	memset(change, 0, sizeof(*change));
+	if (!t->on)
+		return false;
+
+	change->stop = true;
+	change->stopKey = t->key;
+	t->on = false;
+	return true;
+}
+
+
+//The nearest MIDI key to a frequency in Hz. A4 (440 Hz) is key 69.
+uint8_t Voice_Frequency_Key(double frequency)
+{
+	double key;
+
+	if (frequency <= 0)
+		return 0;
+	key = 69 + 12 * log2(frequency / 440.0);
+	if (key < 0)
+		return 0;
+	if (key > 127)
+		return 127;
+	return (uint8_t)lround(key);
+}
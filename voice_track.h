@@ -0,0 +1,48 @@
+//Note tracking for sound chips. The chip players don't see notes, just what
+//each channel sounds like from one frame to the next. This works out where the
+//notes start and stop. A note starts when a channel becomes audible, when its
+//pitch changes, or when it's retriggered, and ends when the channel goes quiet
+//or the next note starts. Sound drivers usually fade notes out with software
+//envelopes and then jump the volume back up for the next note, so a volume that
+//rises after it's been falling counts as a retrigger too.
+
+#ifndef VOICE_TRACK_H
+#define VOICE_TRACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//What a channel sounds like on one frame
+struct voice_frame
+{
+	bool audible;
+	uint8_t key;         //MIDI key
+	uint8_t volume;      //0-15
+	bool restarted;      //The note was retriggered since the last frame
+};
+
+//What we've said about a channel so far. Start these zeroed.
+struct voice_track
+{
+	bool on;             //A note is playing
+	uint8_t key;         //Key of the note that's playing
+	uint8_t volume;      //Volume on the last frame
+	bool falling;        //The volume has been going down
+};
+
+//Notes to stop and start. The stop always comes first.
+struct voice_change
+{
+	bool stop;
+	uint8_t stopKey;
+	bool start;
+	uint8_t startKey;
+	uint8_t velocity;
+};
+
+bool Voice_Track_Update(struct voice_track *t, const struct voice_frame *f,
+                        struct voice_change *change);
+bool Voice_Track_End(struct voice_track *t, struct voice_change *change);
+uint8_t Voice_Frequency_Key(double frequency);
+
+#endif
@@ -0,0 +1,108 @@
+//Simple worker pool. Jobs are handed out one at a time from a shared counter,
+//so a few slow jobs don't hold up the rest of the queue. There's nothing fancy
+//here -- each job is expected to be big (a whole file or more), so the cost of
+//taking a lock to get the next index is lost in the noise.
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "work_pool.h"
+
+struct pool
+{
+	pthread_mutex_t lock;
+	size_t nextJob;
+	size_t numJobs;
+	pool_job job;
+	void *context;
+};
+
+struct pool_worker
+{
+	struct pool *pool;
+	unsigned number;
+};
+
+
+//Return the number of online CPU cores, or 1 if we can't tell
+unsigned Pool_Default_Threads(void)
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	
+	return (cores > 0) ? (unsigned)cores : 1;
+}
+
+
+//Worker thread. Keep grabbing the next job until there aren't any left.
+static void *Pool_Worker(void *arg)
+{
+	struct pool_worker *worker = arg;
+	struct pool *pool = worker->pool;
+	size_t index;
+	
+	while (1)
+	{
+		pthread_mutex_lock(&pool->lock);
+		index = pool->nextJob++;
+		pthread_mutex_unlock(&pool->lock);
+		
+		if (index >= pool->numJobs)
+			break;
+		pool->job(pool->context, index, worker->number);
+	}
+	
+	return NULL;
+}
+
+
+//Run jobs 0 through numJobs-1 on up to numThreads threads and wait for all of
+//them to finish. The calling thread acts as worker 0, so a single-threaded run
+//doesn't create any threads at all. If a thread can't be created, the workers
+//we already have will pick up the slack.
+void Pool_Run(size_t numJobs, unsigned numThreads, pool_job job, void *context)
+{
+	struct pool pool;
+	struct pool_worker *workers;
+	pthread_t *threads;
+	unsigned started = 1, t;
+	
+	if (numThreads == 0)
+		numThreads = 1;
+	if (numThreads > numJobs)
+		numThreads = (numJobs > 0) ? (unsigned)numJobs : 1;
+	
+	pool.nextJob = 0;
+	pool.numJobs = numJobs;
+	pool.job = job;
+	pool.context = context;
+	pthread_mutex_init(&pool.lock, NULL);
+	
+	workers = malloc(numThreads * sizeof(struct pool_worker));
+	threads = malloc(numThreads * sizeof(pthread_t));
+	if (workers == NULL || threads == NULL)
+	{
+		//Fall back to running everything on this thread
+		struct pool_worker self = {&pool, 0};
+		Pool_Worker(&self);
+	} else
+	{
+		for (t = 0; t < numThreads; t++)
+		{
+			workers[t].pool = &pool;
+			workers[t].number = t;
+		}
+		for (t = 1; t < numThreads; t++)
+		{
+			if (pthread_create(&threads[started], NULL, Pool_Worker,
+			                   &workers[started]) == 0)
+				started++;
+		}
+		Pool_Worker(&workers[0]);
+		for (t = 1; t < started; t++)
+			pthread_join(threads[t], NULL);
+	}
+	
+	pthread_mutex_destroy(&pool.lock);
+	free(workers);
+	free(threads);
+}
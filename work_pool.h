@@ -0,0 +1,16 @@
+//Simple worker pool for running independent jobs on all of the CPU cores
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stddef.h>
+
+//Job function. The context pointer is shared by every job, the index says which
+//job to run, and the worker number (0 to numThreads-1) can be used to pick out
+//per-thread scratch state so that jobs never have to share anything mutable.
+typedef void (*pool_job)(void *context, size_t index, unsigned worker);
+
+unsigned Pool_Default_Threads(void);
+void Pool_Run(size_t numJobs, unsigned numThreads, pool_job job, void *context);
+
+#endif